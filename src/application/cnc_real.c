@@ -0,0 +1,345 @@
+/*
+ * Number backend of the parser -> planner path, see cnc_real.h
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef _WINDOWS
+	#include "stdafx.h"
+#else
+	#include "global.h"
+#endif
+
+#include "cnc_real.h"
+
+static const uint64_t pow10tab[20] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+	1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+	1000000000000000000ULL, 10000000000000000000ULL
+};
+
+// exact in double
+static const double pow10d[23] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define DECIMAL_MAX_SCALE	100
+
+#define IS_DIGIT(c)	((uint8_t)((c) - '0') <= 9)
+
+const char *real_scanDecimal(const char *str, REAL_DECIMAL *d)
+{
+	const char *p = str, *first;
+	uint64_t m = 0;
+	int scale = 0, digits = 0;	// significant ones
+	char dropped = 0;			// first digit which didn't fit the mantissa
+	char c;
+
+	d->negative = false;
+	// the characters before the number are skipped
+	for (; (c = *p) != 0; p++)
+	{
+		if (IS_DIGIT(c) || c == '.')
+			break;
+		if (c == '-' || c == '+')
+		{
+			d->negative = c == '-';
+			p++;
+			break;
+		}
+	}
+	first = p;
+	while (*p == '0')
+		p++;	// leading zeros
+	for (; IS_DIGIT(*p); p++)
+	{
+		if (digits < REAL_DECIMAL_DIGITS)
+		{
+			m = m * 10 + (*p - '0');
+			digits++;
+		}
+		else
+		{
+			if (dropped == 0)
+				dropped = *p;
+			if (scale > -DECIMAL_MAX_SCALE)
+				scale--;
+		}
+	}
+	if (*p == '.')
+	{
+		p++;
+		if (m == 0)
+			for (; *p == '0'; p++)
+				if (scale < DECIMAL_MAX_SCALE)
+					scale++;	// leading zeros of the fraction
+		for (; IS_DIGIT(*p); p++)
+		{
+			if (digits < REAL_DECIMAL_DIGITS)
+			{
+				m = m * 10 + (*p - '0');
+				digits++;
+				scale++;
+			}
+			else if (dropped == 0)
+				dropped = *p;
+		}
+	}
+	if (p == first || (p == first + 1 && *first == '.'))
+		return str;	// no digits
+	if (dropped >= '5')
+		m++;
+	d->mantissa = m;
+	d->scale = (int8_t)scale;
+	return p;
+}
+
+double real_decimalToDouble(const REAL_DECIMAL *d)
+{
+	double v = (double)d->mantissa;
+	int scale = d->scale;
+
+	while (scale > 22)
+	{
+		v /= pow10d[22];
+		scale -= 22;
+	}
+	while (scale < -22)
+	{
+		v *= pow10d[22];
+		scale += 22;
+	}
+	v = scale >= 0 ? v / pow10d[scale] : v * pow10d[-scale];
+	return d->negative ? -v : v;
+}
+
+int32_t real_decimalToFixed(const REAL_DECIMAL *d, uint8_t digits)
+{
+	uint64_t m = d->mantissa;
+	int scale = d->scale - digits;
+
+	if (scale > 19)
+		m = 0;	// m < 10^19: it rounds to 0
+	else if (scale > 0)
+		m = (m + pow10tab[scale] / 2) / pow10tab[scale];
+	for (; scale < 0 && m <= INT32_MAX; scale++)
+		m *= 10;
+	if (m > INT32_MAX)
+		m = INT32_MAX;
+	return d->negative ? -(int32_t)m : (int32_t)m;
+}
+
+#if (USE_CNC_REAL == 2)
+
+CNC_REAL real_fromDecimal(const REAL_DECIMAL *d)
+{
+	uint64_t m = d->mantissa;
+	int scale = d->scale;
+	CNC_REAL v;
+
+	// mantissa << REAL_Q has to fit 63 bits: the last digits are rounded off
+	while (m >= (1ULL << (63 - REAL_Q)) && scale > 0)
+	{
+		m = (m + 5) / 10;
+		scale--;
+	}
+	if (m == 0 || scale > 19)
+		v = 0;
+	else if (scale < 0 || m >= (1ULL << (63 - REAL_Q)))
+		v = REAL_MAX;
+	else
+		v = real_sat((int64_t)(((m << REAL_Q) + (pow10tab[scale] >> 1)) / pow10tab[scale]));
+	return d->negative ? -v : v;
+}
+
+static uint32_t real_isqrt32(uint32_t v)
+{
+	uint32_t r = 0, bit = 1UL << 30;
+
+	while (bit > v)
+		bit >>= 2;
+	while (bit != 0)
+	{
+		if (v >= r + bit)
+		{
+			v -= r + bit;
+			r = (r >> 1) + bit;
+		}
+		else
+			r >>= 1;
+		bit >>= 2;
+	}
+	return r;
+}
+
+static uint32_t real_isqrt64(uint64_t v)
+{
+	uint64_t r = 0, bit = (uint64_t)1 << 62;
+
+	if (v <= 0xffffffffUL)
+		return real_isqrt32((uint32_t)v);	// short segments: no 64 bit loop
+	while (bit > v)
+		bit >>= 2;
+	while (bit != 0)
+	{
+		if (v >= r + bit)
+		{
+			v -= r + bit;
+			r = (r >> 1) + bit;
+		}
+		else
+			r >>= 1;
+		bit >>= 2;
+	}
+	return (uint32_t)r;
+}
+
+CNC_REAL real_sqrt(CNC_REAL v)
+{
+	return v > 0 ? (CNC_REAL)real_isqrt64((uint64_t)v << REAL_Q) : 0;
+}
+
+CNC_REAL real_hypot(CNC_REAL a, CNC_REAL b)
+{
+	return real_sat(real_isqrt64((uint64_t)((int64_t)a * a) + (uint64_t)((int64_t)b * b)));
+}
+
+CNC_REAL real_hypot3(CNC_REAL a, CNC_REAL b, CNC_REAL c)
+{
+	return real_sat(real_isqrt64((uint64_t)((int64_t)a * a) + (uint64_t)((int64_t)b * b) + (uint64_t)((int64_t)c * c)));
+}
+
+/*
+ * CORDIC: angles in Q29 radians, vectors in Q30.
+ * atan(2^-i) in Q29
+ */
+#define CORDIC_STEPS	20
+#define CORDIC_PI		1686629713L
+#define CORDIC_PI_2		843314857L
+#define CORDIC_K		652032874L	// 1 / gain of the rotations, Q30
+
+static const int32_t cordicAtan[CORDIC_STEPS] = {
+	421657428, 248918915, 131521918, 66762579, 33510843, 16771758, 8387925, 4194219,
+	2097141, 1048575, 524288, 262144, 131072, 65536, 32768, 16384,
+	8192, 4096, 2048, 1024
+};
+
+static CNC_REAL cordic_toReal(int32_t a)
+{
+	return (a + (1 << 12)) >> 13;	// Q29 -> Q16
+}
+
+CNC_REAL real_angle(CNC_REAL ax, CNC_REAL ay, CNC_REAL bx, CNC_REAL by)
+{
+	int64_t dot = (int64_t)ax * bx + (int64_t)ay * by;
+	int64_t cross = (int64_t)ax * by - (int64_t)ay * bx;
+	int32_t x, y, t, a = 0;
+	int i;
+
+	if (dot == 0 && cross == 0)
+		return 0;
+	// both to 28 bits: gain of the rotations (1.65) must fit in int32
+	while (dot >= (1L << 28) || dot <= -(1L << 28) || cross >= (1L << 28) || cross <= -(1L << 28))
+	{
+		dot >>= 1;
+		cross >>= 1;
+	}
+	while (dot < (1L << 27) && dot > -(1L << 27) && cross < (1L << 27) && cross > -(1L << 27))
+	{
+		dot <<= 1;
+		cross <<= 1;
+	}
+	x = (int32_t)dot;
+	y = (int32_t)cross;
+	if (x < 0)
+	{	// turn by 90 degrees to the right half-plane
+		t = x;
+		if (y >= 0)
+		{
+			x = y; y = -t; a = CORDIC_PI_2;
+		}
+		else
+		{
+			x = -y; y = t; a = -CORDIC_PI_2;
+		}
+	}
+	for (i = 0; i < CORDIC_STEPS; i++)
+	{
+		t = x;
+		if (y > 0)
+		{
+			x += y >> i; y -= t >> i; a += cordicAtan[i];
+		}
+		else
+		{
+			x -= y >> i; y += t >> i; a -= cordicAtan[i];
+		}
+	}
+	return cordic_toReal(a);
+}
+
+void real_sinCos(CNC_REAL angle, CNC_REAL *s, CNC_REAL *c)
+{
+	int64_t z = (int64_t)angle << 13;	// Q16 -> Q29
+	int32_t x = CORDIC_K, y = 0, t, a;
+	bool neg = false;
+	int i;
+
+	while (z > CORDIC_PI)
+		z -= 2 * (int64_t)CORDIC_PI;
+	while (z < -CORDIC_PI)
+		z += 2 * (int64_t)CORDIC_PI;
+	a = (int32_t)z;
+	if (a > CORDIC_PI_2)
+	{	// sin(a) = -sin(a - pi), cos(a) = -cos(a - pi)
+		a -= CORDIC_PI;
+		neg = true;
+	}
+	else if (a < -CORDIC_PI_2)
+	{
+		a += CORDIC_PI;
+		neg = true;
+	}
+	for (i = 0; i < CORDIC_STEPS; i++)
+	{
+		t = x;
+		if (a >= 0)
+		{
+			x -= y >> i; y += t >> i; a -= cordicAtan[i];
+		}
+		else
+		{
+			x += y >> i; y -= t >> i; a += cordicAtan[i];
+		}
+	}
+	x = (x + (1 << 13)) >> 14;	// Q30 -> Q16
+	y = (y + (1 << 13)) >> 14;
+	*c = neg ? -x : x;
+	*s = neg ? -y : y;
+}
+
+#else
+
+#if (USE_CNC_REAL == 1)
+// exact in float
+static const float pow10f[11] = {
+	1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+#endif
+
+CNC_REAL real_fromDecimal(const REAL_DECIMAL *d)
+{
+#if (USE_CNC_REAL == 1)
+	if (d->mantissa < (1UL << 24) && d->scale >= 0 && d->scale <= 10)
+	{	// one correctly rounded division, no double on the FPU of Cortex-M4
+		float v = (float)(uint32_t)d->mantissa / pow10f[d->scale];
+		return d->negative ? -v : v;
+	}
+#endif
+	return (CNC_REAL)real_decimalToDouble(d);
+}
+
+#endif
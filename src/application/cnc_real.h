@@ -0,0 +1,185 @@
+#ifndef CNC_REAL_H_
+#define CNC_REAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+/*
+ * Number type of the G-code parser, arcs and planner (CNC_REAL), selected by USE_CNC_REAL
+ * in the board header:
+ *	0	double
+ *	1	float, for the FPU of Cortex-M4
+ *	2	fixed point Q15.16 in int32_t, no soft float on Cortex-M3
+ * +, -, compares, multiplication and division by an integer are plain C operators,
+ * products and quotients of two reals and the functions go through real_*().
+ */
+#ifndef USE_CNC_REAL
+	#define USE_CNC_REAL	0
+#endif
+#ifndef __INLINE
+	#define __INLINE	__inline
+#endif
+
+#if (USE_CNC_REAL == 2)
+
+typedef int32_t CNC_REAL;
+
+#define REAL_Q			16
+#define REAL_ONE		((CNC_REAL)1 << REAL_Q)
+#define REAL_C(x)		((CNC_REAL)((x) * 65536.0 + ((x) < 0 ? -0.5 : 0.5)))
+// "unlimited" value: products saturate here, so sums of a few of them don't overflow
+#define REAL_MAX		((CNC_REAL)(INT32_MAX / 4))
+
+static __INLINE CNC_REAL real_sat(int64_t v)
+{
+	return v > REAL_MAX ? REAL_MAX : (v < -REAL_MAX ? -REAL_MAX : (CNC_REAL)v);
+}
+
+static __INLINE CNC_REAL real_fromInt(int32_t v)	{ return real_sat((int64_t)v << REAL_Q); }
+static __INLINE int32_t real_toInt(CNC_REAL v)		{ return v >= 0 ? v >> REAL_Q : -(-v >> REAL_Q); }
+static __INLINE double real_toDouble(CNC_REAL v)	{ return v / 65536.0; }
+static __INLINE CNC_REAL real_abs(CNC_REAL v)		{ return v < 0 ? -v : v; }
+
+static __INLINE CNC_REAL real_mul(CNC_REAL a, CNC_REAL b)
+{
+	return real_sat(((int64_t)a * b) >> REAL_Q);
+}
+
+static __INLINE CNC_REAL real_div(CNC_REAL a, CNC_REAL b)
+{
+	if (b == 0)
+		return a < 0 ? -REAL_MAX : REAL_MAX;
+	return real_sat(((int64_t)a << REAL_Q) / b);
+}
+
+// num / den
+static __INLINE CNC_REAL real_ratio(int32_t num, int32_t den)
+{
+	return real_sat(((int64_t)num << REAL_Q) / den);
+}
+
+// v * num / den without overflow of v * num
+static __INLINE CNC_REAL real_mulDiv(CNC_REAL v, int32_t num, int32_t den)
+{
+	return real_sat((int64_t)v * num / den);
+}
+
+// round(v * num / den), the result may be out of the CNC_REAL range
+static __INLINE int32_t real_mulDivRound(CNC_REAL v, int32_t num, int32_t den)
+{
+	int64_t r = (int64_t)v * num / den;
+	return (int32_t)(r >= 0 ? (r + (REAL_ONE >> 1)) >> REAL_Q : -((-r + (REAL_ONE >> 1)) >> REAL_Q));
+}
+
+// round(v * k), the result may be out of the CNC_REAL range
+static __INLINE int32_t real_mulToInt(CNC_REAL v, CNC_REAL k)
+{
+	int64_t r = (int64_t)v * k;
+	return (int32_t)(r >= 0 ? (r + (1LL << 31)) >> 32 : -((-r + (1LL << 31)) >> 32));
+}
+
+// Scale below 2 for n * scale of integers, Q31: Q16 has too few digits for 1/320
+typedef uint32_t REAL_RECIP;
+
+// num / den, up to 2
+static __INLINE REAL_RECIP real_recipRatio(int32_t num, int32_t den)
+{
+	return (REAL_RECIP)((((uint64_t)num << 31) + (den >> 1)) / den);
+}
+
+static __INLINE CNC_REAL real_mulRecip(int32_t n, REAL_RECIP r)
+{
+	int64_t v = (int64_t)n * r;
+	return real_sat(v >= 0 ? (v + (1 << 14)) >> 15 : -((-v + (1 << 14)) >> 15));
+}
+
+CNC_REAL real_sqrt(CNC_REAL v);
+CNC_REAL real_hypot(CNC_REAL a, CNC_REAL b);
+CNC_REAL real_hypot3(CNC_REAL a, CNC_REAL b, CNC_REAL c);
+CNC_REAL real_angle(CNC_REAL ax, CNC_REAL ay, CNC_REAL bx, CNC_REAL by);
+void real_sinCos(CNC_REAL angle, CNC_REAL *s, CNC_REAL *c);
+
+// Arc segments between exact corrections (see mc_arc): rotations by a small angle in Q16
+// leave the circle too fast, every point is computed by CORDIC
+#define REAL_ARC_CORRECTION	0
+
+#else
+
+#if (USE_CNC_REAL == 1)
+	typedef float CNC_REAL;
+	#define REAL_MAX	1e18f
+	#define REAL_SQRT	sqrtf
+	#define REAL_ATAN2	atan2f
+	#define REAL_SIN		sinf
+	#define REAL_COS		cosf
+#else
+	typedef double CNC_REAL;
+	#define REAL_MAX	1e18
+	#define REAL_SQRT	sqrt
+	#define REAL_ATAN2	atan2
+	#define REAL_SIN		sin
+	#define REAL_COS		cos
+#endif
+
+#define REAL_ONE		((CNC_REAL)1)
+#define REAL_C(x)		((CNC_REAL)(x))
+#define REAL_ARC_CORRECTION	N_ARC_CORRECTION
+
+static __INLINE CNC_REAL real_fromInt(int32_t v)	{ return (CNC_REAL)v; }
+static __INLINE int32_t real_toInt(CNC_REAL v)		{ return (int32_t)v; }
+static __INLINE double real_toDouble(CNC_REAL v)	{ return v; }
+static __INLINE CNC_REAL real_abs(CNC_REAL v)		{ return v < 0 ? -v : v; }
+static __INLINE CNC_REAL real_mul(CNC_REAL a, CNC_REAL b)	{ return a * b; }
+static __INLINE CNC_REAL real_div(CNC_REAL a, CNC_REAL b)	{ return a / b; }
+static __INLINE CNC_REAL real_ratio(int32_t num, int32_t den)	{ return (CNC_REAL)num / den; }
+static __INLINE CNC_REAL real_mulDiv(CNC_REAL v, int32_t num, int32_t den)	{ return v * num / den; }
+static __INLINE int32_t real_mulDivRound(CNC_REAL v, int32_t num, int32_t den)
+{
+	v = v * num / den;
+	return (int32_t)(v < 0 ? v - REAL_C(0.5) : v + REAL_C(0.5));
+}
+static __INLINE int32_t real_mulToInt(CNC_REAL v, CNC_REAL k)
+{
+	v *= k;
+	return (int32_t)(v < 0 ? v - REAL_C(0.5) : v + REAL_C(0.5));
+}
+typedef CNC_REAL REAL_RECIP;
+static __INLINE REAL_RECIP real_recipRatio(int32_t num, int32_t den)	{ return (CNC_REAL)num / den; }
+static __INLINE CNC_REAL real_mulRecip(int32_t n, REAL_RECIP r)	{ return n * r; }
+static __INLINE CNC_REAL real_sqrt(CNC_REAL v)	{ return v > 0 ? REAL_SQRT(v) : 0; }
+static __INLINE CNC_REAL real_hypot(CNC_REAL a, CNC_REAL b)	{ return REAL_SQRT(a * a + b * b); }
+static __INLINE CNC_REAL real_hypot3(CNC_REAL a, CNC_REAL b, CNC_REAL c)	{ return REAL_SQRT(a * a + b * b + c * c); }
+// CCW angle from vector a to vector b, -pi..pi
+static __INLINE CNC_REAL real_angle(CNC_REAL ax, CNC_REAL ay, CNC_REAL bx, CNC_REAL by)
+{
+	return REAL_ATAN2(ax * by - ay * bx, ax * bx + ay * by);
+}
+static __INLINE void real_sinCos(CNC_REAL angle, CNC_REAL *s, CNC_REAL *c)
+{
+	*s = REAL_SIN(angle);
+	*c = REAL_COS(angle);
+}
+
+#endif
+
+#define REAL_PI		REAL_C(3.14159265358979)
+
+// Decimal number of the text: mantissa / 10^scale, up to REAL_DECIMAL_DIGITS significant digits
+#define REAL_DECIMAL_DIGITS	18
+typedef struct {
+	uint64_t mantissa;
+	int8_t scale;		// digits after the point, < 0 if integer digits were dropped
+	bool negative;
+} REAL_DECIMAL;
+
+// [+|-]digits[.digits], the characters before the number are skipped.
+// Returns the end of the number, str if there are no digits.
+const char *real_scanDecimal(const char *str, REAL_DECIMAL *d);
+CNC_REAL real_fromDecimal(const REAL_DECIMAL *d);
+// Correctly rounded while the mantissa is below 2^53 and scale is 0..22
+double real_decimalToDouble(const REAL_DECIMAL *d);
+// round(number * 10^digits) saturated to int32_t, e.g. digits 3: mm -> 1/1000 mm
+int32_t real_decimalToFixed(const REAL_DECIMAL *d, uint8_t digits);
+
+#endif /* CNC_REAL_H_ */
@@ -1,49 +1,176 @@
+#include <stdlib.h>
 #include "global.h"
 
 #if (USE_ENCODER == 1)
 
-int32_t encoderCorrectionCntUp, encoderCorrectionCntDown, encoderCorrectionDelta, encoderCorrectionMaxDelta;
+typedef struct {
+	TIM_TypeDef *	Timer;		// NULL - no encoder on the axis
+	GPIO_TypeDef *	Port;
+	uint16_t		Pins;
+	int32_t			cntPer360;	// counts per revolution of the motor
+	bool			invert;
+} enc_init_t;
+
+#ifdef ENC0_TIM
+	#define ENC0_INIT	{ ENC0_TIM, ENC0_PORT, ENC0_PINS, ENC0_CNT_PER_360, ENC0_INVERT }
+#else
+	#define ENC0_INIT	{ NULL }
+#endif
+#ifdef ENC1_TIM
+	#define ENC1_INIT	{ ENC1_TIM, ENC1_PORT, ENC1_PINS, ENC1_CNT_PER_360, ENC1_INVERT }
+#else
+	#define ENC1_INIT	{ NULL }
+#endif
+#ifdef ENC2_TIM
+	#define ENC2_INIT	{ ENC2_TIM, ENC2_PORT, ENC2_PINS, ENC2_CNT_PER_360, ENC2_INVERT }
+#else
+	#define ENC2_INIT	{ NULL }
+#endif
+
+static const enc_init_t enc_inits[ENCODER_AXES] = { ENC0_INIT, ENC1_INIT, ENC2_INIT };
+
+static struct {
+	uint16_t last;		// counter of the timer at the last loop
+	int32_t  cnt;		// counts of the encoder, 32 bit
+	int32_t  shift;		// steps of the counter which are not a move
+} enc[ENCODER_AXES];
+
 bool isEncoderCorrection = false;
+volatile ENC_STAT encoderStat[ENCODER_AXES];
+volatile uint8_t encoderAlarm;
 
 void encoder_int()
 {
 	GPIO_InitTypeDef GPIO_InitStructure;
 	TIM_TimeBaseInitTypeDef timer_base;
 	TIM_ICInitTypeDef TIM_ICInitStruct;
+	int i;
+
+#ifdef ENC0_TIM
+	ENC0_TIM_CLK();
+#endif
+#ifdef ENC1_TIM
+	ENC1_TIM_CLK();
+#endif
+#ifdef ENC2_TIM
+	ENC2_TIM_CLK();
+#endif
+	for (i = 0; i < ENCODER_AXES; i++)
+	{
+		TIM_TypeDef *tim = enc_inits[i].Timer;
+
+		if (tim == NULL)
+			continue;
+		// PIN_SPEED_MID();
+		PIN_INPUT();
+		PIN_SET_MODE(enc_inits[i].Port, enc_inits[i].Pins);
+
+		TIM_DeInit(tim);
+		TIM_TimeBaseStructInit(&timer_base);
+		timer_base.TIM_Period = 0xFFFF;
+		timer_base.TIM_CounterMode = TIM_CounterMode_Up;
+		TIM_TimeBaseInit(tim, &timer_base);
+
+		// Debounce filter
+		TIM_ICStructInit(&TIM_ICInitStruct);
+		TIM_ICInitStruct.TIM_Channel = TIM_Channel_1;
+		TIM_ICInitStruct.TIM_ICFilter = 3;
+		TIM_ICInit(tim, &TIM_ICInitStruct);
+		TIM_ICInitStruct.TIM_Channel = TIM_Channel_2;
+		TIM_ICInitStruct.TIM_ICFilter = 3;
+		TIM_ICInit(tim, &TIM_ICInitStruct);
+
+		TIM_EncoderInterfaceConfig(tim, TIM_EncoderMode_TI12, TIM_ICPolarity_Rising, TIM_ICPolarity_Rising);
+		TIM_Cmd(tim, ENABLE);
+	}
+	encoder_reset();
+}
+
+bool encoder_isPresent(uint8_t axis)
+{
+	return axis < ENCODER_AXES && enc_inits[axis].Timer != NULL;
+}
+
+// Position of the encoder in steps of the motor
+static int32_t encoder_steps(uint8_t axis)
+{
+	int64_t v = (int64_t)enc[axis].cnt * _smParam.stepsPer360[axis];
+	int32_t d = enc_inits[axis].cntPer360;
+
+	return (int32_t)(v >= 0 ? (v + d / 2) / d : (v - d / 2) / d);
+}
+
+// The 16 bit counter of the timer is read often enough to extend it
+static void encoder_read(uint8_t axis)
+{
+	uint16_t v = (uint16_t)TIM_GetCounter(enc_inits[axis].Timer);
+	int16_t d = (int16_t)(v - enc[axis].last);
+
+	enc[axis].last = v;
+	enc[axis].cnt += enc_inits[axis].invert ? -d : d;
+}
+
+void encoder_reset(void)
+{
+	int i;
+
+	__disable_irq();
+	for (i = 0; i < ENCODER_AXES; i++)
+	{
+		encoderStat[i].err = encoderStat[i].maxErr = 0;
+		encoderStat[i].corrUp = encoderStat[i].corrDown = 0;
+		if (enc_inits[i].Timer == NULL)
+			continue;
+		encoder_read(i);
+		enc[i].shift = encoder_steps(i) - stepm_getCurGlobalStepsNum(i);
+	}
+	encoderAlarm = 0;
+	__enable_irq();
+}
+
+void encoder_shift(uint8_t axis, int32_t steps)
+{
+	if (axis < ENCODER_AXES)
+		enc[axis].shift += steps;
+}
+
+void encoder_proc(void)
+{
+	int32_t err, alarm, deadBand;
+	int i;
 
-	// PIN_SPEED_MID();
-	PIN_INPUT();
-	PIN_SET_MODE(ENCODER_PORT, ENCODER_PINS);
-
-	RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM8, ENABLE);
-	TIM_DeInit(TIM8);
-	TIM_TimeBaseStructInit(&timer_base);
-	timer_base.TIM_Period = 0xFFFF;
-	timer_base.TIM_CounterMode = TIM_CounterMode_Up;
-	TIM_TimeBaseInit(TIM8, &timer_base);
-
-	// Debounce filter
-	TIM_ICInitStruct.TIM_Channel = TIM_Channel_1;
-	TIM_ICInitStruct.TIM_ICFilter = 3;
-	TIM_ICInit(TIM8, &TIM_ICInitStruct);
-	TIM_ICInitStruct.TIM_Channel = TIM_Channel_2;
-	TIM_ICInitStruct.TIM_ICFilter = 3;
-	TIM_ICInit(TIM8, &TIM_ICInitStruct);
-
-	TIM_EncoderInterfaceConfig(TIM8, TIM_EncoderMode_TI12, TIM_ICPolarity_Rising, TIM_ICPolarity_Rising);
-
-	//TIM_ITConfig(TIM8, TIM_IT_Update, ENABLE);
-	//NVIC_EnableIRQ(TIM8_IRQn);
-	//-------------
-	// if (TIM_GetITStatus(TIM8, TIM_IT_Update) != RESET) {
-	//   TIM_ClearITPendingBit(TIM8, TIM_IT_Update);
-	//   direction = (TIM8->CR1 & TIM_CR1_DIR ? FORWARD : BACKWARD);
-	// }
-
-	TIM_Cmd(TIM8, ENABLE);
-
-	encoderZreset();
-	encoderCorrectionCntUp = encoderCorrectionCntDown = encoderCorrectionDelta = encoderCorrectionMaxDelta = 0;
+	for (i = 0; i < ENCODER_AXES; i++)
+	{
+		if (enc_inits[i].Timer == NULL)
+			continue;
+		encoder_read(i);
+	#if (USE_STEPM_DMA == 1)
+		if (stepm_inProc())
+			continue;	// the step counters are ahead of the waveform which is played
+	#endif
+		err = stepm_getCurGlobalStepsNum(i) + enc[i].shift - encoder_steps(i);
+		encoderStat[i].err = err;
+		if (labs(err) > labs(encoderStat[i].maxErr))
+			encoderStat[i].maxErr = err;
+		alarm = sm_mmToSteps(i, REAL_C(SM_FOLLOWING_ERROR_MM));
+		if (alarm != 0 && labs(err) > alarm && (encoderAlarm & (1 << i)) == 0)
+		{	// the steps are lost: stop, the position is not known
+			encoderAlarm |= 1 << i;
+			stepm_EmergeStop();
+			continue;
+		}
+		deadBand = ENCODER_DEADBAND_UM * _smParam.stepsPer360[i] / _smParam.umPer360[i];
+		if (!isEncoderCorrection || labs(err) <= deadBand || encoderAlarm != 0)
+			continue;
+		// one step at a time: the error of the next loop includes it
+		if (stepm_correct(i, err > 0 ? 1 : -1))
+		{
+			if (err > 0)
+				encoderStat[i].corrUp++;
+			else
+				encoderStat[i].corrDown++;
+		}
+	}
 }
 
 #endif
@@ -7,17 +7,39 @@
 
 #include <stdint.h>
 
-void encoder_int(void);
-static __INLINE int32_t encoderZvalue() { return (0x007FFF - (int32_t)TIM_GetCounter(TIM8)) >> 2; }
-static __INLINE void encoderZreset() {  TIM8->CNT = 0x7FFF; }
-
+/*
+ * Encoders of the axes (ENC<motor>_TIM in the board header). encoder_proc compares them
+ * with the position of the step counters at ENCODER_LOOP_FRQ: the following error is
+ * corrected by a step more or less in the move going on (isEncoderCorrection), an error
+ * over SM_FOLLOWING_ERROR_MM stops the motion and raises encoderAlarm: the step IRQs load
+ * no move until encoder_reset clears it.
+ */
+#define ENCODER_AXES					3
+#define ENCODER_LOOP_FRQ				1000
+// the move is corrected if so many steps are left in it
 #define ENCODER_CORRECTION_MIN_STEPS	150
-#define ENCODER_Z_CNT_PER_360			512
-// 0.014 mm
-#define ENCODER_Z_MIN_MEASURE			(MM_PER_360 * 1500 / ENCODER_Z_CNT_PER_360)
+// dead band of the correction, 1/1000 mm
+#define ENCODER_DEADBAND_UM				14
+
+typedef struct {
+	int32_t err;		// following error, steps: the step counter - the encoder
+	int32_t maxErr;		// the largest one since encoder_reset
+	uint32_t corrUp;	// steps added to the moves
+	uint32_t corrDown;	// steps removed from the moves
+} ENC_STAT;
+
+void encoder_int(void);
+bool encoder_isPresent(uint8_t axis);
+// The encoder is the position of the step counter now, the statistics and the alarm are cleared
+void encoder_reset(void);
+// The step counter of the axis is shifted by steps which are not a move (backlash takeup)
+void encoder_shift(uint8_t axis, int32_t steps);
+// Control loop, called by the ramp IRQ at ENCODER_LOOP_FRQ
+void encoder_proc(void);
 
 extern bool isEncoderCorrection;
-extern int32_t encoderCorrectionCntUp, encoderCorrectionCntDown, encoderCorrectionDelta, encoderCorrectionMaxDelta;
+extern volatile ENC_STAT encoderStat[ENCODER_AXES];
+extern volatile uint8_t encoderAlarm;	// axes over the following error limit
 
 #endif
 #endif
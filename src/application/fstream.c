@@ -0,0 +1,265 @@
+/*
+ * Ping-pong reader of the job file, see fstream.h
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef _WINDOWS
+	#include "stdafx.h"
+#else
+	#include "global.h"
+#endif
+
+#if (USE_SDCARD != 0)
+#include "fstream.h"
+
+#define SECTOR_SIZE		512
+
+FSTREAM_STAT fstreamStat;
+
+static struct {
+	FIL *fid;
+	char *half[2];
+	uint32_t len[2];	// bytes of the half
+	uint32_t ofs[2];	// of the half in the file
+	uint32_t pos;		// the next byte of the file
+	uint32_t skip;		// bytes before the first byte of fstream_open
+	uint8_t cur;		// the half of the parser
+	uint8_t read;		// the half which is read
+	bool isReading;
+	bool isLast;		// the half of the parser is the end of the file
+	bool isError;
+	bool isMotion;
+#if (USE_SDCARD == 1)
+	bool isDma;
+	bool isSeek;		// the sector of pos is not known
+	uint32_t sect;		// the sector of pos, when pos is not the start of the cluster
+	uint32_t part;		// bytes of the DMA transfer
+#endif
+} fstream;
+
+static void fstream_fail(void)
+{
+	fstreamStat.errors++;
+	fstream.isError = true;
+	fstream.isReading = false;
+}
+
+#if (USE_SDCARD == 1)
+static void fstream_partDone(uint32_t n)
+{
+	fstream.pos += n;
+	fstream.len[fstream.read] += n;
+	fstream.sect += (n + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+// The next part of the half: the first sector of the cluster by FatFs (it follows the chain),
+// the rest of the cluster by DMA
+static void fstream_readPart(void)
+{
+	FIL *fid = fstream.fid;
+	char *dst = fstream.half[fstream.read] + fstream.len[fstream.read];
+	uint32_t rest = fid->fsize - fstream.pos;
+	uint32_t bcs = (uint32_t)fid->fs->csize * SECTOR_SIZE;
+	uint32_t n;
+
+	if (rest == 0 || fstream.len[fstream.read] == FSTREAM_HALF)
+	{
+		fstream.isReading = false;
+		return;
+	}
+	if (fstream.pos % bcs == 0 || fstream.isSeek)
+	{
+		if (f_lseek(fid, fstream.pos + 1) != FR_OK)
+		{
+			fstream_fail();
+			return;
+		}
+		fstream.isSeek = false;
+		n = rest < SECTOR_SIZE ? rest : SECTOR_SIZE;
+		memcpy(dst, fid->buf, n);
+		fstream.sect = fid->dsect;
+		fstream_partDone(n);
+		return;
+	}
+	n = (bcs - fstream.pos % bcs) / SECTOR_SIZE;	// sectors to the end of the cluster
+	if (n > (FSTREAM_HALF - fstream.len[fstream.read]) / SECTOR_SIZE)
+		n = (FSTREAM_HALF - fstream.len[fstream.read]) / SECTOR_SIZE;
+	if (n > (rest + SECTOR_SIZE - 1) / SECTOR_SIZE)
+		n = (rest + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	fstream.part = n * SECTOR_SIZE < rest ? n * SECTOR_SIZE : rest;
+	if (n == 1)
+	{
+		SD_errno = SD_ReadBlock(fstream.sect << 9, (uint32_t *)dst, SECTOR_SIZE);
+		if (SD_errno != SD_OK)
+			fstream_fail();
+		else
+			fstream_partDone(fstream.part);
+		return;
+	}
+	SD_errno = SD_StartReadMultiBlocks(fstream.sect << 9, (uint32_t *)dst, SECTOR_SIZE, n);
+	if (SD_errno != SD_OK)
+		fstream_fail();
+	else
+		fstream.isDma = true;
+}
+
+// true - the DMA transfer is over
+static bool fstream_dmaDone(bool isWait)
+{
+	SD_Error st;
+
+	do
+		st = SD_GetReadState();
+	while (isWait && st == SD_REQUEST_PENDING);
+	if (st == SD_REQUEST_PENDING)
+		return false;
+	fstream.isDma = false;
+	if (st != SD_OK)
+	{
+		SD_errno = st;
+		fstream_fail();
+	}
+	else
+		fstream_partDone(fstream.part);
+	return true;
+}
+
+static void fstream_startHalf(uint8_t h)
+{
+	fstream.read = h;
+	fstream.len[h] = 0;
+	fstream.ofs[h] = fstream.pos;
+	fstream.isReading = true;
+	fstream_readPart();
+}
+#endif
+
+void fstream_poll(void)
+{
+#if (USE_SDCARD == 1)
+	if (!fstream.isReading || (fstream.isDma && !fstream_dmaDone(false)))
+		return;
+	if (fstream.isReading)
+		fstream_readPart();
+#endif
+}
+
+void fstream_idle(void)
+{
+#if (USE_SDCARD == 1)
+	if (fstream.isDma)
+		fstream_dmaDone(true);
+#endif
+}
+
+bool fstream_open(FIL *fid, char *buf, uint32_t ofs, bool isMotion)
+{
+	memset(&fstream, 0, sizeof(fstream));
+	memset(&fstreamStat, 0, sizeof(fstreamStat));
+	fstream.fid = fid;
+	fstream.half[0] = buf + FSTREAM_TAIL;
+	fstream.half[1] = buf + 2 * FSTREAM_TAIL + FSTREAM_HALF;
+	fstream.cur = 1;
+	fstream.isMotion = isMotion;
+#if (USE_SDCARD == 1)
+	fstream.pos = ofs & ~(SECTOR_SIZE - 1);
+	fstream.skip = ofs - fstream.pos;
+	fstream.isSeek = true;
+	fstream_startHalf(0);
+#else
+	if (f_lseek(fid, ofs) != FR_OK)
+		fstream_fail();
+	fstream.pos = ofs;
+#endif
+	return !fstream.isError;
+}
+
+char *fstream_next(const char *tail, uint32_t tailLen, uint32_t *len)
+{
+	uint8_t h = fstream.cur ^ 1;
+	char *str;
+
+	if (fstream.isLast || fstream.isError || fstream.fid == NULL)
+		return NULL;
+	if (tailLen >= FSTREAM_TAIL)
+	{
+		fstream_fail();
+		return NULL;
+	}
+#if (USE_SDCARD == 1)
+	if (fstream.isReading)
+	{
+		bool isUnderrun = false;
+
+		if (fstreamStat.reads != 0)
+			fstreamStat.waits++;
+		do
+		{
+			if (fstream.isMotion && fstreamStat.reads != 0 && !isUnderrun && !stepm_inProc())
+			{
+				fstreamStat.underruns++;
+				isUnderrun = true;
+			}
+			fstream_poll();
+		} while (fstream.isReading);
+		if (fstream.isError)
+			return NULL;
+	}
+	fstream.isLast = fstream.pos >= fstream.fid->fsize;
+#else
+	{
+		UINT rd = 0;
+
+		if (f_read(fstream.fid, fstream.half[h], FSTREAM_HALF, &rd) != FR_OK)
+		{
+			fstream_fail();
+			return NULL;
+		}
+		fstream.len[h] = rd;
+		fstream.ofs[h] = fstream.pos;
+		fstream.pos += rd;
+		fstream.isLast = rd < FSTREAM_HALF;
+	}
+#endif
+	str = fstream.half[h] - tailLen;
+	if (tailLen != 0)
+		memmove(str, tail, tailLen);
+	*len = tailLen + fstream.len[h];
+	str[*len] = 0;
+	if (fstreamStat.reads == 0)
+	{	// the start of fstream_open is in the sector
+		str += fstream.skip;
+		*len -= fstream.skip;
+	}
+	fstream.cur = h;
+	fstreamStat.reads++;
+#if (USE_SDCARD == 1)
+	if (!fstream.isLast)
+		fstream_startHalf(h ^ 1);	// the other half is parsed
+#endif
+	return str;
+}
+
+uint32_t fstream_tell(const char *p)
+{
+	return fstream.ofs[fstream.cur] + (p - fstream.half[fstream.cur]);
+}
+
+bool fstream_isLast(void)
+{
+	return fstream.isLast;
+}
+
+void fstream_close(void)
+{
+#if (USE_SDCARD == 1)
+	if (fstream.isDma)
+		fstream_dmaDone(true);
+#endif
+	fstream.isReading = false;
+	fstream.fid = NULL;
+}
+#endif
@@ -0,0 +1,46 @@
+#ifndef FSTREAM_H_
+#define FSTREAM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Ping-pong reader of the job file: one half of the buffer is read while the other one is parsed.
+ * Buffer: [tail 0][half 0][tail 1][half 1], the unparsed end of a half (the line which goes on)
+ * is copied to the tail before the next half, so the lines are parsed where they are.
+ * The read of a half starts when the other one is given to the parser: the half is the watermark.
+ * USE_SDCARD == 1: the sectors go by DMA (SD_StartReadMultiBlocks), fstream_poll ends the transfers.
+ * Else the half is read by f_read when it is needed.
+ */
+#define FSTREAM_HALF	7680	// bytes, 15 sectors
+#define FSTREAM_TAIL	256		// the longest line, the longer ones are cut
+#define FSTREAM_SIZE	(2 * (FSTREAM_TAIL + FSTREAM_HALF) + 4)
+
+#if (USE_SDCARD != 0)
+typedef struct {
+	uint32_t reads;		// halves
+	uint32_t waits;		// the parser waited for the half
+	uint32_t underruns;	// ... and the motors were stopped
+	uint32_t errors;
+} FSTREAM_STAT;
+
+extern FSTREAM_STAT fstreamStat;
+
+// buf - FSTREAM_SIZE bytes, word aligned; ofs - the first byte; isMotion - the waits stop the motors
+bool fstream_open(FIL *fid, char *buf, uint32_t ofs, bool isMotion);
+// The next half after tailLen bytes of tail (the rest of the previous one), zero terminated.
+// NULL - the end of the file or the error
+char *fstream_next(const char *tail, uint32_t tailLen, uint32_t *len);
+// The half of fstream_next is the last one of the file
+bool fstream_isLast(void);
+// Offset in the file of the byte of the last half (or its tail)
+uint32_t fstream_tell(const char *p);
+// Goes on with the read, it's called while the parser waits for the motors
+void fstream_poll(void);
+// Ends the DMA transfer: the SD card is free for the other files till the next fstream_poll
+void fstream_idle(void);
+// Ends the read, the SD card is free
+void fstream_close(void);
+#endif
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * Records of the pre-compiled job (.gbin), see gbin.h
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef _WINDOWS
+	#include "stdafx.h"
+#else
+	#include "global.h"
+#endif
+
+#include "gbin.h"
+
+bool gbin_isFileName(const char *name)
+{
+	const char *ext = strrchr(name, '.'), *gbin = ".gbin";
+
+	if (ext == NULL)
+		return false;
+	for (; *ext != 0 && *gbin != 0; ext++, gbin++)
+	{
+		if (tolower((unsigned char)*ext) != *gbin)
+			return false;
+	}
+	return *ext == 0 && *gbin == 0;
+}
+
+bool gbin_checkHdr(const GBIN_HDR *hdr, const SM_PARAM *p)
+{
+	return hdr->magic == GBIN_MAGIC && hdr->version == GBIN_VERSION
+		&& memcmp(hdr->stepsPer360, p->stepsPer360, sizeof(hdr->stepsPer360)) == 0
+		&& memcmp(hdr->umPer360, p->umPer360, sizeof(hdr->umPer360)) == 0;
+}
+
+static uint8_t *gbin_putU(uint8_t *p, uint32_t v)
+{
+	while (v >= 0x80)
+	{
+		*p++ = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+static uint8_t *gbin_putS(uint8_t *p, int32_t v)
+{
+	return gbin_putU(p, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+uint8_t gbin_encode(const GBIN_RECORD *rec, uint8_t *buf)
+{
+	uint8_t *p = buf + 1;
+	int i;
+
+	buf[0] = rec->type | (rec->flag ? 0x08 : 0);
+	switch (rec->type)
+	{
+	case GBIN_LINE:
+		for (i = 0; i < CRDS_SIZE; i++)
+		{
+			if (rec->steps[i] != 0)
+			{
+				buf[0] |= 0x10 << i;
+				p = gbin_putS(p, rec->steps[i]);
+			}
+		}
+		p = gbin_putU(p, rec->lengthUm);
+		break;
+	case GBIN_ARC:
+		p = gbin_putS(p, rec->arc.x);
+		p = gbin_putS(p, rec->arc.y);
+		p = gbin_putS(p, rec->arc.xEnd);
+		p = gbin_putS(p, rec->arc.yEnd);
+		p = gbin_putU(p, rec->arc.r);
+		p = gbin_putU(p, rec->arc.length);
+		p = gbin_putU(p, rec->lengthUm);
+		break;
+	case GBIN_CMD:
+		*p++ = rec->cmd;
+		p = gbin_putU(p, rec->value);
+		break;
+	case GBIN_FEED:
+		p = gbin_putU(p, rec->value);
+		break;
+	}
+	return (uint8_t)(p - buf);
+}
+
+// NULL - the number goes on after end
+static const uint8_t *gbin_getU(const uint8_t *p, const uint8_t *end, uint32_t *v)
+{
+	uint32_t x = 0;
+	uint8_t shift;
+
+	for (shift = 0; p < end && shift < 35; shift += 7)
+	{
+		x |= (uint32_t)(*p & 0x7F) << shift;
+		if ((*p++ & 0x80) == 0)
+		{
+			*v = x;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static const uint8_t *gbin_getS(const uint8_t *p, const uint8_t *end, int32_t *v)
+{
+	uint32_t u = 0;
+
+	p = gbin_getU(p, end, &u);
+	*v = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+	return p;
+}
+
+int gbin_decode(GBIN_RECORD *rec, const uint8_t *buf, uint32_t len)
+{
+	const uint8_t *p = buf + 1, *end = buf + len;
+	uint32_t u = 0;
+	int i;
+
+	if (len == 0)
+		return 0;
+	rec->type = buf[0] & 0x07;
+	rec->flag = (buf[0] & 0x08) != 0;
+	switch (rec->type)
+	{
+	case GBIN_LINE:
+		for (i = 0; i < CRDS_SIZE; i++)
+		{
+			rec->steps[i] = 0;
+			if ((buf[0] & (0x10 << i)) != 0 && p != NULL)
+				p = gbin_getS(p, end, &rec->steps[i]);
+		}
+		if (p != NULL)
+			p = gbin_getU(p, end, &rec->lengthUm);
+		break;
+	case GBIN_ARC:
+		if (p != NULL) p = gbin_getS(p, end, &rec->arc.x);
+		if (p != NULL) p = gbin_getS(p, end, &rec->arc.y);
+		if (p != NULL) p = gbin_getS(p, end, &rec->arc.xEnd);
+		if (p != NULL) p = gbin_getS(p, end, &rec->arc.yEnd);
+		if (p != NULL) p = gbin_getU(p, end, &rec->arc.r);
+		if (p != NULL) p = gbin_getU(p, end, &rec->arc.length);
+		if (p != NULL) p = gbin_getU(p, end, &rec->lengthUm);
+		rec->arc.cw = rec->flag;
+		break;
+	case GBIN_CMD:
+		if (p >= end)
+			return 0;
+		rec->cmd = *p++;
+		p = gbin_getU(p, end, &u);
+		rec->value = u;
+		break;
+	case GBIN_FEED:
+		p = gbin_getU(p, end, &rec->value);
+		break;
+	case GBIN_OVERRIDE:
+	case GBIN_END:
+		break;
+	default:
+		return -1;
+	}
+	if (p == NULL)
+		return len < GBIN_MAX_RECORD ? 0 : -1;
+	return (int)(p - buf);
+}
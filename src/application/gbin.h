@@ -0,0 +1,62 @@
+#ifndef GBIN_H_
+#define GBIN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gcode.h"
+#include "stepmotor.h"
+
+/*
+ * Pre-compiled job (.gbin): the blocks which the parser, the arcs and the path stage give
+ * to the planner, made on a host by tools/gbinc with the same code and the machine profile.
+ * cnc_gfile streams them to the planner, no text is parsed on the MCU.
+ *
+ * GBIN_HDR, then the records. Record: type in the low 3 bits of the first byte, the flag
+ * in bit 3, the numbers are varints (7 bits a byte, low first), signed ones are zigzag coded.
+ */
+#define GBIN_MAGIC		0x4E494247	// "GBIN"
+#define GBIN_VERSION	1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	int32_t  stepsPer360[CRDS_SIZE];	// the profile of the steps, it must be the one of the machine
+	int32_t  umPer360[CRDS_SIZE];
+	uint32_t timeMs;					// ideal time of the job
+	int32_t  minUm[3], maxUm[3];		// bounds of XYZ, 1/1000 mm
+} GBIN_HDR;
+
+#define GBIN_LINE		0	// bits 4..7 - axes of the steps; steps, length (1/1000 mm); flag - rapid
+#define GBIN_ARC		1	// x, y, xEnd, yEnd, r, length (STEPM_ARC), length (1/1000 mm); flag - CW
+#define GBIN_CMD		2	// STEPM_CMD_*, value
+#define GBIN_FEED		3	// feed rate of the next moves, 1/1000 mm/min
+#define GBIN_OVERRIDE	4	// flag - M48 (override enabled) / M49
+#define GBIN_END		5	// M2 / M30
+
+#define GBIN_MAX_RECORD	40	// bytes
+
+typedef struct {
+	uint8_t  type;
+	bool     flag;
+	int32_t  steps[CRDS_SIZE];	// LINE
+	STEPM_ARC arc;				// ARC
+	uint32_t lengthUm;			// LINE, ARC
+	uint32_t value;				// FEED, CMD
+	uint8_t  cmd;				// CMD
+} GBIN_RECORD;
+
+bool gbin_isFileName(const char *name);
+bool gbin_checkHdr(const GBIN_HDR *hdr, const SM_PARAM *p);
+uint8_t gbin_encode(const GBIN_RECORD *rec, uint8_t *buf);
+// Bytes of the record, 0 - the record goes on after len, -1 - bad record
+int gbin_decode(GBIN_RECORD *rec, const uint8_t *buf, uint32_t len);
+
+#if (USE_GBIN_WRITER == 1)
+	// The blocks of the planner go to the file (tools/gbinc)
+	bool gbin_putLine(const int32_t steps[], CNC_REAL moveLength, CNC_REAL feed_rate, bool isRapid);
+	bool gbin_putArc(const STEPM_ARC *arc, CNC_REAL length, CNC_REAL feed_rate);
+	bool gbin_putCmd(uint8_t cmd, uint32_t value);
+	bool gbin_putOverride(bool isEnabled);
+#endif
+
+#endif
@@ -16,12 +16,15 @@
 #endif
 
 #include "gcode.h"
+#include "planner.h"
 
 #define X_AXIS 0
 #define Y_AXIS 1
 #define Z_AXIS 2
 
 #define MM_PER_INCH (25.4)
+// G83: the tool goes back into the hole by rapid up to this distance above the last peck (mm)
+#define GC_PECK_CLEARANCE_MM (0.25)
 
 #define NEXT_ACTION_DEFAULT 0
 #define NEXT_ACTION_DWELL_G4 1
@@ -36,160 +39,205 @@
 #define NEXT_ACTION_EXTRUDER_WAIT_T 10
 #define NEXT_ACTION_CW_ARC 11
 #define NEXT_ACTION_CCW_ARC 12
+#define NEXT_ACTION_DRILL_G81 13
+#define NEXT_ACTION_DRILL_G82 14 // dwell at the bottom
+#define NEXT_ACTION_PECK_G83 15
+
+#define IS_CYCLE(action) ((action) >= NEXT_ACTION_DRILL_G81 && (action) <= NEXT_ACTION_PECK_G83)
 
 typedef struct {
 	uint8_t status_code;
 	uint8_t inches_mode;             /* 0 = millimeter mode, 1 = inches mode {G20, G21} */
 	uint8_t absolute_mode;           /* 0 = relative motion, 1 = absolute motion {G90, G91} */
-	uint8_t spindle_on, extruder_on;
-	double feed_rate, seek_rate;     /* Millimeters/second */
-	double extruder_length, extruder_k;
-	double position[3];              /* Where the interpreter considers the tool to be at this point in the code */
+	uint8_t outputs;                 /* STEPM_OUT_* {M3, M5, M7, M8, M9, M106, M107} */
+	uint8_t extruder_on;
+	CNC_REAL feed_rate, seek_rate;   /* Millimeters/second */
+	CNC_REAL extruder_length, extruder_k;
+	CNC_REAL position[3];             /* Where the interpreter considers the tool to be at this point in the code */
 	int16_t s_value;           /* RPM/100 or temperature of the current extruder */
 	uint8_t next_action;  /* The action that will be taken by the parsed line */
+	GC_CYCLE cycle;            /* {G81, G82, G83, G98, G99} */
 } parser_state_t;
 
 parser_state_t gc;
 
 #define FAIL(status) { gc.status_code = status; return(gc.status_code); }
 
+/*
+ * Numbers of the text: the digits are collected to one integer and scaled once
+ * by a power of ten (real_scanDecimal)
+ */
 double strtod_M(const char *str, char **endptr)
 {
-	double number = 0.0;
-	double div = 0.0;
-	bool negative = false;
-	bool plus = false;
-	bool skip = true;
-	char c;
-	while ((c = *str) != 0)
-	{
-		if (c == '+')
-		{
-			if (skip && !plus)
-			{
-				plus = true;
-				skip = false;
-			}
-			else
-				break;
-		}
-		else if (skip && !negative && c == '-')
-		{
-			if (skip && !negative)
-			{
-				negative = true;
-				skip = false;
-			}
-			else
-				break;
-		}
-		else if (c == '.')
-		{
-			if (div == 0.0)
-				div = 1.0;
-			else
-				break;
-		}
-		else if (c >= '0' && c <= '9')
-		{
-			skip = false;
-			if (div == 0.0)
-				number = number * 10.0 + (double)(c - '0');
-			else
-			{
-				div *= 10.0;
-				number += ((double)(c - '0') / div);
-			}
-		}
-		else if (!skip)
-		{
-			break;
-		}
-		str++;
-	}
+	REAL_DECIMAL d;
+	const char *end = real_scanDecimal(str, &d);
 
-	if (negative) number = -number;
-	if (endptr != NULL) *endptr = (char *)str;
-	return number;
+	if (endptr != NULL) *endptr = (char *)end;
+	return end != str ? real_decimalToDouble(&d) : 0;
 }
 
-static int read_double(char *line, int *char_counter, double *double_ptr)
+int32_t strtofix_M(const char *str, char **endptr, uint8_t digits)
 {
-	char *start = line + *char_counter;
-	char *end;
+	REAL_DECIMAL d;
+	const char *end = real_scanDecimal(str, &d);
 
-	*double_ptr = strtod_M(start, &end);
-	if (end == start)
-	{
-		gc.status_code = GCSTATUS_BAD_NUMBER_FORMAT;
-		return false;
-	}
-	*char_counter = (int)(end - line);
-	return true;
+	if (endptr != NULL) *endptr = (char *)end;
+	return end != str ? real_decimalToFixed(&d, digits) : 0;
 }
 
-static int next_statement(char *letter, double *double_ptr, char *line, int *char_counter)
+static CNC_REAL strtor_M(const char *str, char **endptr)
 {
-	while (line[*char_counter] == ' ') (*char_counter)++;
+	REAL_DECIMAL d;
+	const char *end = real_scanDecimal(str, &d);
 
-	if (line[*char_counter] == 0 || line[*char_counter] == ';' ||
-		line[*char_counter] == '\n' || line[*char_counter] == '\r') return false;
-	*letter = line[*char_counter];
-	if ((*letter < 'A') || (*letter > 'Z'))
+	if (endptr != NULL) *endptr = (char *)end;
+	return end != str ? real_fromDecimal(&d) : 0;
+}
+
+/*
+ * Words of the line go to the table in one pass, the spaces and the comments are skipped.
+ * The line is neither modified nor copied, it may be in the read buffer of the file.
+ */
+uint8_t gc_parse_line(const char *line, GC_LINE *words)
+{
+	const char *p = line;
+	char *end;
+	GC_WORD *w;
+
+	words->n = 0;
+	if (*p == '%')
+		return GCSTATUS_OK;	// start and end of the program
+	while (true)
 	{
-		gc.status_code = GCSTATUS_EXPECTED_COMMAND_LETTER;
-		return false;
+		switch (*p)
+		{
+		case ' ':
+		case '\t':
+			p++;
+			continue;
+		case 0:
+		case ';':
+		case '\n':
+		case '\r':
+			return GCSTATUS_OK;
+		case '(':
+			while (*p != 0 && *p != ')')
+				p++;
+			if (*p != 0)
+				p++;
+			continue;
+		}
+		if (*p < 'A' || *p > 'Z')
+			return GCSTATUS_EXPECTED_COMMAND_LETTER;
+		if (words->n >= GC_MAX_WORDS)
+			return GCSTATUS_TOO_MANY_WORDS;
+		w = &words->w[words->n++];
+		w->letter = *p++;
+		w->value = strtor_M(p, &end);
+		if (end == p)
+			return GCSTATUS_BAD_NUMBER_FORMAT;
+		w->flags = real_fromInt(real_toInt(w->value)) != w->value ? GC_WORD_FRAC : 0;
+		p = end;
 	}
-	(*char_counter)++;
-	return read_double(line, char_counter, double_ptr);
 }
 
 void gc_init(void)
 {
 	memset(&gc, 0, sizeof(gc));
-	gc.feed_rate = SM_DEFAULT_FEED_RATE;
-	gc.seek_rate = SM_DEFAULT_SEEK_RATE;
+	gc.feed_rate = real_fromInt(SM_DEFAULT_FEED_RATE);
+	gc.seek_rate = real_fromInt(SM_DEFAULT_SEEK_RATE);
 	gc.absolute_mode = true;
 	// gc.startPosX = commonValues.startX;
 	// gc.startPosY = commonValues.startY;
 	// gc.startPosZ = commonValues.startZ;
-	gc.extruder_k = 1;
+	gc.extruder_k = REAL_ONE;
 	// commonValues.extruder_k;
 	gc.next_action = NEXT_ACTION_DEFAULT;
 }
 
-static double to_millimeters(double value)
+void gc_getModal(GC_MODAL *m)
+{
+	memcpy(m->position, gc.position, sizeof(m->position));
+	m->feed_rate = gc.feed_rate;
+	m->seek_rate = gc.seek_rate;
+	m->extruder_length = gc.extruder_length;
+	m->extruder_k = gc.extruder_k;
+	m->s_value = gc.s_value;
+	m->extruder_on = gc.extruder_on;
+	m->action = gc.next_action;
+	m->inches_mode = gc.inches_mode;
+	m->absolute_mode = gc.absolute_mode;
+	m->outputs = gc.outputs;
+	m->cycle = gc.cycle;
+}
+
+void gc_setModal(const GC_MODAL *m)
+{
+	memcpy(gc.position, m->position, sizeof(gc.position));
+	gc.feed_rate = m->feed_rate;
+	gc.seek_rate = m->seek_rate;
+	gc.extruder_length = m->extruder_length;
+	gc.extruder_k = m->extruder_k;
+	gc.s_value = m->s_value;
+	gc.extruder_on = m->extruder_on;
+	gc.next_action = m->action;
+	gc.inches_mode = m->inches_mode;
+	gc.absolute_mode = m->absolute_mode;
+	gc.outputs = m->outputs;
+	gc.cycle = m->cycle;
+}
+
+static CNC_REAL to_millimeters(CNC_REAL value)
 {
-	return (gc.inches_mode ? (value * MM_PER_INCH) : value);
+	return (gc.inches_mode ? real_mul(value, REAL_C(MM_PER_INCH)) : value);
 }
 
-static void mc_arc(double *position, double *target, double *offset, double feed_rate, double radius, uint8_t isclockwise)
+static void mc_arc(CNC_REAL *position, CNC_REAL *target, CNC_REAL *offset, CNC_REAL feed_rate, CNC_REAL radius, uint8_t isclockwise)
 {
-	double center_axisX = position[X_AXIS] + offset[X_AXIS];
-	double center_axisY = position[Y_AXIS] + offset[Y_AXIS];
-	double move_z = target[Z_AXIS] - position[Z_AXIS];
-	double r_axisX = -offset[X_AXIS];  // Radius vector from center to current location
-	double r_axisY = -offset[Y_AXIS];
-	double rt_axisX = target[X_AXIS] - center_axisX;
-	double rt_axisY = target[Y_AXIS] - center_axisY;
+	CNC_REAL center_axisX = position[X_AXIS] + offset[X_AXIS];
+	CNC_REAL center_axisY = position[Y_AXIS] + offset[Y_AXIS];
+	CNC_REAL move_z = target[Z_AXIS] - position[Z_AXIS];
+	CNC_REAL r_axisX = -offset[X_AXIS];  // Radius vector from center to current location
+	CNC_REAL r_axisY = -offset[Y_AXIS];
+	CNC_REAL rt_axisX = target[X_AXIS] - center_axisX;
+	CNC_REAL rt_axisY = target[Y_AXIS] - center_axisY;
 
 	// CCW angle between position and target from circle center. Only one atan2() trig computation required.
-	double angular_travel = atan2(r_axisX*rt_axisY - r_axisY*rt_axisX, r_axisX*rt_axisX + r_axisY*rt_axisY);
-	double millimeters_of_travel;
+	CNC_REAL angular_travel = real_angle(r_axisX, r_axisY, rt_axisX, rt_axisY);
+	CNC_REAL theta_max, t;
 	uint16_t segments;
 
-	if (angular_travel < 0) { angular_travel += 2 * M_PI; }
-	if (isclockwise) { angular_travel -= 2 * M_PI; }
-	if (angular_travel == 0.0) angular_travel = (isclockwise) ? -2 * M_PI : 2 * M_PI;
+	if (angular_travel < 0) { angular_travel += 2 * REAL_PI; }
+	if (isclockwise) { angular_travel -= 2 * REAL_PI; }
+	if (angular_travel == 0) angular_travel = (isclockwise) ? -2 * REAL_PI : 2 * REAL_PI;
+
+	// Speed on the circle is limited by the centripetal acceleration v^2/r
+	feed_rate = plan_arcFeedRate(feed_rate, radius);
+
+#if (USE_STEPM_ARC == 1)
+	if (cnc_arcIsNative(radius, move_z))
+	{	// the step engine makes the circle itself
+		if (!cnc_arc(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], center_axisX, center_axisY, radius, angular_travel, feed_rate))
+			gc.status_code = GCSTATUS_CANCELED;
+		return;
+	}
+#endif
 
-	millimeters_of_travel = hypot(angular_travel*radius, fabs(move_z));
-	if (millimeters_of_travel <= DEFAULT_MM_PER_ARC_SEGMENT) { return; }
-	segments = (int16_t)floor(millimeters_of_travel / DEFAULT_MM_PER_ARC_SEGMENT);
+	// Chord of the angle theta is off the arc by r * (1 - cos(theta / 2)) ~= r * theta^2 / 8,
+	// so the longest segment within SM_ARC_TOLERANCE_MM is theta = 2 * sqrt(2 * tolerance * r) / r
+	theta_max = REAL_PI / 4;
+	if (radius > _smParam.arcTolerance)
+	{
+		t = real_div(2 * real_sqrt(2 * real_mul(_smParam.arcTolerance, radius)), radius);
+		if (t < theta_max)
+			theta_max = t;
+	}
+	segments = (uint16_t)real_toInt(real_div(real_abs(angular_travel), theta_max)) + 1;
 
 	//  scr_fontColor(White,Black); scr_gotoxy(1,13);	scr_printf("angle:%f steps:%d", angular_travel, segments); scr_clrEndl();
 
-	double theta_per_segment = angular_travel / segments;
-	double dz = move_z / segments;
+	CNC_REAL theta_per_segment = angular_travel / segments;
+	CNC_REAL dz = move_z / segments;
 
 	/* Vector rotation by transformation matrix: r is the original vector, r_T is the rotated vector,
 	   and phi is the angle of rotation. Based on the solution approach by Jens Geisler.
@@ -211,45 +259,43 @@ static void mc_arc(double *position, double *target, double *offset, double feed
 	   numerical drift error. N_ARC_CORRECTION may be on the order a hundred(s) before error becomes an
 	   issue for CNC machines with the single precision Arduino calculations.
 
-	   This approximation also allows mc_arc to immediately insert a line segment into the planner
-	   without the initial overhead of computing cos() or sin(). By the time the arc needs to be applied
-	   a correction, the planner should have caught up to the lag caused by the initial mc_arc overhead.
-	   This is important when there are successive arc motions.
+	   Segments are chosen by the chord tolerance and may be longer than 0.1 rad on small circles,
+	   so the rotation matrix is computed exactly, once per arc.
 	   */
 	// Vector rotation matrix values
-	double cos_T = 1 - 0.5*theta_per_segment*theta_per_segment; // Small angle approximation
-	double sin_T = theta_per_segment;
-
-	double arc_target[3];
-	double sin_Ti;
-	double cos_Ti;
-	double r_axisi;
-	double moveLength, dx, dy;
+	CNC_REAL cos_T, sin_T;
+
+	CNC_REAL arc_target[3];
+	CNC_REAL sin_Ti;
+	CNC_REAL cos_Ti;
+	CNC_REAL r_axisi;
+	CNC_REAL moveLength, dx, dy;
 	uint16_t i;
 	int8_t count = 0;
 	// Initialize
 	arc_target[Z_AXIS] = position[Z_AXIS];
 	arc_target[X_AXIS] = position[X_AXIS];
 	arc_target[Y_AXIS] = position[Y_AXIS];
+	real_sinCos(theta_per_segment, &sin_T, &cos_T);
 	// double moveSum = 0;
 	//  uint32_t timeSum = 0;
 
 	for (i = 1; i < segments; i++)
 	{	// Increment (segments-1)
-		if (count < N_ARC_CORRECTION)
+		if (count < REAL_ARC_CORRECTION)
 		{	// Apply vector rotation matrix
-			r_axisi = r_axisX*sin_T + r_axisY*cos_T;
-			r_axisX = r_axisX*cos_T - r_axisY*sin_T;
+			r_axisi = real_mul(r_axisX, sin_T) + real_mul(r_axisY, cos_T);
+			r_axisX = real_mul(r_axisX, cos_T) - real_mul(r_axisY, sin_T);
 			r_axisY = r_axisi;
 			count++;
 		}
 		else
 		{	// Arc correction to radius vector. Computed only every N_ARC_CORRECTION increments.
 			// Compute exact location by applying transformation matrix from initial radius vector(=-offset).
-			cos_Ti = cos(i*theta_per_segment);
-			sin_Ti = sin(i*theta_per_segment);
-			r_axisX = -offset[X_AXIS] * cos_Ti + offset[Y_AXIS] * sin_Ti;
-			r_axisY = -offset[X_AXIS] * sin_Ti - offset[Y_AXIS] * cos_Ti;
+			// (the angle isn't i * theta_per_segment: rounding of fixed point would grow with i)
+			real_sinCos(real_mulDiv(angular_travel, i, segments), &sin_Ti, &cos_Ti);
+			r_axisX = real_mul(-offset[X_AXIS], cos_Ti) + real_mul(offset[Y_AXIS], sin_Ti);
+			r_axisY = real_mul(-offset[X_AXIS], sin_Ti) - real_mul(offset[Y_AXIS], cos_Ti);
 			count = 0;
 		}
 
@@ -260,10 +306,9 @@ static void mc_arc(double *position, double *target, double *offset, double feed
 
 		dx = arc_target[X_AXIS] - position[X_AXIS];
 		dy = arc_target[Y_AXIS] - position[Y_AXIS];
-		if (isnan(dx) && isnan(dy) && isnan(dz)) moveLength = 0;
-		else moveLength = sqrt(dx*dx + dy*dy + dz*dz);
+		moveLength = real_hypot3(dx, dy, dz);
 
-		if (!cnc_line(arc_target[X_AXIS], arc_target[Y_AXIS], arc_target[Z_AXIS], 0, moveLength, feed_rate))
+		if (!cnc_line(arc_target[X_AXIS], arc_target[Y_AXIS], arc_target[Z_AXIS], 0, moveLength, feed_rate, false))
 		{
 			gc.status_code = GCSTATUS_CANCELED;
 			return;
@@ -276,40 +321,92 @@ static void mc_arc(double *position, double *target, double *offset, double feed
 	dx = target[X_AXIS] - arc_target[X_AXIS];
 	dy = target[Y_AXIS] - arc_target[Y_AXIS];
 	dz = target[Z_AXIS] - arc_target[Z_AXIS];
-	if (isnan(dx) && isnan(dy) && isnan(dz))
-		moveLength = 0;
-	else
-		moveLength = sqrt(dx * dx + dy * dy + dz * dz);
-	if (!cnc_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], 0, moveLength, gc.feed_rate))
+	moveLength = real_hypot3(dx, dy, dz);
+	if (!cnc_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], 0, moveLength, feed_rate, false))
 	{
 		gc.status_code = GCSTATUS_CANCELED;
 	}
 }
 
+// Move of the cycle from position to z, or to (x, y) at the Z of position
+static bool mc_move(CNC_REAL *position, CNC_REAL x, CNC_REAL y, CNC_REAL z, bool isRapid)
+{
+	CNC_REAL moveLength = real_hypot3(x - position[X_AXIS], y - position[Y_AXIS], z - position[Z_AXIS]);
+
+	if (moveLength == 0)
+		return true;
+	position[X_AXIS] = x;
+	position[Y_AXIS] = y;
+	position[Z_AXIS] = z;
+	return cnc_line(x, y, z, 0, moveLength, isRapid ? gc.seek_rate : gc.feed_rate, isRapid);
+}
+
+/*
+ * Hole of the canned cycle at (x, y) from position, r and bottom are absolute:
+ * the rapid moves go to the planner as the other lines, the look-ahead joins them,
+ * only the bottom of the hole is the stop.
+ * Z goes up to R first if it's below, then XY, down to R and the feed to the bottom
+ * (G83: by pecks with the rapid back to R between them), the rapid to the clear level.
+ */
+static bool mc_drill(CNC_REAL *position, CNC_REAL x, CNC_REAL y, CNC_REAL r, CNC_REAL bottom, CNC_REAL clear, uint8_t action)
+{
+	CNC_REAL depth, top;
+
+	if (position[Z_AXIS] < r && !mc_move(position, position[X_AXIS], position[Y_AXIS], r, true))
+		return false;
+	if (!mc_move(position, x, y, position[Z_AXIS], true) || !mc_move(position, x, y, r, true))
+		return false;
+	for (depth = r; depth > bottom;)
+	{
+		top = depth;
+		depth = action == NEXT_ACTION_PECK_G83 ? depth - gc.cycle.q : bottom;
+		if (depth < bottom)
+			depth = bottom;
+		// back into the hole of the previous peck
+		if (top < r - REAL_C(GC_PECK_CLEARANCE_MM) && !mc_move(position, x, y, top + REAL_C(GC_PECK_CLEARANCE_MM), true))
+			return false;
+		if (!mc_move(position, x, y, depth, false))
+			return false;
+		if (depth > bottom && !mc_move(position, x, y, r, true))
+			return false;
+	}
+	if (action == NEXT_ACTION_DRILL_G82 && !cnc_dwell(gc.cycle.dwell))
+		return false;
+	return mc_move(position, x, y, clear, true);
+}
+
 // Executes one line of 0-terminated G-Code. The line is assumed to contain only upper case
 // characters and signed floating point values (no whitespace).
-uint8_t gc_execute_line(char *line)
+uint8_t gc_execute_line(const char *line)
 {
-	double feed_rate;
-	double extrudeLength;
-	int char_counter = 0;
+	GC_LINE words;
+
+	gc.status_code = gc_parse_line(line, &words);
+	if (gc.status_code)
+		return gc.status_code;
+	return gc_execute_words(&words);
+}
+
+uint8_t gc_execute_words(const GC_LINE *words)
+{
+	CNC_REAL feed_rate;
+	CNC_REAL extrudeLength;
 	char letter;
-	double value, oldPosition[3], dx, dy, dz, moveLength, offset[3], radius = 0;
-	int pause_value = 0;
-	uint8_t radius_mode = false;
+	CNC_REAL value, oldPosition[3], dx, dy, dz, moveLength, offset[3], radius = 0;
+	int i, pause_value = 0;
+	uint8_t radius_mode = false, isAxisWord = false;
+	uint8_t outputs = gc.outputs;
 
 	gc.status_code = GCSTATUS_OK;
-	
-	if (line[0] == ';'
-		|| line[0] == '('
-		|| line[0] == '%'
-		)
-		return GCSTATUS_OK;	// comments
-
-	// Pass 1: Commands
-	while (next_statement(&letter, &value, line, &char_counter))
+
+	// Commands: modal state and the action of the line
+	for (i = 0; i < words->n; i++)
 	{
-		int int_value = (int)value;
+		int int_value = real_toInt(words->w[i].value);
+
+		letter = words->w[i].letter;
+		if ((letter == 'G' || letter == 'M') && (words->w[i].flags & GC_WORD_FRAC) != 0)
+			FAIL(GCSTATUS_UNSUPPORTED_STATEMENT);	// G64.1 etc.
 		switch (letter)
 		{
 		case 'N':
@@ -329,14 +426,25 @@ uint8_t gc_execute_line(char *line)
 			case 90: gc.absolute_mode = true; break;
 			case 91: gc.absolute_mode = false; break;
 			case 92: gc.next_action = NEXT_ACTION_RESET_XYZ_G92; break;
+			case 81:
+			case 82:
+			case 83:
+				if (!IS_CYCLE(gc.next_action))
+					gc.cycle.initZ = gc.position[Z_AXIS];
+				gc.next_action = int_value == 81 ? NEXT_ACTION_DRILL_G81 : int_value == 82 ? NEXT_ACTION_DRILL_G82 : NEXT_ACTION_PECK_G83;
+				break;
+			case 80:	// Cancel canned cycle
+				if (IS_CYCLE(gc.next_action))
+					gc.next_action = NEXT_ACTION_SEEK_G0;
+				break;
+			case 98: gc.cycle.retractR = false; break;	// Feedrate per minute (group type A), the cycles go back to the Z before them
+			case 99: gc.cycle.retractR = true; break;
 			case 64:
 			case 40:
 			case 17:	// G17    X-Y
 			case 94:	// Feedrate per minute
-			case 98:	// Feedrate per minute (group type A)
 			case 97:	// Constant spindle speed M T Takes an S address integer, which is interpreted as rev/min (rpm). The default speed mode per system parameter if no mode is programmed. 
 			case 49:	// Tool length offset compensation cancel
-			case 80:	// Cancel canned cycle
 				break;
 			default: FAIL(GCSTATUS_UNSUPPORTED_STATEMENT);
 			}
@@ -352,9 +460,14 @@ uint8_t gc_execute_line(char *line)
 			case 60:
 				gc.next_action = NEXT_ACTION_STOP;
 				break;
-			case 3: gc.spindle_on = 1; break;
+			case 3: gc.outputs |= STEPM_OUT_SPINDLE; break;
 			//	case 4: gc.spindle_direction = -1; break;
-			case 5: gc.spindle_on = 0; break;
+			case 5: gc.outputs &= ~STEPM_OUT_SPINDLE; break;
+			case 7: gc.outputs |= STEPM_OUT_MIST; break;
+			case 8: gc.outputs |= STEPM_OUT_FLOOD; break;
+			case 9: gc.outputs &= ~(STEPM_OUT_MIST | STEPM_OUT_FLOOD); break;
+			case 106: gc.outputs |= STEPM_OUT_FAN; break;		// Fan On, S (PWM) is ignored
+			case 107: gc.outputs &= ~STEPM_OUT_FAN; break;
 #if (USE_EXTRUDER == 1)
 			case 101: //  M101 Turn extruder 1 on Forward 
 				gc.next_action = NEXT_ACTION_EXTRUDER_ON;
@@ -373,13 +486,7 @@ uint8_t gc_execute_line(char *line)
 			case 23: // Thread gradual pullout ON
 			case 24: // Thread gradual pullout OFF
 			case 52: // Unload Last tool from spindle
-			case 49: // Feedrate override NOT allowed
-			case 48: // Feedrate override allowed
-			case 8:  // Coolant on
-			case 9:  // Coolant off
 			case 105: // M105: Get Extruder Temperature Example: M105 Request the temperature of the current extruder and the build base in degrees Celsius. The temperatures are returned to the host computer. For example, the line sent to the host in response to this command looks like 
-			case 106: // M106: Fan On Example: M106 S127 Turn on the cooling fan at half speed. Optional parameter 'S' declares the PWM value (0-255) 
-			case 107: // Fan Off 
 			case 108: // M108: Set Extruder Speed  Sets speed of extruder motor. (Deprecated in current firmware, see M113) 
 			case 110: // Set Current Line Number 
 			case 113: // Set Extruder PWM 
@@ -388,6 +495,10 @@ uint8_t gc_execute_line(char *line)
 			case 142: // Holding Pressure Example: M142 S1 Set the holding pressure of the bed to 1 bar. 
 			case 6:
 				return gc.status_code;
+			case 48: // Feedrate override allowed
+			case 49: // Feedrate override NOT allowed
+				cnc_overrideEnable(int_value == 48);
+				return gc.status_code;
 			default: FAIL(GCSTATUS_UNSUPPORTED_STATEMENT);
 			}
 			break;
@@ -398,17 +509,20 @@ uint8_t gc_execute_line(char *line)
 	if (gc.status_code)
 		return(gc.status_code);
 
-	char_counter = 0;
 	oldPosition[X_AXIS] = gc.position[X_AXIS];
 	oldPosition[Y_AXIS] = gc.position[Y_AXIS];
 	oldPosition[Z_AXIS] = gc.position[Z_AXIS];
 	offset[0] = offset[1] = offset[2] = 0;
 
-	// Pass 2: Parameters
+	// Parameters
 	extrudeLength = 0;
-	while (next_statement(&letter, &value, line, &char_counter))
+	for (i = 0; i < words->n; i++)
 	{
-		double unit_millimeters_value = to_millimeters(value);
+		CNC_REAL unit_millimeters_value;
+
+		letter = words->w[i].letter;
+		value = words->w[i].value;
+		unit_millimeters_value = to_millimeters(value);
 		switch (letter)
 		{
 		case 'E': extrudeLength = value; break;
@@ -420,11 +534,21 @@ uint8_t gc_execute_line(char *line)
 			//	if (unit_millimeters_value > SM_MAX_FEEDRATE)
 			//		FAIL(GCSTATUS_UNSOPORTED_FEEDRATE);
 			break;
-		case 'P': pause_value = (int)value; break;
-		case 'S': gc.s_value = (int16_t)value; break;
+		case 'P':	// seconds, the dwell is in msec
+			pause_value = real_mulDivRound(value, 1000, 1);
+			if (IS_CYCLE(gc.next_action))
+				gc.cycle.dwell = pause_value;
+			break;
+		case 'S': gc.s_value = (int16_t)real_toInt(value); break;
 		case 'X':
 		case 'Y':
 		case 'Z':
+			isAxisWord = true;
+			if (letter == 'Z' && IS_CYCLE(gc.next_action))
+			{	// the bottom of the hole, Z of the tool goes back to the clear level
+				gc.cycle.z = unit_millimeters_value;
+				break;
+			}
 			if (gc.absolute_mode)
 				gc.position[letter - 'X'] = unit_millimeters_value;
 			else
@@ -436,9 +560,20 @@ uint8_t gc_execute_line(char *line)
 			offset[letter - 'I'] = unit_millimeters_value;
 			break;
 		case 'R':
+			if (IS_CYCLE(gc.next_action))
+			{
+				gc.cycle.r = unit_millimeters_value;
+				isAxisWord = true;
+				break;
+			}
 			radius = unit_millimeters_value;
 			radius_mode = true;
 			break;
+		case 'Q':
+			if (!IS_CYCLE(gc.next_action))
+				FAIL(GCSTATUS_UNSUPPORTED_PARAM);
+			gc.cycle.q = real_abs(unit_millimeters_value);
+			break;
 		case 'G':
 		case 'N':
 		case 'M':
@@ -457,30 +592,27 @@ uint8_t gc_execute_line(char *line)
 	dy = gc.position[Y_AXIS] - oldPosition[Y_AXIS];
 	dz = gc.position[Z_AXIS] - oldPosition[Z_AXIS];
 
-	if (fabs(dx) < SM_TOO_SHORT_SEGMENT_MM) { dx = 0.0; gc.position[X_AXIS] = oldPosition[X_AXIS]; }
-	if (fabs(dy) < SM_TOO_SHORT_SEGMENT_MM) { dy = 0.0; gc.position[Y_AXIS] = oldPosition[Y_AXIS]; }
-	if (fabs(dz) < SM_TOO_SHORT_SEGMENT_MM) { dz = 0.0; gc.position[Z_AXIS] = oldPosition[Z_AXIS]; }
-
-	moveLength = sqrt(dx * dx + dy * dy + dz * dz);
-	feed_rate = gc.next_action == (NEXT_ACTION_SEEK_G0 ? gc.seek_rate : gc.feed_rate);
+	moveLength = real_hypot3(dx, dy, dz);
+	feed_rate = gc.next_action == NEXT_ACTION_SEEK_G0 ? gc.seek_rate : gc.feed_rate;
 	if (gc.extruder_on)
 	{
-		if (extrudeLength == 0.0)
-			gc.extruder_length += moveLength*gc.extruder_k;
+		if (extrudeLength == 0)
+			gc.extruder_length += real_mul(moveLength, gc.extruder_k);
 		else
 			gc.extruder_length = extrudeLength;
 	}
 
+	// spindle, coolant and fan are switched before the motion of the line, in order with the moves
+	if (gc.outputs != outputs && !cnc_outputs(gc.outputs))
+		return GCSTATUS_CANCELED;
+
 	if ((gc.next_action == NEXT_ACTION_SEEK_G0 ||
 		gc.next_action == NEXT_ACTION_LINEAR_G1 ||
 		gc.next_action == NEXT_ACTION_CW_ARC ||
 		gc.next_action == NEXT_ACTION_CCW_ARC)
-		&& moveLength < SM_TOO_SHORT_SEGMENT_MM)
+		&& moveLength == 0)
 	{
-		// too short move.. Ignore
-		gc.position[X_AXIS] = oldPosition[X_AXIS];
-		gc.position[Y_AXIS] = oldPosition[Y_AXIS];
-		gc.position[Z_AXIS] = oldPosition[Z_AXIS];
+		// no move.. Ignore. Short moves go to the path stage of cnc_line, it combines them
 		return(gc.status_code);
 	}
 
@@ -488,7 +620,8 @@ uint8_t gc_execute_line(char *line)
 	switch (gc.next_action)
 	{
 	case NEXT_ACTION_DWELL_G4:
-		cnc_dwell(pause_value * 1000);
+		if (!cnc_dwell(pause_value))
+			return GCSTATUS_CANCELED;
 		break;
 	case NEXT_ACTION_RESET_XYZ_G92:
 		gc.position[0] = gc.position[1] = gc.position[2] = 0;
@@ -498,18 +631,24 @@ uint8_t gc_execute_line(char *line)
 		break;
 	case NEXT_ACTION_GO_HOME_G28:
 	case NEXT_ACTION_SEEK_G0:
-		if (!cnc_line(gc.position[X_AXIS], gc.position[Y_AXIS], gc.position[Z_AXIS], 0, moveLength, feed_rate))  // mm * 60000/(mm/min) = msec
+		if (!cnc_line(gc.position[X_AXIS], gc.position[Y_AXIS], gc.position[Z_AXIS], 0, moveLength, feed_rate, true))  // mm * 60000/(mm/min) = msec
 			return GCSTATUS_CANCELED;
 		break;
 	case NEXT_ACTION_LINEAR_G1:
-		if (!cnc_line(gc.position[X_AXIS], gc.position[Y_AXIS], gc.position[Z_AXIS], gc.extruder_length, moveLength, feed_rate))
+		if (!cnc_line(gc.position[X_AXIS], gc.position[Y_AXIS], gc.position[Z_AXIS], gc.extruder_length, moveLength, feed_rate, false))
 			return GCSTATUS_CANCELED;
 		break;
 	case NEXT_ACTION_CW_ARC:
 	case NEXT_ACTION_CCW_ARC:
+		if (moveLength < REAL_C(SM_TOO_SHORT_SEGMENT_MM))
+		{	// the end is within the line tolerance of the start: a line to it, not an arc
+			if (!cnc_line(gc.position[X_AXIS], gc.position[Y_AXIS], gc.position[Z_AXIS], 0, moveLength, feed_rate, false))
+				return GCSTATUS_CANCELED;
+			break;
+		}
 		if (radius_mode)
 		{
-			double h_x2_div_d;
+			CNC_REAL h_x2_div_d, d_div_2r;
 			/* We need to calculate the center of the circle that has the designated radius and passes
 				   through both the current position and the target position. This method calculates the following
 				   set of equations where [x,y] is the vector from current to target position, d == magnitude of
@@ -557,12 +696,15 @@ uint8_t gc_execute_line(char *line)
 				   i = (x - (y * h_x2_div_d))/2
 				   j = (y + (x * h_x2_div_d))/2
 
+				   Squares of the lengths don't fit the fixed point range, so it's computed as
+				   h_x2_div_d = sqrt(1 - (d/2r)^2) / (d/2r)
 				   */
-			h_x2_div_d = -sqrt(4 * radius*radius - dx*dx - dy*dy) / hypot(dx, dy); // == -(h * 2 / d)
+			d_div_2r = real_div(real_hypot(dx, dy), 2 * real_abs(radius));
 			// If r is smaller than d, the arc is now traversing the complex plane beyond the reach of any
 			// real CNC, and thus - for practical reasons - we will terminate promptly:
-			if (isnan(h_x2_div_d))
+			if (d_div_2r > REAL_ONE || d_div_2r == 0)
 				FAIL(GCSTATUS_FLOATING_POINT_ERROR);
+			h_x2_div_d = -real_div(real_sqrt(REAL_ONE - real_mul(d_div_2r, d_div_2r)), d_div_2r); // == -(h * 2 / d)
 			// Invert the sign of h_x2_div_d if the circle is counter clockwise (see sketch below)
 			if (gc.next_action == NEXT_ACTION_CCW_ARC)
 				h_x2_div_d = -h_x2_div_d;
@@ -588,15 +730,36 @@ uint8_t gc_execute_line(char *line)
 				radius = -radius; // Finished with r. Set to positive for mc_arc
 			}
 			// Complete the operation by calculating the actual center of the arc
-			offset[X_AXIS] = 0.5 * (dx - (dy * h_x2_div_d));
-			offset[Y_AXIS] = 0.5 * (dy + (dx * h_x2_div_d));
+			offset[X_AXIS] = (dx - real_mul(dy, h_x2_div_d)) / 2;
+			offset[Y_AXIS] = (dy + real_mul(dx, h_x2_div_d)) / 2;
 		}
 		else
 		{	// Offset mode specific computations
-			radius = hypot(offset[X_AXIS], offset[Y_AXIS]); // Compute arc radius for mc_arc
+			radius = real_hypot(offset[X_AXIS], offset[Y_AXIS]); // Compute arc radius for mc_arc
 		}
 		mc_arc(oldPosition, gc.position, offset, gc.feed_rate, radius, gc.next_action == NEXT_ACTION_CW_ARC);
 		break;
+	case NEXT_ACTION_DRILL_G81:
+	case NEXT_ACTION_DRILL_G82:
+	case NEXT_ACTION_PECK_G83:
+		if (isAxisWord)
+		{	// a hole at each line with X, Y, Z or R
+			CNC_REAL r = gc.cycle.r, bottom = gc.cycle.z;
+
+			if (!gc.absolute_mode)
+			{
+				r += oldPosition[Z_AXIS];
+				bottom += r;
+			}
+			if (bottom >= r || (gc.next_action == NEXT_ACTION_PECK_G83 && gc.cycle.q <= 0))
+				FAIL(GCSTATUS_BAD_CYCLE);
+			// G99 - back to R, G98 - to the Z before the cycle
+			if (!mc_drill(oldPosition, gc.position[X_AXIS], gc.position[Y_AXIS], r, bottom,
+				gc.cycle.retractR || gc.cycle.initZ < r ? r : gc.cycle.initZ, gc.next_action))
+				return GCSTATUS_CANCELED;
+			gc.position[Z_AXIS] = oldPosition[Z_AXIS];
+		}
+		break;
 #if (USE_EXTRUDER == 1)
 	case NEXT_ACTION_EXTRUDER_STOP:
 		cnc_extruder_stop();
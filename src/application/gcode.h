@@ -2,6 +2,7 @@
 #define gcode_h
 
 #include <stdint.h>
+#include "cnc_real.h"
 
 #define GCSTATUS_OK						0
 #define GCSTATUS_BAD_NUMBER_FORMAT		1
@@ -13,9 +14,20 @@
 #define GCSTATUS_TABLE_SIZE_OVER_X		7 
 #define GCSTATUS_TABLE_SIZE_OVER_Y		8 
 #define GCSTATUS_TABLE_SIZE_OVER_Z		9 
+#define GCSTATUS_TOO_MANY_WORDS			10
+#define GCSTATUS_BAD_GBIN				11
+#define GCSTATUS_FILE_READ_ERROR		12
+#define GCSTATUS_BAD_START_LINE			13
+#define GCSTATUS_BAD_CYCLE				14
 #define GCSTATUS_CANCELED				101
 
 #define K_FRQ 10
+
+#define CRDS_SIZE	4
+#define CRD_X 0
+#define CRD_Y 1
+#define CRD_Z 2
+#define CRD_E 3
 #ifndef M_PI
 	#define M_PI 3.141592653589793238462643
 #endif
@@ -27,10 +39,43 @@ typedef struct {
 	int32_t smoothStopF_to0[3];
 	int32_t smoothAF[3];
 	uint32_t maxFeedRate[3]; // steps/sec
+	int32_t jerk[3]; // mm/sec^3
+	int32_t backlash[3]; // steps, taken up at the reversal of the axis
 	uint16_t maxSpindleTemperature;
+	// kinematics of the machine
+	int32_t stepsPer360[CRDS_SIZE];	// steps per revolution of the motor
+	int32_t umPer360[CRDS_SIZE];	// travel per revolution, 1/1000 mm
+	int32_t tableSize[3];			// mm
+	int32_t arcTolerance_um;		// see SM_ARC_TOLERANCE_MM
+	int32_t arcMinRadius_um;		// see SM_ARC_MIN_RADIUS_MM
+	// made of the values above by sm_deriveParam, sm.bin does not keep them: they stay last
+	CNC_REAL stepsPerMm[CRDS_SIZE];	// mm -> steps
+	REAL_RECIP mmPerStep[CRDS_SIZE];	// steps -> mm
+	CNC_REAL arcTolerance;			// mm
+	CNC_REAL arcMinRadius;			// mm
 } SM_PARAM;
 
+/*
+ * Machine profile: the defaults below, sm.conf can change them (see initSmParam).
+ * The code takes the kinematics from _smParam only, the conversions are multiplications.
+ */
 extern SM_PARAM _smParam;
+void sm_defaultParam(SM_PARAM *p);
+// Values out of range are replaced by the defaults, returns the number of them
+int sm_checkParam(SM_PARAM *p);
+void sm_deriveParam(SM_PARAM *p);
+
+static __INLINE int32_t sm_mmToSteps(uint8_t crd, CNC_REAL mm)
+{
+	return real_mulToInt(mm, _smParam.stepsPerMm[crd]);
+}
+
+static __INLINE CNC_REAL sm_stepsToMm(uint8_t crd, int32_t steps)
+{
+	return real_mulRecip(steps, _smParam.mmPerStep[crd]);
+}
+
+// Defaults of the profile
 // 200 - full step 360/1.8
 #define SM_STEPS_PER_360	(3200 / 2)
 #define SM_X_STEPS_PER_360	SM_STEPS_PER_360
@@ -54,7 +99,7 @@ extern SM_PARAM _smParam;
 #define SM_Y_MAX_STEPS_PER_SEC (SM_Y_MAX_FEEDRATE * SM_Y_STEPS_PER_MM / 60)
 #define SM_Z_MAX_STEPS_PER_SEC (SM_Z_MAX_FEEDRATE * SM_Z_STEPS_PER_MM / 60)
 
-#define SM_MANUAL_MODE_STEPS_PER_SEC SM_STEPS_PER_360 * 2 // 640*2 -> 10mm/sec = 600mm/min
+#define SM_MANUAL_MODE_STEPS_PER_SEC (_smParam.stepsPer360[CRD_X] * 2) // 640*2 -> 10mm/sec = 600mm/min
 
 
 #define SM_DEFAULT_FEED_RATE 50		// G1
@@ -74,15 +119,55 @@ extern SM_PARAM _smParam;
 #define SM_SMOOTH_DFEED_Y	50
 #define SM_SMOOTH_DFEED_Z	40 //20
 
-// время на ступеньку (msec)
+// Рывок (скорость изменения ускорения) в mm/sec^3, задает S-образный разгон
+#define SM_SMOOTH_JERK_X	1500
+#define SM_SMOOTH_JERK_Y	1000
+#define SM_SMOOTH_JERK_Z	800
+
+// Backlash of the lead screws (steps), 0 - no compensation
+#define SM_BACKLASH_X		0
+#define SM_BACKLASH_Y		0
+#define SM_BACKLASH_Z		0
+// Following error (mm) of the axes with encoder that stops the motion, 0 - no alarm
+#define SM_FOLLOWING_ERROR_MM	0.5
+
+// Input shaper (USE_STEPW_SHAPER): STEPW_SHAPER_ZV, _ZVD or _EI, ringing frequency (Hz) and
+// damping ratio of each axis, 0 Hz - no shaping. ZVD and EI need 16 Hz at least, ZV - 8 Hz
+#define SM_SHAPER_TYPE		STEPW_SHAPER_ZVD
+#define SM_SHAPER_FRQ_X		40
+#define SM_SHAPER_FRQ_Y		35
+#define SM_SHAPER_FRQ_Z		0
+#define SM_SHAPER_DAMPING_X	0.1
+#define SM_SHAPER_DAMPING_Y	0.1
+#define SM_SHAPER_DAMPING_Z	0.1
+
+// время на ступеньку (msec), единица времени для smoothAF
 #define SM_SMOOTH_TFEED		(50) 
 
-#define SM_SMOOTH_COS_A			977000
+// Junction deviation (mm): distance from the corner of the circle along which the corner
+// is passed, sets the speed of the corners (0.01..0.05)
+#define SM_JUNCTION_DEVIATION_MM	0.02
+// Moves shorter than this are not planned alone, the path stage adds them to the next move
 #define SM_TOO_SHORT_SEGMENT_MM	0.015
+// Path stage: up to SM_PATH_WINDOW moves of one feed rate become one planner block,
+// if all their ends are within SM_PATH_TOLERANCE_MM of it
+#define SM_PATH_TOLERANCE_MM	0.005
+#define SM_PATH_WINDOW			16
+// The backlash is taken up along this length of the move after the reversal (mm),
+// longer moves are split
+#define SM_BACKLASH_SMOOTH_MM	0.5
+// Feed override (percent): range and step of the keys, rapid override is 100, 50 or 25
+#define SM_FEED_OVR_MIN			10
+#define SM_FEED_OVR_MAX			200
+#define SM_FEED_OVR_STEP		10
+#define SM_RAPID_OVR_MIN		25
 
 // for smoth alg.
 #define SM_SHORT_SEGMENT_MM		0.5
-#define DEFAULT_MM_PER_ARC_SEGMENT	0.2
+// Max distance between an arc and its segments (mm), sets the segment count of G2/G3
+#define SM_ARC_TOLERANCE_MM		0.002
+// Smaller arcs are cut into lines with USE_STEPM_ARC too
+#define SM_ARC_MIN_RADIUS_MM	0.1
 
 // Number of arc generation iterations by small angle approximation before exact arc trajectory
 // correction. This parameter maybe decreased if there are issues with the accuracy of the arc
@@ -100,18 +185,76 @@ extern SM_PARAM _smParam;
 #define GFILE_MODE_MASK_SHOW 2
 #define GFILE_MODE_MASK_EXEC 4
 
-void cnc_gfile(char *fileName, int mode);
+// Words of a G-code line (letter and value) made by gc_parse_line in one pass
+#define GC_MAX_WORDS	24
+#define GC_WORD_FRAC	0x01	// the value isn't an integer
+typedef struct {
+	char letter;
+	uint8_t flags;
+	CNC_REAL value;
+} GC_WORD;
+
+typedef struct {
+	uint8_t n;
+	GC_WORD w[GC_MAX_WORDS];
+} GC_LINE;
+
+// Canned drilling cycle G81/G82/G83, the words stay for the next holes
+typedef struct {
+	CNC_REAL r, z;				// R plane and the bottom (G91: increments from Z and R)
+	CNC_REAL q;					// depth of the peck (G83)
+	CNC_REAL initZ;				// Z before the cycle, G98 goes back there
+	int32_t dwell;				// msec at the bottom (G82 P, seconds)
+	uint8_t retractR;			// G99: back to R only
+} GC_CYCLE;
+
+// Modal state of the parser, the restart of the job from a line (gindex.h)
+typedef struct {
+	CNC_REAL position[3];		// mm
+	CNC_REAL feed_rate, seek_rate;
+	CNC_REAL extruder_length, extruder_k;
+	int16_t s_value;			// S word
+	uint8_t extruder_on;
+	uint8_t action;				// G0/G1/G2/G3 etc. stays for the next lines
+	uint8_t inches_mode;		// G20/G21
+	uint8_t absolute_mode;		// G90/G91
+	uint8_t outputs;			// STEPM_OUT_*
+	GC_CYCLE cycle;
+} GC_MODAL;
+
+// startLine - the job goes on from this line, the lines before it are parsed without motion
+void cnc_gfile(char *fileName, int mode, int startLine);
+// The job goes on at the line of the parsed state (cnc_gfile, tools/gbinc), safeZ - the top of the job
+bool cnc_restart(int mode, CNC_REAL safeZ);
 void gc_init(void);
-uint8_t gc_execute_line(char *line);
+void gc_getModal(GC_MODAL *m);
+void gc_setModal(const GC_MODAL *m);
+uint8_t gc_parse_line(const char *line, GC_LINE *words);
+uint8_t gc_execute_words(const GC_LINE *words);
+uint8_t gc_execute_line(const char *line);
 
-void cnc_go_home(double rate);
-void cnc_dwell(int pause);
+void cnc_go_home(CNC_REAL rate);
+// G4 (msec) and M-code outputs (STEPM_OUT_*): blocks of the planner, the step engine runs them
+// in order with the moves
+uint8_t cnc_dwell(int pause);
+uint8_t cnc_outputs(uint8_t outputs);
 uint8_t cnc_line(
-	double x, double y, double z,
-	double extruder_length, double length,
-	double feed_rate
+	CNC_REAL x, CNC_REAL y, CNC_REAL z,
+	CNC_REAL extruder_length, CNC_REAL length,
+	CNC_REAL feed_rate, bool isRapid
 	);
 void cnc_end(void);
+uint8_t cnc_flush(void);
+// M48 / M49: feed and rapid override allowed / not allowed (100%)
+void cnc_overrideEnable(bool isEnabled);
+#if (USE_STEPM_ARC == 1)
+	bool cnc_arcIsNative(CNC_REAL radius, CNC_REAL move_z);
+	uint8_t cnc_arc(
+		CNC_REAL x, CNC_REAL y, CNC_REAL z,
+		CNC_REAL cx, CNC_REAL cy, CNC_REAL radius,
+		CNC_REAL angular_travel, CNC_REAL feed_rate
+		);
+#endif
 
 #if (USE_EXTRUDER == 1)
 	void cnc_extruder_stop(void);
@@ -120,5 +263,7 @@ void cnc_end(void);
 #endif
 
 double strtod_M(const char *str, char **endptr);
+// round(number * 10^digits), e.g. 0 for integers, 3 for 1/1000 mm
+int32_t strtofix_M(const char *str, char **endptr, uint8_t digits);
 
 #endif
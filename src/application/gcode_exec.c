@@ -11,6 +11,10 @@
 
 #include "screen_io.h"
 #include "gcode.h"
+#include "planner.h"
+#include "gbin.h"
+#include "fstream.h"
+#include "gindex.h"
 
 #define ENABLE_SHOW_MAX_TIME_STEPS	640
 #define MAX_STR_SIZE				150
@@ -18,7 +22,95 @@
 // #define NO_ACCELERATION_CORRECTION
 
 SM_PARAM _smParam;
-bool isPause = false;
+
+void sm_defaultParam(SM_PARAM *p)
+{
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	p->smoothStartF_from0[0] = SM_SMOOTH_START_X*K_FRQ;
+	p->smoothStartF_from0[1] = SM_SMOOTH_START_Y*K_FRQ;
+	p->smoothStartF_from0[2] = SM_SMOOTH_START_Z*K_FRQ;
+	p->smoothStopF_to0[0] = SM_SMOOTH_STOP_X*K_FRQ;
+	p->smoothStopF_to0[1] = SM_SMOOTH_STOP_Y*K_FRQ;
+	p->smoothStopF_to0[2] = SM_SMOOTH_STOP_Z*K_FRQ;
+	p->smoothAF[0] = SM_SMOOTH_DFEED_X*SM_X_STEPS_PER_MM*SM_SMOOTH_TFEED*K_FRQ / 1000;
+	p->smoothAF[1] = SM_SMOOTH_DFEED_Y*SM_Y_STEPS_PER_MM*SM_SMOOTH_TFEED*K_FRQ / 1000;
+	p->smoothAF[2] = SM_SMOOTH_DFEED_Z*SM_Z_STEPS_PER_MM*SM_SMOOTH_TFEED / 1000 * K_FRQ;
+	p->maxFeedRate[0] = SM_X_MAX_STEPS_PER_SEC*K_FRQ;
+	p->maxFeedRate[1] = SM_Y_MAX_STEPS_PER_SEC*K_FRQ;
+	p->maxFeedRate[2] = SM_Z_MAX_STEPS_PER_SEC*K_FRQ;
+	p->jerk[0] = SM_SMOOTH_JERK_X;
+	p->jerk[1] = SM_SMOOTH_JERK_Y;
+	p->jerk[2] = SM_SMOOTH_JERK_Z;
+	p->backlash[0] = SM_BACKLASH_X;
+	p->backlash[1] = SM_BACKLASH_Y;
+	p->backlash[2] = SM_BACKLASH_Z;
+	p->maxSpindleTemperature = MAX_SPINDEL_TEMPERATURE;
+
+	p->stepsPer360[CRD_X] = SM_X_STEPS_PER_360;
+	p->stepsPer360[CRD_Y] = SM_Y_STEPS_PER_360;
+	p->stepsPer360[CRD_Z] = SM_Z_STEPS_PER_360;
+	p->stepsPer360[CRD_E] = SM_E_STEPS_PER_MM;
+	for (i = 0; i < 3; i++)
+		p->umPer360[i] = MM_PER_360 * 1000;
+	p->umPer360[CRD_E] = 1000;	// the extruder is in steps per mm
+	p->tableSize[0] = MAX_TABLE_SIZE_X;
+	p->tableSize[1] = MAX_TABLE_SIZE_Y;
+	p->tableSize[2] = MAX_TABLE_SIZE_Z;
+	p->arcTolerance_um = (int32_t)(SM_ARC_TOLERANCE_MM * 1000 + 0.5);
+	p->arcMinRadius_um = (int32_t)(SM_ARC_MIN_RADIUS_MM * 1000 + 0.5);
+	sm_deriveParam(p);
+}
+
+// A value out of lo..hi is replaced by the default one
+#define SM_CHECK(v, lo, hi)	if (p->v < (lo) || p->v > (hi)) { p->v = def.v; bad++; }
+
+int sm_checkParam(SM_PARAM *p)
+{
+	SM_PARAM def;
+	int i, bad = 0;
+
+	sm_defaultParam(&def);
+	for (i = 0; i < CRDS_SIZE; i++)
+	{
+		SM_CHECK(stepsPer360[i], 1, 1000000);
+		SM_CHECK(umPer360[i], 1, 1000000);
+		// 0.5..8000 steps per mm: mmPerStep is Q31 below 2, stepsPerMm is in the CNC_REAL range
+		if ((int64_t)p->umPer360[i] > (int64_t)p->stepsPer360[i] * 2000 || p->stepsPer360[i] > p->umPer360[i] * 8)
+		{
+			p->stepsPer360[i] = def.stepsPer360[i];
+			p->umPer360[i] = def.umPer360[i];
+			bad++;
+		}
+	}
+	for (i = 0; i < 3; i++)
+	{
+		SM_CHECK(smoothStartF_from0[i], 1, INT32_MAX);
+		SM_CHECK(smoothStopF_to0[i], 1, INT32_MAX);
+		SM_CHECK(smoothAF[i], 1, INT32_MAX);
+		SM_CHECK(maxFeedRate[i], 1, INT32_MAX);
+		SM_CHECK(jerk[i], 1, INT32_MAX);
+		SM_CHECK(backlash[i], 0, 10000);
+		SM_CHECK(tableSize[i], 1, 10000);
+	}
+	SM_CHECK(arcTolerance_um, 1, 1000);
+	SM_CHECK(arcMinRadius_um, 1, 1000000);
+	return bad;
+}
+
+void sm_deriveParam(SM_PARAM *p)
+{
+	int i;
+
+	for (i = 0; i < CRDS_SIZE; i++)
+	{
+		p->stepsPerMm[i] = real_ratio(p->stepsPer360[i] * 1000, p->umPer360[i]);
+		p->mmPerStep[i] = real_recipRatio(p->umPer360[i], p->stepsPer360[i] * 1000);
+	}
+	p->arcTolerance = real_ratio(p->arcTolerance_um, 1000);
+	p->arcMinRadius = real_ratio(p->arcMinRadius_um, 1000);
+}
 
 #if (USE_LCD != 0)
 	double k_scr;
@@ -33,38 +125,32 @@ bool isGcodeStop;
 	uint8_t isExtruderOn;
 #endif
 
-double minX, maxX, minY, maxY, minZ, maxZ;
-
-#define CRDS_SIZE	4
-#define CRD_X 0
-#define CRD_Y 1
-#define CRD_Z 2
-#define CRD_E 3
+CNC_REAL minX, maxX, minY, maxY, minZ, maxZ;
 
 #ifndef NO_ACCELERATION_CORRECTION
+// Moves waiting to be combined with the next ones before they go to the planner (path stage).
+// Ends of the moves in steps from the start of the first one, the last end is the end of the block.
 typedef struct {
-	uint32_t steps[CRDS_SIZE], frq[CRDS_SIZE];
-	uint8_t isNullCmd, dir[CRDS_SIZE], changeDir;
-	double length;
-	int32_t cos_a;
-	uint32_t feed_rate;
-} MVECTOR;
+	int32_t pts[SM_PATH_WINDOW][CRDS_SIZE];
+	uint8_t n;
+	CNC_REAL feed_rate;
+	bool isRapid;
+} MSEGMENT;
 #endif
 
 #define MAX_SHOW_GCODE_LINES	2
 typedef struct {
-	char cmd[MAX_STR_SIZE];
+	const char *cmd;	// in cncFileBuf, in keep before the buffer is read again
 	int lineNum;
+	char keep[MAX_STR_SIZE];
 } GCODE_CMD;
 
-#define MVECTOR_SZ		3
-#define TABLE_CENTER_X	(MAX_TABLE_SIZE_X / 4)
-#define TABLE_CENTER_Y	(MAX_TABLE_SIZE_Y / 4)
+#define TABLE_CENTER_X	(_smParam.tableSize[CRD_X] / 4)
+#define TABLE_CENTER_Y	(_smParam.tableSize[CRD_Y] / 4)
 
 struct {
 #ifndef NO_ACCELERATION_CORRECTION
-	MVECTOR mvector[MVECTOR_SZ];
-	int32_t mvectPtrCur, mvectCnt;
+	MSEGMENT segment;
 #endif
 	GCODE_CMD gcode[MAX_SHOW_GCODE_LINES];
 	int gcodePtrCur;
@@ -85,11 +171,49 @@ short crdYtoScr(double y)
 }
 #endif
 
+// Feed and rapid override, percent. The engine takes it at once, the planner at the next block:
+// the block being sent must keep the entry speed of the next one.
+static uint16_t ovrFeed, ovrRapid;
+static bool isOvrEnabled, isOvrChanged;
+
+static void cnc_applyOverride(void)
+{
+	uint16_t feed = isOvrEnabled ? ovrFeed : 100, rapid = isOvrEnabled ? ovrRapid : 100;
+
+	stepm_setOverride(feed, rapid);
+	isOvrChanged = true;
+#if (USE_LCD != 0)
+	scr_fontColor(Cyan, Black);
+	scr_gotoxy(1, 11);
+	scr_printf("F:%3d%c R:%3d%c ", feed, '%', rapid, '%');
+#endif
+}
+
+static void cnc_resetOverride(void)
+{
+	ovrFeed = ovrRapid = 100;
+	isOvrEnabled = true;
+	isOvrChanged = false;
+	stepm_setOverride(100, 100);
+}
+
+// M48 / M49
+void cnc_overrideEnable(bool isEnabled)
+{
+	if (isOvrEnabled == isEnabled)
+		return;
+	isOvrEnabled = isEnabled;
+#if (USE_GBIN_WRITER == 1)
+	gbin_putOverride(isEnabled);
+#endif
+	cnc_applyOverride();
+}
+
 void initGcodeProc(void)
 {
 #if (USE_LCD != 0)
-	double kx = ((double)(LCD_WIDTH  - 10)) / MAX_TABLE_SIZE_X;
-	double ky = ((double)(LCD_HEIGHT - 2)) / MAX_TABLE_SIZE_Y;
+	double kx = ((double)(LCD_WIDTH  - 10)) / _smParam.tableSize[CRD_X];
+	double ky = ((double)(LCD_HEIGHT - 2)) / _smParam.tableSize[CRD_Y];
 	k_scr = kx > ky ? ky : kx;
 	LCD_Clear(Black);
 #endif
@@ -97,9 +221,7 @@ void initGcodeProc(void)
 	memset(&linesBuffer, 0, sizeof(linesBuffer));
 
 #ifndef NO_ACCELERATION_CORRECTION
-	linesBuffer.mvectPtrCur = 0;
-	linesBuffer.mvector[0].isNullCmd = true;
-	linesBuffer.mvectCnt = 1;
+	plan_init();
 #endif
 
 #if (USE_LCD != 0)
@@ -125,13 +247,35 @@ void initGcodeProc(void)
 
 	gc_init();
 	stepm_init();
+	cnc_resetOverride();
 	commonTimeIdeal = commonTimeReal = 0;
 	isGcodeStop = false;
 	startWorkTime = Seconds();
 }
 
 //---------------------------------------------------------------------
-char cncFileBuf[16000];
+// The file is read by halves (fstream.h), the lines are parsed where they are
+char cncFileBuf[FSTREAM_SIZE] __attribute__((aligned(4)));
+
+#if (USE_SDCARD != 0)
+// The shown lines are going to be overwritten by the next half of the file
+static void cnc_keepShownLines(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_SHOW_GCODE_LINES; i++)
+	{
+		GCODE_CMD *gp = &linesBuffer.gcode[i];
+
+		if (gp->cmd >= cncFileBuf && gp->cmd < cncFileBuf + sizeof(cncFileBuf))
+		{
+			strncpy(gp->keep, gp->cmd, sizeof(gp->keep) - 1);
+			gp->keep[sizeof(gp->keep) - 1] = 0;
+			gp->cmd = gp->keep;
+		}
+	}
+}
+#endif
 
 #if (USE_KEYBOARD == 2)
 const TPKey_t TPPause	= TPKEY(  0, 220, 319, 239, 0, NULL);
@@ -141,10 +285,18 @@ const TPKey_t kbdGFileA	= TPKEY( 84, 220, 156, 239, KEY_A, "PAUSE");
 const TPKey_t kbdGFile0	= TPKEY(164, 220, 236, 239, KEY_0, "ON ENC");
 const TPKey_t kbdGFile1	= TPKEY(244, 220, 319, 239, KEY_1, "OFF ENC");
 #endif
+const TPKey_t kbdGFile2	= TPKEY(  0, 196,  52, 215, KEY_2, "F-");
+const TPKey_t kbdGFile3	= TPKEY( 60, 196, 112, 215, KEY_3, "F+");
+const TPKey_t kbdGFile5	= TPKEY(120, 196, 172, 215, KEY_5, "R-");
+const TPKey_t kbdGFile6	= TPKEY(180, 196, 232, 215, KEY_6, "R+");
 const TPKey_p kbdGFile[] = {
 	&TPPause,
 	&kbdGFileC,
 	&kbdGFileA,
+	&kbdGFile2,
+	&kbdGFile3,
+	&kbdGFile5,
+	&kbdGFile6,
 #if (USE_ENCODER == 1)
 	&kbdGFile0,
 	&kbdGFile1,
@@ -153,34 +305,71 @@ const TPKey_p kbdGFile[] = {
 };
 #endif
 
-void cnc_gfile(char *fileName, int mode)
+#if (USE_LCD != 0)
+static void cnc_showError(uint8_t st, int lineNum, const char *str)
 {
-	int n;
-	int lineNum;
-	uint8_t hasMoreLines;
-
-	initGcodeProc();
-
-#if (USE_SDCARD != 0)
-	FIL fid;
-	FRESULT res = f_open(&fid, fileName, FA_READ);
-	if (res != FR_OK)
+	scr_fontColor(Red, Black);
+	scr_gotoxy(1, 11);
+	switch (st)
 	{
-		win_showErrorWin();
-	#if   (USE_SDCARD == 1)
-		scr_printf("Error open file:'%s'\nStatus:%d [%d]", fileName, (int)res, SD_errno);
-	#elif (USE_SDCARD == 2)
-		scr_printf("Error open file:'%s'\nStatus:%d", fileName, (int)res);
-	#endif
-		return;
+	case GCSTATUS_BAD_NUMBER_FORMAT:
+		scr_puts("BAD_NUMBER_FORMAT");
+		break;
+	case GCSTATUS_EXPECTED_COMMAND_LETTER:
+		scr_puts("EXPECTED_COMMAND_LETTER");
+		break;
+	case GCSTATUS_UNSUPPORTED_STATEMENT:
+		scr_puts("UNSUPPORTED_STATEMENT");
+		break;
+	case GCSTATUS_FLOATING_POINT_ERROR:
+		scr_puts("FLOATING_POINT_ERROR");
+		break;
+	case GCSTATUS_UNSUPPORTED_PARAM:
+		scr_puts("UNSUPPORTED_PARAM");
+		break;
+	case GCSTATUS_UNSOPORTED_FEEDRATE:
+		scr_puts("GCSTATUS_UNSUPPORTED_FEEDRATE");
+		break;
+	case GCSTATUS_TABLE_SIZE_OVER_X:
+		scr_puts("GCSTATUS_TABLE_SIZE_OVER_X");
+		break;
+	case GCSTATUS_TABLE_SIZE_OVER_Y:
+		scr_puts("GCSTATUS_TABLE_SIZE_OVER_Y");
+		break;
+	case GCSTATUS_TABLE_SIZE_OVER_Z:
+		scr_puts("GCSTATUS_TABLE_SIZE_OVER_Z");
+		break;
+	case GCSTATUS_TOO_MANY_WORDS:
+		scr_puts("TOO_MANY_WORDS");
+		break;
+	case GCSTATUS_BAD_GBIN:
+		scr_puts("BAD_GBIN");
+		break;
+	case GCSTATUS_FILE_READ_ERROR:
+		scr_puts("FILE_READ_ERROR");
+		break;
+	case GCSTATUS_BAD_START_LINE:
+		scr_puts("BAD_START_LINE");
+		break;
+	case GCSTATUS_BAD_CYCLE:
+		scr_puts("BAD_CYCLE");
+		break;
+	case GCSTATUS_CANCELED:
+		scr_puts("GCSTATUS_CANCELED");
+		break;
 	}
+	scr_printf(" at line %d:\n %s", lineNum, str);
+}
+#else
+	#define cnc_showError(st, lineNum, str)
 #endif
-	curGCodeMode = mode;
 
+static void cnc_gfileScreen(void)
+{
 #if (USE_LCD != 0)
 	if ((curGCodeMode & GFILE_MODE_MASK_SHOW) != 0)
 	{
-		scr_Rectangle(crdXtoScr(0), crdYtoScr(MAX_TABLE_SIZE_Y), crdXtoScr(MAX_TABLE_SIZE_X), crdYtoScr(0), Red, false);
+		scr_Rectangle(crdXtoScr(0), crdYtoScr(_smParam.tableSize[CRD_Y]), crdXtoScr(_smParam.tableSize[CRD_X]), crdYtoScr(0), Red, false);
 		scr_Line(prev_scrX, 30, prev_scrX, 240 - 30, Green);
 		scr_Line(50, prev_scrY, 320 - 50, prev_scrY, Green);
 	}
@@ -191,122 +380,205 @@ void cnc_gfile(char *fileName, int mode)
 #if   (USE_KEYBOARD == 1)
 		scr_fontColor(Blue, Black);
 		scr_gotoxy(3, 14);
-		scr_puts("C-Cancel  A-Pause 0/1-encoder");
+		scr_puts("C-Cancel A-Pause 0/1-enc 2/3 F 5/6 R");
 #elif (USE_KEYBOARD == 2)
 		SetTouchKeys(kbdGFile);
 #endif
 	}
+}
 
-	lineNum = 1;
-	hasMoreLines = true;
-	do
+/*
+ * Start at the line: the lines before it are parsed without motion, here the state of the parser
+ * stays and the rest goes as at the start of the job (the tool is at the origin).
+ * The tool goes up to the top of the job, over the point of the line, the outputs are switched on
+ * and it goes down at the feed.
+ */
+bool cnc_restart(int mode, CNC_REAL safeZ)
+{
+	GC_MODAL m;
+	CNC_REAL x, y, z;
+
+	if (safeZ < maxZ)
+		safeZ = maxZ;
+	gc_getModal(&m);
+	x = m.position[CRD_X];
+	y = m.position[CRD_Y];
+	z = m.position[CRD_Z];
+	if (safeZ < z)
+		safeZ = z;
+	initGcodeProc();
+	gc_setModal(&m);
+	curGCodeMode = mode;
+	cnc_gfileScreen();
+
+	linesBuffer.stepsFromStartE = sm_mmToSteps(CRD_E, m.extruder_length);
+	if (safeZ > 0 && !cnc_line(0, 0, safeZ, m.extruder_length, safeZ, m.seek_rate, true))
+		return false;
+	if ((x != 0 || y != 0) && !cnc_line(x, y, safeZ, m.extruder_length, real_hypot(x, y), m.seek_rate, true))
+		return false;
+	if (m.outputs != 0 && !cnc_outputs(m.outputs))
+		return false;
+	return safeZ == z || cnc_line(x, y, z, m.extruder_length, safeZ - z, m.feed_rate, false);
+}
+
+#if (USE_SDCARD != 0)
+static uint8_t cnc_gbinFile(FIL *fid, int *blockNum);
+
+void cnc_gfile(char *fileName, int mode, int startLine)
+{
+	int lineNum;
+	uint8_t st = GCSTATUS_OK;
+
+	initGcodeProc();
+
+	FIL fid;
+	FRESULT res = f_open(&fid, fileName, FA_READ);
+	if (res != FR_OK)
 	{
-		char *p = cncFileBuf, *str;
+		win_showErrorWin();
+	#if   (USE_SDCARD == 1)
+		scr_printf("Error open file:'%s'\nStatus:%d [%d]", fileName, (int)res, SD_errno);
+	#elif (USE_SDCARD == 2)
+		scr_printf("Error open file:'%s'\nStatus:%d", fileName, (int)res);
+	#endif
+		return;
+	}
+	curGCodeMode = mode;
 
-		while (true)
+	lineNum = 1;
+	if (gbin_isFileName(fileName))
+	{
+		if (startLine > 1)	// the blocks have no lines: gbinc -s makes the job from the line
+			st = GCSTATUS_BAD_START_LINE;
+		else
 		{
-			*p = 0;
-			str = p + 1;
-			if ((cncFileBuf + sizeof(cncFileBuf) - str) < (MAX_STR_SIZE + 1))
-				break;
-#if (USE_SDCARD != 0)
-			if (f_gets(str, MAX_STR_SIZE, &fid) == NULL)
+			cnc_gfileScreen();
+			st = cnc_gbinFile(&fid, &lineNum);
+		}
+	}
+	else
+	{
+		char *p, *str = NULL, *bufEnd;
+		uint32_t len, tail = 0;	// bytes of the half, the line which goes on in the next one
+		uint32_t ofs = 0;		// of the first line
+		CNC_REAL safeZ = 0;
+		bool isIndex = false;
+
+		if (startLine > 1)
+		{	// the lines before the start are checked
+	#if (USE_SDCARD == 1)
+			GIDX_ENTRY e;
+
+			if (gidx_find(fileName, startLine, &e, &lineNum, &safeZ))
 			{
-				hasMoreLines = false;
-				break;
+				ofs = e.offset;
+				gc_setModal(&e.modal);
 			}
-#endif
-			str_trim(str);
-			*p = (uint8_t)strlen(str) + 1;
-			p += *p + 1;
+	#endif
+			curGCodeMode = GFILE_MODE_MASK_CHK;
 		}
-
-		for (p = cncFileBuf; !isGcodeStop && *p != 0; lineNum++, p += *p + 1)
+		else
 		{
-			uint8_t st;
+	#if (USE_SDCARD == 1)
+			if ((mode & GFILE_MODE_MASK_EXEC) == 0)
+				isIndex = gidx_create(fileName);
+	#endif
+			cnc_gfileScreen();
+		}
 
-			str = p + 1;
-			if ((curGCodeMode & GFILE_MODE_MASK_EXEC) != 0)
+		fstream_open(&fid, cncFileBuf, ofs, (mode & GFILE_MODE_MASK_EXEC) != 0);
+		while (!isGcodeStop && (str = fstream_next(str, tail, &len)) != NULL)
+		{
+			bufEnd = str + len;
+			for (; !isGcodeStop && str < bufEnd; lineNum++, str = p + 1)
 			{
-				int i;
-				GCODE_CMD *gp;
-
-				linesBuffer.gcodePtrCur++;
-				if (linesBuffer.gcodePtrCur > (MAX_SHOW_GCODE_LINES - 1))
-					linesBuffer.gcodePtrCur = 0;
-				gp = &linesBuffer.gcode[linesBuffer.gcodePtrCur];
-				strcpy(gp->cmd, str);
-				gp->lineNum = lineNum;
-#if (USE_LCD != 0) && (MAX_SHOW_GCODE_LINES > 0)
-				scr_fontColor(Green, Black);
-				//	if(stepm_getRemainLines() > 1) {
-				for (i = 0, n = linesBuffer.gcodePtrCur + 1; i < MAX_SHOW_GCODE_LINES; i++, n++)
-				{
-					if (n > (MAX_SHOW_GCODE_LINES - 1))
-						n = 0;
-					gp = &linesBuffer.gcode[n];
-					scr_gotoxy(1, i);
-					if (gp->lineNum)
-						scr_printf("%d:%s", gp->lineNum, gp->cmd);
-					scr_clrEndl();
+				p = memchr(str, '\n', bufEnd - str);
+				if (p == NULL)
+				{	// the line goes on in the next half, unless it's the end of the file or too long
+					if (!fstream_isLast() && bufEnd - str < FSTREAM_TAIL)
+						break;
+					p = bufEnd;
 				}
-				//	}
-#endif
-			}
-
-			DBG("\n   [gcode:%d] %s", lineNum, str);
-			st = gc_execute_line(str);
-			if (st != GCSTATUS_OK)
-			{
-#if (USE_LCD != 0)
-				scr_fontColor(Red, Black);
-				scr_gotoxy(1, 11);
-				switch (st)
+	#if (USE_SDCARD == 1)
+				if (isIndex && (lineNum - 1) % GIDX_STEP == 0)
+					gidx_add(fstream_tell(str));
+	#endif
+				if (lineNum == startLine && !cnc_restart(mode, safeZ))
 				{
-				case GCSTATUS_BAD_NUMBER_FORMAT:
-					scr_puts("BAD_NUMBER_FORMAT");
-					break;
-				case GCSTATUS_EXPECTED_COMMAND_LETTER:
-					scr_puts("EXPECTED_COMMAND_LETTER");
-					break;
-				case GCSTATUS_UNSUPPORTED_STATEMENT:
-					scr_puts("UNSUPPORTED_STATEMENT");
-					break;
-				case GCSTATUS_FLOATING_POINT_ERROR:
-					scr_puts("FLOATING_POINT_ERROR");
-					break;
-				case GCSTATUS_UNSUPPORTED_PARAM:
-					scr_puts("UNSUPPORTED_PARAM");
-					break;
-				case GCSTATUS_UNSOPORTED_FEEDRATE:
-					scr_puts("GCSTATUS_UNSUPPORTED_FEEDRATE");
-					break;
-				case GCSTATUS_TABLE_SIZE_OVER_X:
-					scr_puts("GCSTATUS_TABLE_SIZE_OVER_X");
-					break;
-				case GCSTATUS_TABLE_SIZE_OVER_Y:
-					scr_puts("GCSTATUS_TABLE_SIZE_OVER_Y");
-					break;
-				case GCSTATUS_TABLE_SIZE_OVER_Z:
-					scr_puts("GCSTATUS_TABLE_SIZE_OVER_Z");
-					break;
-				case GCSTATUS_CANCELED:
-					scr_puts("GCSTATUS_CANCELED");
+					st = GCSTATUS_CANCELED;
 					break;
 				}
-				scr_printf(" at line %d:\n %s", lineNum, str);
+				*p = 0;
+				if (p > str && p[-1] == '\r')
+					p[-1] = 0;
+				if ((curGCodeMode & GFILE_MODE_MASK_EXEC) != 0)
+				{
+#if (USE_LCD != 0) && (MAX_SHOW_GCODE_LINES > 0)
+					int i, n;
 #endif
-#if (USE_SDCARD != 0)
-				f_close(&fid);
+					GCODE_CMD *gp;
+
+					linesBuffer.gcodePtrCur++;
+					if (linesBuffer.gcodePtrCur > (MAX_SHOW_GCODE_LINES - 1))
+						linesBuffer.gcodePtrCur = 0;
+					gp = &linesBuffer.gcode[linesBuffer.gcodePtrCur];
+					gp->cmd = str;
+					gp->lineNum = lineNum;
+#if (USE_LCD != 0) && (MAX_SHOW_GCODE_LINES > 0)
+					scr_fontColor(Green, Black);
+					//	if(stepm_getRemainLines() > 1) {
+					for (i = 0, n = linesBuffer.gcodePtrCur + 1; i < MAX_SHOW_GCODE_LINES; i++, n++)
+					{
+						if (n > (MAX_SHOW_GCODE_LINES - 1))
+							n = 0;
+						gp = &linesBuffer.gcode[n];
+						scr_gotoxy(1, i);
+						if (gp->lineNum)
+							scr_printf("%d:%s", gp->lineNum, gp->cmd);
+						scr_clrEndl();
+					}
+					//	}
 #endif
-				return;
+				}
+
+				DBG("\n   [gcode:%d] %s", lineNum, str);
+				st = gc_execute_line(str);
+				if (st != GCSTATUS_OK)
+				{
+					cnc_showError(st, lineNum, str);
+					fstream_close();
+	#if (USE_SDCARD == 1)
+					if (isIndex)
+						gidx_close(maxZ);
+	#endif
+					f_close(&fid);
+					return;
+				}
+				fstream_poll();
 			}
+			// the rest of the half goes before the next one
+			cnc_keepShownLines();
+			tail = str < bufEnd ? bufEnd - str : 0;
 		}
-	} while (!isGcodeStop && hasMoreLines);
-
-#if (USE_SDCARD != 0)
+		if (fstreamStat.errors != 0)
+			st = GCSTATUS_FILE_READ_ERROR;
+		else if (st == GCSTATUS_OK && !isGcodeStop && startLine > 1 && startLine >= lineNum)
+			st = GCSTATUS_BAD_START_LINE;	// past the end: the job was checked only
+		fstream_close();
+	#if (USE_SDCARD == 1)
+		if (isIndex)
+			gidx_close(maxZ);
+	#endif
+	}
 	f_close(&fid);
-#endif
+	if (st != GCSTATUS_OK)
+	{
+		cnc_showError(st, lineNum, fileName);
+		return;
+	}
+
+	if (!cnc_flush())
+		return;
 
 	if ((curGCodeMode & GFILE_MODE_MASK_EXEC) == 0)
 	{
@@ -325,17 +597,12 @@ void cnc_gfile(char *fileName, int mode)
 			t2 / 3600, (t2 / 60) % 60, t2 % 60,
 			lineNum
 			);
-		scr_printf("\n X%f/%f Y%f/%f Z%f/%f", minX, maxX, minY, maxY, minZ, maxZ);
-#endif
-	}
-	else
-	{
-#ifndef NO_ACCELERATION_CORRECTION
-		cnc_line(0, 0, 0, 0, 0, 0);
-		cnc_line(0, 0, 0, 0, 0, 0);
+		scr_printf("\n X%f/%f Y%f/%f Z%f/%f",
+			real_toDouble(minX), real_toDouble(maxX), real_toDouble(minY), real_toDouble(maxY), real_toDouble(minZ), real_toDouble(maxZ));
 #endif
 	}
 }
+#endif
 
 uint16_t calcColor(uint8_t val)
 {
@@ -348,21 +615,78 @@ uint16_t calcColor(uint8_t val)
 	return 0x80F0;
 }
 
-void cnc_dwell(int pause)
-{
-	commonTimeIdeal += pause;
-	commonTimeReal += pause;
-}
 //=================================================================================================================================
 
 extern const char axisName[5];
 
-const double axisK[4] = {
-	SM_X_STEPS_PER_MM,
-	SM_Y_STEPS_PER_MM,
-	SM_Z_STEPS_PER_MM,
-	SM_E_STEPS_PER_MM
+#if (USE_KEYBOARD == 2)
+const TPKey_t TPPauseB	= TPKEY(  0, 220, 156, 239, KEY_B, "CONTINUE");
+const TPKey_t TPPauseC	= TPKEY(164, 220, 319, 239, KEY_C, "CANCEL");
+const TPKey_p kbdPause[] = {
+	&TPPause,
+	&TPPauseB,
+	&TPPauseC,
+	NULL
 };
+#endif
+
+#if (USE_KEYBOARD != 0)
+static void cnc_setOverride(int feed, int rapid)
+{
+	if (!isOvrEnabled)
+		return;
+	if (feed < SM_FEED_OVR_MIN) feed = SM_FEED_OVR_MIN;
+	if (feed > SM_FEED_OVR_MAX) feed = SM_FEED_OVR_MAX;
+	if (rapid < SM_RAPID_OVR_MIN) rapid = SM_RAPID_OVR_MIN;
+	if (rapid > 100) rapid = 100;
+	ovrFeed = (uint16_t)feed;
+	ovrRapid = (uint16_t)rapid;
+	cnc_applyOverride();
+}
+
+/*
+ * Feed hold: the motors brake and stop in the middle of the move, the queued moves stay.
+ * 'B' - cycle start from the same step, 'C' - cancel the job.
+ */
+static uint8_t cnc_feedHold(void)
+{
+	bool isCancel = false;
+	int key;
+	#if (USE_KEYBOARD == 2)
+	const TPKey_p * tp_save;
+	tp_save = SetTouchKeys(kbdPause);
+	#endif
+	#if (USE_KEYBOARD == 1)
+	scr_fontColor(Black, White);
+	scr_gotoxy(1, 13);
+	scr_puts(" PAUSE..'B'-continue 'C'-cancel");
+	scr_clrEndl();
+	#endif
+
+	stepm_feedHold();
+	do
+	{
+		key = kbd_getKey();
+	} while (key != KEY_B && key != KEY_C);
+	if (key == KEY_C)
+	{
+		stepm_EmergeStop();
+		isCancel = true;
+	}
+	else
+		stepm_cycleStart();
+
+	#if (USE_KEYBOARD == 1)
+	scr_fontColor(White, Black);
+	scr_gotoxy(1, 13);
+	scr_clrEndl();
+	#endif
+	#if (USE_KEYBOARD == 2)
+	SetTouchKeys(tp_save);
+	#endif
+	return !isCancel;
+}
+#endif
 
 uint8_t cnc_waitSMotorReady(void)
 {
@@ -377,27 +701,27 @@ uint8_t cnc_waitSMotorReady(void)
 
 	do
 	{
+#if (USE_SDCARD != 0)
+		fstream_poll();	// the next half of the job file goes on while the motors run
+#endif
 		if (stepm_getRemainLines() > 1)
 		{
 			scr_fontColor(Yellow, Black);
 			for (i = 0; i < STEPS_MOTORS; i++)
 			{
-				int32_t globalSteps = stepm_getCurGlobalStepsNum(i);
-				double n = (double)globalSteps / axisK[i];
 				scr_gotoxy(1 + i * 10, 3);
-				scr_printf("%c:%f ", axisName[i], n);
+				scr_printf("%c:%f ", axisName[i], real_toDouble(sm_stepsToMm(i, stepm_getCurGlobalStepsNum(i))));
 #if (USE_ENCODER == 1)
-				if (i == 2)
-				{
-					int32_t enVal = encoderZvalue();
-					double encValmm = (double)(enVal * MM_PER_360) / ENCODER_Z_CNT_PER_360;
-					scr_gotoxy(1 + 2 * 10, 4); scr_printf("errZ:%f  ", encValmm - n);
+				if (encoder_isPresent(i))
+				{	// following error: mm, steps now [max], steps added/removed
+					scr_gotoxy(1 + i * 10, 4);
+					scr_printf("e%c:%f ", axisName[i], real_toDouble(sm_stepsToMm(i, encoderStat[i].err)));
 					if (isEncoderCorrection)
 					{
-						scr_gotoxy(1, 6);
-						scr_printf("dZ:%d[%d]    ", encoderCorrectionDelta, encoderCorrectionMaxDelta);
-						scr_gotoxy(15, 6);
-						scr_printf("Up:%d Dn:%d  ", encoderCorrectionCntUp, encoderCorrectionCntDown);
+						scr_gotoxy(1 + i * 10, 6);
+						scr_printf("%d[%d] ", encoderStat[i].err, encoderStat[i].maxErr);
+						scr_gotoxy(1 + i * 10, 7);
+						scr_printf("+%d-%d ", encoderStat[i].corrUp, encoderStat[i].corrDown);
 					}
 				}
 #endif
@@ -416,6 +740,10 @@ uint8_t cnc_waitSMotorReady(void)
 				scr_gotoxy(30, 12);
 				scr_fontColor(Cyan, Black);
 				scr_printf("%02d:%02d:%02d", t / 3600, (t / 60) % 60, t % 60);
+#if (USE_SDCARD != 0)
+				scr_gotoxy(1, 12);	// the parser waited for the file, the motors were stopped
+				scr_printf("SD w:%d u:%d ", fstreamStat.waits, fstreamStat.underruns);
+#endif
 			}
 #endif
 		}
@@ -426,7 +754,23 @@ uint8_t cnc_waitSMotorReady(void)
 			stepm_EmergeStop();
 			return false;
 		case KEY_A:
-			isPause = true;
+			if (!cnc_feedHold())
+				return false;
+			break;
+		case KEY_2:
+			cnc_setOverride(ovrFeed - SM_FEED_OVR_STEP, ovrRapid);
+			break;
+		case KEY_3:
+			cnc_setOverride(ovrFeed + SM_FEED_OVR_STEP, ovrRapid);
+			break;
+		case KEY_4:
+			cnc_setOverride(100, 100);
+			break;
+		case KEY_5:	// rapid: 100, 50, 25
+			cnc_setOverride(ovrFeed, ovrRapid / 2);
+			break;
+		case KEY_6:
+			cnc_setOverride(ovrFeed, ovrRapid * 2);
 			break;
 		case KEY_0:
 #if (USE_ENCODER == 1)
@@ -434,6 +778,8 @@ uint8_t cnc_waitSMotorReady(void)
 #endif
 			scr_gotoxy(1, 6);
 			scr_clrEndl();
+			scr_gotoxy(1, 7);
+			scr_clrEndl();
 			break;
 		case KEY_1:
 #if (USE_ENCODER == 1)
@@ -465,21 +811,26 @@ uint8_t cnc_waitSMotorReady(void)
 #endif
 		return false;
 	}
+#if (USE_ENCODER == 1)
+	if (encoderAlarm != 0)
+	{	// the motion is stopped by the encoder loop
+		stepm_EmergeStop();
+	#if (USE_LCD != 0)
+		scr_fontColor(Red, Black);
+		scr_gotoxy(7, 11);
+		scr_puts("FOLLOWING ERROR ");
+		for (i = 0; i < ENCODER_AXES; i++)
+			if (encoderAlarm & (1 << i))
+				scr_printf("%c", axisName[i]);
+		scr_clrEndl();
+	#endif
+		return false;
+	}
+#endif
 	return true;
 }
 
-#if (USE_KEYBOARD == 2)
-const TPKey_t TPPauseB	= TPKEY(  0, 220, 156, 239, KEY_B, "CONTINUE");
-const TPKey_t TPPauseC	= TPKEY(164, 220, 319, 239, KEY_C, "CANCEL");
-const TPKey_p kbdPause[] = {
-	&TPPause,
-	&TPPauseB,
-	&TPPauseC,
-	NULL
-};
-#endif
-
-uint8_t sendLine(uint32_t fxyze[], uint32_t abs_dxyze[], uint8_t dir_xyze[])
+uint8_t sendLine(uint32_t fxyze[], uint32_t abs_dxyze[], uint8_t dir_xyze[], const STEPM_RAMP *ramp, const STEPM_ARC *arc)
 {
 	uint32_t f = 0;
 	uint32_t i, n = 0;
@@ -514,27 +865,35 @@ uint8_t sendLine(uint32_t fxyze[], uint32_t abs_dxyze[], uint8_t dir_xyze[])
 
 		if ((curGCodeMode & GFILE_MODE_MASK_SHOW) != 0)
 		{
-			if (dir_xyze[0])	linesBuffer.stepsX += abs_dxyze[0];
-			else				linesBuffer.stepsX -= abs_dxyze[0];
+			int32_t d[3];
+			for (i = 0; i < 3; i++)
+			{	// the backlash takeup is not drawn
+				d[i] = abs_dxyze[i];
+				if (ramp != NULL && (ramp->backlash & (1 << i)) != 0)
+					d[i] -= _smParam.backlash[i];
+			}
+
+			if (dir_xyze[0])	linesBuffer.stepsX += d[0];
+			else				linesBuffer.stepsX -= d[0];
 
-			if (dir_xyze[1])	linesBuffer.stepsY += abs_dxyze[1];
-			else				linesBuffer.stepsY -= abs_dxyze[1];
+			if (dir_xyze[1])	linesBuffer.stepsY += d[1];
+			else				linesBuffer.stepsY -= d[1];
 
-			if (dir_xyze[2])	linesBuffer.stepsZ += abs_dxyze[2];
-			else				linesBuffer.stepsZ -= abs_dxyze[2];
+			if (dir_xyze[2])	linesBuffer.stepsZ += d[2];
+			else				linesBuffer.stepsZ -= d[2];
 
 #if (USE_LCD != 0)
 			double x, y;
 			short scrX, scrY;
 
-			x = (double)linesBuffer.stepsX / SM_X_STEPS_PER_MM;
-			y = (double)linesBuffer.stepsY / SM_Y_STEPS_PER_MM;
+			x = real_toDouble(sm_stepsToMm(CRD_X, linesBuffer.stepsX));
+			y = real_toDouble(sm_stepsToMm(CRD_Y, linesBuffer.stepsY));
 
 			scrX = crdXtoScr(TABLE_CENTER_X + x);
 			scrY = crdYtoScr(TABLE_CENTER_Y + y);
 
 			if (scrX != prev_scrX || prev_scrY != scrY)
-				scr_Line(prev_scrX, prev_scrY, scrX, scrY, calcColor((uint8_t)(linesBuffer.stepsZ * 5 / SM_X_STEPS_PER_MM) & 0x1F));
+				scr_Line(prev_scrX, prev_scrY, scrX, scrY, calcColor((uint8_t)real_toInt(sm_stepsToMm(CRD_Z, linesBuffer.stepsZ * 5)) & 0x1F));
 			prev_scrX = scrX;
 			prev_scrY = scrY;
 #endif
@@ -571,7 +930,7 @@ uint8_t sendLine(uint32_t fxyze[], uint32_t abs_dxyze[], uint8_t dir_xyze[])
 			{
 				DBG(" !!!!!! <%d:%d/%d too hight feedrate!> ", i, fxyze[i], _smParam.maxFeedRate[i]);
 			}
-			if (fxyze[i] < (50 * SM_X_STEPS_PER_MM / 60) && abs_dxyze[i] > 120)
+			if (fxyze[i] < sm_mmToSteps(i, REAL_C(50)) / 60 && abs_dxyze[i] > 120)
 			{
 				DBG(" !!!!!! <%d:%d too slow feedrate!> ", i, fxyze[i]);
 			}
@@ -587,579 +946,418 @@ uint8_t sendLine(uint32_t fxyze[], uint32_t abs_dxyze[], uint8_t dir_xyze[])
 	if (!cnc_waitSMotorReady())
 		return false;
 
-	if (isPause)
-	{
-#if (USE_KEYBOARD != 0)
-	#if (USE_KEYBOARD == 2)
-		const TPKey_p * tp_save;
-		tp_save = SetTouchKeys(kbdPause);
-	#endif
-	#if (USE_KEYBOARD == 1)
-		scr_fontColor(Black, White);
-		scr_gotoxy(1, 13);
-		scr_puts(" PAUSE..'B'-continue 'C'-cancel");
-		scr_clrEndl();
-	#endif
-		while (stepm_inProc()) { }
-		stepm_EmergeStop();
-
-		while (isPause)
-		{
-			switch (kbd_getKey())
-			{
-			case KEY_C:
-				isPause = false;
-	#if (USE_KEYBOARD == 2)
-				SetTouchKeys(tp_save);
-	#endif
-				return false;
-			case KEY_B:
-				isPause = false;
-			}
-		}
+	if (arc != NULL)
+		stepm_addArc(arc, ramp);
+	else if (ramp != NULL)
+		stepm_addRamp(abs_dxyze, dir_xyze, ramp);
+	else
+		stepm_addMove(abs_dxyze, fxyze, dir_xyze);
+	return true;
+}
 
-	#if (USE_KEYBOARD == 1)
-		scr_fontColor(White, Black);
-		scr_gotoxy(1, 13);
-		scr_clrEndl();
-	#endif
-	#if (USE_KEYBOARD == 2)
-		SetTouchKeys(tp_save);
-	#endif
-#endif
-	}
-	stepm_addMove(abs_dxyze, fxyze, dir_xyze);
+// Command of the step engine, the job check skips it
+static uint8_t sendCmd(uint8_t cmd, uint32_t value)
+{
+	if ((curGCodeMode & GFILE_MODE_MASK_EXEC) == 0)
+		return true;
+	if (!cnc_waitSMotorReady())
+		return false;
+	stepm_addCmd(cmd, value);
 	return true;
 }
 
 #ifndef NO_ACCELERATION_CORRECTION
-static __INLINE int8_t findInAccelerationCrd(MVECTOR *p, MVECTOR *p_in, int32_t *smothdF, int32_t *frqStart)
+/*
+ * Time of the S-shaped speed change by dv (mm/sec).
+ * Speed follows 3t^2-2t^3, so the peak acceleration is 1.5*dv/T (the mean one is dv/T)
+ * and the peak jerk is 6*dv/T^2. The acceleration of sm.conf is the peak one.
+ */
+static CNC_REAL cnc_rampTime(CNC_REAL dv, CNC_REAL acceleration, CNC_REAL jerk)
 {
-	int8_t crd = -1;
-	int32_t  i, j, df[3], step_df[3], frq_in[3], dt[3], max_time = 0;
+	CNC_REAL t = real_div(dv + dv / 2, acceleration);
+	if (jerk > 0 && real_mul(real_mul(t, t), jerk) < 6 * dv)
+		t = real_sqrt(real_div(6 * dv, jerk));
+	return t;
+}
 
-	for (i = 0; i < 3; i++)
-	{
-		frq_in[i] = p->changeDir ? 0 : p_in->frq[i];
-		if (p->frq[i] != 0) df[i] = labs((int32_t)frq_in[i] - (int32_t)p->frq[i]);
+// Path length of acceleration from v0 to the peak speed and deceleration to v1
+static CNC_REAL cnc_rampsLength(CNC_REAL v0, CNC_REAL peak, CNC_REAL v1, CNC_REAL acceleration, CNC_REAL jerk)
+{
+	return real_mul((v0 + peak) / 2, cnc_rampTime(peak - v0, acceleration, jerk))
+		+ real_mul((peak + v1) / 2, cnc_rampTime(peak - v1, acceleration, jerk));
+}
+
+/*
+ * Send the oldest planned block to the step motors as one move with jerk limited
+ * acceleration from the entry speed, cruise and deceleration to the entry speed of the next block.
+ * The step engine follows the profile by itself (see stepm_addRamp).
+ */
+static bool cnc_execBlock(void)
+{
+	PLAN_BLOCK *b = plan_getBlock();
+	uint32_t fxyze[CRDS_SIZE];
+	STEPM_RAMP ramp;
+	CNC_REAL v0, v1, peak, lo, hi, min_speed, jerk, t_acc, t_dec, d_acc, d_dec, t;
+	uint32_t n, ticks;
+	int i;
+
+	if (isOvrChanged)
+	{	// replan the queue with the new override
+		isOvrChanged = false;
+		plan_setOverride(isOvrEnabled ? ovrFeed : 100, isOvrEnabled ? ovrRapid : 100);
 	}
-	for (i = 0; i < 3; i++)
+	if (b == NULL)
+		return true;
+	if (b->cmd != STEPM_CMD_MOVE)
 	{
-		if (p->frq[i] == 0 || df[i] < _smParam.smoothStartF_from0[i])
+		if (!sendCmd(b->cmd, b->value))
+			return false;
+		plan_discardBlock();
+		return true;
+	}
+
+	min_speed = real_sqrt(b->min_speed_sqr);
+	v0 = real_sqrt(b->entry_speed_sqr);
+	v1 = real_sqrt(plan_getExitSpeedSqr());
+	if (v0 < min_speed) v0 = min_speed;
+	if (v1 < min_speed) v1 = min_speed;
+	peak = real_sqrt(b->nominal_speed_sqr);
+	if (peak < v0) peak = v0;
+	if (peak < v1) peak = v1;
+
+	// The planner guarantees the ramps fit with the mean acceleration, the jerk limit may need more length
+	jerk = b->jerk;
+	lo = v0 > v1 ? v0 : v1;
+	if (cnc_rampsLength(v0, lo, v1, b->acceleration, jerk) > b->millimeters)
+		jerk = 0;
+	if (cnc_rampsLength(v0, peak, v1, b->acceleration, jerk) > b->millimeters)
+	{	// nominal speed is not reachable, find the peak speed
+		hi = peak;
+		for (i = 0; i < 20; i++)
 		{
-			dt[i] = 0;
-			continue;
-		} // движения по координате - нет. значит торможение ускорение отсутвует.
-		step_df[i] = _smParam.smoothAF[i];
-		dt[i] = df[i] / step_df[i]; // время необходимое на изменение скорости
-		for (j = 0; j < 3; j++)
-		{ // коррекция ускорения с учетом остальных осей.
-			int32_t f;
-			if (i == j || p->steps[j] == 0) continue;
-			f = (int32_t)((int64_t)step_df[i] * (int64_t)p->steps[j] / p->steps[i]);
-			if (f >(_smParam.smoothAF[j] * 3 / 2))
-			{
-				dt[i] = 0;
-				//step_df[i] = step_df[i]*_smParam.smoothAF[j]/f;
-			}
+			peak = (lo + hi) / 2;
+			if (cnc_rampsLength(v0, peak, v1, b->acceleration, jerk) > b->millimeters)
+				hi = peak;
+			else
+				lo = peak;
 		}
+		peak = lo;
 	}
-	for (i = 0; i < 3; i++)
+	t_acc = cnc_rampTime(peak - v0, b->acceleration, jerk);
+	t_dec = cnc_rampTime(peak - v1, b->acceleration, jerk);
+	d_acc = real_mul((v0 + peak) / 2, t_acc);
+	d_dec = real_mul((peak + v1) / 2, t_dec);
+	t = t_acc + t_dec;
+	if (b->millimeters > d_acc + d_dec)
+		t += real_div(b->millimeters - d_acc - d_dec, peak);
+
+	// Frequency of the main axis: speed / length * steps (of the path for arcs)
+	n = b->step_event_count;
+	ramp.fEntry = real_mulDivRound(real_div(v0, b->millimeters), n * K_FRQ, 1);
+	ramp.fPeak = real_mulDivRound(real_div(peak, b->millimeters), n * K_FRQ, 1);
+	ramp.fExit = real_mulDivRound(real_div(v1, b->millimeters), n * K_FRQ, 1);
+	ticks = real_mulDivRound(t_acc, STEPM_RAMP_FRQ, 1);
+	ramp.tAcc = ticks > 0xffff ? 0xffff : (uint16_t)ticks;
+	ramp.decelSteps = 0;
+	if (t_dec >= REAL_C(1.0 / STEPM_RAMP_FRQ))
 	{
-		if (max_time < dt[i])
-		{
-			crd = (int8_t)i;
-			max_time = dt[i];
-		} // ищем ось с максимальным временем ускорения      
+		ramp.decelSteps = real_mulDivRound(real_div(d_dec, b->millimeters), n, 1);
+		if (ramp.decelSteps == 0)
+			ramp.decelSteps = 1;
 	}
-	// если разница в скоростях меньше той, при которой можно стартовать с 0 и не было коррекций
-	if (crd >= 0 && df[crd] < _smParam.smoothStartF_from0[crd] && step_df[crd] == _smParam.smoothAF[crd])
-		return -1;
-	*smothdF = frq_in[crd] < (int32_t)p->frq[crd] ? step_df[crd] : -step_df[crd];
-	*frqStart = frq_in[crd];
-	return crd;
+	// feed hold: speed which is safe to stop from, acceleration per ramp tick
+	ramp.fStop = real_mulDivRound(real_div(min_speed, b->millimeters), n * K_FRQ, 1);
+	ramp.accel = real_mulDivRound(real_div(b->acceleration, b->millimeters), n * K_FRQ, STEPM_RAMP_FRQ);
+	// the engine slows the move down if the override goes lower while it's in the queue
+	ramp.ovr = b->ovr;
+	ramp.isRapid = b->isRapid;
+	ramp.backlash = b->backlash;
+
+	// average frequencies: for the job time estimation
+	t = real_div(REAL_ONE, t);
+	for (i = 0; i < CRDS_SIZE; i++)
+		fxyze[i] = real_mulDivRound(t, b->steps[i] * K_FRQ, 1);
+	if (!sendLine(fxyze, b->steps, b->dir, &ramp, b->isArc ? &b->arc : NULL))
+		return false;
+	plan_discardBlock();
+	return true;
 }
 
-static __INLINE int8_t findOutAccelerationCrd(MVECTOR *p, MVECTOR *p_out, int32_t *smothdF, int32_t *frqStop)
+static bool cnc_planLine(int32_t steps[], CNC_REAL moveLength, CNC_REAL feed_rate, bool isRapid)
 {
-	int8_t crd = -1;
-	int32_t i, j, df[3], frq_out[3], step_df[3], max_time = 0, dt[3];
+#if (USE_GBIN_WRITER == 1)
+	return gbin_putLine(steps, moveLength, feed_rate, isRapid);
+#else
+	while (plan_isFull())	// a line may take two blocks
+		if (!cnc_execBlock())
+			return false;
+	plan_bufferLine(steps, moveLength, feed_rate, isRapid);
+	return true;
+#endif
+}
+
+// Millimeters of the steps, XYZ in v[0..2]
+static CNC_REAL cnc_stepsToMm(const int32_t steps[CRDS_SIZE], CNC_REAL v[3])
+{
+	int i;
 
-	// разница в скоростях
 	for (i = 0; i < 3; i++)
-	{
-		frq_out[i] = p_out->changeDir ? 0 : p_out->frq[i];
-		df[i] = labs((int32_t)p->frq[i] - frq_out[i]);
-	}
+		v[i] = sm_stepsToMm(i, steps[i]);
+	return real_hypot3(v[0], v[1], v[2]);
+}
+
+// All ends of the waiting moves are on the line from the start to pt within SM_PATH_TOLERANCE_MM
+// and go along it in order
+static bool cnc_pathIsLine(const MSEGMENT *p, const int32_t pt[CRDS_SIZE])
+{
+	CNC_REAL u[3], w[3], len, t, prevT = 0;
+	int i, k;
+
+	len = cnc_stepsToMm(pt, u);
+	if (len == 0)
+		return false;
 	for (i = 0; i < 3; i++)
+		u[i] = real_div(u[i], len);
+	for (k = 0; k < p->n; k++)
 	{
-		// движения по координате - нет. значит торможение ускорение отсутвует
-		// и так же запрешено ускорение выше скорости, указанной для отрезка
-		if (p->frq[i] == 0 || frq_out[i] >(int32_t)p->frq[i]) { dt[i] = 0; continue; }
-		step_df[i] = _smParam.smoothAF[i];
-		dt[i] = df[i] / step_df[i]; // время (msec) необходимое на изменение скорости
-		for (j = 0; j < 3; j++) { // коррекция ускорения с учетом остальных осей.
-			int32_t f;
-			if (i == j || p->steps[j] == 0) continue;
-			f = (int32_t)((int64_t)step_df[i] * (int64_t)p->steps[j] / p->steps[i]);
-			if (f >(_smParam.smoothAF[j] * 3 / 2)) {
-				dt[i] = 0;
-				//    step_df[i] = step_df[i]*_smParam.smoothAF[j]/f;
-			}
-		}
-	}
-	for (i = 0; i < 3; i++) {
-		if (max_time < dt[i]) { crd = (int8_t)i; max_time = dt[i]; } // ищем ось с максимальным временем ускорения      
+		cnc_stepsToMm(p->pts[k], w);
+		t = real_mul(w[0], u[0]) + real_mul(w[1], u[1]) + real_mul(w[2], u[2]);
+		if (t < prevT || t > len)
+			return false;
+		if (real_hypot3(w[0] - real_mul(t, u[0]), w[1] - real_mul(t, u[1]), w[2] - real_mul(t, u[2])) > REAL_C(SM_PATH_TOLERANCE_MM))
+			return false;
+		prevT = t;
 	}
-	if (crd >= 0 && df[crd] < _smParam.smoothStopF_to0[crd] && step_df[crd] == _smParam.smoothAF[crd]) return -1; // если разница в скоростях меньше той, при которой можно старотовать с 0
-	*smothdF = frq_out[crd] < (int32_t)p->frq[crd] ? step_df[crd] : -step_df[crd];
-	*frqStop = frq_out[crd];
-	return crd;
+	return true;
 }
 
-// интегрировние числовое, что бы проверить если ли возможность затормозить на коротких отрезках
-static __INLINE int32_t chk_Speed(int32_t i, uint32_t fxyze[], uint32_t abs_dxyze[])
+// The waiting moves go to the planner as one line
+static bool cnc_pathFlush(void)
 {
-	if (fxyze[i] > (uint32_t)_smParam.smoothStopF_to0[i])
-	{
-		uint32_t dv = _smParam.smoothAF[i];
-		uint32_t v = dv, s = 0, max_s = abs_dxyze[i] / 3 * 2;
-		do
-		{
-			s += v*SM_SMOOTH_TFEED / 1000 / K_FRQ, v += _smParam.smoothAF[i];
-		} while (s < max_s);
-		if (v < fxyze[i])
-			return abs_dxyze[i] * 1000L * K_FRQ / (v - dv) + 1;
-	}
-	return -1;
+	MSEGMENT *p = &linesBuffer.segment;
+	int32_t *end;
+	CNC_REAL v[3];
+
+	if (p->n == 0)
+		return true;
+	end = p->pts[p->n - 1];
+	p->n = 0;
+	DBG("\n-> path dx:%d dy:%d dz:%d", end[CRD_X], end[CRD_Y], end[CRD_Z]);
+	return cnc_planLine(end, cnc_stepsToMm(end, v), p->feed_rate, p->isRapid);
 }
-#endif
 
-bool smothLine(
+// The move goes to the path stage: it is combined with the next ones or the waiting ones go first
+static bool cnc_pathLine(
 	int32_t dx, int32_t dy, int32_t dz, int32_t de,
-	int32_t time_msec,
-	double moveLength, uint32_t feed_rate
+	CNC_REAL feed_rate, bool isRapid
 	)
 {
-	uint32_t abs_dxyze[4];
-	uint32_t fxyze[4];
-	uint8_t dir_xyze[4];
-	int32_t n;
-#ifndef NO_ACCELERATION_CORRECTION
-	MVECTOR *p_next, *p_cur, *p_prev;
-	int32_t i;
-#endif
+	MSEGMENT *p = &linesBuffer.segment;
+	int32_t d[CRDS_SIZE] = { dx, dy, dz, de }, pt[CRDS_SIZE], *last;
+	CNC_REAL v[3];
+	int i;
 
-	abs_dxyze[CRD_X] = labs(dx);
-	abs_dxyze[CRD_Y] = labs(dy);
-	abs_dxyze[CRD_Z] = labs(dz);
-	abs_dxyze[CRD_E] = labs(de);
-	dir_xyze[CRD_X] = dx > 0;
-	dir_xyze[CRD_Y] = dy > 0;
-	dir_xyze[CRD_Z] = dz > 0;
-	dir_xyze[CRD_E] = de > 0;
-#if (USE_DEBUG_MODE == 1)
+	DBG("\n-> orig.line dx:%d dy:%d dz:%d", dx, dy, dz);
+	if (p->n != 0)
 	{
-		DBG("\n[%d]-> orig.line dx:%d dy:%d dz:%d", linesBuffer.mvectCnt, dx, dy, dz);
-		if (linesBuffer.mvectCnt == 405)
-		{
-			delayMs(100);
-		}
-	}
-#endif
-	while (time_msec > 0)
-	{
-		DBG(" T:%d", time_msec);
-		fxyze[CRD_Z] = abs_dxyze[CRD_Z] * 1000L * K_FRQ / time_msec;
-		if (fxyze[CRD_Z] > _smParam.maxFeedRate[CRD_Z])
-		{
-			DBG(" cZ");
-			time_msec = (uint64_t)abs_dxyze[CRD_Z] * (1000L * K_FRQ) / _smParam.maxFeedRate[CRD_Z] + 1;
-			continue;
-		}
-		if ((n = chk_Speed(CRD_Z, fxyze, abs_dxyze)) > 0)
-		{
-			DBG(" bZ");
-			time_msec = n;
-			continue;
-		}
-
-		fxyze[CRD_Y] = abs_dxyze[CRD_Y] * 1000L * K_FRQ / time_msec;
-		if (fxyze[CRD_Y] > _smParam.maxFeedRate[CRD_Y])
-		{
-			DBG(" cY");
-			time_msec = (uint64_t)abs_dxyze[CRD_Y] * (1000L * K_FRQ) / _smParam.maxFeedRate[CRD_Y] + 1;
-			continue;
-		}
-		if ((n = chk_Speed(CRD_Y, fxyze, abs_dxyze)) > 0)
-		{
-			DBG(" bY");
-			time_msec = n; continue;
-		}
-
-		fxyze[CRD_X] = (uint64_t)abs_dxyze[CRD_X] * (1000L * K_FRQ) / time_msec;
-		if (fxyze[CRD_X] > _smParam.maxFeedRate[CRD_X])
-		{
-			DBG(" cX");
-			time_msec = (uint64_t)abs_dxyze[CRD_X] * (1000L * K_FRQ) / _smParam.maxFeedRate[CRD_X] + 1;
-			continue;
+		// CAM programs (ArtCam) break long sections into small ones retaining speed:
+		// combining these portions into one.
+		last = p->pts[p->n - 1];
+		for (i = 0; i < CRDS_SIZE; i++)
+			pt[i] = last[i] + d[i];
+		if (cnc_stepsToMm(last, v) < REAL_C(SM_TOO_SHORT_SEGMENT_MM))
+		{	// too short to be planned alone: it's the start of this move
+			memcpy(p->pts[0], pt, sizeof(pt));
+			p->n = 1;
+			p->feed_rate = feed_rate;
+			p->isRapid = isRapid;
+			return true;
 		}
-		if ((n = chk_Speed(CRD_X, fxyze, abs_dxyze)) > 0)
+		if (p->feed_rate == feed_rate && p->isRapid == isRapid && p->n < SM_PATH_WINDOW && cnc_pathIsLine(p, pt))
 		{
-			DBG(" bX");
-			time_msec = n;
-			continue;
+			memcpy(p->pts[p->n++], pt, sizeof(pt));
+			DBG("\nSUM vectors");
+			return true;
 		}
-
-		fxyze[CRD_E] = (uint64_t)abs_dxyze[CRD_E] * (1000L * K_FRQ) / time_msec;
-		break;
+		if (!cnc_pathFlush())
+			return false;
 	}
-	DBG(" ->T%d", time_msec);
+	memcpy(p->pts[0], d, sizeof(d));
+	p->n = 1;
+	p->feed_rate = feed_rate;
+	p->isRapid = isRapid;
+	return true;
+}
+#endif
 
 #ifdef NO_ACCELERATION_CORRECTION
-	return sendLine(fxyze, abs_dxyze, dir_xyze);
-#else
-	linesBuffer.mvectPtrCur++;
-	if (linesBuffer.mvectPtrCur >= MVECTOR_SZ)
-		linesBuffer.mvectPtrCur = 0;
-	//-------------------
-	p_next = &linesBuffer.mvector[n = linesBuffer.mvectPtrCur];
-	if ((--n) < 0)
-		n = MVECTOR_SZ - 1;
-	p_cur = &linesBuffer.mvector[n];
-	if ((--n) < 0)
-		n = MVECTOR_SZ - 1;
-	p_prev = &linesBuffer.mvector[n];
-	//------------------
-
-	if (time_msec == 0)
+bool smothLine(
+	int32_t dx, int32_t dy, int32_t dz, int32_t de,
+	CNC_REAL moveLength, CNC_REAL feed_rate
+	)
+{
+	uint32_t abs_dxyze[CRDS_SIZE], fxyze[CRDS_SIZE];
+	uint8_t dir_xyze[CRDS_SIZE];
+	int32_t d[CRDS_SIZE] = { dx, dy, dz, de };
+	uint32_t time_msec = real_mulDivRound(real_div(moveLength, feed_rate), 60000, 1) + 1;
+	int i;
+
+	for (i = 0; i < CRDS_SIZE; i++)
 	{
-		for (i = 0; i < 4; i++)
-		{
-			p_next->frq[i] = 0;
-			p_next->steps[i] = 0;
-		}
-		p_next->isNullCmd = true;
+		abs_dxyze[i] = labs(d[i]);
+		dir_xyze[i] = d[i] > 0;
 	}
-	else
+	for (i = 0; i < 3; i++)
 	{
-		// ArtCam breaks long sections into small retaining speed!
-		// Combining these portions into one.
-		if (p_cur->feed_rate == feed_rate)
-		{
-			for (i = n = 0; i < 3; i++)
-			{
-				if (p_cur->steps[i] == 0 && abs_dxyze[i] == 0)
-					n++;
-				else if (p_cur->dir[i] != dir_xyze[i])
-					n += 10;
-			}
-			if (n == 2)
-			{
-				for (i = n = 0; i < 4; i++)
-					p_cur->steps[i] += abs_dxyze[i];
-				if (p_cur->frq[0] < fxyze[0] || p_cur->frq[1] < fxyze[1] || p_cur->frq[2] < fxyze[2])
-				{
-					for (i = n = 0; i < 4; i++)
-						p_cur->frq[i] = fxyze[i];
-				}
-				p_cur->length += moveLength;
-				p_cur->isNullCmd = false;
-				linesBuffer.mvectPtrCur--;
-				if (linesBuffer.mvectPtrCur < 0)
-					linesBuffer.mvectPtrCur = MVECTOR_SZ - 1;
-				DBG("\nSUM vectors"); return true;
-			}
-		}
-		p_next->isNullCmd = false;
-		p_next->length = moveLength;
-		p_next->feed_rate = feed_rate;
-		for (i = 0; i < 4; i++)
-		{
-			p_next->steps[i] = abs_dxyze[i];
-			p_next->frq[i] = fxyze[i];
-			p_next->dir[i] = dir_xyze[i];
-		}
+		if ((uint64_t)abs_dxyze[i] * (1000L * K_FRQ) / time_msec > _smParam.maxFeedRate[i])
+			time_msec = (uint64_t)abs_dxyze[i] * (1000L * K_FRQ) / _smParam.maxFeedRate[i] + 1;
 	}
-	if (linesBuffer.mvectCnt > 1)
+	for (i = 0; i < CRDS_SIZE; i++)
+		fxyze[i] = (uint64_t)abs_dxyze[i] * (1000L * K_FRQ) / time_msec;
+	return sendLine(fxyze, abs_dxyze, dir_xyze, NULL, NULL);
+}
+#endif
+
+/*
+ * Execute all moves waiting in the planner, the machine stops at the end.
+ */
+uint8_t cnc_flush(void)
+{
+#ifndef NO_ACCELERATION_CORRECTION
+	if (!cnc_pathFlush())
+		return false;
+	while (!plan_isEmpty())
 	{
-		p_next->cos_a = 0;
-		if (!p_cur->isNullCmd)
-		{
-			p_next->changeDir = false;
-			for (i = 0; !p_next->changeDir && i < 3; i++)
-			{
-				if (p_next->dir[i] != p_cur->dir[i]
-					|| (p_next->steps[i] == 0 && p_cur->steps[i] != 0)
-					|| (p_next->steps[i] != 0 && p_cur->steps[i] == 0)
-					)
-					p_next->changeDir = true;
-			}
-			p_next->cos_a = 0;
-			if (!p_next->changeDir)
-			{
-				// Integer calculations only if the movement is less than the steps fit in 32 bits
-				const uint32_t k[3] = { SM_X_STEPS_PER_MM, SM_Y_STEPS_PER_MM, SM_Z_STEPS_PER_MM };
-				for (i = 0; i < 3; i++)
-				{
-					int32_t v = (int32_t)((uint32_t)p_next->steps[i] * 1000L / (uint32_t)(p_next->length * k[i]))
-						* (int32_t)((uint32_t)p_cur->steps[i] * 1000L / (uint32_t)(p_cur->length * k[i]));
-					if (p_next->dir[i] == p_cur->dir[i])
-						p_next->cos_a += v;
-					else
-						p_next->cos_a -= v;
-				}
-				if (p_next->cos_a < SM_SMOOTH_COS_A)
-					p_next->changeDir = true;
-			}
-		}
-		else
-			p_next->changeDir = true;
+		if (!cnc_execBlock())
+			return false;
 	}
-	linesBuffer.mvectCnt++;
-	if (linesBuffer.mvectCnt < 3 || p_cur->isNullCmd)
-		return true;
-	//------------------
-#if (USE_DEBUG_MODE == 1)
-	DBG("\nl.prev dx:%c%d(%d)\tdy:%c%d(%d)\tdz:%c%d(%d)", p_prev->dir[0] ? '+' : '-', p_prev->steps[0], p_prev->frq[0],
-		p_prev->dir[1] ? '+' : '-', p_prev->steps[1], p_prev->frq[1],
-		p_prev->dir[2] ? '+' : '-', p_prev->steps[2], p_prev->frq[2]);
-	DBG("\nl.cur dx:%c%d(%d)\tdy:%c%d(%d)\tdz:%c%d(%d) cos_a:%f", p_cur->dir[0] ? '+' : '-', p_cur->steps[0], p_cur->frq[0],
-		p_cur->dir[1] ? '+' : '-', p_cur->steps[1], p_cur->frq[1],
-		p_cur->dir[2] ? '+' : '-', p_cur->steps[2], p_cur->frq[2], p_cur->cos_a / 1000000.0);
-	DBG("\nl.next dx:%c%d(%d)\tdy:%c%d(%d)\tdz:%c%d(%d) cos_a:%f", p_next->dir[0] ? '+' : '-', p_next->steps[0], p_next->frq[0],
-		p_next->dir[1] ? '+' : '-', p_next->steps[1], p_next->frq[1],
-		p_next->dir[2] ? '+' : '-', p_next->steps[2], p_next->frq[2], p_next->cos_a / 1000000.0);
 #endif
-	// Search coordinate where necessary braking or acceleration
-	int8_t crd_in, crd_out;
-	bool has_max_frq = true;
-	int32_t df_in = 0, df_out = 0, frq_in = 0, frq_out = 0, frq;
+	return true;
+}
 
-	crd_in = findInAccelerationCrd(p_cur, p_prev, &df_in, &frq_in);
-	crd_out = findOutAccelerationCrd(p_cur, p_next, &df_out, &frq_out);
+// The moves before the command go first, the planner keeps the moves after it
+static uint8_t cnc_planCmd(uint8_t cmd, uint32_t value)
+{
+#ifdef NO_ACCELERATION_CORRECTION
+	return sendCmd(cmd, value);
+#else
+	if (!cnc_pathFlush())
+		return false;
+#if (USE_GBIN_WRITER == 1)
+	return gbin_putCmd(cmd, value);
+#else
+	while (plan_isFull())	// a line may take two blocks
+		if (!cnc_execBlock())
+			return false;
+	plan_bufferCmd(cmd, value);
+	return true;
+#endif
+#endif
+}
 
-	DBG("\ncrd_in:%d df_in:%d frq_in:%d  crd_out:%d df_out:%d frq_out:%d",
-		crd_in, df_in, frq_in,
-		crd_out, df_out, frq_out);
+uint8_t cnc_dwell(int pause)
+{
+	commonTimeIdeal += pause;
+	commonTimeReal += pause;
+	if (pause <= 0)
+		return true;
+	return cnc_planCmd(STEPM_CMD_DWELL, pause);
+}
 
-	if (crd_out > 0 && df_out < 0)
-	{
-		crd_out = -1;
-		DBG("\nOut acceleration disabled");
-	}
+uint8_t cnc_outputs(uint8_t outputs)
+{
+	return cnc_planCmd(STEPM_CMD_OUTPUTS, outputs);
+}
 
-	if (crd_in < 0 && crd_out < 0)
-	{	// Entire line without the need to accelerate or brake
-		return sendLine(p_cur->frq, p_cur->steps, p_cur->dir);
-	}
 
-	/*
-	double t0 = 0, t1 = 0;
-	int32_t s0 = 0, s1 = 0;
-	if(crd_in >= 0) {
-	t0 = ((int32_t)p_cur->frq[crd_in]-frq_in)/((double)df_in*SM_SMOOTH_TFEED/1000);
-	s0 = (int32_t)(frq_in/K_FRQ * t0 + df_in*SM_SMOOTH_TFEED/K_FRQ * t0*t0/2);
-	}
-	if(crd_out >= 0) {
-	t1 = ((int32_t)p_cur->frq[crd_out]-frq_out)/((double)df_out*SM_SMOOTH_TFEED/1000);
-	s1 = (int32_t)(frq_out/K_FRQ * t0 + df_out*SM_SMOOTH_TFEED/K_FRQ * t1*t1/2);
-	}
-	DBG("\nin:%fs %d  out:%f %d", t0, s0, t1, s1);
-	*/
+#if (USE_STEPM_ARC == 1)
+	#ifdef NO_ACCELERATION_CORRECTION
+		#error "USE_STEPM_ARC needs the planner"
+	#endif
 
-	int32_t fBreakage_out = 0, sBreakage_out = -1;
-	// Search pitch axis crd_out want to start braking (if necessary)
-	if (crd_out >= 0)
-	{
-		int32_t tmp_dd = 0, s_in = 0;
-		int32_t f2 = frq_out, max_f = p_cur->frq[crd_out], length_steps = p_cur->steps[crd_out];
-		int32_t f1 = crd_in >= 0 ? (int32_t)((int64_t)frq_in*p_cur->steps[crd_out] / p_cur->steps[crd_in]) : (int32_t)p_cur->frq[crd_out];
-		int32_t dd_f1 = crd_in >= 0 ? (int32_t)((int64_t)df_in*p_cur->steps[crd_out] / p_cur->steps[crd_in]) : 0;
-
-		sBreakage_out = 0;	// sBreakage_out - number of steps from the end
-		for (i = 0; true; i++)
-		{	// We go from the end of the braking distance
-			fBreakage_out = (f2 += df_out);
-			if (crd_in >= 0)
-			{
-				// If you have not reached a maximum speed of incoming
-				if ((dd_f1 < 0 && f1 > max_f) || (dd_f1 > 0 && f1 < max_f))
-				{
-					f1 += dd_f1;
-					s_in += f1*SM_SMOOTH_TFEED / K_FRQ / 1000; // Integration over the boost phase
-				}
-			}
-			if (f2 > max_f)
-			{	// if reached maximum speed specified for the vector braking
-				break;
-			}
-			sBreakage_out += (tmp_dd = f2*SM_SMOOTH_TFEED / K_FRQ / 1000);	// Time integration braking area
-			if (sBreakage_out >= (int32_t)p_cur->steps[crd_out])
-			{
-				sBreakage_out = length_steps; crd_in = -1;
-				break;
-			}
-			// If the acceleration and deceleration areas converged before reaching a maximum speed vector
-			if ((s_in + sBreakage_out) >= length_steps)
-			{
-				has_max_frq = false;
-				if (labs(f1 - f2) > df_out && dd_f1 > 0)
-				{
-					if (f1  < f2)
-					{
-						sBreakage_out -= tmp_dd;
-					}
-					else
-					{
-						while (labs(f1 - f2) > df_out && sBreakage_out < length_steps)
-						{
-							fBreakage_out = (f2 += df_out);
-							sBreakage_out += f2*SM_SMOOTH_TFEED / K_FRQ / 1000;
-							f1 -= dd_f1;
-						}
-					}
-				}
-				break;
-			}
-		}
-		if (length_steps - sBreakage_out < 2)
-		{
-			crd_in = -1;
-			sBreakage_out = length_steps;  // For cases where the length of the segment stabilized speed is low
-		}
-	}
-	DBG("\n crd_out=%d sBreakage_out=%d fBreakage_out=%d", crd_out, sBreakage_out, fBreakage_out);
-	uint8_t isProcess = true;
-	
-	uint32_t remainSteps[CRDS_SIZE];
-	for (i = 0; i < STEPS_MOTORS; i++)
-		remainSteps[i] = p_cur->steps[i];
-
-	// =========== Input braking / acceleration
-	if (crd_in >= 0)
-	{
-		uint8_t isProcess = true;
-		frq = frq_in + df_in;
-		while (isProcess && ((df_in < 0 && frq >(int32_t)p_cur->frq[crd_in]) || (df_in > 0 && frq < (int32_t)p_cur->frq[crd_in])))
-		{
-			for (i = 0; i < STEPS_MOTORS; i++)
-			{
-				fxyze[i] = (uint32_t)((uint64_t)frq * (uint64_t)p_cur->steps[i] / p_cur->steps[crd_in]);
-				abs_dxyze[i] = (uint64_t)fxyze[i] * SM_SMOOTH_TFEED / K_FRQ / 1000;
-			}
-			if (crd_out >= 0 && abs_dxyze[crd_out] >(remainSteps[crd_out] - sBreakage_out))
-			{
-				n = remainSteps[crd_out] - sBreakage_out;
-				for (i = 0; i < STEPS_MOTORS; i++)
-					abs_dxyze[i] = (uint64_t)n*p_cur->steps[i] / p_cur->steps[crd_out];
-				isProcess = false;
-			}
-			for (i = 0; i < STEPS_MOTORS; i++)
-				if (abs_dxyze[i] != 0 && remainSteps[i] <= abs_dxyze[i])
-				{
-					for (i = 0; i < 4; i++)
-						abs_dxyze[i] = remainSteps[i];
-					isProcess = false;
-					break;
-				}
+bool cnc_arcIsNative(CNC_REAL radius, CNC_REAL move_z)
+{
+	// the job check and preview draw the lines, the backlash is taken up between the lines
+	// the step engine draws a circle: the same steps per mm of X and Y
+	return (curGCodeMode & GFILE_MODE_MASK_EXEC) != 0 && move_z == 0 && radius >= _smParam.arcMinRadius
+		&& _smParam.backlash[CRD_X] == 0 && _smParam.backlash[CRD_Y] == 0
+		&& _smParam.stepsPerMm[CRD_X] == _smParam.stepsPerMm[CRD_Y];
+}
 
-			if (!sendLine(fxyze, abs_dxyze, p_cur->dir))
-				return false;
-			for (i = 0; i < STEPS_MOTORS; i++)
-				remainSteps[i] -= abs_dxyze[i];
-			frq += df_in;
-		}
-	}
-	// ========= No braking
-	if (crd_out < 0)
-	{
-		if (remainSteps[crd_in] == 0)
-		{
-			// Set the input speed to the next line
-			for (i = 0; i < 4; i++)
-				p_cur->frq[i] = fxyze[i];
-			return true;
-		}
-		return sendLine(p_cur->frq, remainSteps, p_cur->dir); // Remain line
-	}
-	// =========== Line with established frequency
-	if (remainSteps[crd_out] >(uint32_t)sBreakage_out)
-	{
-		for (i = 0; i < STEPS_MOTORS; i++)
-		{
-			uint32_t dd = (int64_t)sBreakage_out*p_cur->steps[i] / p_cur->steps[crd_out];
-			abs_dxyze[i] = (dd <= remainSteps[i]) ? remainSteps[i] - dd : 0;
-			remainSteps[i] -= abs_dxyze[i];
-			if (has_max_frq)
-				fxyze[i] = p_cur->frq[i];
-		}
-		if (!sendLine(fxyze, abs_dxyze, p_cur->dir))
-			return false;
-		if (sBreakage_out == 0)
-			return true;
-		//f_out = p_cur->frq[crd_out];
-	}
-	// ============= Braking
-	for (frq = fBreakage_out; isProcess && remainSteps[crd_out] > 0;)
-	{
-		frq -= df_out;
-		if (labs(frq - frq_out) < labs(df_out))
-		{
-			frq = frq_out < _smParam.smoothStopF_to0[crd_out] ? _smParam.smoothStopF_to0[crd_out] : frq_out;
-			for (i = 0; i < 4; i++)
-			{
-				fxyze[i] = (uint32_t)((uint64_t)frq * (uint64_t)p_cur->steps[i] / p_cur->steps[crd_out]);
-				abs_dxyze[i] = remainSteps[i];
-			}
-			isProcess = false;
-		}
-		else
-		{
-			for (i = 0; i < 4; i++)
-			{
-				fxyze[i] = (uint32_t)((uint64_t)frq * (uint64_t)p_cur->steps[i] / p_cur->steps[crd_out]);
-				abs_dxyze[i] = (uint64_t)fxyze[i] * SM_SMOOTH_TFEED / K_FRQ / 1000L;
-			}
-		}
+static bool cnc_planArc(const STEPM_ARC *arc, CNC_REAL length, CNC_REAL feed_rate)
+{
+	if (!cnc_pathFlush())	// the lines waiting to be combined go first
+		return false;
+#if (USE_GBIN_WRITER == 1)
+	return gbin_putArc(arc, length, feed_rate);
+#else
+	int32_t steps[CRDS_SIZE] = { arc->xEnd - arc->x, arc->yEnd - arc->y, 0, 0 };
+	CNC_REAL start_vec[2], end_vec[2];
 
-		for (i = 0; i < 4; i++)
-		{
-			if (abs_dxyze[i] > remainSteps[i] || (abs_dxyze[i] != 0 && (abs_dxyze[i] - remainSteps[i]) < 15))
-			{
-				for (i = 0; i < 4; i++)
-				{
-					abs_dxyze[i] = remainSteps[i];
-				}
-				isProcess = false;
-				break;
-			}
-		}
-		if (!sendLine(fxyze, abs_dxyze, p_cur->dir))
+	// direction of the motion at the ends: CCW (-y, x) / r
+	start_vec[CRD_X] = real_ratio(arc->cw ? arc->y : -arc->y, arc->r);
+	start_vec[CRD_Y] = real_ratio(arc->cw ? -arc->x : arc->x, arc->r);
+	end_vec[CRD_X] = real_ratio(arc->cw ? arc->yEnd : -arc->yEnd, arc->r);
+	end_vec[CRD_Y] = real_ratio(arc->cw ? -arc->xEnd : arc->xEnd, arc->r);
+
+	while (plan_isFull())	// a line may take two blocks
+		if (!cnc_execBlock())
 			return false;
-		for (i = 0; i < STEPS_MOTORS; i++)
-			remainSteps[i] -= abs_dxyze[i];
-	}
-	// Set the input speed to the next line
-	for (i = 0; i < STEPS_MOTORS; i++)
-		p_cur->frq[i] = fxyze[i];
-#endif
+	plan_bufferArc(steps, arc, length, feed_rate, start_vec, end_vec);
 	return true;
+#endif
 }
 
+/*
+ * Circular XY move to (x, y) around (cx, cy) as one block of the planner and the step engine
+ */
+uint8_t cnc_arc(
+	CNC_REAL x, CNC_REAL y, CNC_REAL z,
+	CNC_REAL cx, CNC_REAL cy, CNC_REAL radius,
+	CNC_REAL angular_travel, CNC_REAL feed_rate
+	)
+{
+	STEPM_ARC arc;
+	CNC_REAL length = real_mul(real_abs(angular_travel), radius);
+	int32_t
+		newX = sm_mmToSteps(CRD_X, x),
+		newY = sm_mmToSteps(CRD_Y, y),
+		centerX = sm_mmToSteps(CRD_X, cx),
+		centerY = sm_mmToSteps(CRD_Y, cy);
+
+	arc.x = linesBuffer.stepsFromStartX - centerX;
+	arc.y = linesBuffer.stepsFromStartY - centerY;
+	arc.xEnd = newX - centerX;
+	arc.yEnd = newY - centerY;
+	arc.r = sm_mmToSteps(CRD_X, radius);
+	arc.length = sm_mmToSteps(CRD_X, length);
+	arc.cw = angular_travel < 0;
+	if (arc.length < 8)	// less than a couple of steps of each axis
+		return cnc_line(x, y, z, 0, length, feed_rate, false);
+
+	linesBuffer.stepsFromStartX = newX;
+	linesBuffer.stepsFromStartY = newY;
+
+	commonTimeIdeal += real_mulDivRound(real_div(length, feed_rate), 60000, 1);
+
+	if (IS_KEY_C())
+		return false;
+	return cnc_planArc(&arc, length, feed_rate);
+}
+#endif
 
 uint8_t cnc_line(
-	double x, double y, double z,
-	double extruder_length,
-	double moveLength,
-	double feed_rate
+	CNC_REAL x, CNC_REAL y, CNC_REAL z,
+	CNC_REAL extruder_length,
+	CNC_REAL moveLength,
+	CNC_REAL feed_rate, bool isRapid
 	)
 {
 	int32_t
-		newX = lround(x * SM_X_STEPS_PER_360 / MM_PER_360),
-		newY = lround(y * SM_Y_STEPS_PER_360 / MM_PER_360),
-		newZ = lround(z * SM_Z_STEPS_PER_360 / MM_PER_360),
-		newE = lround(extruder_length * SM_E_STEPS_PER_MM);
+		newX = sm_mmToSteps(CRD_X, x),
+		newY = sm_mmToSteps(CRD_Y, y),
+		newZ = sm_mmToSteps(CRD_Z, z),
+		newE = sm_mmToSteps(CRD_E, extruder_length);
 
 	int32_t dx = newX - linesBuffer.stepsFromStartX;
 	int32_t dy = newY - linesBuffer.stepsFromStartY;
@@ -1171,12 +1369,8 @@ uint8_t cnc_line(
 	linesBuffer.stepsFromStartZ = newZ;
 	linesBuffer.stepsFromStartE = newE;
 
-	uint32_t time_msec = (uint32_t)(moveLength * (60000.0 / feed_rate));
+	commonTimeIdeal += real_mulDivRound(real_div(moveLength, feed_rate), 60000, 1);
 
-	commonTimeIdeal += time_msec;
-
-	if ((dx != 0 || dy != 0 || dx != 0) && time_msec == 0)
-		time_msec = 1;
 	if (de < 0)
 		de = newE; // 91384.9586 - max value for skeinforge.py
 
@@ -1194,7 +1388,11 @@ uint8_t cnc_line(
 
 	//=======================================
 	// if((curGCodeMode & GFILE_MODE_MASK_EXEC) != 0) {
-	return smothLine(dx, dy, dz, de, time_msec, moveLength, (uint32_t)feed_rate);
+#ifdef NO_ACCELERATION_CORRECTION
+	return smothLine(dx, dy, dz, de, moveLength, feed_rate);
+#else
+	return cnc_pathLine(dx, dy, dz, de, feed_rate, isRapid);
+#endif
 	// }
 	// return true;
 }
@@ -1204,13 +1402,110 @@ void cnc_end(void)
 	isGcodeStop = true;
 }
 
+#if (USE_SDCARD != 0)
+/*
+ * Pre-compiled job (gbin.h): the records go to the planner as they are.
+ * The file is read by halves (fstream.h) as the text one, blockNum - the record which is done
+ */
+static uint8_t cnc_gbinRecords(int *blockNum)
+{
+	GBIN_HDR hdr;
+	GBIN_RECORD rec;
+	CNC_REAL feed_rate = 0;
+	const char *str;
+	uint32_t len = 0, pos = sizeof(hdr);	// bytes of the half, the next record
+	int n;
+
+	if ((str = fstream_next(NULL, 0, &len)) == NULL || len < sizeof(hdr))
+		return GCSTATUS_BAD_GBIN;
+	memcpy(&hdr, str, sizeof(hdr));
+	if (!gbin_checkHdr(&hdr, &_smParam))
+		return GCSTATUS_BAD_GBIN;
+	commonTimeIdeal = hdr.timeMs;
+	minX = real_ratio(hdr.minUm[CRD_X], 1000);
+	maxX = real_ratio(hdr.maxUm[CRD_X], 1000);
+	minY = real_ratio(hdr.minUm[CRD_Y], 1000);
+	maxY = real_ratio(hdr.maxUm[CRD_Y], 1000);
+	minZ = real_ratio(hdr.minUm[CRD_Z], 1000);
+	maxZ = real_ratio(hdr.maxUm[CRD_Z], 1000);
+
+	for (*blockNum = 0; !isGcodeStop; (*blockNum)++)
+	{
+		n = gbin_decode(&rec, (const uint8_t *)str + pos, len - pos);
+		if (n == 0 && !fstream_isLast())
+		{	// the record goes on in the next half
+			if ((str = fstream_next(str + pos, len - pos, &len)) == NULL)
+				return GCSTATUS_BAD_GBIN;
+			pos = 0;
+			n = gbin_decode(&rec, (const uint8_t *)str, len);
+		}
+		if (n <= 0)	// a bad record or the end of the file without GBIN_END
+			return GCSTATUS_BAD_GBIN;
+		pos += n;
+		fstream_poll();
+
+		if (IS_KEY_C())
+			return GCSTATUS_CANCELED;
+		switch (rec.type)
+		{
+		case GBIN_LINE:
+			linesBuffer.stepsFromStartX += rec.steps[CRD_X];
+			linesBuffer.stepsFromStartY += rec.steps[CRD_Y];
+			linesBuffer.stepsFromStartZ += rec.steps[CRD_Z];
+			linesBuffer.stepsFromStartE += rec.steps[CRD_E];
+			if (!cnc_planLine(rec.steps, real_ratio(rec.lengthUm, 1000), feed_rate, rec.flag))
+				return GCSTATUS_CANCELED;
+			break;
+		case GBIN_ARC:
+	#if (USE_STEPM_ARC == 1)
+			linesBuffer.stepsFromStartX += rec.arc.xEnd - rec.arc.x;
+			linesBuffer.stepsFromStartY += rec.arc.yEnd - rec.arc.y;
+			if (!cnc_planArc(&rec.arc, real_ratio(rec.lengthUm, 1000), feed_rate))
+				return GCSTATUS_CANCELED;
+			break;
+	#else
+			return GCSTATUS_BAD_GBIN;	// compiled for the native arcs
+	#endif
+		case GBIN_CMD:
+			if (rec.cmd == STEPM_CMD_DWELL)
+				commonTimeReal += rec.value;	// the ideal time is in the header
+			if (!cnc_planCmd(rec.cmd, rec.value))
+				return GCSTATUS_CANCELED;
+			break;
+		case GBIN_FEED:
+			feed_rate = real_ratio(rec.value, 1000);
+			break;
+		case GBIN_OVERRIDE:
+			cnc_overrideEnable(rec.flag);
+			break;
+		case GBIN_END:
+			cnc_end();
+			break;
+		}
+	}
+	return GCSTATUS_OK;
+}
+
+static uint8_t cnc_gbinFile(FIL *fid, int *blockNum)
+{
+	uint8_t st;
+
+	fstream_open(fid, cncFileBuf, 0, (curGCodeMode & GFILE_MODE_MASK_EXEC) != 0);
+	st = cnc_gbinRecords(blockNum);
+	if (fstreamStat.errors != 0)
+		st = GCSTATUS_FILE_READ_ERROR;
+	fstream_close();
+	return st;
+}
+#endif
+
 #if (USE_EXTRUDER == 1)
 void cnc_extruder_stop(void)
 {
 	isExtruderOn = false;
 	cnc_waitSMotorReady();
 	uint8_t dir[4] = { 0, 0, 0, 1 };
-	uint32_t steps[4] = { 0, 0, 0, SM_E_STEPS_PER_MM / 2 };
+	uint32_t steps[4] = { 0, 0, 0, sm_mmToSteps(CRD_E, REAL_C(0.5)) };
 	const uint32_t frq[4] = {
 		SM_MANUAL_MODE_STEPS_PER_SEC * K_FRQ,
 		SM_MANUAL_MODE_STEPS_PER_SEC * K_FRQ,
@@ -0,0 +1,166 @@
+/*
+ * Line index of the job for the start at the line, see gindex.h
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef _WINDOWS
+	#include "stdafx.h"
+#else
+	#include "global.h"
+#endif
+
+#include "gindex.h"
+#include "fstream.h"
+
+#define GIDX_MAGIC		0x58444947	// "GIDX"
+#define GIDX_EXT		".idx"
+#define GIDX_BUF_SIZE	8			// entries in RAM before they are written
+
+bool gidx_isFileName(const char *name)
+{
+	const char *ext = strrchr(name, '.'), *idx = GIDX_EXT;
+
+	if (ext == NULL)
+		return false;
+	for (; *ext != 0 && *idx != 0; ext++, idx++)
+	{
+		if (tolower((unsigned char)*ext) != *idx)
+			return false;
+	}
+	return *ext == 0 && *idx == 0;
+}
+
+#if (USE_SDCARD == 1)
+typedef struct {
+	uint32_t magic;
+	uint16_t size;		// bytes of GIDX_ENTRY
+	uint16_t step;		// GIDX_STEP
+	uint32_t count;		// entries
+	uint32_t jobSize;	// the job file of the index
+	uint16_t jobDate, jobTime;
+	CNC_REAL safeZ;
+} GIDX_HDR;
+
+static struct {
+	FIL fid;
+	GIDX_HDR hdr;
+	GIDX_ENTRY buf[GIDX_BUF_SIZE];
+	uint8_t n;
+	bool isOpen;
+} gidx;
+
+static char gidxName[100];
+
+static bool gidx_name(const char *jobName)
+{
+	if (strlen(jobName) + sizeof(GIDX_EXT) > sizeof(gidxName))
+		return false;
+	strcpy(gidxName, jobName);
+	strcat(gidxName, GIDX_EXT);
+	return true;
+}
+
+static bool gidx_stat(const char *jobName, GIDX_HDR *hdr)
+{
+	FILINFO job;
+
+	memset(&job, 0, sizeof(job));
+	if (f_stat(jobName, &job) != FR_OK || !gidx_name(jobName))
+		return false;
+	hdr->magic = GIDX_MAGIC;
+	hdr->size = sizeof(GIDX_ENTRY);
+	hdr->step = GIDX_STEP;
+	hdr->jobSize = job.fsize;
+	hdr->jobDate = job.fdate;
+	hdr->jobTime = job.ftime;
+	return true;
+}
+
+bool gidx_create(const char *jobName)
+{
+	GIDX_HDR hdr;
+	UINT n = 0;
+
+	memset(&gidx, 0, sizeof(gidx));
+	if (!gidx_stat(jobName, &gidx.hdr) || f_open(&gidx.fid, gidxName, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+		return false;
+	memset(&hdr, 0, sizeof(hdr));	// it's written at the end
+	f_write(&gidx.fid, &hdr, sizeof(hdr), &n);
+	gidx.isOpen = n == sizeof(hdr);
+	if (!gidx.isOpen)
+		f_close(&gidx.fid);
+	return gidx.isOpen;
+}
+
+static void gidx_flush(void)
+{
+	UINT n = 0, size = gidx.n * sizeof(GIDX_ENTRY);
+
+	if (gidx.n == 0)
+		return;
+	fstream_idle();	// the job file is read by DMA
+	f_write(&gidx.fid, gidx.buf, size, &n);
+	gidx.hdr.count += gidx.n;
+	gidx.n = 0;
+	if (n != size)
+	{	// the index stays without the header: it's not valid
+		f_close(&gidx.fid);
+		gidx.isOpen = false;
+	}
+}
+
+void gidx_add(uint32_t offset)
+{
+	if (!gidx.isOpen)
+		return;
+	gidx.buf[gidx.n].offset = offset;
+	gc_getModal(&gidx.buf[gidx.n].modal);
+	if (++gidx.n == GIDX_BUF_SIZE)
+		gidx_flush();
+}
+
+void gidx_close(CNC_REAL safeZ)
+{
+	UINT n;
+
+	if (!gidx.isOpen)
+		return;
+	gidx_flush();
+	if (!gidx.isOpen)
+		return;
+	gidx.hdr.safeZ = safeZ;
+	if (f_lseek(&gidx.fid, 0) == FR_OK)
+		f_write(&gidx.fid, &gidx.hdr, sizeof(gidx.hdr), &n);
+	f_close(&gidx.fid);
+	gidx.isOpen = false;
+}
+
+bool gidx_find(const char *jobName, int line, GIDX_ENTRY *e, int *entryLine, CNC_REAL *safeZ)
+{
+	GIDX_HDR job, hdr;
+	FIL fid;
+	UINT n = 0, rd = 0;
+	uint32_t k;
+
+	if (line < 1 || !gidx_stat(jobName, &job) || f_open(&fid, gidxName, FA_READ) != FR_OK)
+		return false;
+	if (f_read(&fid, &hdr, sizeof(hdr), &n) == FR_OK && n == sizeof(hdr) && hdr.count != 0
+		&& hdr.magic == job.magic && hdr.size == job.size && hdr.step == job.step
+		&& hdr.jobSize == job.jobSize && hdr.jobDate == job.jobDate && hdr.jobTime == job.jobTime)
+	{	// the entries have one size: the one of the line is at once
+		k = (uint32_t)(line - 1) / GIDX_STEP;
+		if (k >= hdr.count)
+			k = hdr.count - 1;
+		if (f_lseek(&fid, sizeof(hdr) + k * sizeof(GIDX_ENTRY)) == FR_OK)
+			f_read(&fid, e, sizeof(GIDX_ENTRY), &rd);
+		*entryLine = k * GIDX_STEP + 1;
+		*safeZ = hdr.safeZ;
+	}
+	f_close(&fid);
+	return rd == sizeof(GIDX_ENTRY);
+}
+#endif
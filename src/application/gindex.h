@@ -0,0 +1,36 @@
+#ifndef GINDEX_H_
+#define GINDEX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gcode.h"
+
+/*
+ * Line index of the job (sidecar file "<job>.idx"): the check pass of the job writes the offset
+ * of the line and the modal state of the parser before it every GIDX_STEP lines.
+ * The start at the line reads one entry, seeks the job file there and parses
+ * less than GIDX_STEP lines without motion.
+ * The index is of the job which has the same size and time as at the check pass.
+ */
+#define GIDX_STEP		100	// lines between the entries
+
+typedef struct {
+	uint32_t offset;	// of the line in the job file
+	GC_MODAL modal;		// the state of the parser before the line
+} GIDX_ENTRY;
+
+bool gidx_isFileName(const char *name);
+
+#if (USE_SDCARD == 1)
+	// Check pass of the job
+	bool gidx_create(const char *jobName);
+	// The line at offset, it's GIDX_STEP lines after the last one
+	void gidx_add(uint32_t offset);
+	// safeZ - the top of the job (mm), the restart goes to the line over the part there
+	void gidx_close(CNC_REAL safeZ);
+
+	// The entry at or before the line, entryLine - the line of the entry
+	bool gidx_find(const char *jobName, int line, GIDX_ENTRY *e, int *entryLine, CNC_REAL *safeZ);
+#endif
+
+#endif
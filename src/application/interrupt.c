@@ -89,11 +89,17 @@ void SysTick_Handler(void)
 
 #if (STEPS_MOTORS > 0)
 void stepm_proc(uint8_t id);
+void stepm_rampProc(void);
+void stepm_ddaProc(void);
 
 #ifdef M0_TIM_IRQHandler
 void M0_TIM_IRQHandler(void)
 {
+#if (USE_STEPM_DDA == 1)
+	stepm_ddaProc();
+#else
 	stepm_proc(0);
+#endif
 }
 #endif
 
@@ -116,6 +122,51 @@ void M3_TIM_IRQHandler(void)
 	stepm_proc(3);
 }
 #endif
+
+#if (USE_STEPM_OC == 1)
+void stepm_cntProc(uint8_t id);
+
+	#ifdef M0_CNT_TIM_IRQHandler
+void M0_CNT_TIM_IRQHandler(void)
+{
+	stepm_cntProc(0);
+}
+	#endif
+	#ifdef M1_CNT_TIM_IRQHandler
+void M1_CNT_TIM_IRQHandler(void)
+{
+	stepm_cntProc(1);
+}
+	#endif
+	#ifdef M2_CNT_TIM_IRQHandler
+void M2_CNT_TIM_IRQHandler(void)
+{
+	stepm_cntProc(2);
+}
+	#endif
+	#ifdef M3_CNT_TIM_IRQHandler
+void M3_CNT_TIM_IRQHandler(void)
+{
+	stepm_cntProc(3);
+}
+	#endif
+#endif
+
+#if (USE_STEPM_DMA == 1)
+void stepm_dmaProc(void);
+
+void STEPW_DMA_IRQHandler(void)
+{
+	stepm_dmaProc();
+}
+#endif
+
+#ifdef STEPM_RAMP_TIM_IRQHandler
+void STEPM_RAMP_TIM_IRQHandler(void)
+{
+	stepm_rampProc();
+}
+#endif
 #endif	/* (STEPS_MOTORS > 0) */
 
 #if (USE_RS232 == 1)
@@ -1,9 +1,13 @@
 #include <string.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include "global.h"
 #include "screen_io.h"
+#include "Crc32.h"
+#include "gindex.h"
 
 #define CONF_FILE_NAME "sm.conf"
+#define CACHE_FILE_NAME "sm.bin"
 
 #define MAX_FILE_LIST_SZ 256
 #define MAX_FILE_NAME_SZ 80
@@ -35,29 +39,112 @@ char *str_trim(char *str)
 	}
 	return str;
 }
+/***************************************************
+ *	Binary cache of _smParam: sm.conf is parsed and checked once,
+ *	the next boots load it while sm.conf and the firmware defaults are the same.
+ *	Only the values of sm.conf are cached, sm_deriveParam makes the rest.
+ */
+#if (USE_SDCARD == 1)
+#define SM_CACHE_MAGIC	0x324D5300	// "\0SM2"
+#define SM_CACHE_SIZE	offsetof(SM_PARAM, stepsPerMm)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t size;		// of the cached values
+	uint32_t confSize;	// sm.conf of the cache
+	uint16_t confDate, confTime;
+	uint32_t defCrc;	// of the defaults: sm.conf can leave some of them
+	uint32_t crc;		// of the parameters
+} SM_CACHE_HDR;
+
+static uint32_t smCacheCrc(const SM_PARAM *p)
+{
+	const uint8_t *b = (const uint8_t *)p;
+	uint32_t i, crc = 0;
+
+	Init_CRC32();
+	for (i = 0; i < SM_CACHE_SIZE; i++)
+		crc = UpdateCRC32(b[i]);
+	return crc;
+}
+
+static uint32_t smDefaultCrc(void)
+{
+	SM_PARAM def;
+
+	sm_defaultParam(&def);
+	return smCacheCrc(&def);
+}
+
+static bool loadSmCache(const FILINFO *conf)
+{
+	SM_CACHE_HDR hdr;
+	SM_PARAM param;
+	FIL fid;
+	UINT n1 = 0, n2 = 0;
+
+	if (f_open(&fid, CACHE_FILE_NAME, FA_READ) != FR_OK)
+		return false;
+	memset(&param, 0, sizeof(param));
+	f_read(&fid, &hdr, sizeof(hdr), &n1);
+	f_read(&fid, &param, SM_CACHE_SIZE, &n2);
+	f_close(&fid);
+	if (n1 != sizeof(hdr) || n2 != SM_CACHE_SIZE || hdr.magic != SM_CACHE_MAGIC || hdr.size != SM_CACHE_SIZE
+		|| hdr.confSize != conf->fsize || hdr.confDate != conf->fdate || hdr.confTime != conf->ftime
+		|| hdr.defCrc != smDefaultCrc() || hdr.crc != smCacheCrc(&param))
+		return false;
+	memcpy(&_smParam, &param, SM_CACHE_SIZE);
+	sm_deriveParam(&_smParam);
+	return true;
+}
+
+static void saveSmCache(void)
+{
+	SM_CACHE_HDR hdr;
+	FILINFO conf;
+	FIL fid;
+	UINT n;
+
+	memset(&conf, 0, sizeof(conf));
+	if (f_stat(CONF_FILE_NAME, &conf) != FR_OK)
+		return;
+	hdr.magic = SM_CACHE_MAGIC;
+	hdr.size = SM_CACHE_SIZE;
+	hdr.confSize = conf.fsize;
+	hdr.confDate = conf.fdate;
+	hdr.confTime = conf.ftime;
+	hdr.defCrc = smDefaultCrc();
+	hdr.crc = smCacheCrc(&_smParam);
+	if (f_open(&fid, CACHE_FILE_NAME, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+		return;
+	f_write(&fid, &hdr, sizeof(hdr), &n);
+	f_write(&fid, &_smParam, SM_CACHE_SIZE, &n);
+	f_close(&fid);
+}
+#endif
+
 /***************************************************
  *	Initialize _smParam and load from config file
  */
 void initSmParam(void)
 {
-	_smParam.smoothStartF_from0[0] = SM_SMOOTH_START_X*K_FRQ;
-	_smParam.smoothStartF_from0[1] = SM_SMOOTH_START_Y*K_FRQ;
-	_smParam.smoothStartF_from0[2] = SM_SMOOTH_START_Z*K_FRQ;
-	_smParam.smoothStopF_to0[0] = SM_SMOOTH_STOP_X*K_FRQ;
-	_smParam.smoothStopF_to0[1] = SM_SMOOTH_STOP_Y*K_FRQ;
-	_smParam.smoothStopF_to0[2] = SM_SMOOTH_STOP_Z*K_FRQ;
-	_smParam.smoothAF[0] = SM_SMOOTH_DFEED_X*SM_X_STEPS_PER_MM*SM_SMOOTH_TFEED*K_FRQ / 1000;
-	_smParam.smoothAF[1] = SM_SMOOTH_DFEED_Y*SM_Y_STEPS_PER_MM*SM_SMOOTH_TFEED*K_FRQ / 1000;
-	_smParam.smoothAF[2] = SM_SMOOTH_DFEED_Z*SM_Z_STEPS_PER_MM*SM_SMOOTH_TFEED / 1000 * K_FRQ;
-	_smParam.maxFeedRate[0] = SM_X_MAX_STEPS_PER_SEC*K_FRQ;
-	_smParam.maxFeedRate[1] = SM_Y_MAX_STEPS_PER_SEC*K_FRQ;
-	_smParam.maxFeedRate[2] = SM_Z_MAX_STEPS_PER_SEC*K_FRQ;
-	_smParam.maxSpindleTemperature = MAX_SPINDEL_TEMPERATURE;
+	sm_defaultParam(&_smParam);
 
 #if (USE_SDCARD == 1)
 	FIL fid;
+	FILINFO conf;
 	char str[256], *p;
-	int i;
+	int i, n;
+	bool hasJerk, hasBacklash;
+
+	memset(&conf, 0, sizeof(conf));
+	if (f_stat(CONF_FILE_NAME, &conf) != FR_OK)
+		return;
+	if (loadSmCache(&conf))
+	{
+		scr_printf("\n%s cached", CONF_FILE_NAME);
+		return;
+	}
 	FRESULT fres = f_open(&fid, CONF_FILE_NAME, FA_READ);
 	if (fres == FR_OK)
 	{
@@ -68,24 +155,63 @@ void initSmParam(void)
 			if (f_gets(str, sizeof(str), &fid) == NULL)
 				break;
 			DBG("\nc:%d:'%s'", i, str);
+			hasJerk = strstr(str, "jerk") != NULL;	// older files keep garbage in the 5th value
+			hasBacklash = strstr(str, "backlash") != NULL;
 			if (f_gets(str, sizeof(str), &fid) == NULL)
 				break;
 			DBG("\nd:%d:'%s'", i, str);
 			p = str;
-			_smParam.smoothStartF_from0[i] = strtod_M(p, &p);
-			_smParam.smoothStopF_to0[i] = strtod_M(p, &p);
-			_smParam.smoothAF[i] = strtod_M(p, &p);
-			_smParam.maxFeedRate[i] = strtod_M(p, &p);
+			_smParam.smoothStartF_from0[i] = strtofix_M(p, &p, 0);
+			_smParam.smoothStopF_to0[i] = strtofix_M(p, &p, 0);
+			_smParam.smoothAF[i] = strtofix_M(p, &p, 0);
+			_smParam.maxFeedRate[i] = strtofix_M(p, &p, 0);
+			if (hasJerk)
+			{
+				int32_t jerk = strtofix_M(p, &p, 0);
+				if (jerk > 0)
+					_smParam.jerk[i] = jerk;
+			}
+			if (hasBacklash)
+			{
+				int32_t backlash = strtofix_M(p, &p, 0);
+				if (backlash >= 0)
+					_smParam.backlash[i] = backlash;
+			}
 		}
 		if (f_gets(str, sizeof(str), &fid) != NULL)
 		{
 			DBG("t:'%s'", str);
 			if (f_gets(str, sizeof(str), &fid) != NULL)
-				_smParam.maxSpindleTemperature = strtod_M(str, &p);
+				_smParam.maxSpindleTemperature = strtofix_M(str, &p, 0);
+		}
+		// kinematics, older files have no such lines
+		if (f_gets(str, sizeof(str), &fid) != NULL && strstr(str, "steps") != NULL)
+		{
+			for (i = 0; i < CRDS_SIZE; i++)
+			{
+				if (f_gets(str, sizeof(str), &fid) == NULL)
+					break;
+				p = str;
+				_smParam.stepsPer360[i] = strtofix_M(p, &p, 0);
+				_smParam.umPer360[i] = strtofix_M(p, &p, 0);
+				if (i < 3)
+					_smParam.tableSize[i] = strtofix_M(p, &p, 0);
+			}
+			if (f_gets(str, sizeof(str), &fid) != NULL && f_gets(str, sizeof(str), &fid) != NULL)
+			{
+				p = str;
+				_smParam.arcTolerance_um = strtofix_M(p, &p, 0);
+				_smParam.arcMinRadius_um = strtofix_M(p, &p, 0);
+			}
 		}
 		scr_puts("*");
 		f_close(&fid);
-		scr_puts(" OK");
+		if ((n = sm_checkParam(&_smParam)) != 0)
+			scr_printf(" %d bad values, defaults are used", n);
+		else
+			scr_puts(" OK");
+		sm_deriveParam(&_smParam);
+		saveSmCache();
 	}
 #endif
 }
@@ -114,19 +240,27 @@ void saveSmParam(void)
 	scr_printf("\nSave into %s", CONF_FILE_NAME);
 	for (i = 0; i < 3; i++)
 	{
-		f_printf(&fid, "Crd%d (F:steps*%d/sec): 'smoothStartF_from0,smoothStopF_to0,smoothAF,maxFeedRate\n", i, K_FRQ);
-		f_printf(&fid, "%d,%d,%d,%d,%d\n",
+		f_printf(&fid, "Crd%d (F:steps*%d/sec): 'smoothStartF_from0,smoothStopF_to0,smoothAF,maxFeedRate,jerk(mm/sec^3),backlash(steps)\n", i, K_FRQ);
+		f_printf(&fid, "%d,%d,%d,%d,%d,%d\n",
 			_smParam.smoothStartF_from0[i],
 			_smParam.smoothStopF_to0[i],
 			_smParam.smoothAF[i],
-			_smParam.maxFeedRate[i]
+			_smParam.maxFeedRate[i],
+			_smParam.jerk[i],
+			_smParam.backlash[i]
 		);
 		scr_puts(".");
 	}
 	f_printf(&fid, "Spindle switch-off temperature (C.degree)\n");
 	f_printf(&fid, "%d\n", _smParam.maxSpindleTemperature);
+	f_printf(&fid, "XYZE: steps per revolution, travel per revolution (1/1000 mm), table size (mm)\n");
+	for (i = 0; i < CRDS_SIZE; i++)
+		f_printf(&fid, "%d,%d,%d\n", _smParam.stepsPer360[i], _smParam.umPer360[i], i < 3 ? _smParam.tableSize[i] : 0);
+	f_printf(&fid, "Arcs (1/1000 mm): tolerance, min. radius of G2/G3 as one move\n");
+	f_printf(&fid, "%d,%d\n", _smParam.arcTolerance_um, _smParam.arcMinRadius_um);
 	scr_puts("*");
 	f_close(&fid);
+	saveSmCache();
 	scr_puts(" - OK");
 #endif
 }
@@ -204,6 +338,7 @@ void readFileList(void)
 	FILINFO finfo;
 	DIR dirs;
 	static char lfn[_MAX_LFN + 1];
+	char *p;
 	int i;
 
 	win_showMsgWin();
@@ -226,8 +361,10 @@ void readFileList(void)
 			break;
 		if (finfo.fname[0] == '.')
 			continue;
-		if (!(finfo.fattrib & AM_DIR) && strcmp(CONF_FILE_NAME, *finfo.lfname ? finfo.lfname : finfo.fname) != 0)
-			strncpy(&fileList[fileListSz++][0], *finfo.lfname ? finfo.lfname : finfo.fname, MAX_FILE_NAME_SZ);
+		p = *finfo.lfname ? finfo.lfname : finfo.fname;
+		if (!(finfo.fattrib & AM_DIR) && strcmp(CONF_FILE_NAME, p) != 0 && strcmp(CACHE_FILE_NAME, p) != 0
+			&& !gidx_isFileName(p))
+			strncpy(&fileList[fileListSz++][0], p, MAX_FILE_NAME_SZ);
 	}
 	
 	if (loadedFileName[0] != 0)
@@ -368,6 +505,41 @@ void setTime(void)
 	if (c == KEY_D) rtc_settime(&rtc);
 }
 #endif	/* USE_RTC == 1 */
+
+#if (USE_SDCARD == 1)
+// The line of the job to start at, 0 - cancel
+int inputLineNum(void)
+{
+	static const int digitKeys[10] = { KEY_0, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8, KEY_9 };
+	int c = -1, i, n = 0;
+
+	win_showMsgWin();
+	scr_setScroll(false);
+	scr_puts("D-ENTER C-CANCEL '*' -Backspace");
+	scr_printf("\n\nFile:%s", &fileList[currentFile][0]);
+	do
+	{
+		if (c == KEY_STAR)
+			n /= 10;
+		for (i = 0; i < 10; i++)
+		{
+			if (c == digitKeys[i] && n < 10000000)
+				n = n * 10 + i;
+		}
+		scr_gotoxy(0, 4);
+		scr_fontColorNormal();
+		scr_puts(" Start at line: ");
+		scr_fontColorInvers();
+		if (n != 0)
+			scr_printf("%d", n);
+		scr_fontColorNormal();
+		scr_clrEndl();
+		while ((c = kbd_getKey()) < 0);
+	} while (c != KEY_C && c != KEY_D);
+
+	return c == KEY_D ? n : 0;
+}
+#endif
 #endif	/* USE_KEYBOARD == 1*/
 
 #if (USE_KEYBOARD == 2)
@@ -391,6 +563,48 @@ const TPKey_p kbdLast2Lines[] = {
 
 #endif
 
+/***************************************************
+ *	Run the job from the line, 0 or 1 - from the start
+ */
+void startGcode(int startLine)
+{
+	FLASH_KEYS();
+
+#if (USE_LCD == 1)
+	uint32_t stime;
+	stime = Seconds();
+#endif
+#if (USE_SDCARD != 0)
+	cnc_gfile(&fileList[currentFile][0], GFILE_MODE_MASK_EXEC, startLine);
+#endif
+	while (stepm_inProc())
+	{
+		scr_fontColor(Yellow, Blue);
+		scr_gotoxy(1, 13);
+		scr_printf(" remain moves: %d", stepm_getRemainLines());
+		scr_clrEndl();
+	}
+	stepm_EmergeStop();
+
+#if (USE_LCD == 1)
+	scr_fontColor(Yellow, Blue);
+	scr_gotoxy(0, 13);
+	scr_puts("   FINISH. PRESS C-KEY");
+	scr_clrEndl();
+	
+	stime = Seconds() - stime;
+	scr_fontColor(Yellow, Blue);
+	scr_gotoxy(0, 14);
+	scr_printf("   work time: %02d:%02d", stime / 60, stime % 60);
+	scr_clrEndl();
+#endif
+#if (USE_LCD == 2)
+	SetTouchKeys(kbdLast2Lines);
+#endif
+	FLASH_KEYS();
+	WAIT_KEY_C();
+}
+
 /***************************************************
  *	Main
  */
@@ -439,8 +653,7 @@ int main()
 				"0 - start gcode   1 - manual mode\n"
 				"2 - show gcode    3 - delete file\n"
 				"4 - set time      5 - file info\n"
-				//"6 - scan mode\t "
-				"7 - save conf.file (v1.1)");
+				"6 - start at line 7 - save conf.file");
 #endif
 #if (USE_KEYBOARD == 2)
 			SetTouchKeys(kbdSelectFile);
@@ -480,44 +693,9 @@ int main()
 	// Start GCode
 	//
 		case KEY_0:
-		{
-			FLASH_KEYS();
-
-#if (USE_LCD == 1)
-			uint32_t stime;
-			stime = Seconds();
-#endif
-			cnc_gfile(&fileList[currentFile][0], GFILE_MODE_MASK_EXEC);
-			while (stepm_inProc())
-			{
-				scr_fontColor(Yellow, Blue);
-				scr_gotoxy(1, 13);
-				scr_printf(" remain moves: %d", stepm_getRemainLines());
-				scr_clrEndl();
-			}
-			stepm_EmergeStop();
-
-#if (USE_LCD == 1)
-			scr_fontColor(Yellow, Blue);
-			scr_gotoxy(0, 13);
-			scr_puts("   FINISH. PRESS C-KEY");
-			scr_clrEndl();
-			
-			stime = Seconds() - stime;
-			scr_fontColor(Yellow, Blue);
-			scr_gotoxy(0, 14);
-			scr_printf("   work time: %02d:%02d", stime / 60, stime % 60);
-			scr_clrEndl();
-#endif
-#if (USE_LCD == 2)
-			SetTouchKeys(kbdLast2Lines);
-#endif
-			FLASH_KEYS();
-			WAIT_KEY_C();
-
+			startGcode(0);
 			redrawScr = true;
 			break;
-		}
 	//
 	// Manual Mode
 	//
@@ -531,12 +709,26 @@ int main()
 	//
 		case KEY_2:
 			FLASH_KEYS();
-			cnc_gfile(&fileList[currentFile][0], GFILE_MODE_MASK_SHOW | GFILE_MODE_MASK_CHK);
+			cnc_gfile(&fileList[currentFile][0], GFILE_MODE_MASK_SHOW | GFILE_MODE_MASK_CHK, 0);
 			scr_printf("\n              PRESS C-KEY");
 			FLASH_KEYS();
 			while (kbd_getKey() != KEY_C);
 			redrawScr = true;
 			break;
+	#if (USE_KEYBOARD == 1)
+	//
+	// Start GCode at the line (the index of "show gcode")
+	//
+		case KEY_6:
+		{
+			int n = inputLineNum();
+
+			if (n != 0)
+				startGcode(n);
+			redrawScr = true;
+			break;
+		}
+	#endif
 	//
 	// Delete file
 	//
@@ -8,8 +8,8 @@ const char axisName[5] = "XYZE";
 void manualMode(void)
 {
 	static uint8_t limits = 0xFF;
-	const double axisK[4] = { SM_X_STEPS_PER_MM, SM_Y_STEPS_PER_MM, SM_Z_STEPS_PER_MM, SM_E_STEPS_PER_MM };
-	int i, k = SM_X_STEPS_PER_MM;
+	const int kMax = sm_mmToSteps(CRD_X, REAL_ONE);	// steps per mm
+	int i, k = kMax;
 	uint32_t frq[4] = {
 		SM_MANUAL_MODE_STEPS_PER_SEC * K_FRQ,
 		SM_MANUAL_MODE_STEPS_PER_SEC * K_FRQ,
@@ -38,7 +38,7 @@ void manualMode(void)
 		scr_fontColor(White, Black);
 		for (i = 0; i < 3; i++)
 		{
-			double n = (double)stepm_getCurGlobalStepsNum(i) / axisK[i];
+			double n = real_toDouble(sm_stepsToMm(i, stepm_getCurGlobalStepsNum(i)));
 			scr_gotoxy(1 + i * 10, TEXT_Y_MAX - 4); scr_printf("%c:%f  ", axisName[i], n);
 			if (i < 3)
 			{
@@ -46,12 +46,10 @@ void manualMode(void)
 				scr_printf("steps %c:%d      ", axisName[i], stepm_getCurGlobalStepsNum(i));
 			}
 	#if (USE_ENCODER == 1)
-			if (i == 2)
+			if (encoder_isPresent(i))
 			{
-				int32_t v = encoderZvalue();
-				scr_gotoxy(25, TEXT_Y_MAX - 1); scr_printf("encZ:%d    ", v);
-				scr_gotoxy(1 + 2 * 10, TEXT_Y_MAX - 5);
-				scr_printf("errZ:%f  ", (double)(v*MM_PER_360) / ENCODER_Z_CNT_PER_360 - n);
+				scr_gotoxy(1 + i * 10, TEXT_Y_MAX - 5);
+				scr_printf("e%c:%f  ", axisName[i], real_toDouble(sm_stepsToMm(i, encoderStat[i].err)));
 			}
 	#endif
 			dir[i] = 0;
@@ -59,7 +57,7 @@ void manualMode(void)
 		}
 		scr_fontColor(Blue, Black);
 		scr_gotoxy(2, TEXT_Y_MAX - 7);
-		scr_printf("step per key press: %f mm ", (double)k / SM_X_STEPS_PER_MM);
+		scr_printf("step per key press: %f mm ", real_toDouble(sm_stepsToMm(CRD_X, k)));
 
 		switch (kbd_getKey())
 		{
@@ -67,8 +65,7 @@ void manualMode(void)
 			while (stepm_inProc() && kbd_getKey() != KEY_C) {}
 			stepm_ZeroGlobalCrd();
 	#if (USE_ENCODER == 1)
-			encoderZreset();
-			encoderCorrectionCntUp = encoderCorrectionCntDown = encoderCorrectionDelta = encoderCorrectionMaxDelta = 0;
+			encoder_reset();
 	#endif
 			break;
 		case KEY_6: steps[0] = k; dir[0] = 1; stepm_addMove(steps, frq, dir); break;
@@ -100,7 +97,7 @@ void manualMode(void)
 			stepm_addMove(steps, frq, dir);
 			break;
 		case KEY_A:
-			if (k < SM_X_STEPS_PER_MM) k++;
+			if (k < kMax) k++;
 			break;
 		case KEY_B:
 			if (k > 1) k--;
@@ -109,7 +106,7 @@ void manualMode(void)
 			k = 1;
 			break;
 		case KEY_DIES:
-			if (k < SM_X_STEPS_PER_MM) k += SM_X_STEPS_PER_MM / 8;
+			if (k < kMax) k += kMax / 8;
 			break;
 		case KEY_C:
 			stepm_EmergeStop();
@@ -48,7 +48,8 @@ u16 MAL_Init(u8 lun)
 		}
 		Mass_Block_Size[0] = 512;
 		Status = SD_EnableWideBusOperation(SDIO_BusWide_4b);
-		//	Status = SD_SetDeviceMode(SD_DMA_MODE);
+		// The blocking reads are in the polling mode (SD_SetDeviceMode above): the buffers of FatFs
+		// and USB may be unaligned. The job file goes by DMA with SD_StartReadMultiBlocks (fstream.c)
 		break;
 	default:
 		return MAL_FAIL;
@@ -0,0 +1,486 @@
+/* Look-ahead planner.
+ * Backward/forward velocity passes are inspired by the "Grbl" planner
+ * Copyright (c) 2009-2011 Simen Svale Skogsrud
+ * Copyright (c) 2011-2013 Sungeun K. Jeon
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifdef _WINDOWS
+	#include "stdafx.h"
+#else
+	#include "global.h"
+#endif
+
+#include "planner.h"
+
+static PLAN_BLOCK block_buffer[PLANNER_BUF_SIZE];
+static uint8_t block_buffer_tail;		// oldest block, entry speed is fixed
+static uint8_t block_buffer_head;		// next free slot
+static uint8_t block_buffer_planned;	// blocks up to this one are optimal
+
+static struct {
+	CNC_REAL unit_vec[CRDS_SIZE];
+	CNC_REAL nominal_speed_sqr;
+	CNC_REAL stop_speed_sqr;
+	uint8_t isValid;
+} prev;
+
+static uint16_t plan_ovr[2];		// feed and rapid override, percent
+static uint8_t plan_dirs, plan_dirsKnown;	// last direction of XYZ (bits): side of the backlash
+
+// per axis limits in mm
+static CNC_REAL axis_accel[3], axis_jerk[3], axis_max_speed[3], axis_start_speed[3], axis_stop_speed[3];
+
+static __INLINE uint8_t next_block_index(uint8_t idx)
+{
+	return ++idx >= PLANNER_BUF_SIZE ? 0 : idx;
+}
+
+static __INLINE uint8_t prev_block_index(uint8_t idx)
+{
+	return idx == 0 ? PLANNER_BUF_SIZE - 1 : idx - 1;
+}
+
+void plan_init(void)
+{
+	int i;
+
+	block_buffer_tail = block_buffer_head = block_buffer_planned = 0;
+	memset(&prev, 0, sizeof(prev));
+	plan_ovr[0] = plan_ovr[1] = 100;
+	plan_dirs = plan_dirsKnown = 0;	// the first move of each axis takes no slack up
+
+	for (i = 0; i < 3; i++)
+	{
+		// smoothAF - frequency increment per SM_SMOOTH_TFEED msec, steps/sec^2 -> mm/sec^2
+		axis_accel[i] = real_mulRecip(_smParam.smoothAF[i] * 1000 / (SM_SMOOTH_TFEED * K_FRQ), _smParam.mmPerStep[i]);
+		axis_jerk[i] = real_fromInt(_smParam.jerk[i]);
+		axis_max_speed[i] = real_mulRecip(_smParam.maxFeedRate[i] / K_FRQ, _smParam.mmPerStep[i]);
+		axis_start_speed[i] = real_mulRecip(_smParam.smoothStartF_from0[i] / K_FRQ, _smParam.mmPerStep[i]);
+		axis_stop_speed[i] = real_mulRecip(_smParam.smoothStopF_to0[i] / K_FRQ, _smParam.mmPerStep[i]);
+	}
+}
+
+// Path speed (mm/sec) with the centripetal acceleration within the limits of X and Y
+static CNC_REAL plan_arcMaxSpeed(CNC_REAL radius)
+{
+	CNC_REAL accel = axis_accel[CRD_X] < axis_accel[CRD_Y] ? axis_accel[CRD_X] : axis_accel[CRD_Y];
+	return real_mul(real_sqrt(accel), real_sqrt(radius));
+}
+
+CNC_REAL plan_arcFeedRate(CNC_REAL feed_rate, CNC_REAL radius)
+{
+	CNC_REAL max_speed = plan_arcMaxSpeed(radius);
+
+	return feed_rate / 60 < max_speed ? feed_rate : max_speed * 60;
+}
+
+// One slot is kept for the rest of a line split by the backlash takeup
+bool plan_isFull(void)
+{
+	uint8_t head = block_buffer_head, tail = block_buffer_tail;
+	return (head >= tail ? head - tail : head + PLANNER_BUF_SIZE - tail) >= PLANNER_BUF_SIZE - 2;
+}
+
+bool plan_isEmpty(void)
+{
+	return block_buffer_head == block_buffer_tail;
+}
+
+PLAN_BLOCK *plan_getBlock(void)
+{
+	return plan_isEmpty() ? NULL : &block_buffer[block_buffer_tail];
+}
+
+CNC_REAL plan_getExitSpeedSqr(void)
+{
+	uint8_t idx = next_block_index(block_buffer_tail);
+	return idx == block_buffer_head ? 0 : block_buffer[idx].entry_speed_sqr;
+}
+
+void plan_discardBlock(void)
+{
+	if (plan_isEmpty())
+		return;
+	if (block_buffer_tail == block_buffer_planned)
+		block_buffer_planned = next_block_index(block_buffer_planned);
+	block_buffer_tail = next_block_index(block_buffer_tail);
+}
+
+/*
+ * Recalculate entry speeds of the not yet optimal blocks.
+ * Reverse pass: the newest block must be able to stop at its end, every earlier block
+ * must be able to decelerate to the entry speed of the following one.
+ * Forward pass: entry speeds are limited by acceleration from the previous block.
+ * Blocks before block_buffer_planned can't be improved any more and are skipped,
+ * so the work per appended block stays small even with the deep queue.
+ */
+// v^2 change over the block: the speed follows 3t^2-2t^3 (cnc_rampTime), the acceleration
+// of the block is its peak one, the mean one is 2/3 of it
+static CNC_REAL plan_speedChangeSqr(const PLAN_BLOCK *block)
+{
+	return real_mulDiv(real_mul(block->acceleration, block->millimeters), 4, 3);
+}
+
+static void plan_recalculate(void)
+{
+	uint8_t idx = prev_block_index(block_buffer_head);
+	PLAN_BLOCK *cur, *next;
+	CNC_REAL entry_speed_sqr;
+
+	if (idx == block_buffer_planned)
+		return;	// only one plannable block, its entry speed is fixed
+
+	// Reverse pass
+	cur = &block_buffer[idx];
+	entry_speed_sqr = plan_speedChangeSqr(cur);
+	cur->entry_speed_sqr = entry_speed_sqr < cur->max_entry_speed_sqr ? entry_speed_sqr : cur->max_entry_speed_sqr;
+
+	idx = prev_block_index(idx);
+	while (idx != block_buffer_planned)
+	{
+		next = cur;
+		cur = &block_buffer[idx];
+		idx = prev_block_index(idx);
+		if (cur->entry_speed_sqr != cur->max_entry_speed_sqr)
+		{
+			entry_speed_sqr = next->entry_speed_sqr + plan_speedChangeSqr(cur);
+			cur->entry_speed_sqr = entry_speed_sqr < cur->max_entry_speed_sqr ? entry_speed_sqr : cur->max_entry_speed_sqr;
+		}
+	}
+
+	// Forward pass
+	next = &block_buffer[block_buffer_planned];
+	idx = next_block_index(block_buffer_planned);
+	while (idx != block_buffer_head)
+	{
+		cur = next;
+		next = &block_buffer[idx];
+		if (cur->entry_speed_sqr < next->entry_speed_sqr)
+		{
+			entry_speed_sqr = cur->entry_speed_sqr + plan_speedChangeSqr(cur);
+			if (entry_speed_sqr < next->entry_speed_sqr)
+			{	// acceleration limited - this junction is optimal now
+				next->entry_speed_sqr = entry_speed_sqr;
+				block_buffer_planned = idx;
+			}
+		}
+		if (next->entry_speed_sqr == next->max_entry_speed_sqr)
+			block_buffer_planned = idx;
+		idx = next_block_index(idx);
+	}
+}
+
+/*
+ * Junction deviation (as in Grbl): the corner is passed along the circle which touches both moves
+ * and is SM_JUNCTION_DEVIATION_MM away from the corner, with the acceleration of the axes
+ * in the direction of the velocity change: v^2 = a * deviation * cos(t/2) / (1 - cos(t/2)),
+ * t - angle of the turn. It's written with s = sin(t/2) = |cur - prev| / 2, which stays exact
+ * for the small angles in fixed point: cos / (1 - cos) = c * (1 + c) / s^2.
+ */
+static CNC_REAL plan_junctionSpeedSqr(const CNC_REAL unit_vec[CRDS_SIZE])
+{
+	CNC_REAL d[3], s2, c, len, accel = REAL_MAX;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		d[i] = unit_vec[i] - prev.unit_vec[i];
+	s2 = (real_mul(d[0], d[0]) + real_mul(d[1], d[1]) + real_mul(d[2], d[2])) / 4;
+	if (s2 == 0)
+		return REAL_MAX;	// straight
+	if (s2 >= REAL_ONE)
+		return 0;			// reverse
+	len = real_hypot3(d[0], d[1], d[2]);
+	for (i = 0; i < 3; i++)
+	{
+		if (d[i] != 0 && real_mul(accel, real_abs(d[i])) > real_mul(axis_accel[i], len))
+			accel = real_div(real_mul(axis_accel[i], len), real_abs(d[i]));
+	}
+	c = real_sqrt(REAL_ONE - s2);
+	return real_mul(real_mul(accel, REAL_C(SM_JUNCTION_DEVIATION_MM)), real_div(real_mul(c, REAL_ONE + c), s2));
+}
+
+/*
+ * Speeds of the block with the override of its kind. The speeds to start from 0 and to stop to 0
+ * are never above the nominal one.
+ */
+static CNC_REAL plan_limitSqr(CNC_REAL speed, CNC_REAL limit_sqr)
+{
+	CNC_REAL speed_sqr = real_mul(speed, speed);
+	return speed_sqr < limit_sqr ? speed_sqr : limit_sqr;
+}
+
+static void plan_setSpeeds(PLAN_BLOCK *block)
+{
+	CNC_REAL speed;
+
+	block->ovr = plan_ovr[block->isRapid ? 1 : 0];
+	speed = real_mulDiv(block->feed_speed, block->ovr, 100);
+	if (speed > block->max_speed)
+		speed = block->max_speed;
+	block->nominal_speed_sqr = real_mul(speed, speed);
+	block->min_speed_sqr = plan_limitSqr(block->start_speed < block->stop_speed ? block->start_speed : block->stop_speed,
+		block->nominal_speed_sqr);
+}
+
+/*
+ * Junction speed with previous block: from the angle of the corner (junction deviation),
+ * but not below the speed at which it's safe to stop and start again.
+ */
+static CNC_REAL plan_entryLimit(const PLAN_BLOCK *block, CNC_REAL prev_nominal_sqr, CNC_REAL prev_stop_sqr)
+{
+	CNC_REAL junction_speed_sqr = block->junction_speed_sqr;
+	CNC_REAL safe_speed_sqr = plan_limitSqr(block->start_speed, block->nominal_speed_sqr);
+
+	if (safe_speed_sqr > prev_stop_sqr)
+		safe_speed_sqr = prev_stop_sqr;
+	if (junction_speed_sqr < safe_speed_sqr)
+		junction_speed_sqr = safe_speed_sqr;
+	// never faster than both blocks are allowed
+	if (junction_speed_sqr > block->nominal_speed_sqr)
+		junction_speed_sqr = block->nominal_speed_sqr;
+	if (junction_speed_sqr > prev_nominal_sqr)
+		junction_speed_sqr = prev_nominal_sqr;
+	return junction_speed_sqr;
+}
+
+/*
+ * Limits and junction of the block which is filled by plan_bufferLine/plan_bufferArc.
+ * max_speed - limit of the path speed (mm/sec) of the move itself,
+ * axis_part - the largest part of the path speed for each axis along the move,
+ * end_vec - direction at the end.
+ */
+static bool plan_addBlock(PLAN_BLOCK *block, CNC_REAL feed_rate, CNC_REAL max_speed,
+	const CNC_REAL axis_part[CRDS_SIZE], const CNC_REAL end_vec[CRDS_SIZE])
+{
+	int i;
+
+	block->feed_speed = feed_rate / 60;	// mm/min -> mm/sec
+	block->max_speed = max_speed;
+	block->start_speed = block->stop_speed = REAL_MAX;
+	block->acceleration = REAL_MAX;
+	block->jerk = REAL_MAX;
+	for (i = 0; i < 3; i++)
+	{
+		CNC_REAL unit = axis_part[i];
+
+		if (unit == 0)
+			continue;
+		// Limits along the path from the limits of each axis
+		if (real_mul(block->max_speed, unit) > axis_max_speed[i])
+			block->max_speed = real_div(axis_max_speed[i], unit);
+		if (real_mul(block->acceleration, unit) > axis_accel[i])
+			block->acceleration = real_div(axis_accel[i], unit);
+		if (real_mul(block->jerk, unit) > axis_jerk[i])
+			block->jerk = real_div(axis_jerk[i], unit);
+		if (real_mul(block->start_speed, unit) > axis_start_speed[i])
+			block->start_speed = real_div(axis_start_speed[i], unit);
+		if (real_mul(block->stop_speed, unit) > axis_stop_speed[i])
+			block->stop_speed = real_div(axis_stop_speed[i], unit);
+	}
+	plan_setSpeeds(block);
+
+	block->junction_speed_sqr = 0;
+	block->max_entry_speed_sqr = 0;
+	if (prev.isValid)
+	{
+		block->junction_speed_sqr = plan_junctionSpeedSqr(block->unit_vec);
+		block->max_entry_speed_sqr = plan_entryLimit(block, prev.nominal_speed_sqr, prev.stop_speed_sqr);
+	}
+	block->entry_speed_sqr = plan_isEmpty() ? 0 : block->max_entry_speed_sqr;
+
+	for (i = 0; i < CRDS_SIZE; i++)
+		prev.unit_vec[i] = end_vec[i];
+	prev.nominal_speed_sqr = block->nominal_speed_sqr;
+	prev.stop_speed_sqr = plan_limitSqr(block->stop_speed, block->nominal_speed_sqr);
+	prev.isValid = true;
+
+	if (plan_isEmpty())
+		block->max_entry_speed_sqr = 0;	// the machine is stopped
+	block_buffer_head = next_block_index(block_buffer_head);
+	plan_recalculate();
+	return true;
+}
+
+void plan_setOverride(uint16_t feed, uint16_t rapid)
+{
+	uint8_t idx = block_buffer_tail;
+	PLAN_BLOCK *block, *prev_block = NULL;
+
+	plan_ovr[0] = feed;
+	plan_ovr[1] = rapid;
+	if (plan_isEmpty())
+		return;
+	while (idx != block_buffer_head)
+	{
+		block = &block_buffer[idx];
+		plan_setSpeeds(block);
+		if (prev_block != NULL)
+		{	// the oldest block keeps its entry speed: it's the exit speed of the move in the step engine
+			block->max_entry_speed_sqr = plan_entryLimit(block, prev_block->nominal_speed_sqr,
+				plan_limitSqr(prev_block->stop_speed, prev_block->nominal_speed_sqr));
+			block->entry_speed_sqr = 0;
+		}
+		prev_block = block;
+		idx = next_block_index(idx);
+	}
+	prev.nominal_speed_sqr = prev_block->nominal_speed_sqr;
+	prev.stop_speed_sqr = plan_limitSqr(prev_block->stop_speed, prev_block->nominal_speed_sqr);
+	block_buffer_planned = block_buffer_tail;
+	plan_recalculate();
+}
+
+// Steps of the block from the start to the end
+static bool plan_setSteps(PLAN_BLOCK *block, int32_t steps[CRDS_SIZE])
+{
+	int i;
+
+	block->step_event_count = 0;
+	for (i = 0; i < CRDS_SIZE; i++)
+	{
+		block->steps[i] = labs(steps[i]);
+		block->dir[i] = steps[i] > 0;
+		if (block->steps[i] > block->step_event_count)
+			block->step_event_count = block->steps[i];
+	}
+	return block->step_event_count != 0;
+}
+
+// Axes of XYZ (bits) which reverse with the move and have the backlash, the directions are remembered
+static uint8_t plan_reversal(const int32_t steps[CRDS_SIZE])
+{
+	uint8_t mask = 0, bit;
+	int i;
+
+	for (i = 0; i < 3; i++)
+	{
+		bit = 1 << i;
+		if (steps[i] == 0)
+			continue;
+		if ((plan_dirsKnown & bit) != 0 && ((plan_dirs & bit) != 0) != (steps[i] > 0) && _smParam.backlash[i] > 0)
+			mask |= bit;
+		plan_dirsKnown |= bit;
+		if (steps[i] > 0)
+			plan_dirs |= bit;
+		else
+			plan_dirs &= ~bit;
+	}
+	return mask;
+}
+
+/*
+ * Line block. The axes of backlash mask make the steps of the slack in the new direction
+ * within the same time, so the takeup is blended into the move: the speeds are limited
+ * by the faster rate of the axis, the corners stay those of the path.
+ */
+static bool plan_addLine(int32_t steps[CRDS_SIZE], CNC_REAL millimeters, CNC_REAL feed_rate, bool isRapid,
+	uint8_t backlash)
+{
+	PLAN_BLOCK *block = &block_buffer[block_buffer_head];
+	CNC_REAL axis_part[CRDS_SIZE];
+	int i;
+
+	plan_setSteps(block, steps);
+	for (i = 0; i < 3; i++)
+	{
+		if ((backlash & (1 << i)) == 0)
+			continue;
+		block->steps[i] += _smParam.backlash[i];
+		block->dir[i] = (plan_dirs >> i) & 1;	// the axis may have no steps of its own in this part
+		if (block->steps[i] > block->step_event_count)
+			block->step_event_count = block->steps[i];
+	}
+	if (block->step_event_count == 0)
+		return false;
+
+	block->millimeters = millimeters;
+	block->cmd = STEPM_CMD_MOVE;
+	block->isArc = false;
+	block->isRapid = isRapid;
+	block->backlash = backlash;
+	for (i = 0; i < CRDS_SIZE; i++)
+	{
+		block->unit_vec[i] = real_div(sm_stepsToMm(i, steps[i]), millimeters);
+		axis_part[i] = real_abs(block->unit_vec[i]);
+		if ((backlash & (1 << i)) != 0)
+			axis_part[i] = real_div(sm_stepsToMm(i, block->steps[i]), millimeters);
+	}
+	return plan_addBlock(block, feed_rate, REAL_MAX, axis_part, block->unit_vec);
+}
+
+bool plan_bufferLine(int32_t steps[CRDS_SIZE], CNC_REAL millimeters, CNC_REAL feed_rate, bool isRapid)
+{
+	int32_t part[CRDS_SIZE];
+	CNC_REAL k;
+	uint8_t backlash;
+	int i;
+
+	if (plan_isFull() || millimeters <= 0)
+		return false;
+	backlash = plan_reversal(steps);
+	if (backlash != 0 && millimeters > REAL_C(SM_BACKLASH_SMOOTH_MM))
+	{	// the slack is taken up at the start of the move, the rest of it goes as usual
+		k = real_div(REAL_C(SM_BACKLASH_SMOOTH_MM), millimeters);
+		for (i = 0; i < CRDS_SIZE; i++)
+			part[i] = real_mulDivRound(k, steps[i], 1);
+		plan_addLine(part, REAL_C(SM_BACKLASH_SMOOTH_MM), feed_rate, isRapid, backlash);
+		for (i = 0; i < CRDS_SIZE; i++)
+			part[i] = steps[i] - part[i];
+		plan_addLine(part, millimeters - REAL_C(SM_BACKLASH_SMOOTH_MM), feed_rate, isRapid, 0);
+		return true;
+	}
+	return plan_addLine(steps, millimeters, feed_rate, isRapid, backlash);
+}
+
+bool plan_bufferArc(int32_t steps[CRDS_SIZE], const STEPM_ARC *arc, CNC_REAL millimeters, CNC_REAL feed_rate,
+	const CNC_REAL start_vec[2], const CNC_REAL end_vec[2])
+{
+	PLAN_BLOCK *block = &block_buffer[block_buffer_head];
+	CNC_REAL axis_part[CRDS_SIZE], exit_vec[CRDS_SIZE];
+	int i;
+
+	if (plan_isFull() || millimeters <= 0 || arc->length == 0)
+		return false;
+
+	plan_setSteps(block, steps);	// full circle has no steps
+	block->step_event_count = arc->length;
+	block->millimeters = millimeters;
+	block->cmd = STEPM_CMD_MOVE;
+	block->isArc = true;
+	block->isRapid = false;
+	block->backlash = 0;	// the arcs are cut into lines if X or Y has the backlash
+	block->arc = *arc;
+	for (i = 0; i < CRDS_SIZE; i++)
+	{
+		block->unit_vec[i] = i < 2 ? start_vec[i] : 0;
+		exit_vec[i] = i < 2 ? end_vec[i] : 0;
+		// the motion turns: each of X and Y moves with the full speed somewhere on the circle
+		axis_part[i] = i < 2 ? REAL_ONE : 0;
+	}
+	// the centripetal acceleration limits the speed with the override too
+	return plan_addBlock(block, feed_rate, plan_arcMaxSpeed(sm_stepsToMm(CRD_X, arc->r)), axis_part, exit_vec);
+}
+
+/*
+ * The command is a block without length and speeds: the moves before it must stop at its entry,
+ * the move after it has no junction to start with.
+ */
+bool plan_bufferCmd(uint8_t cmd, uint32_t value)
+{
+	PLAN_BLOCK *block = &block_buffer[block_buffer_head];
+
+	if (plan_isFull())
+		return false;
+	memset(block, 0, sizeof(PLAN_BLOCK));
+	block->cmd = cmd;
+	block->value = value;
+	prev.isValid = false;
+
+	block_buffer_head = next_block_index(block_buffer_head);
+	plan_recalculate();
+	return true;
+}
@@ -0,0 +1,71 @@
+#ifndef PLANNER_H_
+#define PLANNER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gcode.h"
+#include "stepmotor.h"
+
+// Look-ahead depth in blocks (32..128).
+// Every block handed to the step engine leaves the queue and stays fixed,
+// so the queue holds only not yet executed moves.
+#ifndef PLANNER_BUF_SIZE
+	#define PLANNER_BUF_SIZE	32
+#endif
+
+typedef struct {
+	uint32_t steps[CRDS_SIZE];
+	uint8_t  dir[CRDS_SIZE];
+	uint32_t step_event_count;		// max(steps[])
+	CNC_REAL millimeters;
+	CNC_REAL acceleration;			// mm/sec/sec along the path
+	CNC_REAL jerk;					// mm/sec^3 along the path
+	CNC_REAL nominal_speed_sqr;		// (mm/sec)^2
+	CNC_REAL entry_speed_sqr;
+	CNC_REAL max_entry_speed_sqr;	// junction limit with previous block
+	CNC_REAL min_speed_sqr;			// speed which is safe to start from 0 or stop to 0
+	CNC_REAL unit_vec[CRDS_SIZE];	// direction at the start
+	// without the override: the speeds above are made of them by plan_setOverride
+	CNC_REAL feed_speed;			// programmed speed, mm/sec
+	CNC_REAL max_speed;				// limits of the axes and the move
+	CNC_REAL start_speed, stop_speed;
+	CNC_REAL junction_speed_sqr;	// limit of the corner with previous block
+	uint16_t ovr;					// override of the nominal speed, percent
+	bool     isRapid;				// G0, rapid override
+	uint8_t  backlash;				// axes (bits) which take the backlash up in this block
+	bool     isArc;
+	STEPM_ARC arc;					// circular move (USE_STEPM_ARC), steps[] are from the start to the end
+	uint8_t  cmd;					// STEPM_CMD_MOVE or a command for the step engine, see plan_bufferCmd
+	uint32_t value;					// of the command
+} PLAN_BLOCK;
+
+void plan_init(void);
+bool plan_isFull(void);
+bool plan_isEmpty(void);
+
+// Append a move to the queue and replan. Returns false if the move is empty
+// or the queue is full (call plan_getBlock/plan_discardBlock first).
+bool plan_bufferLine(int32_t steps[CRDS_SIZE], CNC_REAL millimeters, CNC_REAL feed_rate, bool isRapid);
+// Circular XY move, millimeters - length of the arc, start_vec/end_vec - directions (X, Y) at its ends
+bool plan_bufferArc(int32_t steps[CRDS_SIZE], const STEPM_ARC *arc, CNC_REAL millimeters, CNC_REAL feed_rate,
+	const CNC_REAL start_vec[2], const CNC_REAL end_vec[2]);
+
+// Command for the step engine (STEPM_CMD_DWELL, STEPM_CMD_OUTPUTS) in order with the moves.
+// The motion stops at it, the moves after it are planned as usual.
+bool plan_bufferCmd(uint8_t cmd, uint32_t value);
+
+// Feed rate (mm/min) of a circular XY move with the centripetal acceleration v^2/r
+// within the acceleration of the axes
+CNC_REAL plan_arcFeedRate(CNC_REAL feed_rate, CNC_REAL radius);
+
+// Feed and rapid override (percent): nominal speeds of the queued blocks are changed and replanned,
+// new blocks get them too. The entry speed of the oldest block stays.
+void plan_setOverride(uint16_t feed, uint16_t rapid);
+
+// Oldest block in the queue (NULL if empty) and the speed it must leave with.
+PLAN_BLOCK *plan_getBlock(void);
+CNC_REAL plan_getExitSpeedSqr(void);
+// Fix the oldest block: it was handed to the step engine.
+void plan_discardBlock(void);
+
+#endif /* PLANNER_H_ */
@@ -2,23 +2,77 @@
 #include <string.h>
 #include <stdbool.h>
 #include "global.h"
+#include "stepq.h"
+#include "stepwave.h"
 
-#define STEPS_BUF_SIZE	8
+// Moves queue, see stepq.h. The moves are loaded in the IRQs only: the step IRQs load
+// the next one at the end of a move, the ramp IRQ when the motors are idle.
 
 #if (STEPS_MOTORS > 0)
 typedef struct
 {
 	uint32_t steps[STEPS_MOTORS];
 	uint32_t pscValue[STEPS_MOTORS];
-	uint32_t arrValue[STEPS_MOTORS];
+	uint32_t period[STEPS_MOTORS];	// Q16, see STEPM_PERIOD
 	uint32_t f[STEPS_MOTORS];
 	uint8_t  dir[STEPS_MOTORS];
+	uint32_t kAxis[STEPS_MOTORS];	// f[i] = fMain * kAxis[i] >> 16
+	uint8_t  mainAxis;
+	STEPM_RAMP ramp;
+#if (USE_STEPM_ARC == 1)
+	bool     isArc;
+	STEPW_ARC arc;					// with the first event
+#endif
+	uint8_t  cmd;					// STEPM_CMD_*, the move is STEPM_CMD_MOVE
+	uint32_t value;					// of the command
 } LINE_DATA;
 volatile LINE_DATA steps_buf[STEPS_BUF_SIZE];
 #endif
 
-volatile int8_t steps_buf_count;
-		 int8_t steps_buf_get, steps_buf_put;
+#if (STEPS_MOTORS > 0)
+// Profile of the move in process
+volatile struct {
+	STEPM_PROFILE prof;
+	STEPW_HOLD hold;				// feed hold
+	uint32_t f;						// frequency of the step timers
+	uint32_t kAxis[STEPS_MOTORS];
+	uint8_t  mainAxis;
+	uint32_t dwell;					// ramp ticks left of the dwell command
+#if (USE_ENCODER == 1)
+	uint8_t  encTick;				// ramp ticks to the encoder loop
+#endif
+} ramp;
+
+// Step period of the timer in 1/65536 of its tick. ARR holds the integer part or one more,
+// the update IRQ carries the fraction (sigma-delta), so the average rate is exact.
+typedef struct
+{
+	uint32_t period;				// Q16
+	uint16_t acc;					// fraction carried to the next periods
+} STEPM_PERIOD;
+static volatile STEPM_PERIOD stepm_periods[STEPS_MOTORS];
+#endif
+
+// State of the M-code outputs, see STEPM_OUT_*
+static volatile uint8_t stepm_outputs;
+
+#if (STEPS_MOTORS > 0) && (USE_STEPM_DDA == 1)
+// DDA: the main axis steps on every tick of M0_TIM, others by Bresenham
+volatile struct {
+	uint32_t events;				// ticks left in the move
+	uint32_t total;					// steps of the main axis
+	uint32_t delta[STEPS_MOTORS];
+	int32_t  err[STEPS_MOTORS];
+	uint8_t  mask;					// axes with STEP on
+	bool     clk;
+#if (USE_STEPM_ARC == 1)
+	bool     isArc;
+	STEPW_ARC arc;					// next event of the arc
+#endif
+} dda;
+#endif
+
+volatile uint8_t steps_buf_get, steps_buf_put;
 
 #if (USE_STEP_DEBUG == 1)
 	LINE_DATA cur_steps_buf; // for debug only
@@ -35,8 +89,55 @@ typedef struct mx_timer_init_s {
 	TIM_TypeDef *	Timer;
 	uint8_t			IRQn;
 	uint32_t		Clock;
+#if (USE_STEPM_OC == 1)
+	uint8_t			Channel;	// output compare channel on STEP pin
+	TIM_TypeDef *	Counter;	// slave timer which counts steps, may be NULL
+	uint16_t		CounterITR;
+#endif
 } mx_timer_init_t;
 
+#if (USE_STEPM_DMA == 1)
+	#if (USE_STEPM_DDA == 1) || (USE_STEPM_OC == 1)
+		#error "USE_STEPM_DMA replaces USE_STEPM_DDA and USE_STEPM_OC engines"
+	#endif
+	#ifndef STM32F10X_HD
+		#error "USE_STEPM_DMA is implemented for STM32F10x DMA channels only"
+	#endif
+	#ifndef STEPW_HALF_TICKS
+		#define STEPW_HALF_TICKS	200
+	#endif
+// Waveform of each port: two halves, the DMA plays one while the other is filled
+static uint32_t stepw_wave[STEPW_PORTS_MAX][STEPW_HALF_TICKS * 2];
+static uint32_t *stepw_bufs[STEPW_PORTS_MAX];
+static GPIO_TypeDef *stepw_ports[STEPW_PORTS_MAX];
+static DMA_Channel_TypeDef * const stepw_dma[STEPW_PORTS_MAX] = { STEPW_DMA0, STEPW_DMA1, STEPW_DMA2 };
+static const uint16_t stepw_dmaCC[STEPW_PORTS_MAX] = { TIM_DMA_CC1, TIM_DMA_CC2, TIM_DMA_CC4 };
+static volatile bool stepw_isRun;
+static uint8_t stepw_idleHalves;
+static void stepm_dmaInit(void);
+#elif (USE_STEPW_SHAPER == 1)
+	#error "USE_STEPW_SHAPER needs the DMA step waveform (USE_STEPM_DMA)"
+#endif
+
+#if (USE_STEPM_ARC == 1) && (USE_STEPM_DDA == 0) && (USE_STEPM_DMA == 0)
+	#error "USE_STEPM_ARC needs all axes stepped by one engine (USE_STEPM_DDA or USE_STEPM_DMA)"
+#endif
+
+#if (USE_STEPM_OC == 1)
+	#if (USE_STEPM_DDA == 1)
+		#error "USE_STEPM_OC needs own timer for each axis (USE_STEPM_DDA = 0)"
+	#endif
+	// STEP pulse is made by timer (PWM2: low, high from CCR, falling edge at update),
+	// IRQ is once per step
+	#define STEPM_IRQ_PER_STEP	1
+	#define STEPM_MAX_FRQ		50000
+	// Constant frequency moves longer than this are counted by the slave timer
+	#define STEPM_HW_COUNT_MIN	64
+#else
+	#define STEPM_IRQ_PER_STEP	2
+	#define STEPM_MAX_FRQ		15000
+#endif
+
 const mx_pin_init_t mx_limits[] = {
 #ifdef LIMIT_X_PORT
 	{ LIMIT_X_PORT,	LIMIT_X_PIN	},
@@ -50,6 +151,23 @@ const mx_pin_init_t mx_limits[] = {
 	{ NULL }
 };
 
+// M-code outputs: the board may have none of them
+const mx_pin_init_t mx_outputs[] = {
+#ifdef OUT_SPINDLE_PORT
+	{ OUT_SPINDLE_PORT,	OUT_SPINDLE_PIN	},
+#endif
+#ifdef OUT_MIST_PORT
+	{ OUT_MIST_PORT,	OUT_MIST_PIN	},
+#endif
+#ifdef OUT_FLOOD_PORT
+	{ OUT_FLOOD_PORT,	OUT_FLOOD_PIN	},
+#endif
+#ifdef OUT_FAN_PORT
+	{ OUT_FAN_PORT,		OUT_FAN_PIN		},
+#endif
+	{ NULL }
+};
+
 #if (STEPS_MOTORS > 0)
 
 	const mx_pin_init_t mx_enables[] = {
@@ -103,18 +221,40 @@ const mx_pin_init_t mx_limits[] = {
 		{ NULL }
 	};
 
+#if (USE_STEPM_OC == 1)
+	#ifndef M0_CNT_TIM
+		#define M0_CNT_TIM		NULL
+		#define M0_CNT_TIM_ITR	0
+	#endif
+	#ifndef M1_CNT_TIM
+		#define M1_CNT_TIM		NULL
+		#define M1_CNT_TIM_ITR	0
+	#endif
+	#ifndef M2_CNT_TIM
+		#define M2_CNT_TIM		NULL
+		#define M2_CNT_TIM_ITR	0
+	#endif
+	#ifndef M3_CNT_TIM
+		#define M3_CNT_TIM		NULL
+		#define M3_CNT_TIM_ITR	0
+	#endif
+	#define MX_TIMER(n)	{ M##n##_TIM, M##n##_TIM_IRQn, M##n##_TIM_CLK, M##n##_STEP_OC, M##n##_CNT_TIM, M##n##_CNT_TIM_ITR }
+#else
+	#define MX_TIMER(n)	{ M##n##_TIM, M##n##_TIM_IRQn, M##n##_TIM_CLK }
+#endif
+
 	const mx_timer_init_t mx_timers[] = {
 	#ifdef M0_TIM
-		{ M0_TIM, M0_TIM_IRQn, M0_TIM_CLK },
+		MX_TIMER(0),
 	#endif
 	#ifdef M1_TIM
-		{ M1_TIM, M1_TIM_IRQn, M1_TIM_CLK },
+		MX_TIMER(1),
 	#endif
 	#ifdef M2_TIM
-		{ M2_TIM, M2_TIM_IRQn, M2_TIM_CLK },
+		MX_TIMER(2),
 	#endif
 	#ifdef M3_TIM
-		{ M3_TIM, M3_TIM_IRQn, M3_TIM_CLK },
+		MX_TIMER(3),
 	#endif
 		{ NULL }
 	};
@@ -129,6 +269,7 @@ volatile struct
 			 bool	clk;
 			 bool	dir;
 	volatile bool	isInProc;
+	volatile bool	hwCount;	// steps are counted by the slave timer
 } step_motors[STEPS_MOTORS];
 #endif
 
@@ -153,13 +294,83 @@ void stepm_in_ports_init(const mx_pin_init_t * mx_port, GPIO_InitTypeDef * GPIO_
 	}
 }
 
+static void stepm_setOutputs(uint8_t outputs)
+{
+	stepm_outputs = outputs;
+#ifdef OUT_SPINDLE_PORT
+	GPIO_WriteBit(OUT_SPINDLE_PORT, OUT_SPINDLE_PIN, (outputs & STEPM_OUT_SPINDLE) ? Bit_SET : Bit_RESET);
+#endif
+#ifdef OUT_MIST_PORT
+	GPIO_WriteBit(OUT_MIST_PORT, OUT_MIST_PIN, (outputs & STEPM_OUT_MIST) ? Bit_SET : Bit_RESET);
+#endif
+#ifdef OUT_FLOOD_PORT
+	GPIO_WriteBit(OUT_FLOOD_PORT, OUT_FLOOD_PIN, (outputs & STEPM_OUT_FLOOD) ? Bit_SET : Bit_RESET);
+#endif
+#ifdef OUT_FAN_PORT
+	GPIO_WriteBit(OUT_FAN_PORT, OUT_FAN_PIN, (outputs & STEPM_OUT_FAN) ? Bit_SET : Bit_RESET);
+#endif
+}
+
+#if (STEPS_MOTORS > 0) && (USE_STEPM_OC == 1)
+static void stepm_setPulse(const mx_timer_init_t *mx_timer, uint16_t pulse)
+{
+	switch (mx_timer->Channel)
+	{
+	case 1: TIM_SetCompare1(mx_timer->Timer, pulse); break;
+	case 2: TIM_SetCompare2(mx_timer->Timer, pulse); break;
+	case 3: TIM_SetCompare3(mx_timer->Timer, pulse); break;
+	case 4: TIM_SetCompare4(mx_timer->Timer, pulse); break;
+	}
+}
+
+/*
+ * Output compare on STEP pin and optional slave timer which counts the update events
+ */
+static void stepm_ocInit(const mx_timer_init_t *mx_timer)
+{
+	TIM_OCInitTypeDef TIM_OC;
+
+	TIM_OCStructInit(&TIM_OC);
+	TIM_OC.TIM_OCMode = TIM_OCMode_PWM2;
+	TIM_OC.TIM_OutputState = TIM_OutputState_Enable;
+	TIM_OC.TIM_OCPolarity = TIM_OCPolarity_High;
+	TIM_OC.TIM_Pulse = 0;
+	switch (mx_timer->Channel)
+	{
+	case 1: TIM_OC1Init(mx_timer->Timer, &TIM_OC); TIM_OC1PreloadConfig(mx_timer->Timer, TIM_OCPreload_Enable); break;
+	case 2: TIM_OC2Init(mx_timer->Timer, &TIM_OC); TIM_OC2PreloadConfig(mx_timer->Timer, TIM_OCPreload_Enable); break;
+	case 3: TIM_OC3Init(mx_timer->Timer, &TIM_OC); TIM_OC3PreloadConfig(mx_timer->Timer, TIM_OCPreload_Enable); break;
+	case 4: TIM_OC4Init(mx_timer->Timer, &TIM_OC); TIM_OC4PreloadConfig(mx_timer->Timer, TIM_OCPreload_Enable); break;
+	}
+	// UG loads PSC/ARR/CCR at the move start without the update IRQ
+	TIM_UpdateRequestConfig(mx_timer->Timer, TIM_UpdateSource_Regular);
+	TIM_SelectOutputTrigger(mx_timer->Timer, TIM_TRGOSource_Update);
+
+	if (mx_timer->Counter != NULL)
+	{
+		TIM_TimeBaseInitTypeDef TIM_TimeBase;
+
+		TIM_TimeBaseStructInit(&TIM_TimeBase);
+		TIM_TimeBaseInit(mx_timer->Counter, &TIM_TimeBase);
+		TIM_ITRxExternalClockConfig(mx_timer->Counter, mx_timer->CounterITR);
+		TIM_UpdateRequestConfig(mx_timer->Counter, TIM_UpdateSource_Regular);
+		TIM_ClearITPendingBit(mx_timer->Counter, TIM_IT_Update);
+		TIM_ITConfig(mx_timer->Counter, TIM_IT_Update, ENABLE);
+	}
+}
+#endif
+
 void stepm_init(void)
 {
 	GPIO_InitTypeDef GPIO_InitStructure;
 
-	steps_buf_count = 0;
 	steps_buf_get = steps_buf_put = 0;
 
+	PIN_SPEED_MID();
+	PIN_OUTPUT_PP();
+	stepm_ports_init(mx_outputs, &GPIO_InitStructure);
+	stepm_outputs = 0;
+
 #if (STEPS_MOTORS > 0)
 
 	NVIC_InitTypeDef NVIC_InitStructure;
@@ -178,6 +389,12 @@ void stepm_init(void)
 	PIN_OUTPUT_PP();
 	stepm_ports_init(mx_enables, &GPIO_InitStructure);
 	stepm_ports_init(mx_dirs, &GPIO_InitStructure);
+#if (USE_STEPM_OC == 1)
+	PIN_ALTFUNC_PP();
+	#ifdef MX_STEP_REMAP
+	MX_STEP_REMAP();
+	#endif
+#endif
 	stepm_ports_init(mx_steps, &GPIO_InitStructure);
 	
 	PIN_INPUT_PU();
@@ -190,7 +407,39 @@ void stepm_init(void)
 
 	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
 	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+	#if (USE_STEPM_OC == 1)
+	// The update IRQ counts the step and arms the last pulse within a step period: the step
+	// timers preempt the ramp IRQ (the encoder loop, the profile). 2 of group 2 is 1 of
+	// group 1 of the USB too.
+	NVIC_PriorityGroupConfig(NVIC_PriorityGroup_2);
+	#else
 	NVIC_PriorityGroupConfig(NVIC_PriorityGroup_0);
+	#endif
+
+	#if (USE_STEPM_OC == 1)
+	// Slave step counters
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 2;
+		#ifdef M0_CNT_TIM_CLK
+	M0_CNT_TIM_CLK();
+	NVIC_InitStructure.NVIC_IRQChannel = M0_CNT_TIM_IRQn;
+	NVIC_Init(&NVIC_InitStructure);
+		#endif
+		#ifdef M1_CNT_TIM_CLK
+	M1_CNT_TIM_CLK();
+	NVIC_InitStructure.NVIC_IRQChannel = M1_CNT_TIM_IRQn;
+	NVIC_Init(&NVIC_InitStructure);
+		#endif
+		#ifdef M2_CNT_TIM_CLK
+	M2_CNT_TIM_CLK();
+	NVIC_InitStructure.NVIC_IRQChannel = M2_CNT_TIM_IRQn;
+	NVIC_Init(&NVIC_InitStructure);
+		#endif
+		#ifdef M3_CNT_TIM_CLK
+	M3_CNT_TIM_CLK();
+	NVIC_InitStructure.NVIC_IRQChannel = M3_CNT_TIM_IRQn;
+	NVIC_Init(&NVIC_InitStructure);
+		#endif
+	#endif
 
 	const mx_timer_init_t * mx_timer = mx_timers;
 	while (mx_timer->Timer != NULL)
@@ -204,30 +453,332 @@ void stepm_init(void)
 		mx_timer->Timer->EGR = TIM_PSCReloadMode_Update;
 		TIM_ClearITPendingBit(mx_timer->Timer, TIM_IT_Update);
 		TIM_ARRPreloadConfig(mx_timer->Timer, ENABLE);
+#if (USE_STEPM_OC == 1)
+		stepm_ocInit(mx_timer);
+#endif
 		TIM_ITConfig(mx_timer->Timer, TIM_IT_Update, ENABLE);
 		mx_timer++;
 	}
+
+	ramp.prof.phase = STEPM_PROFILE_OFF;
+	#ifdef STEPM_RAMP_TIM
+	NVIC_InitStructure.NVIC_IRQChannel = STEPM_RAMP_TIM_IRQn;
+		#if (USE_STEPM_OC == 1)
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 2;
+		#endif
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 2;
+	NVIC_Init(&NVIC_InitStructure);
+
+	RCC_APB1PeriphClockCmd(STEPM_RAMP_TIM_CLK, ENABLE);
+	TIM_TimeBase.TIM_Prescaler = SystemCoreClock / 1000000 - 1;	// 1 MHz
+	TIM_TimeBase.TIM_Period = 1000000 / STEPM_RAMP_FRQ - 1;
+	TIM_TimeBaseInit(STEPM_RAMP_TIM, &TIM_TimeBase);
+	TIM_ClearITPendingBit(STEPM_RAMP_TIM, TIM_IT_Update);
+	TIM_ITConfig(STEPM_RAMP_TIM, TIM_IT_Update, ENABLE);
+	TIM_Cmd(STEPM_RAMP_TIM, ENABLE);
+	#endif
+	#if (USE_STEPM_DMA == 1)
+	stepm_dmaInit();
+	#endif
+#endif
+}
+
+#if (STEPS_MOTORS > 0)
+/*
+ * Step frequency (steps/sec * K_FRQ) to timer prescaler and period (Q16 ticks, see STEPM_PERIOD)
+ */
+static void stepm_frqToTimer(uint32_t f, uint32_t *psc, uint32_t *period)
+{
+	uint32_t pscValue = 1;
+	uint64_t p;
+
+	if (f > (STEPM_MAX_FRQ * K_FRQ))
+		f = STEPM_MAX_FRQ * K_FRQ;
+	if (f < K_FRQ)
+		f = K_FRQ;			// 1Hz
+
+	// SystemCoreClock / (psc * period) = frq (1 falling age on STEPM_IRQ_PER_STEP IRQ)
+	p = ((uint64_t)SystemCoreClock * K_FRQ << 16) / ((uint64_t)f * STEPM_IRQ_PER_STEP);
+	while (p >= ((uint64_t)0x10000 << 16))	// ARR of the longer period fits 16 bits
+	{
+		pscValue = pscValue << 1;
+		p = p >> 1;
+	}
+	*psc = pscValue - 1;
+	*period = (uint32_t)p;
+}
+
+/*
+ * Start the timer with the period: ARR of the first one, the update IRQs dither the next ones
+ */
+static void stepm_loadPeriod(int i, uint32_t psc, uint32_t period)
+{
+	stepm_periods[i].period = period;
+	mx_timers[i].Timer->PSC = psc;
+	TIM_SetAutoreload(mx_timers[i].Timer, (period >> 16) - 1);
+}
+
+/*
+ * Update IRQ: ARR of the period after the next one (ARR is preloaded)
+ */
+static __INLINE void stepm_nextPeriod(int i)
+{
+	uint32_t acc = stepm_periods[i].acc + (stepm_periods[i].period & 0xffff);
+
+	stepm_periods[i].acc = (uint16_t)acc;
+	mx_timers[i].Timer->ARR = (stepm_periods[i].period >> 16) - 1 + (acc >> 16);
+}
+
+/*
+ * Change frequency of all running axes, preloaded values are applied at the next timer update
+ */
+static void stepm_setFrq(uint32_t f)
+{
+	uint32_t psc, period;
+#if (USE_STEPM_DDA == 1)
+	stepm_frqToTimer(f, &psc, &period);
+	stepm_loadPeriod(0, psc, period);
+#else
+	for (int i = 0; i < STEPS_MOTORS; i++)
+	{
+		if (!step_motors[i].isInProc)
+			continue;
+		stepm_frqToTimer((uint32_t)(((uint64_t)f * ramp.kAxis[i]) >> 16), &psc, &period);
+		stepm_loadPeriod(i, psc, period);
+	#if (USE_STEPM_OC == 1)
+		stepm_setPulse(&mx_timers[i], period >> 17);
+	#endif
+	}
 #endif
 }
+#endif
 
 #if (STEPS_MOTORS > 0)
+/*
+ * Frequency of the move in process
+ */
+static void stepm_runFrq(uint32_t f)
+{
+#if (USE_STEPM_ARC == 1) && (USE_STEPM_DDA == 1)
+	if (dda.isArc)
+	{	// the rate of events follows the direction of the motion
+		stepm_setFrq(stepw_arcFrq((STEPW_ARC *)&dda.arc, f));
+		ramp.f = f;
+		return;
+	}
+#endif
+	if (f != ramp.f)
+		stepm_setFrq(f);
+	ramp.f = f;
+}
+
+// Motors are stepping. A dwell is not: the feed hold stops it at once.
+static bool stepm_isRun(void)
+{
+	for (int i = 0; i < STEPS_MOTORS; i++)
+		if (step_motors[i].isInProc)
+			return true;
+	return false;
+}
+
+/*
+ * Step timers of the move in process: stop for the feed hold and start again
+ */
+static void stepm_holdTimers(FunctionalState state)
+{
+#if (USE_STEPM_DDA == 1)
+	if (dda.events != 0)
+		TIM_Cmd(mx_timers[0].Timer, state);
+#else
+	#if (USE_STEPM_OC == 1)
+	__disable_irq();	// CR1 of the step IRQ (one pulse mode) is not lost
+	#endif
+	for (int i = 0; i < STEPS_MOTORS; i++)
+		if (step_motors[i].isInProc)
+			TIM_Cmd(mx_timers[i].Timer, state);
+	#if (USE_STEPM_OC == 1)
+	__enable_irq();
+	#endif
+#endif
+}
+#endif
+
+void stepm_nextMove(void);
+#if (STEPS_MOTORS > 0) && (USE_STEPM_DMA == 1)
+static void stepm_dmaStart(void);
+#endif
+
+/*
+ * Ramp generator IRQ: follows the velocity profile of the current move
+ */
+void stepm_rampProc(void)
+{
+#if (STEPS_MOTORS > 0) && defined(STEPM_RAMP_TIM)
+	uint32_t f;
+
+	#if (USE_STEPM_OC == 1)
+	if (TIM_GetITStatus(STEPM_RAMP_TIM, TIM_IT_Update) == RESET)
+	{	// pended by the step IRQ at the end of the move, it is not a tick of the profile
+		stepm_nextMove();
+		return;
+	}
+	#endif
+	TIM_ClearITPendingBit(STEPM_RAMP_TIM, TIM_IT_Update);
+
+	#if (USE_ENCODER == 1)
+	if (++ramp.encTick >= STEPM_RAMP_FRQ / ENCODER_LOOP_FRQ)
+	{
+		ramp.encTick = 0;
+		encoder_proc();
+	}
+	#endif
+	if (ramp.hold.state == STEPW_HOLD_STOP)
+		return;		// the move waits for the cycle start, its profile too
+	if (ramp.dwell != 0)
+	{	// dwell command: the next move starts after it
+		if (--ramp.dwell == 0)
+			stepm_nextMove();
+		return;
+	}
+	if (steps_buf_get != steps_buf_put)
+	{	// the motors are idle: the move of the producer starts here (stepm_publish)
+	#if (USE_STEPM_DMA == 1)
+		if (!stepw_isRun)
+			stepm_dmaStart();
+	#else
+		stepm_nextMove();	// it returns at once if a move is in process
+	#endif
+	}
+#if (USE_STEPM_ARC == 1) && (USE_STEPM_DDA == 1)
+	if (dda.isArc)
+		f = stepw_profileRun((STEPM_PROFILE *)&ramp.prof, stepw_arcLeft((STEPW_ARC *)&dda.arc));
+	else
+#endif
+	f = stepw_profileRun((STEPM_PROFILE *)&ramp.prof, step_motors[ramp.mainAxis].steps);
+	f = stepw_holdTick((STEPW_HOLD *)&ramp.hold, f);
+	if (f == 0)
+		stepm_holdTimers(DISABLE);	// feed hold: braking is over
+	else
+		stepm_runFrq(f);
+#endif
+}
+
+#if (STEPS_MOTORS > 0) && (USE_STEPM_OC == 1)
+/*
+ * Prepare the timer of the axis for the move: the timer stops by itself after the last pulse
+ * (one pulse mode is set when one step is left). Long moves with constant frequency are
+ * counted by the slave timer and the step IRQ is enabled only for the last step.
+ */
+static void stepm_ocStart(int i, bool isConstFrq)
+{
+	const mx_timer_init_t *mx_timer = &mx_timers[i];
+
+	stepm_setPulse(mx_timer, stepm_periods[i].period >> 17);
+	mx_timer->Timer->EGR = TIM_PSCReloadMode_Immediate;	// load PSC, ARR, CCR and clear the counter
+	TIM_SelectOnePulseMode(mx_timer->Timer, step_motors[i].steps <= 1 ? TIM_OPMode_Single : TIM_OPMode_Repetitive);
+
+	// no update IRQ to carry a fraction of the period: the counted steps would drift
+	step_motors[i].hwCount = mx_timer->Counter != NULL && isConstFrq
+		&& (stepm_periods[i].period & 0xffff) == 0
+		&& step_motors[i].steps >= STEPM_HW_COUNT_MIN && step_motors[i].steps <= 0x10001;
+	if (step_motors[i].hwCount)
+	{
+		TIM_ITConfig(mx_timer->Timer, TIM_IT_Update, DISABLE);
+		TIM_SetCounter(mx_timer->Counter, 0);
+		TIM_SetAutoreload(mx_timer->Counter, step_motors[i].steps - 2);	// overflow on the step before the last
+		TIM_ClearITPendingBit(mx_timer->Counter, TIM_IT_Update);
+		TIM_Cmd(mx_timer->Counter, ENABLE);
+	}
+}
+#endif
+
+/*
+ * Slave timer IRQ: all steps except the last one are done
+ */
+void stepm_cntProc(uint8_t id)
+{
+#if (STEPS_MOTORS > 0) && (USE_STEPM_OC == 1)
+	const mx_timer_init_t *mx_timer = &mx_timers[id];
+	int32_t done;
+
+	TIM_ClearITPendingBit(mx_timer->Counter, TIM_IT_Update);
+	TIM_Cmd(mx_timer->Counter, DISABLE);
+	if (!step_motors[id].hwCount)
+		return;
+
+	TIM_SelectOnePulseMode(mx_timer->Timer, TIM_OPMode_Single);
+	done = step_motors[id].steps - 1;
+	step_motors[id].globalSteps += step_motors[id].dir ? done : -done;
+	step_motors[id].steps = 1;
+	step_motors[id].hwCount = false;
+	TIM_ClearITPendingBit(mx_timer->Timer, TIM_IT_Update);
+	TIM_ITConfig(mx_timer->Timer, TIM_IT_Update, ENABLE);
+#endif
+}
+
+#if (STEPS_MOTORS > 0)
+// The move starts with the backlash takeup of these axes: it's not a change of the position
+static void stepm_takeBacklash(const LINE_DATA *p)
+{
+	for (int i = 0; i < STEPS_MOTORS && i < 3; i++)
+		if ((p->ramp.backlash & (1 << i)) != 0)
+		{
+			step_motors[i].globalSteps += p->dir[i] ? -_smParam.backlash[i] : _smParam.backlash[i];
+	#if (USE_ENCODER == 1)
+			encoder_shift(i, p->dir[i] ? _smParam.backlash[i] : -_smParam.backlash[i]);	// the motor turns
+	#endif
+		}
+}
+
+// Command at the head of the queue is executed, false - it's a move
+static bool stepm_nextCmd(void)
+{
+	LINE_DATA *p = (LINE_DATA *)(&steps_buf[steps_buf_get]);
+
+	if (p->cmd == STEPM_CMD_MOVE)
+		return false;
+	if (p->cmd == STEPM_CMD_OUTPUTS)
+		stepm_setOutputs((uint8_t)p->value);
+	else
+		ramp.dwell = p->value * (STEPM_RAMP_FRQ / 1000);
+	steps_buf_release(&steps_buf_get);
+	return true;
+}
+
 void stepm_nextMove(void)
 {
 	int i;
+	if (ramp.dwell != 0)
+		return;
 	for (i = 0; i < STEPS_MOTORS; i++)
 		if (step_motors[i].isInProc)
 			return;
 
 	// Check for moves presents in steps buffer and all motors stops
-	while (steps_buf_count != 0)
+	while (steps_buf_get != steps_buf_put)
 	{
+	#if (USE_ENCODER == 1)
+		if (encoderAlarm != 0)
+		{	// a move published after the alarm is dropped, not run
+			steps_buf_get = steps_buf_put;
+			return;
+		}
+	#endif
+		if (stepm_nextCmd())
+		{
+			if (ramp.dwell != 0)
+				return;		// the ramp IRQ goes on after the dwell
+			continue;
+		}
 		// Load next move
-		__disable_irq();
+		uint32_t fExitPrev = ramp.prof.line.fExit;
+		ramp.prof.phase = STEPM_PROFILE_OFF;
 		LINE_DATA *p = (LINE_DATA *)(&steps_buf[steps_buf_get]);
 	#if (USE_STEP_DEBUG == 1)
 		memcpy(&cur_steps_buf, p, sizeof(cur_steps_buf)); // for debug
 	#endif
 
+		stepm_takeBacklash(p);
 		mx_enable = 0;
 	#ifdef MX_EN_PORT
 		GPIO_ResetBits(mx_enables[0].Port, mx_enables[0].Pin);
@@ -242,36 +793,6 @@ void stepm_nextMove(void)
 				step_motors[i].steps = p->steps[i];
 				step_motors[i].dir = p->dir[i];
 
-	#if (USE_ENCODER == 1)
-				if (i == MX_ENCODER && isEncoderCorrection && step_motors[i].steps > ENCODER_CORRECTION_MIN_STEPS)
-				{
-					int32_t enVal = encoderZvalue();
-					int32_t globalSteps = stepm_getCurGlobalStepsNum(i);
-					int32_t dv = enVal * MM_PER_360 * 1000L / ENCODER_Z_CNT_PER_360 - globalSteps * MM_PER_360 * 1000L / SM_Z_STEPS_PER_360; // delta in 1/1000 mm
-					encoderCorrectionDelta = dv;	// TODO for debug.. will be removed
-					if (labs(encoderCorrectionMaxDelta) < labs(encoderCorrectionDelta))
-						encoderCorrectionMaxDelta = encoderCorrectionDelta;
-
-					if (dv > ENCODER_Z_MIN_MEASURE)
-					{
-						encoderCorrectionCntDown++;	// TODO for debug.. will be removed
-
-						step_motors[i].globalSteps++;
-						if (step_motors[i].dir)
-							step_motors[i].steps--;
-						else
-							step_motors[i].steps++;
-					}
-					if (dv < -ENCODER_Z_MIN_MEASURE)
-					{
-						encoderCorrectionCntUp++;	// TODO for debug.. will be removed
-
-						step_motors[i].globalSteps--;
-						if (step_motors[i].dir) step_motors[i].steps++;
-						else step_motors[i].steps--;
-					}
-				}
-	#endif
 				step_motors[i].clk = true;
 				MX_STEP_OFF(mx_steps[i].Port, mx_steps[i].Pin);
 				GPIO_WriteBit(mx_dirs[i].Port, mx_dirs[i].Pin, p->dir[i] ? Bit_SET : Bit_RESET);
@@ -280,32 +801,273 @@ void stepm_nextMove(void)
 	#else
 				GPIO_SetBits(mx_enables[i].Port, mx_enables[i].Pin);
 	#endif
-				mx_timers[i].Timer->PSC = p->pscValue[i];
-				TIM_SetAutoreload(mx_timers[i].Timer, p->arrValue[i]);
+	#if (USE_STEPM_DDA == 0)
+				stepm_loadPeriod(i, p->pscValue[i], p->period[i]);
+	#endif
+	#if (USE_STEPM_OC == 1)
+				stepm_ocStart(i, p->ramp.tAcc == 0 && p->ramp.decelSteps == 0);
+	#endif
 				step_motors[i].isInProc = true;
 			}
 		}
-
-		steps_buf_get++;
-		if (steps_buf_get >= STEPS_BUF_SIZE)
-			steps_buf_get = 0;
-		steps_buf_count--;
+	#if (USE_STEPM_DDA == 1)
+		dda.total = 0;
+		for (i = 0; i < STEPS_MOTORS; i++)
+		{
+			dda.delta[i] = p->steps[i] != 0 ? step_motors[i].steps : 0;
+			if (dda.delta[i] > dda.total)
+				dda.total = dda.delta[i];
+		}
+		for (i = 0; i < STEPS_MOTORS; i++)
+			dda.err[i] = dda.total >> 1;
+		dda.events = dda.total;
+		#if (USE_STEPM_ARC == 1)
+		dda.isArc = p->isArc;
+		if (p->isArc)
+		{
+			dda.arc = p->arc;
+			dda.events = 1;		// the arc tells its end
+		}
+		#endif
+		stepm_loadPeriod(0, p->pscValue[p->mainAxis], p->period[p->mainAxis]);
+	#endif
 
 		for (i = 0; i < STEPS_MOTORS; i++)
-			if (step_motors[i].isInProc)
-				TIM_Cmd(mx_timers[i].Timer, ENABLE);
+			ramp.kAxis[i] = p->kAxis[i];
+		ramp.mainAxis = p->mainAxis;
+		stepw_profileStart((STEPM_PROFILE *)&ramp.prof, (const STEPM_RAMP *)&p->ramp);
+		ramp.f = ramp.prof.f;	// the timers are set to it
+		if (ramp.hold.state != STEPW_HOLD_OFF)	// the feed hold goes on with the new move
+			stepw_holdNextMove((STEPW_HOLD *)&ramp.hold, (const STEPM_PROFILE *)&ramp.prof, fExitPrev);
+		if (ramp.hold.state != STEPW_HOLD_STOP)	// the override and the hold may keep it lower
+			stepm_runFrq(stepw_holdFrq((const STEPW_HOLD *)&ramp.hold, stepw_profileFrq((const STEPM_PROFILE *)&ramp.prof)));
+
+		steps_buf_release(&steps_buf_get);	// the slot is free for the producer
+
+		if (ramp.hold.state != STEPW_HOLD_STOP)
+			stepm_holdTimers(ENABLE);
 	#ifdef MX_EN_PORT
 		if (mx_enable)
 			GPIO_SetBits(mx_enables[0].Port, mx_enables[0].Pin);
 	#endif
-		__enable_irq();
-		if (mx_enable != 0)
-			break;
+		for (i = 0; i < STEPS_MOTORS; i++)
+			if (step_motors[i].isInProc)
+				return;
 	}
 }
 #endif
 
 
+#if (STEPS_MOTORS > 0) && (USE_STEPM_DMA == 1)
+static uint8_t stepm_dmaPort(GPIO_TypeDef *port)
+{
+	uint8_t i;
+	for (i = 0; i < STEPW_PORTS_MAX && stepw_ports[i] != NULL; i++)
+		if (stepw_ports[i] == port)
+			return i;
+	stepw_ports[i] = port;	// STEPW_PORTS_MAX is enough for the boards
+	stepw_bufs[i] = stepw_wave[i];
+	return i;
+}
+
+/*
+ * STEPW_TIM compare events (CC1, CC2, CC4) request the DMA channels of the ports,
+ * each channel copies the waveform to BSRR of its port in the circular mode
+ */
+static void stepm_dmaInit(void)
+{
+	STEPW_PIN step[STEPS_MOTORS], dir[STEPS_MOTORS];
+	TIM_TimeBaseInitTypeDef TIM_TimeBase;
+	TIM_OCInitTypeDef TIM_OC;
+	DMA_InitTypeDef DMA_InitStructure;
+	NVIC_InitTypeDef NVIC_InitStructure;
+	int i;
+
+	for (i = 0; i < STEPS_MOTORS; i++)
+	{
+		step[i].port = stepm_dmaPort(mx_steps[i].Port);
+		step[i].pin = mx_steps[i].Pin;
+		dir[i].port = stepm_dmaPort(mx_dirs[i].Port);
+		dir[i].pin = mx_dirs[i].Pin;
+	}
+	stepw_init(step, dir, STEPS_MOTORS, STEPW_TICK_FRQ);
+#if (USE_STEPW_SHAPER == 1)
+	{
+		static const double frq[] = { SM_SHAPER_FRQ_X, SM_SHAPER_FRQ_Y, SM_SHAPER_FRQ_Z };
+		static const double damping[] = { SM_SHAPER_DAMPING_X, SM_SHAPER_DAMPING_Y, SM_SHAPER_DAMPING_Z };
+
+		for (i = 0; i < STEPS_MOTORS && i < 3; i++)
+			stepw_shaperInit(i, SM_SHAPER_TYPE, frq[i], damping[i]);
+	}
+#endif
+
+	STEPW_TIM_CLK();
+	STEPW_DMA_CLK();
+
+	TIM_TimeBaseStructInit(&TIM_TimeBase);
+	TIM_TimeBase.TIM_Prescaler = 0;
+	TIM_TimeBase.TIM_Period = SystemCoreClock / STEPW_TICK_FRQ - 1;
+	TIM_TimeBaseInit(STEPW_TIM, &TIM_TimeBase);
+	TIM_OCStructInit(&TIM_OC);
+	TIM_OC.TIM_OCMode = TIM_OCMode_Timing;
+	TIM_OC.TIM_Pulse = 1;
+	TIM_OC1Init(STEPW_TIM, &TIM_OC);
+	TIM_OC.TIM_Pulse = 2;
+	TIM_OC2Init(STEPW_TIM, &TIM_OC);
+	TIM_OC.TIM_Pulse = 3;
+	TIM_OC4Init(STEPW_TIM, &TIM_OC);
+
+	DMA_StructInit(&DMA_InitStructure);
+	DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+	DMA_InitStructure.DMA_BufferSize = STEPW_HALF_TICKS * 2;
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_VeryHigh;
+	DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+	for (i = 0; i < STEPW_PORTS_MAX && stepw_ports[i] != NULL; i++)
+	{
+		DMA_DeInit(stepw_dma[i]);
+		DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&stepw_ports[i]->BSRR;
+		DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)stepw_wave[i];
+		DMA_Init(stepw_dma[i], &DMA_InitStructure);
+	}
+	// the first channel tells when the half of the waveform is played
+	DMA_ITConfig(stepw_dma[0], DMA_IT_HT | DMA_IT_TC, ENABLE);
+
+	NVIC_InitStructure.NVIC_IRQChannel = STEPW_DMA_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 2;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+	stepw_isRun = false;
+}
+
+/*
+ * Fill the half of the waveform with the queued moves. Returns false if there was nothing to do.
+ */
+static bool stepm_dmaFill(uint16_t offset)
+{
+	uint16_t n = 0;
+	bool isBusy = false;
+	int i;
+
+	while (n < STEPW_HALF_TICKS)
+	{
+	#if (USE_ENCODER == 1)
+		if (encoderAlarm != 0)
+			steps_buf_get = steps_buf_put;	// a move published after the alarm is dropped, not run
+	#endif
+		if (stepw_isIdle() && steps_buf_get != steps_buf_put)
+		{
+			LINE_DATA *p = (LINE_DATA *)(&steps_buf[steps_buf_get]);
+	#if (USE_STEP_DEBUG == 1)
+			memcpy(&cur_steps_buf, p, sizeof(cur_steps_buf)); // for debug
+	#endif
+			if (p->cmd == STEPM_CMD_OUTPUTS)
+				stepm_setOutputs((uint8_t)p->value);	// it's ahead of the motion by the waveform played
+			else if (p->cmd == STEPM_CMD_DWELL)
+				stepw_loadDwell((uint32_t)((uint64_t)p->value * STEPW_TICK_FRQ / 1000));
+			else
+	#if (USE_STEPM_ARC == 1)
+			if (p->isArc)
+				stepw_loadArc(&p->arc, &p->ramp);
+			else
+	#endif
+			{
+				stepm_takeBacklash(p);
+				stepw_loadMove(p->steps, p->dir, &p->ramp);
+			}
+			steps_buf_release(&steps_buf_get);
+		}
+		if (stepw_isPlaying())
+			isBusy = true;
+		n += stepw_fill(stepw_bufs, offset + n, STEPW_HALF_TICKS - n);
+	}
+	for (i = 0; i < STEPS_MOTORS; i++)
+		step_motors[i].globalSteps += stepw_takeSteps(i);
+	return isBusy;
+}
+
+static void stepm_dmaStart(void)
+{
+	int i;
+
+	for (i = 0; i < STEPS_MOTORS; i++)
+	{
+	#ifdef MX_EN_PORT
+		mx_enable |= (1 << i);
+	#else
+		GPIO_SetBits(mx_enables[i].Port, mx_enables[i].Pin);
+	#endif
+	}
+	#ifdef MX_EN_PORT
+	GPIO_SetBits(mx_enables[0].Port, mx_enables[0].Pin);
+	#endif
+
+	stepm_dmaFill(0);
+	stepm_dmaFill(STEPW_HALF_TICKS);
+	stepw_idleHalves = 0;
+	stepw_isRun = true;
+	for (i = 0; i < STEPW_PORTS_MAX && stepw_ports[i] != NULL; i++)
+	{
+		DMA_SetCurrDataCounter(stepw_dma[i], STEPW_HALF_TICKS * 2);
+		DMA_Cmd(stepw_dma[i], ENABLE);
+		TIM_DMACmd(STEPW_TIM, stepw_dmaCC[i], ENABLE);
+	}
+	TIM_SetCounter(STEPW_TIM, 0);
+	TIM_Cmd(STEPW_TIM, ENABLE);
+}
+
+static void stepm_dmaStop(void)
+{
+	int i;
+
+	TIM_Cmd(STEPW_TIM, DISABLE);
+	for (i = 0; i < STEPW_PORTS_MAX && stepw_ports[i] != NULL; i++)
+	{
+		TIM_DMACmd(STEPW_TIM, stepw_dmaCC[i], DISABLE);
+		DMA_Cmd(stepw_dma[i], DISABLE);
+	}
+	DMA_ClearITPendingBit(STEPW_DMA_IT_GL);
+	stepw_isRun = false;
+}
+#endif
+
+/*
+ * DMA half/complete IRQ: refill the played half of the waveform.
+ * The engine stops after the waveform was idle for a while.
+ */
+void stepm_dmaProc(void)
+{
+#if (STEPS_MOTORS > 0) && (USE_STEPM_DMA == 1)
+	uint16_t offset;
+
+	if (DMA_GetITStatus(STEPW_DMA_IT_HT))
+	{
+		DMA_ClearITPendingBit(STEPW_DMA_IT_HT);
+		offset = 0;
+	}
+	else
+	{
+		DMA_ClearITPendingBit(STEPW_DMA_IT_TC);
+		offset = STEPW_HALF_TICKS;
+	}
+
+	if (limits_chk())
+	{
+		stepm_EmergeStop();
+		return;
+	}
+	if (stepm_dmaFill(offset))
+		stepw_idleHalves = 0;
+	else if (++stepw_idleHalves > 2)	// the last STEP reset is played too
+		stepm_dmaStop();
+#endif
+}
+
 void stepm_proc(uint8_t id)
 {
 
@@ -322,8 +1084,34 @@ void stepm_proc(uint8_t id)
 		return;
 	}
 
+#if (USE_STEPM_OC == 1)
+	// update event: falling edge of STEP is done by the timer
+	if (step_motors[id].isInProc)
+	{
+		stepm_nextPeriod(id);
+		if (step_motors[id].steps != 0)
+			step_motors[id].steps--;
+		if (step_motors[id].dir)
+			step_motors[id].globalSteps++;
+		else
+			step_motors[id].globalSteps--;
+		if (step_motors[id].steps == 1)
+			TIM_SelectOnePulseMode(mx_timers[id].Timer, TIM_OPMode_Single);	// stop after the last pulse
+		else if (step_motors[id].steps == 0)
+		{
+			TIM_Cmd(mx_timers[id].Timer, DISABLE);
+			step_motors[id].isInProc = false;
+	#ifdef STEPM_RAMP_TIM
+			NVIC_SetPendingIRQ(STEPM_RAMP_TIM_IRQn);	// the ramp IRQ, which owns the profile, loads the next move
+	#else
+			stepm_nextMove();
+	#endif
+		}
+	}
+#else
 	if (step_motors[id].isInProc)
 	{
+		stepm_nextPeriod(id);
 		if (step_motors[id].clk)
 			MX_STEP_ON(mx_steps[id].Port, mx_steps[id].Pin);
 		else
@@ -347,15 +1135,136 @@ void stepm_proc(uint8_t id)
 		}
 	}
 #endif
+#endif
+}
+
+/*
+ * DDA tick: STEP is raised on one IRQ and dropped on the next one, as in stepm_proc.
+ * At the end of the move the next one is loaded without stopping the timer.
+ */
+void stepm_ddaProc(void)
+{
+#if (STEPS_MOTORS > 0) && (USE_STEPM_DDA == 1)
+	int i;
+
+	TIM_ClearITPendingBit(mx_timers[0].Timer, TIM_IT_Update);
+
+	if (limits_chk())
+	{
+		stepm_EmergeStop();
+		return;
+	}
+	if (dda.events == 0)
+		return;
+	stepm_nextPeriod(0);
+
+	if (!dda.clk)
+	{
+		dda.mask = 0;
+	#if (USE_STEPM_ARC == 1)
+		if (dda.isArc)
+		{
+			dda.mask = dda.arc.mask;
+			for (i = 0; i < 2; i++)
+			{
+				if ((dda.mask & (1 << i)) == 0)
+					continue;
+				MX_STEP_ON(mx_steps[i].Port, mx_steps[i].Pin);
+				if (step_motors[i].dir)
+					step_motors[i].globalSteps++;
+				else
+					step_motors[i].globalSteps--;
+			}
+			dda.clk = true;
+			return;
+		}
+	#endif
+		for (i = 0; i < STEPS_MOTORS; i++)
+		{
+			dda.err[i] -= dda.delta[i];
+			if (dda.err[i] < 0 && step_motors[i].steps != 0)
+			{
+				dda.err[i] += dda.total;
+				dda.mask |= 1 << i;
+				MX_STEP_ON(mx_steps[i].Port, mx_steps[i].Pin);
+				step_motors[i].steps--;
+				if (step_motors[i].dir)
+					step_motors[i].globalSteps++;
+				else
+					step_motors[i].globalSteps--;
+			}
+		}
+		dda.clk = true;
+		return;
+	}
+
+	for (i = 0; i < STEPS_MOTORS; i++)
+		if (dda.mask & (1 << i))
+			MX_STEP_OFF(mx_steps[i].Port, mx_steps[i].Pin);
+	dda.clk = false;
+
+	#if (USE_STEPM_ARC == 1)
+	if (dda.isArc && stepw_arcNext((STEPW_ARC *)&dda.arc))
+	{	// DIR of the next event is set half a period before its STEP
+		for (i = 0; i < 2; i++)
+		{
+			uint8_t dir = (dda.arc.dir >> i) & 1;
+			if ((dda.arc.mask & (1 << i)) != 0 && step_motors[i].dir != dir)
+			{
+				step_motors[i].dir = dir;
+				GPIO_WriteBit(mx_dirs[i].Port, mx_dirs[i].Pin, dir ? Bit_SET : Bit_RESET);
+			}
+		}
+		return;
+	}
+	#endif
+	if (--dda.events == 0)
+	{
+		for (i = 0; i < STEPS_MOTORS; i++)
+			step_motors[i].isInProc = false;
+		stepm_nextMove();
+		if (dda.events == 0)
+			TIM_Cmd(mx_timers[0].Timer, DISABLE);
+	}
+#endif
 }
 
 void stepm_EmergeStop(void)
 {
 	__disable_irq();
 
-	steps_buf_count = 0;
-	steps_buf_get = steps_buf_put = 0;
+	steps_buf_get = steps_buf_put;	// drop queued moves (consumer side)
+#if (STEPS_MOTORS > 0)
+	ramp.prof.phase = STEPM_PROFILE_OFF;
+	ramp.hold.state = STEPW_HOLD_OFF;
+	ramp.dwell = 0;
+#endif
+	stepm_setOutputs(0);	// spindle and coolant are off too
 #if (STEPS_MOTORS > 0)
+	#if (USE_STEPM_DMA == 1)
+	stepm_dmaStop();
+	stepw_reset();
+	for (int i = 0; i < STEPS_MOTORS; i++)
+	{
+		MX_STEP_OFF(mx_steps[i].Port, mx_steps[i].Pin);
+		step_motors[i].globalSteps += stepw_takeSteps(i);	// steps of the waveform which is not played are lost
+	}
+	#endif
+	#if (USE_STEPM_DDA == 1)
+	TIM_Cmd(mx_timers[0].Timer, DISABLE);
+	TIM_ClearITPendingBit(mx_timers[0].Timer, TIM_IT_Update);
+	dda.events = 0;
+	dda.clk = false;
+	#if (USE_STEPM_ARC == 1)
+	dda.isArc = false;
+	#endif
+	for (int i = 0; i < STEPS_MOTORS; i++)
+	{
+		MX_STEP_OFF(mx_steps[i].Port, mx_steps[i].Pin);
+		step_motors[i].isInProc = false;
+		step_motors[i].clk = true;
+	}
+	#endif
 	for (int i = 0; i < STEPS_MOTORS; i++)
 	{
 		step_motors[i].steps = 0;
@@ -363,6 +1272,17 @@ void stepm_EmergeStop(void)
 		{
 			TIM_Cmd(mx_timers[i].Timer, DISABLE);
 			TIM_ClearITPendingBit(mx_timers[i].Timer, (TIM_IT_Update | TIM_IT_CC1 | TIM_IT_CC2 | TIM_IT_CC3 | TIM_IT_CC4 | TIM_IT_COM | TIM_IT_Trigger | TIM_IT_Break));
+	#if (USE_STEPM_OC == 1)
+			if (step_motors[i].hwCount)
+			{	// steps done by the hardware
+				int32_t done = TIM_GetCounter(mx_timers[i].Counter);
+				TIM_Cmd(mx_timers[i].Counter, DISABLE);
+				step_motors[i].globalSteps += step_motors[i].dir ? done : -done;
+				step_motors[i].hwCount = false;
+				TIM_ITConfig(mx_timers[i].Timer, TIM_IT_Update, ENABLE);
+			}
+			mx_timers[i].Timer->EGR = TIM_PSCReloadMode_Immediate;	// STEP pin low
+	#endif
 			step_motors[i].isInProc = false;
 	#ifdef MX_EN_PORT
 			mx_enable &= ~(1 << i);	// clear M?_ENABLE
@@ -379,77 +1299,196 @@ void stepm_EmergeStop(void)
 	__enable_irq();
 }
 
-void stepm_addMove(uint32_t steps[4], uint32_t frq[4], uint8_t dir[4])
+void stepm_feedHold(void)
 {
+#if (STEPS_MOTORS > 0)
+	__disable_irq();
+	#if (USE_STEPM_DMA == 1)
+	stepw_hold(true);
+	#else
+	stepw_holdStart((STEPW_HOLD *)&ramp.hold, (const STEPM_PROFILE *)&ramp.prof, stepm_isRun());
+	if (ramp.hold.state == STEPW_HOLD_STOP)
+		stepm_holdTimers(DISABLE);
+	#endif
+	__enable_irq();
+#endif
+}
 
+void stepm_cycleStart(void)
+{
 #if (STEPS_MOTORS > 0)
+	__disable_irq();
+	#if (USE_STEPM_DMA == 1)
+	stepw_hold(false);
+	#else
+	bool isStop = ramp.hold.state == STEPW_HOLD_STOP;
 
-	uint32_t pscValue;
-	int i;
+	stepw_holdResume((STEPW_HOLD *)&ramp.hold, (const STEPM_PROFILE *)&ramp.prof, stepm_isRun());
+	if (isStop && ramp.hold.state == STEPW_HOLD_ACC)
+	{	// from the speed which is safe to start with
+		stepm_runFrq(ramp.hold.f);
+		stepm_holdTimers(ENABLE);
+	}
+	#endif
+	__enable_irq();
+#endif
+}
 
-	bool empty = true;
-	for (i = 0; i < STEPS_MOTORS; i++)
-		if (steps[i] != 0)
-		{
-			empty = false;
-			break;
-		}
-	if (empty)
+void stepm_setOverride(uint16_t feed, uint16_t rapid)
+{
+	stepw_setOverride(feed, rapid);
+}
+
+#if (STEPS_MOTORS > 0)
+static void stepm_publish(void)
+{
+	steps_buf_publish(&steps_buf_put);
+	// the motors may be idle: the ramp IRQ starts the move at once, the loading of a move
+	// is never preempted by the IRQs which run it
+	NVIC_SetPendingIRQ(STEPM_RAMP_TIM_IRQn);
+}
+#endif
+
+static void stepm_putLine(uint32_t steps[], uint32_t frq[], uint8_t dir[], const STEPM_RAMP *profile, const STEPW_ARC *arc)
+{
+
+#if (STEPS_MOTORS > 0)
+
+	int i, n = 0;
+
+	for (i = 1; i < STEPS_MOTORS; i++)
+		if (steps[i] > steps[n])
+			n = i;
+	if (steps[n] == 0)
 		return;
 
-	LINE_DATA *p = (LINE_DATA *)(&steps_buf[steps_buf_put]);
+	uint8_t put = steps_buf_put;
+	LINE_DATA *p = (LINE_DATA *)(&steps_buf[put]);
 
-	while (steps_buf_count >= STEPS_BUF_SIZE)
-	{
-		// __WFI();
-	}
+	while (steps_buf_isFull(put, steps_buf_get))
+		__WFI();	// queue is full: sleep until a step IRQ frees a slot
 
+	p->mainAxis = (uint8_t)n;
+	if (profile != NULL)
+		p->ramp = *profile;
+	else
+	{	// constant frequency
+		p->ramp.fEntry = p->ramp.fPeak = p->ramp.fExit = frq[n];
+		p->ramp.tAcc = 0;
+		p->ramp.decelSteps = 0;
+		p->ramp.fStop = frq[n];	// moves without acceleration start and stop with their frequency
+		p->ramp.accel = 0;
+		p->ramp.ovr = 0;
+		p->ramp.isRapid = 0;
+		p->ramp.backlash = 0;
+	}
 	for (i = 0; i < STEPS_MOTORS; i++)
 	{
-		uint32_t f = frq[i];
-		if (f > (15000 * K_FRQ))
-			f = 15000 * K_FRQ;	// 15kHz
-		if (f < K_FRQ)
-			f = K_FRQ;			// 1Hz
-
-		// SystemCoreClock / (psc * arr) = frq
-		pscValue = 1;
-
-		uint32_t arrValue = (SystemCoreClock / 2 * K_FRQ) / f; // (1 falling age on 2 IRQ)
-		while ((arrValue & 0xffff0000) != 0)
-		{
-			pscValue = pscValue << 1;
-			arrValue = arrValue >> 1;
-		}
-		pscValue--;
+		p->kAxis[i] = (uint32_t)(((uint64_t)steps[i] << 16) / steps[n]);
+		stepm_frqToTimer(frq[i], (uint32_t *)&p->pscValue[i], (uint32_t *)&p->period[i]);
 		p->f[i] = frq[i]; // for debug
-		p->arrValue[i] = arrValue;
-		p->pscValue[i] = pscValue;
 		p->dir[i] = dir[i];
 		p->steps[i] = steps[i];
 	}
+	#if (USE_STEPM_ARC == 1)
+	p->isArc = arc != NULL;
+	if (arc != NULL)
+		p->arc = *arc;
+	#endif
+	p->cmd = STEPM_CMD_MOVE;
+	stepm_publish();
+
+#endif
+}
+
+void stepm_addMove(uint32_t steps[], uint32_t frq[], uint8_t dir[])
+{
+	stepm_putLine(steps, frq, dir, NULL, NULL);
+}
+
+void stepm_addRamp(uint32_t steps[], uint8_t dir[], const STEPM_RAMP *profile)
+{
+#if (STEPS_MOTORS > 0)
+	uint32_t frq[STEPS_MOTORS];
+	int i, n = 0;
+
+	for (i = 1; i < STEPS_MOTORS; i++)
+		if (steps[i] > steps[n])
+			n = i;
+	if (steps[n] == 0)
+		return;
+	for (i = 0; i < STEPS_MOTORS; i++)
+		frq[i] = (uint32_t)((uint64_t)profile->fEntry * steps[i] / steps[n]);
+	stepm_putLine(steps, frq, dir, profile, NULL);
+#endif
+}
+
+/*
+ * X and Y are marked as used by the move with the path length as their steps,
+ * the steps are made by the arc DDA of the engine
+ */
+void stepm_addArc(const STEPM_ARC *arc, const STEPM_RAMP *profile)
+{
+#if (STEPS_MOTORS > 1) && (USE_STEPM_ARC == 1)
+	uint32_t steps[STEPS_MOTORS], frq[STEPS_MOTORS];
+	uint8_t dir[STEPS_MOTORS];
+	STEPW_ARC w;
+	int i;
+
+	stepw_arcStart(&w, arc);
+	if (!stepw_arcNext(&w))
+		return;
+	for (i = 0; i < STEPS_MOTORS; i++)
+	{
+		steps[i] = i < 2 ? arc->length + 2 : 0;
+		frq[i] = i < 2 ? stepw_arcFrq(&w, profile->fEntry) : 0;
+		dir[i] = (w.dir >> i) & 1;
+	}
+	stepm_putLine(steps, frq, dir, profile, &w);
+#endif
+}
 
-	steps_buf_put++;
-	if (steps_buf_put >= STEPS_BUF_SIZE)
-		steps_buf_put = 0;
-	__disable_irq();
-	steps_buf_count++;
-	if (mx_enable == 0)
-		stepm_nextMove();
-	__enable_irq();
+void stepm_addCmd(uint8_t cmd, uint32_t value)
+{
+#if (STEPS_MOTORS > 0)
+	uint8_t put = steps_buf_put;
+	LINE_DATA *p = (LINE_DATA *)(&steps_buf[put]);
 
+	while (steps_buf_isFull(put, steps_buf_get))
+		__WFI();	// queue is full: sleep until a step IRQ frees a slot
+
+	memset(p->steps, 0, sizeof(p->steps));
+	p->cmd = cmd;
+	p->value = value;
+	stepm_publish();
+#else
+	if (cmd == STEPM_CMD_OUTPUTS)
+		stepm_setOutputs((uint8_t)value);
 #endif
 }
 
+uint8_t stepm_getOutputs(void)
+{
+	return stepm_outputs;
+}
+
 int32_t stepm_getRemainLines(void)
 {
-	return steps_buf_count;
+	return steps_buf_count(steps_buf_put, steps_buf_get);
 }
 
 int32_t stepm_inProc(void)
 {
-	if (steps_buf_count > 0)
+	if (steps_buf_get != steps_buf_put)
 		return true;
+#if (STEPS_MOTORS > 0)
+	if (ramp.dwell != 0)
+		return true;
+#endif
+#if (STEPS_MOTORS > 0) && (USE_STEPM_DMA == 1)
+	if (stepw_isRun)
+		return true;
+#endif
 #if (STEPS_MOTORS > 0)
 	for (int i = 0; i < STEPS_MOTORS; i++)
 		if (step_motors[i].isInProc)
@@ -460,18 +1499,66 @@ int32_t stepm_inProc(void)
 
 uint32_t stepm_LinesBufferIsFull(void)
 {
-	return steps_buf_count >= STEPS_BUF_SIZE;
+	return steps_buf_isFull(steps_buf_put, steps_buf_get);
 }
 
 int32_t stepm_getCurGlobalStepsNum(uint8_t id)
 {
 #if (STEPS_MOTORS > 0)
+	#if (USE_STEPM_OC == 1)
+	if (step_motors[id].hwCount)
+	{
+		int32_t done = TIM_GetCounter(mx_timers[id].Counter);
+		return step_motors[id].globalSteps + (step_motors[id].dir ? done : -done);
+	}
+	#endif
 	return step_motors[id].globalSteps;
 #else
 	return 0;
 #endif
 }
 
+/*
+ * Encoder correction: the motor makes d (+1 or -1) steps more in the move going on,
+ * the position is not changed. false - the move can't take it: no move or its end is near,
+ * the steps are counted by the hardware, the arc, the main axis of DDA (d in the move
+ * direction), the DMA waveform.
+ */
+bool stepm_correct(uint8_t id, int8_t d)
+{
+	bool isDone = false;
+#if (STEPS_MOTORS > 0) && (USE_STEPM_DMA == 0) && (USE_ENCODER == 1)
+	int32_t n;
+
+	if (id >= STEPS_MOTORS)
+		return false;
+	__disable_irq();
+	if (step_motors[id].isInProc && !step_motors[id].hwCount && step_motors[id].steps > ENCODER_CORRECTION_MIN_STEPS)
+	{
+		n = step_motors[id].dir ? d : -d;	// steps more in the move
+		isDone = true;
+	#if (USE_STEPM_DDA == 1)
+		// Bresenham makes one step more or less over the rest of the move
+		if (n > 0 && step_motors[id].steps + 1 >= dda.events)
+			isDone = false;
+		#if (USE_STEPM_ARC == 1)
+		if (dda.isArc)
+			isDone = false;
+		#endif
+		if (isDone)
+			dda.err[id] -= n * (int32_t)dda.total;
+	#endif
+		if (isDone)
+		{
+			step_motors[id].steps += n;
+			step_motors[id].globalSteps -= d;
+		}
+	}
+	__enable_irq();
+#endif
+	return isDone;
+}
+
 void stepm_ZeroGlobalCrd(void)
 {
 #if (STEPS_MOTORS > 0)
@@ -488,7 +1575,7 @@ void step_dump()
 	for (int i = 0; i < 4; i++)
 	{
 		scr_gotoxy(1, 7 + i);
-		scr_printf("%d,%d,%d,%d [%d]   ", p->steps[i], p->dir[i], p->pscValue[i], p->arrValue[i], p->f[i]); // TODO
+		scr_printf("%d,%d,%d,%d [%d]   ", p->steps[i], p->dir[i], p->pscValue[i], p->period[i] >> 16, p->f[i]); // TODO
 	}
 	#endif
 }
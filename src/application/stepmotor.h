@@ -5,15 +5,65 @@
 
 void stepm_init(void);
 void stepm_EmergeStop(void);
-extern uint8_t stepmPause;
+// Feed hold: the motion brakes within the acceleration and stops in the middle of the move,
+// queued moves stay. Cycle start goes on from the same step with a new acceleration.
+void stepm_feedHold(void);
+void stepm_cycleStart(void);
+// Feed and rapid override (percent) for the moves in the step queue: they are slowed down
+// if the override is below the one they are planned with, never sped up
+void stepm_setOverride(uint16_t feed, uint16_t rapid);
+
+// Ramp generator tick (Hz): frequency of the step timers is updated with this rate
+#define STEPM_RAMP_FRQ	2000
+
+// Velocity profile of a move. Frequencies are for the axis with max steps (steps/sec * K_FRQ),
+// other axes follow it in proportion of their steps.
+// Acceleration is S-shaped (3t^2-2t^3) over tAcc ramp ticks. Braking is S-shaped too,
+// its time is taken from the steps left, so the move always ends with fExit.
+typedef struct {
+	uint32_t fEntry, fPeak, fExit;
+	uint16_t tAcc;
+	uint32_t decelSteps;	// steps of the main axis left when braking starts, 0 - no braking
+	uint32_t fStop;			// feed hold: frequency which is safe to stop from
+	uint32_t accel;			// feed hold: frequency change per ramp tick, 0 - stop at once
+	uint16_t ovr;			// override (percent) the move is planned with, 0 - not scaled
+	uint8_t  isRapid;		// the rapid override is applied
+	uint8_t  backlash;		// axes (bits) whose steps start with the backlash, it's not a move of them
+} STEPM_RAMP;
+
+// Circular move in XY plane (USE_STEPM_ARC). Points are from the centre of the circle in steps,
+// the end point may be off the circle by a step or two. Frequencies of the ramp are for the path
+// along the arc, length is the path in steps.
+typedef struct {
+	int32_t  x, y, xEnd, yEnd;
+	uint32_t r, length;
+	uint8_t  cw;
+} STEPM_ARC;
+
+// Commands of the step queue: executed in order with the moves, the motion is stopped at them
+#define STEPM_CMD_MOVE		0
+#define STEPM_CMD_DWELL		1	// value - msec
+#define STEPM_CMD_OUTPUTS	2	// value - new state of all STEPM_OUT_* outputs
+
+#define STEPM_OUT_SPINDLE	(1 << 0)	// M3 / M5
+#define STEPM_OUT_MIST		(1 << 1)	// M7 / M9
+#define STEPM_OUT_FLOOD		(1 << 2)	// M8 / M9
+#define STEPM_OUT_FAN		(1 << 3)	// M106 / M107
 
 void stepm_addMove(uint32_t steps[], uint32_t frq[], uint8_t dir[]);
+void stepm_addRamp(uint32_t steps[], uint8_t dir[], const STEPM_RAMP *ramp);
+void stepm_addArc(const STEPM_ARC *arc, const STEPM_RAMP *ramp);
+void stepm_addCmd(uint8_t cmd, uint32_t value);
+// Outputs set by the last executed STEPM_CMD_OUTPUTS
+uint8_t stepm_getOutputs(void);
 
 uint32_t stepm_LinesBufferIsFull(void);
 int32_t stepm_getRemainLines(void);
 
 int32_t stepm_getCurGlobalStepsNum(uint8_t id);
 void stepm_ZeroGlobalCrd(void);
+// The motor makes d (+1/-1) steps more in the move going on, see encoder.h
+bool stepm_correct(uint8_t id, int8_t d);
 int32_t stepm_inProc(void);
 void step_dump(void);
 
@@ -0,0 +1,47 @@
+#ifndef STEPQ_H_
+#define STEPQ_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Index ring of the moves queue (stepmotor.c): single producer (stepm_addMove/stepm_addRamp)
+ * and single consumer (the step IRQs). Only the producer writes put and only the consumer
+ * writes get, one slot is always kept free, so no IRQ masking is needed.
+ * The slot is written before put goes on and read before get goes on (__DMB).
+ * Plain C: tools/hosttest/spsc_test.c runs it with two threads.
+ */
+#ifndef STEPS_BUF_SIZE
+	#define STEPS_BUF_SIZE	16
+#endif
+
+static __INLINE uint8_t steps_buf_next(uint8_t idx)
+{
+	return ++idx >= STEPS_BUF_SIZE ? 0 : idx;
+}
+
+static __INLINE uint8_t steps_buf_count(uint8_t put, uint8_t get)
+{
+	return put >= get ? put - get : put + STEPS_BUF_SIZE - get;
+}
+
+static __INLINE bool steps_buf_isFull(uint8_t put, uint8_t get)
+{
+	return steps_buf_next(put) == get;
+}
+
+// Producer: the slot at *put is written, it goes to the consumer
+static __INLINE void steps_buf_publish(volatile uint8_t *put)
+{
+	__DMB();
+	*put = steps_buf_next(*put);
+}
+
+// Consumer: the slot at *get is done, it goes back to the producer
+static __INLINE void steps_buf_release(volatile uint8_t *get)
+{
+	__DMB();
+	*get = steps_buf_next(*get);
+}
+
+#endif /* STEPQ_H_ */
@@ -0,0 +1,866 @@
+/*
+ * Velocity profile follower and step waveform builder.
+ * No hardware access here: the same code runs in the step IRQs and on a host.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _WINDOWS
+	#include "stdafx.h"
+#else
+	#include "global.h"
+#endif
+
+#include "gcode.h"
+#include "stepwave.h"
+
+/*
+ * S-shaped transition from fFrom to fTo: 3t^2 - 2t^3, t = tick / ticks
+ */
+static uint32_t stepw_sCurve(uint32_t fFrom, uint32_t fTo, uint32_t tick, uint32_t ticks)
+{
+	uint32_t t = (tick << 15) / ticks;						// Q15
+	uint32_t k = ((t * t) >> 15) * (3 * 32768 - 2 * t) >> 15;	// Q15
+	return fFrom + (int32_t)(((int64_t)((int32_t)fTo - (int32_t)fFrom) * k) >> 15);
+}
+
+#define STEPW_K_ONE		((uint32_t)1 << 16)
+
+static uint16_t stepw_ovr[2] = {100, 100};	// feed, rapid
+
+void stepw_profileStart(STEPM_PROFILE *prof, const STEPM_RAMP *line)
+{
+	if (prof->k == 0)
+		prof->k = STEPW_K_ONE;
+	prof->phase = STEPM_PROFILE_OFF;
+	prof->line = *line;
+	prof->f = prof->fFrom = line->fEntry;
+	prof->tick = 0;
+	if (line->tAcc != 0)
+		prof->phase = STEPM_PROFILE_ACC;
+	else if (line->decelSteps != 0)
+		prof->phase = STEPM_PROFILE_RUN;
+}
+
+uint32_t stepw_profileTick(STEPM_PROFILE *prof, uint32_t stepsLeft)
+{
+	uint32_t f = prof->f;
+
+	switch (prof->phase)
+	{
+	case STEPM_PROFILE_OFF:
+		return f;
+	case STEPM_PROFILE_ACC:
+		if (++prof->tick >= prof->line.tAcc)
+		{
+			f = prof->line.fPeak;
+			prof->phase = STEPM_PROFILE_RUN;
+		}
+		else
+			f = stepw_sCurve(prof->fFrom, prof->line.fPeak, prof->tick, prof->line.tAcc);
+		break;
+	case STEPM_PROFILE_DEC:
+		if (++prof->tick >= prof->tDec)
+		{
+			f = prof->line.fExit;
+			prof->phase = STEPM_PROFILE_OFF;
+		}
+		else
+			f = stepw_sCurve(prof->fFrom, prof->line.fExit, prof->tick, prof->tDec);
+		break;
+	}
+	if ((prof->phase == STEPM_PROFILE_ACC || prof->phase == STEPM_PROFILE_RUN) && stepsLeft <= prof->line.decelSteps)
+	{	// braking point is reached: the average frequency of the S-curve is (f + fExit) / 2,
+		// so the time which covers the steps left is known even if the peak wasn't reached
+		uint32_t ticks = (uint32_t)((uint64_t)stepsLeft * (2 * K_FRQ * STEPM_RAMP_FRQ) / (f + prof->line.fExit));
+		prof->tDec = ticks > 0xffff ? 0xffff : (ticks == 0 ? 1 : ticks);
+		prof->phase = STEPM_PROFILE_DEC;
+		prof->tick = 0;
+		prof->fFrom = f;
+	}
+	prof->f = f;
+	return f;
+}
+
+void stepw_setOverride(uint16_t feed, uint16_t rapid)
+{
+	stepw_ovr[0] = feed;
+	stepw_ovr[1] = rapid;
+}
+
+uint32_t stepw_profileFrq(const STEPM_PROFILE *prof)
+{
+	return prof->k == 0 ? prof->f : (uint32_t)(((uint64_t)prof->f * prof->k) >> 16);
+}
+
+uint32_t stepw_profileRun(STEPM_PROFILE *prof, uint32_t stepsLeft)
+{
+	uint16_t ovr = stepw_ovr[prof->line.isRapid ? 1 : 0];
+	uint32_t kTo = STEPW_K_ONE, dk = STEPW_K_ONE;
+
+	if (prof->line.ovr != 0 && ovr < prof->line.ovr)
+		kTo = ((uint32_t)ovr << 16) / prof->line.ovr;
+	// k changes with the acceleration of the move: f * dk <= accel
+	if (prof->line.accel != 0 && prof->f != 0)
+		dk = (uint32_t)(((uint64_t)prof->line.accel << 16) / prof->f);
+	if (prof->k > kTo)
+		prof->k = prof->k - kTo > dk ? prof->k - dk : kTo;
+	else if (prof->k < kTo)
+		prof->k = kTo - prof->k > dk ? prof->k + dk : kTo;
+
+	prof->kTime += prof->k;
+	if (prof->kTime >= STEPW_K_ONE)
+	{
+		prof->kTime -= STEPW_K_ONE;
+		if (prof->phase != STEPM_PROFILE_OFF)
+			stepw_profileTick(prof, stepsLeft);
+	}
+	return stepw_profileFrq(prof);
+}
+
+// Envelope ramp from the current frequency to fTo with the average change of accel per tick
+static void stepw_holdRamp(STEPW_HOLD *hold, uint32_t fTo, uint32_t accel)
+{
+	uint32_t df = hold->f > fTo ? hold->f - fTo : fTo - hold->f;
+	uint32_t ticks = accel != 0 ? df / accel : 0;
+
+	hold->fFrom = hold->f;
+	hold->fTo = fTo;
+	hold->tick = 0;
+	hold->ticks = ticks > 0xffff ? 0xffff : (uint16_t)ticks;
+}
+
+void stepw_holdStart(STEPW_HOLD *hold, const STEPM_PROFILE *prof, bool isRun)
+{
+	if (!isRun)
+	{
+		hold->state = STEPW_HOLD_STOP;
+		return;
+	}
+	if (hold->state == STEPW_HOLD_DEC || hold->state == STEPW_HOLD_STOP)
+		return;
+	hold->f = stepw_holdFrq(hold, stepw_profileFrq(prof));
+	hold->state = STEPW_HOLD_DEC;
+	stepw_holdRamp(hold, prof->line.fStop, prof->line.accel);
+}
+
+void stepw_holdResume(STEPW_HOLD *hold, const STEPM_PROFILE *prof, bool isRun)
+{
+	if (!isRun)
+	{
+		hold->state = STEPW_HOLD_OFF;
+		return;
+	}
+	if (hold->state == STEPW_HOLD_OFF || hold->state == STEPW_HOLD_ACC)
+		return;
+	hold->state = STEPW_HOLD_ACC;
+	stepw_holdRamp(hold, prof->line.fPeak, prof->line.accel);
+}
+
+void stepw_holdNextMove(STEPW_HOLD *hold, const STEPM_PROFILE *prof, uint32_t fExitPrev)
+{
+	switch (hold->state)
+	{
+	case STEPW_HOLD_OFF:
+		return;
+	case STEPW_HOLD_STOP:
+		hold->f = prof->line.fStop;
+		return;
+	}
+	if (fExitPrev != 0)
+		hold->f = (uint32_t)((uint64_t)hold->f * prof->line.fEntry / fExitPrev);
+	if (hold->f > stepw_profileFrq(prof))
+		hold->f = stepw_profileFrq(prof);
+	stepw_holdRamp(hold, hold->state == STEPW_HOLD_DEC ? prof->line.fStop : prof->line.fPeak, prof->line.accel);
+}
+
+uint32_t stepw_holdFrq(const STEPW_HOLD *hold, uint32_t f)
+{
+	switch (hold->state)
+	{
+	case STEPW_HOLD_OFF:
+		return f;
+	case STEPW_HOLD_STOP:
+		return 0;
+	}
+	return f < hold->f ? f : hold->f;
+}
+
+uint32_t stepw_holdTick(STEPW_HOLD *hold, uint32_t f)
+{
+	if (hold->state == STEPW_HOLD_DEC || hold->state == STEPW_HOLD_ACC)
+	{
+		if (hold->tick >= hold->ticks)
+		{
+			hold->f = hold->fTo;
+			hold->state = hold->state == STEPW_HOLD_DEC ? STEPW_HOLD_STOP : STEPW_HOLD_OFF;
+		}
+		else
+			hold->f = stepw_sCurve(hold->fFrom, hold->fTo, ++hold->tick, hold->ticks);
+		// the profile itself is slow enough to stop
+		if (hold->state == STEPW_HOLD_DEC && (f <= hold->fTo || hold->f <= hold->fTo))
+			hold->state = STEPW_HOLD_STOP;
+	}
+	return stepw_holdFrq(hold, f);
+}
+
+#define STEPW_ARC_RUN	0
+#define STEPW_ARC_END	1	// steps to the end point
+#define STEPW_ARC_DONE	2
+
+static __INLINE int64_t stepw_abs64(int64_t v)
+{
+	return v < 0 ? -v : v;
+}
+
+void stepw_arcStart(STEPW_ARC *arc, const STEPM_ARC *move)
+{
+	arc->a = *move;
+	arc->err = (int64_t)move->x * move->x + (int64_t)move->y * move->y - (int64_t)move->r * move->r;
+	arc->events = 0;
+	arc->left = move->length;
+	arc->mask = arc->dir = 0;
+	arc->phase = STEPW_ARC_RUN;
+	// an arc up to the half of the circle (length <= pi * r) may end at any point,
+	// a longer one must get to the other side of the circle first
+	arc->armed = (uint64_t)move->length * 113 <= (uint64_t)move->r * 355;
+}
+
+bool stepw_arcNext(STEPW_ARC *arc)
+{
+	int32_t x = arc->a.x, y = arc->a.y, vx, vy, sx, sy;
+	int64_t e, cross, dot;
+
+	if (arc->phase == STEPW_ARC_RUN)
+	{
+		// direction of the motion: CCW (-y, x), CW (y, -x)
+		vx = arc->a.cw ? y : -y;
+		vy = arc->a.cw ? -x : x;
+		if (labs(y) >= labs(x))
+		{	// X is the main axis, Y goes to the centre where it doesn't move
+			sx = vx > 0 ? 1 : -1;
+			sy = vy != 0 ? (vy > 0 ? 1 : -1) : (y > 0 ? -1 : 1);
+			arc->err += 2 * (int64_t)x * sx + 1;
+			x += sx;
+			arc->mask = STEPW_ARC_X;
+			e = arc->err + 2 * (int64_t)y * sy + 1;
+			if (stepw_abs64(e) < stepw_abs64(arc->err))
+			{
+				arc->err = e;
+				y += sy;
+				arc->mask |= STEPW_ARC_Y;
+			}
+		}
+		else
+		{	// Y is the main axis
+			sy = vy > 0 ? 1 : -1;
+			sx = vx != 0 ? (vx > 0 ? 1 : -1) : (x > 0 ? -1 : 1);
+			arc->err += 2 * (int64_t)y * sy + 1;
+			y += sy;
+			arc->mask = STEPW_ARC_Y;
+			e = arc->err + 2 * (int64_t)x * sx + 1;
+			if (stepw_abs64(e) < stepw_abs64(arc->err))
+			{
+				arc->err = e;
+				x += sx;
+				arc->mask |= STEPW_ARC_X;
+			}
+		}
+		arc->dir = (sx > 0 ? STEPW_ARC_X : 0) | (sy > 0 ? STEPW_ARC_Y : 0);
+		arc->a.x = x;
+		arc->a.y = y;
+		arc->events++;
+
+		// the end point is passed when it's behind the point (cross product)
+		// on the same side of the circle (dot product)
+		cross = (int64_t)x * arc->a.yEnd - (int64_t)y * arc->a.xEnd;
+		dot = (int64_t)x * arc->a.xEnd + (int64_t)y * arc->a.yEnd;
+		if (dot < 0)
+			arc->armed = true;
+		else if (arc->armed && (arc->a.cw ? cross >= 0 : cross <= 0))
+			arc->phase = STEPW_ARC_END;
+		return true;
+	}
+	if (arc->phase == STEPW_ARC_END && (x != arc->a.xEnd || y != arc->a.yEnd))
+	{	// a step or two from the point on the ray to the end point
+		arc->mask = 0;
+		if (x != arc->a.xEnd)
+		{
+			arc->mask |= STEPW_ARC_X;
+			arc->dir = x < arc->a.xEnd ? arc->dir | STEPW_ARC_X : arc->dir & ~STEPW_ARC_X;
+			arc->a.x += x < arc->a.xEnd ? 1 : -1;
+		}
+		if (y != arc->a.yEnd)
+		{
+			arc->mask |= STEPW_ARC_Y;
+			arc->dir = y < arc->a.yEnd ? arc->dir | STEPW_ARC_Y : arc->dir & ~STEPW_ARC_Y;
+			arc->a.y += y < arc->a.yEnd ? 1 : -1;
+		}
+		arc->events++;
+		return true;
+	}
+	arc->phase = STEPW_ARC_DONE;
+	arc->mask = 0;
+	return false;
+}
+
+uint32_t stepw_arcLeft(STEPW_ARC *arc)
+{
+	uint32_t m = labs(arc->a.x) > labs(arc->a.y) ? labs(arc->a.x) : labs(arc->a.y);
+	// an event is one step of the main axis, r / m steps along the circle
+	uint32_t path = m != 0 ? (uint32_t)((uint64_t)arc->events * arc->a.r / m) : arc->events;
+
+	arc->events = 0;
+	arc->left = arc->left > path ? arc->left - path : 0;
+	return arc->left;
+}
+
+uint32_t stepw_arcFrq(const STEPW_ARC *arc, uint32_t f)
+{
+	uint32_t m = labs(arc->a.x) > labs(arc->a.y) ? labs(arc->a.x) : labs(arc->a.y);
+
+	if (m >= arc->a.r || arc->phase != STEPW_ARC_RUN)
+		return f;
+	return (uint32_t)((uint64_t)f * m / arc->a.r);
+}
+
+static struct {
+	STEPW_PIN step[STEPW_AXES_MAX], dir[STEPW_AXES_MAX];
+	uint8_t  axes;
+	uint32_t tickFrq;
+	uint16_t rampTicks;					// builder ticks per ramp tick
+	uint32_t stepOff[STEPW_PORTS_MAX];	// STEP pins to drop at the next tick
+	uint8_t  dirMask;					// DIR pins state
+	bool     dirValid;
+	int32_t  made[STEPW_AXES_MAX];
+
+	// move in process
+	bool     active, dirPending;
+	uint8_t  moveDir;
+	uint32_t events, total;
+	uint32_t delta[STEPW_AXES_MAX];
+	int32_t  err[STEPW_AXES_MAX];
+	uint32_t phase, inc;				// phase accumulator of the main axis
+	uint32_t f;							// frequency of inc
+	uint16_t rampCnt;
+	STEPM_PROFILE prof;
+	STEPW_HOLD hold;
+	bool     isArc;
+	STEPW_ARC arc;
+	uint32_t dwell;						// ticks left of the dwell
+} wave;
+
+#if (USE_STEPW_SHAPER == 1)
+/*
+ * Input shaper: the steps of the moves are counted per ramp tick (raw), the waveform makes
+ * sum(w * raw[tick - d]) steps of each axis in a ramp tick, evenly over its builder ticks.
+ * The impulse of ZV/ZVD/EI at time t is split between the ramp ticks around t.
+ * The weights are positive and their sum is 1, so the shaped rate is never above the raw one
+ * and the steps are all made: the remainder is carried to the next ramp tick.
+ */
+#define STEPW_SHAPER_TAPS		6
+#define STEPW_SHAPER_HISTORY	128		// ramp ticks, the longest delay
+
+static struct {
+	uint32_t w[STEPW_AXES_MAX][STEPW_SHAPER_TAPS];	// Q16
+	uint8_t  d[STEPW_AXES_MAX][STEPW_SHAPER_TAPS];	// delay, ramp ticks
+	uint8_t  taps[STEPW_AXES_MAX];
+	uint8_t  maxDelay;
+} shaperTaps;
+
+static struct {
+	int8_t   raw[STEPW_AXES_MAX][STEPW_SHAPER_HISTORY];
+	uint8_t  pos;						// the last ramp tick in raw
+	int16_t  cnt[STEPW_AXES_MAX];		// raw steps of the ramp tick in process
+	uint16_t rawTicks;					// builder ticks of it
+	int32_t  acc[STEPW_AXES_MAX];		// shaped steps not made yet, Q16
+	uint16_t out[STEPW_AXES_MAX];		// steps of the ramp tick in the waveform
+	uint16_t outErr[STEPW_AXES_MAX];	// Bresenham over its builder ticks
+	uint16_t tick;						// builder tick in it
+	uint8_t  dir;						// DIR pins
+	bool     dirValid;
+	uint8_t  tail;						// ramp ticks until the last raw steps are out
+} shaper;
+#endif
+
+static uint32_t stepw_frqToInc(uint32_t f)
+{
+	if (f > wave.tickFrq / 2 * K_FRQ)
+		f = wave.tickFrq / 2 * K_FRQ;	// STEP high and low for one tick at least
+	return (uint32_t)(((uint64_t)f << 32) / ((uint64_t)wave.tickFrq * K_FRQ));
+}
+
+void stepw_init(const STEPW_PIN step[], const STEPW_PIN dir[], uint8_t axes, uint32_t tickFrq)
+{
+	memset(&wave, 0, sizeof(wave));
+	if (axes > STEPW_AXES_MAX)
+		axes = STEPW_AXES_MAX;
+	memcpy(wave.step, step, axes * sizeof(STEPW_PIN));
+	memcpy(wave.dir, dir, axes * sizeof(STEPW_PIN));
+	wave.axes = axes;
+	wave.tickFrq = tickFrq;
+	wave.rampTicks = tickFrq / STEPM_RAMP_FRQ;
+#if (USE_STEPW_SHAPER == 1)
+	memset(&shaper, 0, sizeof(shaper));
+	memset(&shaperTaps, 0, sizeof(shaperTaps));
+	for (int i = 0; i < STEPW_AXES_MAX; i++)
+		stepw_shaperInit(i, STEPW_SHAPER_NONE, 0, 0);
+#endif
+}
+
+void stepw_reset(void)
+{
+	int i;
+
+	wave.active = false;
+	wave.dirValid = false;
+	wave.dwell = 0;
+	wave.hold.state = STEPW_HOLD_OFF;
+	for (i = 0; i < STEPW_PORTS_MAX; i++)
+		wave.stepOff[i] = 0;
+#if (USE_STEPW_SHAPER == 1)
+	memset(&shaper, 0, sizeof(shaper));
+#endif
+}
+
+bool stepw_isIdle(void)
+{
+	return !wave.active;
+}
+
+bool stepw_isPlaying(void)
+{
+#if (USE_STEPW_SHAPER == 1)
+	for (int i = 0; i < wave.axes; i++)
+		if (shaper.acc[i] != 0)
+			return true;
+	// the raw ramp tick the move has ended in and the shaped one in the waveform are not over
+	return wave.active || shaper.tail != 0 || shaper.rawTicks != 0 || shaper.tick != 0;
+#else
+	return wave.active;
+#endif
+}
+
+#if (USE_STEPW_SHAPER == 1)
+// Tap of the impulse a (of sum) at t seconds: split between two ramp ticks
+static void stepw_shaperTap(uint8_t axis, double a, double t)
+{
+	double x = t * STEPM_RAMP_FRQ, frac;
+	uint8_t n = shaperTaps.taps[axis], d;
+
+	if (x > STEPW_SHAPER_HISTORY - 2)
+		x = STEPW_SHAPER_HISTORY - 2;	// the resonance is below the range
+	d = (uint8_t)x;
+	frac = x - d;
+	shaperTaps.d[axis][n] = d;
+	shaperTaps.w[axis][n] = (uint32_t)(a * (1 - frac) * 65536 + 0.5);
+	shaperTaps.d[axis][n + 1] = d + 1;
+	shaperTaps.w[axis][n + 1] = (uint32_t)(a * frac * 65536 + 0.5);
+	shaperTaps.taps[axis] = n + 2;
+	if (d + 1 > shaperTaps.maxDelay)
+		shaperTaps.maxDelay = d + 1;
+}
+
+void stepw_shaperInit(uint8_t axis, uint8_t type, double frq, double damping)
+{
+	double a[3], sum, k, df, td;
+	uint32_t w = 0, *big;
+	int i, n;
+
+	if (axis >= STEPW_AXES_MAX)
+		return;
+	shaperTaps.taps[axis] = 0;
+	if (type == STEPW_SHAPER_NONE || frq <= 0)
+	{
+		shaperTaps.w[axis][0] = 1UL << 16;
+		shaperTaps.d[axis][0] = 0;
+		shaperTaps.taps[axis] = 1;
+		return;
+	}
+	df = sqrt(1 - damping * damping);
+	k = exp(-damping * 3.14159265358979 / df);
+	td = 1 / (frq * df);	// damped period of the ringing
+	n = 3;
+	if (type == STEPW_SHAPER_ZV)
+	{
+		a[0] = 1; a[1] = k;
+		n = 2;
+	}
+	else if (type == STEPW_SHAPER_ZVD)
+	{
+		a[0] = 1; a[1] = 2 * k; a[2] = k * k;
+	}
+	else
+	{	// EI with 5% of the vibration left
+		a[0] = 0.25 * 1.05; a[1] = 0.5 * 0.95 * k; a[2] = 0.25 * 1.05 * k * k;
+	}
+	for (sum = 0, i = 0; i < n; i++)
+		sum += a[i];
+	for (i = 0; i < n; i++)
+		stepw_shaperTap(axis, a[i] / sum, i * td / 2);
+	// the sum of the weights must be 1 exactly
+	big = &shaperTaps.w[axis][0];
+	for (i = 0; i < shaperTaps.taps[axis]; i++)
+	{
+		w += shaperTaps.w[axis][i];
+		if (shaperTaps.w[axis][i] > *big)
+			big = &shaperTaps.w[axis][i];
+	}
+	*big += (1UL << 16) - w;
+}
+#endif
+
+void stepw_loadMove(const uint32_t steps[], const uint8_t dir[], const STEPM_RAMP *ramp)
+{
+	uint32_t fExitPrev;
+	int i;
+
+	wave.total = 0;
+	wave.moveDir = 0;
+	for (i = 0; i < wave.axes; i++)
+	{
+		wave.delta[i] = steps[i];
+		if (steps[i] > wave.total)
+			wave.total = steps[i];
+		if (dir[i])
+			wave.moveDir |= 1 << i;
+	}
+	if (wave.total == 0)
+		return;
+	for (i = 0; i < wave.axes; i++)
+		wave.err[i] = wave.total >> 1;
+	wave.events = wave.total;
+	wave.dirPending = !wave.dirValid || wave.moveDir != wave.dirMask;
+	wave.isArc = false;
+
+	fExitPrev = wave.prof.line.fExit;
+	stepw_profileStart(&wave.prof, ramp);
+	stepw_holdNextMove(&wave.hold, &wave.prof, fExitPrev);
+	wave.f = stepw_holdFrq(&wave.hold, stepw_profileFrq(&wave.prof));
+	wave.inc = stepw_frqToInc(wave.f);
+	wave.phase = 0;
+	wave.rampCnt = 0;
+	wave.active = true;
+}
+
+void stepw_loadArc(const STEPW_ARC *arc, const STEPM_RAMP *ramp)
+{
+	uint32_t fExitPrev;
+
+	if (arc->mask == 0)
+		return;
+	wave.arc = *arc;
+	wave.isArc = true;
+	// DIR of other axes stays as it is
+	wave.moveDir = (wave.dirMask & ~arc->mask) | (arc->dir & arc->mask);
+	wave.dirPending = !wave.dirValid || wave.moveDir != wave.dirMask;
+
+	fExitPrev = wave.prof.line.fExit;
+	stepw_profileStart(&wave.prof, ramp);
+	stepw_holdNextMove(&wave.hold, &wave.prof, fExitPrev);
+	wave.f = stepw_holdFrq(&wave.hold, stepw_profileFrq(&wave.prof));
+	wave.inc = stepw_frqToInc(stepw_arcFrq(&wave.arc, wave.f));
+	wave.phase = 0;
+	wave.rampCnt = 0;
+	wave.active = true;
+}
+
+void stepw_loadDwell(uint32_t ticks)
+{
+	wave.dwell = ticks;
+	wave.active = ticks != 0;
+}
+
+#define STEPW_TICK_END		0x80	// the move is over with this tick (STEPW_AXES_MAX < 8)
+
+/*
+ * One tick of the move in process (not a dwell, DIR is set): axes (bits) which step at it,
+ * with STEPW_TICK_END at the last one. The direction of the steps is dirMask.
+ * New DIR of the next arc event is written at the next tick, one tick before its STEP.
+ */
+static uint8_t stepw_moveTick(void)
+{
+	uint32_t prev, f;
+	uint8_t mask = 0, d;
+	int i;
+
+	if (++wave.rampCnt >= wave.rampTicks && wave.hold.state != STEPW_HOLD_STOP)
+	{
+		wave.rampCnt = 0;
+		f = stepw_profileRun(&wave.prof, wave.isArc ? stepw_arcLeft(&wave.arc) : wave.events);
+		f = stepw_holdTick(&wave.hold, f);
+		if (wave.isArc)	// the rate of events follows the direction of the motion
+			wave.inc = stepw_frqToInc(stepw_arcFrq(&wave.arc, f));
+		else if (f != wave.f)
+			wave.inc = stepw_frqToInc(f);
+		wave.f = f;
+	}
+	if (wave.hold.state == STEPW_HOLD_STOP)
+		return 0;	// the move waits for the resume
+
+	prev = wave.phase;
+	wave.phase += wave.inc;
+	if (wave.phase >= prev)
+		return 0;	// no step at this tick
+
+	if (wave.isArc)
+	{	// STEP of the current event, then the next event is computed
+		mask = wave.arc.mask;
+		if (!stepw_arcNext(&wave.arc))
+			return mask | STEPW_TICK_END;
+		d = (wave.dirMask & ~wave.arc.mask) | (wave.arc.dir & wave.arc.mask);
+		if (d != wave.dirMask)
+		{
+			wave.moveDir = d;
+			wave.dirPending = true;
+		}
+		return mask;
+	}
+
+	// step event: the main axis steps, others by Bresenham
+	for (i = 0; i < wave.axes; i++)
+	{
+		wave.err[i] -= wave.delta[i];
+		if (wave.err[i] < 0)
+		{
+			wave.err[i] += wave.total;
+			mask |= 1 << i;
+		}
+	}
+	if (--wave.events == 0)
+		mask |= STEPW_TICK_END;
+	return mask;
+}
+
+// Dwell tick, false - it's over. The feed hold stops the dwell too.
+static bool stepw_dwellTick(void)
+{
+	return wave.hold.state == STEPW_HOLD_STOP || --wave.dwell != 0;
+}
+
+// STEP of the axes (bits) at the word idx
+static void stepw_stepPins(uint32_t *buf[], uint16_t idx, uint8_t mask)
+{
+	int i;
+
+	for (i = 0; i < wave.axes; i++)
+	{
+		if ((mask & (1 << i)) == 0)
+			continue;
+		buf[wave.step[i].port][idx] |= wave.step[i].pin;
+		wave.stepOff[wave.step[i].port] |= wave.step[i].pin;
+	}
+}
+
+// DIR of the axes (bits) at the word idx, dir - their new state
+static void stepw_dirPins(uint32_t *buf[], uint16_t idx, uint8_t mask, uint8_t dir)
+{
+	int i;
+
+	for (i = 0; i < wave.axes; i++)
+	{
+		if ((mask & (1 << i)) == 0)
+			continue;
+		if (dir & (1 << i))
+			buf[wave.dir[i].port][idx] |= wave.dir[i].pin;
+		else
+			buf[wave.dir[i].port][idx] |= (uint32_t)wave.dir[i].pin << 16;
+	}
+}
+
+#if (USE_STEPW_SHAPER == 0)
+uint16_t stepw_fill(uint32_t *buf[], uint16_t offset, uint16_t count)
+{
+	uint16_t n;
+	uint8_t mask;
+	int i;
+
+	for (n = 0; n < count; n++)
+	{
+		for (i = 0; i < STEPW_PORTS_MAX && buf[i] != NULL; i++)
+		{
+			buf[i][offset + n] = wave.stepOff[i] << 16;	// BSRR: high half resets pins
+			wave.stepOff[i] = 0;
+		}
+		if (!wave.active)
+			continue;
+
+		if (wave.dwell != 0)
+		{
+			if (stepw_dwellTick())
+				continue;
+			wave.active = false;
+			return n + 1;
+		}
+
+		if (wave.dirPending)
+		{	// DIR setup: one tick before the first STEP
+			stepw_dirPins(buf, offset + n, (1 << wave.axes) - 1, wave.moveDir);
+			wave.dirMask = wave.moveDir;
+			wave.dirValid = true;
+			wave.dirPending = false;
+			continue;
+		}
+
+		mask = stepw_moveTick();
+		if (mask == 0)
+			continue;
+		stepw_stepPins(buf, offset + n, mask);
+		for (i = 0; i < wave.axes; i++)
+			if (mask & (1 << i))
+				wave.made[i] += (wave.dirMask & (1 << i)) ? 1 : -1;
+		if (mask & STEPW_TICK_END)
+		{
+			wave.active = false;
+			return n + 1;
+		}
+	}
+	return count;
+}
+#else
+// The moves make one ramp tick of raw steps, false - the move is over before its end
+static bool stepw_rawTick(void)
+{
+	uint8_t mask;
+	int i;
+
+	while (shaper.rawTicks < wave.rampTicks)
+	{
+		if (!wave.active)
+		{	// no move goes on: the rest of the ramp tick is idle
+			shaper.rawTicks = wave.rampTicks;
+			break;
+		}
+		shaper.rawTicks++;
+		if (wave.dwell != 0)
+		{
+			if (stepw_dwellTick())
+				continue;
+			wave.active = false;
+			return false;
+		}
+		if (wave.dirPending)
+		{	// the tick of DIR setup as without the shaper, the pins are set by the shaped steps
+			wave.dirMask = wave.moveDir;
+			wave.dirValid = true;
+			wave.dirPending = false;
+			continue;
+		}
+		mask = stepw_moveTick();
+		for (i = 0; i < wave.axes; i++)
+			if (mask & (1 << i))
+				shaper.cnt[i] += (wave.dirMask & (1 << i)) ? 1 : -1;
+		if (mask & STEPW_TICK_END)
+		{
+			wave.active = false;
+			return false;
+		}
+	}
+	shaper.rawTicks = 0;
+	shaper.pos = shaper.pos + 1 < STEPW_SHAPER_HISTORY ? shaper.pos + 1 : 0;
+	for (i = 0; i < wave.axes; i++)
+	{
+		shaper.raw[i][shaper.pos] = (int8_t)shaper.cnt[i];
+		if (shaper.cnt[i] != 0)
+			shaper.tail = shaperTaps.maxDelay + 1;
+		shaper.cnt[i] = 0;
+	}
+	return true;
+}
+
+// Shaped steps of the ramp tick, DIR is changed at its first word
+static void stepw_shapeTick(uint32_t *buf[], uint16_t idx)
+{
+	int32_t s, c, cMax = wave.rampTicks / 2;	// STEP high and low for one tick at least
+	uint8_t dir = shaper.dir, changed;
+	int i, j, k;
+
+	for (i = 0; i < wave.axes; i++)
+	{
+		s = 0;
+		for (j = 0; j < shaperTaps.taps[i]; j++)
+		{
+			k = shaper.pos - shaperTaps.d[i][j];
+			s += (int32_t)shaperTaps.w[i][j] * shaper.raw[i][k >= 0 ? k : k + STEPW_SHAPER_HISTORY];
+		}
+		shaper.acc[i] += s;
+		c = (shaper.acc[i] + 0x8000) >> 16;
+		if (c > cMax)
+			c = cMax;
+		if (c < -cMax)
+			c = -cMax;
+		shaper.acc[i] -= c * 65536;
+		shaper.out[i] = (uint16_t)(c >= 0 ? c : -c);
+		if ((c > 0 && (dir & (1 << i)) == 0) || (c < 0 && (dir & (1 << i)) != 0))
+		{	// the steps of the new direction start from the middle of a step period
+			dir ^= 1 << i;
+			shaper.outErr[i] = 0;
+		}
+	}
+	changed = shaper.dirValid ? dir ^ shaper.dir : (1 << wave.axes) - 1;
+	if (changed != 0)
+		stepw_dirPins(buf, idx, changed, dir);
+	shaper.dir = dir;
+	shaper.dirValid = true;
+	if (shaper.tail != 0)
+		shaper.tail--;
+}
+
+uint16_t stepw_fill(uint32_t *buf[], uint16_t offset, uint16_t count)
+{
+	uint16_t n;
+	uint8_t mask;
+	int i;
+
+	for (n = 0; n < count; n++)
+	{
+		if (shaper.tick == 0 && !stepw_rawTick())
+			return n;	// the next move goes on with the ramp tick
+		for (i = 0; i < STEPW_PORTS_MAX && buf[i] != NULL; i++)
+		{
+			buf[i][offset + n] = wave.stepOff[i] << 16;	// BSRR: high half resets pins
+			wave.stepOff[i] = 0;
+		}
+		if (shaper.tick == 0)
+			stepw_shapeTick(buf, offset + n);
+		if (++shaper.tick >= wave.rampTicks)
+			shaper.tick = 0;
+
+		mask = 0;
+		for (i = 0; i < wave.axes; i++)
+		{
+			shaper.outErr[i] += shaper.out[i];
+			if (shaper.outErr[i] >= wave.rampTicks)
+			{
+				shaper.outErr[i] -= wave.rampTicks;
+				mask |= 1 << i;
+				wave.made[i] += (shaper.dir & (1 << i)) ? 1 : -1;
+			}
+		}
+		if (mask != 0)
+			stepw_stepPins(buf, offset + n, mask);
+	}
+	return count;
+}
+#endif
+
+int32_t stepw_takeSteps(uint8_t axis)
+{
+	int32_t n = wave.made[axis];
+	wave.made[axis] = 0;
+	return n;
+}
+
+void stepw_hold(bool isHold)
+{
+	bool isRun = wave.active && wave.dwell == 0;
+
+	if (isHold)
+		stepw_holdStart(&wave.hold, &wave.prof, isRun);
+	else
+		stepw_holdResume(&wave.hold, &wave.prof, isRun);
+}
@@ -0,0 +1,139 @@
+#ifndef STEPWAVE_H_
+#define STEPWAVE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stepmotor.h"
+
+// Plain C, no hardware access: it's used by the step IRQs and can be built on a host.
+
+#ifndef USE_STEPW_SHAPER
+	#define USE_STEPW_SHAPER	0
+#endif
+
+// Follower of the move velocity profile (STEPM_RAMP), one call per ramp tick
+typedef struct {
+	STEPM_RAMP line;
+	uint32_t f, fFrom;		// current frequency and the start of the S-curve
+	uint16_t tick, tDec;
+	uint8_t  phase;
+	// override: the profile runs k times slower with k times lower frequency,
+	// so the steps of the ramps are the same. k goes on with the next move.
+	uint32_t k, kTime;		// Q16
+} STEPM_PROFILE;
+
+#define STEPM_PROFILE_OFF	0
+#define STEPM_PROFILE_ACC	1
+#define STEPM_PROFILE_RUN	2
+#define STEPM_PROFILE_DEC	3
+
+void stepw_profileStart(STEPM_PROFILE *prof, const STEPM_RAMP *line);
+// stepsLeft - steps of the main axis. Returns the new frequency of the main axis.
+uint32_t stepw_profileTick(STEPM_PROFILE *prof, uint32_t stepsLeft);
+// Override of the moves which are planned with another one (see STEPM_RAMP.ovr)
+void stepw_setOverride(uint16_t feed, uint16_t rapid);
+// One ramp tick of the profile with the override, returns the frequency of the main axis
+uint32_t stepw_profileRun(STEPM_PROFILE *prof, uint32_t stepsLeft);
+// Current frequency with the override
+uint32_t stepw_profileFrq(const STEPM_PROFILE *prof);
+
+/*
+ * Feed hold: S-shaped envelope over the frequency of the moves. It brakes to fStop of the move
+ * and stops the motion, on resume it accelerates back to fPeak. A move never goes faster than
+ * its own profile, the profile doesn't run while the motion is stopped.
+ */
+typedef struct {
+	uint32_t f, fFrom, fTo;
+	uint16_t tick, ticks;
+	uint8_t  state;
+} STEPW_HOLD;
+
+#define STEPW_HOLD_OFF		0
+#define STEPW_HOLD_DEC		1	// braking
+#define STEPW_HOLD_STOP		2	// stopped in the middle of the move
+#define STEPW_HOLD_ACC		3	// resume
+
+// isRun - a move is in process, otherwise the hold stops at once
+void stepw_holdStart(STEPW_HOLD *hold, const STEPM_PROFILE *prof, bool isRun);
+void stepw_holdResume(STEPW_HOLD *hold, const STEPM_PROFILE *prof, bool isRun);
+// New move is loaded to prof, fExitPrev - the exit frequency of the previous one:
+// it's the same speed as the entry of the new one, so the envelope is scaled by their ratio
+void stepw_holdNextMove(STEPW_HOLD *hold, const STEPM_PROFILE *prof, uint32_t fExitPrev);
+// Frequency f of the profile limited by the envelope, 0 - stopped
+uint32_t stepw_holdFrq(const STEPW_HOLD *hold, uint32_t f);
+// One ramp tick, returns stepw_holdFrq()
+uint32_t stepw_holdTick(STEPW_HOLD *hold, uint32_t f);
+
+/*
+ * Midpoint circle DDA of STEPM_ARC. Every event steps the main axis (the one which moves faster
+ * at this point of the circle), the other axis steps too if it brings the point closer to the circle.
+ * The arc is over when the point passes the ray to the end point, then the last events step
+ * straight to the end point.
+ */
+#define STEPW_ARC_X		(1 << 0)	// bits of the axes in mask and dir
+#define STEPW_ARC_Y		(1 << 1)
+
+typedef struct {
+	STEPM_ARC a;			// a.x, a.y - point after the last event
+	int64_t  err;			// x^2 + y^2 - r^2
+	uint32_t events;		// events since the last stepw_arcLeft()
+	uint32_t left;			// path left (steps)
+	uint8_t  mask, dir;		// the last event: stepped axes, directions (bit set - positive)
+	uint8_t  phase;
+	bool     armed;			// the point was on the other side of the circle from the end point
+} STEPW_ARC;
+
+void stepw_arcStart(STEPW_ARC *arc, const STEPM_ARC *move);
+// Compute the next event, false if the arc is done
+bool stepw_arcNext(STEPW_ARC *arc);
+// Once per ramp tick: path left for the velocity profile
+uint32_t stepw_arcLeft(STEPW_ARC *arc);
+// Frequency of events at the current point for the path frequency f
+uint32_t stepw_arcFrq(const STEPW_ARC *arc, uint32_t f);
+
+/*
+ * Step waveform builder: GPIO BSRR words, one per tick for each port with STEP/DIR pins.
+ * STEP is high for one tick, DIR is written one tick before the first STEP of a move.
+ */
+#define STEPW_AXES_MAX		4
+#define STEPW_PORTS_MAX		3
+
+typedef struct {
+	uint8_t  port;		// index of the port buffer
+	uint16_t pin;
+} STEPW_PIN;
+
+void stepw_init(const STEPW_PIN step[], const STEPW_PIN dir[], uint8_t axes, uint32_t tickFrq);
+void stepw_reset(void);
+// A new move can be loaded
+bool stepw_isIdle(void);
+// The waveform has steps to make: a move or the tail of the input shaper
+bool stepw_isPlaying(void);
+// Start the move, the builder must be idle
+void stepw_loadMove(const uint32_t steps[], const uint8_t dir[], const STEPM_RAMP *ramp);
+// Start the arc, its first event is computed (stepw_arcNext), the builder must be idle
+void stepw_loadArc(const STEPW_ARC *arc, const STEPM_RAMP *ramp);
+// Dwell: idle ticks in order with the moves, the builder must be idle
+void stepw_loadDwell(uint32_t ticks);
+// Fill words [offset, offset + count) of the port buffers (STEPW_PORTS_MAX pointers,
+// NULL after the last used port). Stops after the last step
+// of the move, returns the number of words written. Idle ticks are filled up to count.
+uint16_t stepw_fill(uint32_t *buf[], uint16_t offset, uint16_t count);
+// Steps made by the builder since the previous call (signed)
+int32_t stepw_takeSteps(uint8_t axis);
+// Feed hold of the builder: true - brake and stop, false - resume. A dwell stops at once.
+void stepw_hold(bool isHold);
+
+/*
+ * Input shaper (USE_STEPW_SHAPER): the steps of each axis are convolved with the impulses
+ * of the shaper for its ringing frequency (Hz) and damping ratio. The delays are up to
+ * 63 msec: EI and ZVD work from 16 Hz, ZV from 8 Hz. stepw_init makes all axes unshaped.
+ */
+#define STEPW_SHAPER_NONE	0
+#define STEPW_SHAPER_ZV		1
+#define STEPW_SHAPER_ZVD	2
+#define STEPW_SHAPER_EI		3
+
+void stepw_shaperInit(uint8_t axis, uint8_t type, double frq, double damping);
+
+#endif /* STEPWAVE_H_ */
@@ -78,12 +78,13 @@ int SD_step = 0;
 /* Private variables ---------------------------------------------------------*/
 u32 CardType = SDIO_STD_CAPACITY_SD_CARD_V1_1;
 u32 CSD_Tab[4], CID_Tab[4], RCA = 0;
-u32 DeviceMode = SD_DMA_MODE;
+u32 DeviceMode = SD_POLLING_MODE;	/* as MAL_Init sets it, SD_StartReadMultiBlocks goes by DMA */
 u32 TotalNumberOfBytes = 0, StopCondition = 0;
 u32 *SrcBuffer, *DestBuffer;
 volatile SD_Error TransferError = SD_OK;
 vu32 TransferEnd = 0;
 vu32 NumberOfBytes = 0;
+static u8 IsReadNoWait = 0;
 SDIO_InitTypeDef SDIO_InitStructure;
 SDIO_CmdInitTypeDef SDIO_CmdInitStructure;
 SDIO_DataInitTypeDef SDIO_DataInitStructure;
@@ -1092,6 +1093,13 @@ SD_Error SD_ReadMultiBlocks(u32 addr, u32 *readbuff, u16 BlockSize, u32 NumberOf
 		}
 		else if (DeviceMode == SD_DMA_MODE)
 		{
+			if (IsReadNoWait)
+			{
+				/* SD_StartReadMultiBlocks: SD_GetReadState ends the transfer, no SDIO interrupt */
+				SDIO_DMACmd(ENABLE);
+				DMA_RxConfiguration(readbuff, (NumberOfBlocks * BlockSize));
+				return(errorstatus);
+			}
 			SDIO_ITConfig(SDIO_IT_DCRCFAIL | SDIO_IT_DTIMEOUT | SDIO_IT_DATAEND | SDIO_IT_RXOVERR | SDIO_IT_STBITERR, ENABLE);
 			SDIO_DMACmd(ENABLE);
 			DMA_RxConfiguration(readbuff, (NumberOfBlocks * BlockSize));
@@ -1110,6 +1118,83 @@ SD_Error SD_ReadMultiBlocks(u32 addr, u32 *readbuff, u16 BlockSize, u32 NumberOf
 	return(errorstatus);
 }
 
+/*******************************************************************************
+* Function Name  : SD_StartReadMultiBlocks
+* Description    : Starts the DMA read of the blocks and returns at once, the
+*                  device mode is not changed. SD_GetReadState must be polled
+*                  to the end of the transfer before the next SD command.
+* Input          : - addr: Address from where data are to be read.
+*                  - readbuff: word aligned buffer that will contain the
+*                    received data.
+*                  - BlockSize: the SD card Data block size.
+*                  - NumberOfBlocks: number of blocks to be read (> 1).
+* Output         : None
+* Return         : SD_Error: SD Card Error code.
+*******************************************************************************/
+SD_Error SD_StartReadMultiBlocks(u32 addr, u32 *readbuff, u16 BlockSize, u32 NumberOfBlocks)
+{
+	SD_Error errorstatus;
+	u32 mode = DeviceMode;
+
+	if (NumberOfBlocks < 2 || ((u32)readbuff & 3) != 0)
+	{
+		return(SD_INVALID_PARAMETER);
+	}
+	DeviceMode = SD_DMA_MODE;
+	IsReadNoWait = 1;
+	errorstatus = SD_ReadMultiBlocks(addr, readbuff, BlockSize, NumberOfBlocks);
+	IsReadNoWait = 0;
+	DeviceMode = mode;
+	return(errorstatus);
+}
+
+/*******************************************************************************
+* Function Name  : SD_GetReadState
+* Description    : Checks the read of SD_StartReadMultiBlocks, at the end
+*                  stops the DMA and sends CMD12 STOP_TRANSMISSION.
+* Input          : None
+* Output         : None
+* Return         : SD_Error: SD_REQUEST_PENDING while the data goes,
+*                  SD_OK or the error at the end.
+*******************************************************************************/
+SD_Error SD_GetReadState(void)
+{
+	SD_Error errorstatus = SD_OK, stopstatus;
+
+	if (SDIO_GetFlagStatus(SDIO_FLAG_DTIMEOUT) != RESET)
+	{
+		errorstatus = SD_DATA_TIMEOUT;
+	}
+	else if (SDIO_GetFlagStatus(SDIO_FLAG_DCRCFAIL) != RESET)
+	{
+		errorstatus = SD_DATA_CRC_FAIL;
+	}
+	else if (SDIO_GetFlagStatus(SDIO_FLAG_RXOVERR) != RESET)
+	{
+		errorstatus = SD_RX_OVERRUN;
+	}
+	else if (SDIO_GetFlagStatus(SDIO_FLAG_STBITERR) != RESET)
+	{
+		errorstatus = SD_START_BIT_ERR;
+	}
+	else if (SDIO_GetFlagStatus(SDIO_FLAG_DATAEND) == RESET || DMA_GetFlagStatus(DMA2_FLAG_TC4) == RESET)
+	{
+		return(SD_REQUEST_PENDING);
+	}
+
+	SDIO_DMACmd(DISABLE);
+	DMA_Cmd(DMA2_Channel4, DISABLE);
+	/* Send CMD12 STOP_TRANSMISSION, the card stops the data on the error too */
+	stopstatus = SD_StopTransfer();
+	if (errorstatus == SD_OK)
+	{
+		errorstatus = stopstatus;
+	}
+	/* Clear all the static flags */
+	SDIO_ClearFlag(SDIO_STATIC_FLAGS);
+	return(errorstatus);
+}
+
 /*******************************************************************************
 * Function Name  : SD_WriteBlock
 * Description    : Allows to write one block starting from a specified address
@@ -19,20 +19,65 @@
 #define USE_USB_MSD		1
 #define USE_SDCARD		1
 #define USE_ENCODER		1
+/*
+	USE_STEPM_DDA
+		0	Each axis is stepped by own timer
+		1	All axes are stepped in lockstep by M0_TIM (DDA)
+*/
+#define USE_STEPM_DDA	1
+/*
+	USE_STEPM_OC
+		0	STEP pulse by GPIO in the timer IRQ (2 IRQ per step)
+		1	STEP pin is the timer output compare channel (1 IRQ per step),
+			needs USE_STEPM_DDA = 0 and M?_STEP_OC for each axis, no USE_STEPM_ARC
+*/
+#define USE_STEPM_OC	0
+/*
+	USE_STEPM_DMA
+		0	STEP pulses by the engines above
+		1	DMA copies precomputed BSRR words to STEP/DIR ports (no IRQ per step),
+			needs USE_STEPM_DDA = 0 and USE_STEPM_OC = 0
+*/
+#define USE_STEPM_DMA	0
+/*
+	USE_STEPM_ARC
+		0	G2/G3 are cut into lines (SM_ARC_TOLERANCE_MM)
+		1	G2/G3 in XY plane are one move, stepped by the midpoint circle DDA of the engine,
+			needs USE_STEPM_DDA = 1 or USE_STEPM_DMA = 1
+*/
+#define USE_STEPM_ARC	1
+/*
+	USE_STEPW_SHAPER
+		0	steps of the moves go to the waveform as they are
+		1	input shaper (ZV/ZVD/EI) of each axis against the ringing of the frame,
+			SM_SHAPER_* in gcode.h, needs USE_STEPM_DMA = 1
+*/
+#define USE_STEPW_SHAPER	0
+/*
+	USE_CNC_REAL - numbers of the G-code parser, arcs and planner
+		0	double
+		1	float
+		2	fixed point Q15.16, no soft float on Cortex-M3
+*/
+#define USE_CNC_REAL	2
 
 /*
  * ----- sensors ---------------------------------------
  * PC6, PC7 - encoder	Z encoder mode TIM8 (5 V tolerant!)
  */
 #if (USE_ENCODER == 1)
-	#define ENCODER_PORT	GPIOC
-	#define ENCODER_PINS	(GPIO_Pin_6 | GPIO_Pin_7)
-#endif
-
 /*
- *	Motor number for encoder
+ * Encoder of motor N: ENCN_TIM in encoder mode on CH1/CH2 pins, counts per revolution
+ * of the motor (4 edges of A/B), INVERT = 1 if it counts down when the motor steps up.
+ * Free timers with the encoder mode: TIM8; TIM1 and TIM5 if USE_STEPM_OC = 0
  */
-#define MX_ENCODER			2
+	#define ENC2_TIM			TIM8
+	#define ENC2_TIM_CLK()		RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM8, ENABLE)
+	#define ENC2_PORT			GPIOC
+	#define ENC2_PINS			(GPIO_Pin_6 | GPIO_Pin_7)
+	#define ENC2_CNT_PER_360	2048
+	#define ENC2_INVERT			1
+#endif
 
 /*
  *	One ENABLE for all motors
@@ -60,6 +105,13 @@
 #define M0_DIR_PIN			GPIO_Pin_2
 #define M0_STEP_PORT		GPIOA
 #define M0_STEP_PIN			GPIO_Pin_3
+#define M0_STEP_OC			4	// TIM2_CH4
+// TIM1 counts steps of X by TIM2 TRGO
+#define M0_CNT_TIM			TIM1
+#define M0_CNT_TIM_ITR		TIM_TS_ITR1
+#define M0_CNT_TIM_IRQn		TIM1_UP_IRQn
+#define M0_CNT_TIM_IRQHandler	TIM1_UP_IRQHandler
+#define M0_CNT_TIM_CLK()	RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM1, ENABLE)
 
 #define M1_TIM				TIM3
 #define M1_TIM_IRQn			TIM3_IRQn
@@ -73,6 +125,13 @@
 #define M1_DIR_PIN			GPIO_Pin_9
 #define M1_STEP_PORT		GPIOB
 #define M1_STEP_PIN			GPIO_Pin_1
+#define M1_STEP_OC			4	// TIM3_CH4
+// TIM5 counts steps of Y by TIM3 TRGO
+#define M1_CNT_TIM			TIM5
+#define M1_CNT_TIM_ITR		TIM_TS_ITR1
+#define M1_CNT_TIM_IRQn		TIM5_IRQn
+#define M1_CNT_TIM_IRQHandler	TIM5_IRQHandler
+#define M1_CNT_TIM_CLK()	RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM5, ENABLE)
 
 #define M2_TIM				TIM4
 #define M2_TIM_IRQn			TIM4_IRQn
@@ -86,6 +145,31 @@
 #define M2_DIR_PIN			GPIO_Pin_12
 #define M2_STEP_PORT		GPIOD
 #define M2_STEP_PIN			GPIO_Pin_12
+#define M2_STEP_OC			1	// TIM4_CH1 (full remap)
+#define MX_STEP_REMAP()		GPIO_PinRemapConfig(GPIO_Remap_TIM4, ENABLE)
+
+// Ramp generator: updates step frequencies STEPM_RAMP_FRQ times per second
+#define STEPM_RAMP_TIM				TIM7
+#define STEPM_RAMP_TIM_IRQn			TIM7_IRQn
+#define STEPM_RAMP_TIM_IRQHandler	TIM7_IRQHandler
+#define STEPM_RAMP_TIM_CLK			RCC_APB1Periph_TIM7
+
+#if (USE_STEPM_DMA == 1)
+// Step waveform: TIM1 CC1, CC2, CC4 request DMA1 channels 2, 3, 4,
+// they write BSRR of the ports in order of M0..M2 STEP/DIR pins (GPIOA, GPIOB, GPIOD)
+	#define STEPW_TICK_FRQ		100000	// max. step rate is the half of it
+	#define STEPW_TIM			TIM1
+	#define STEPW_TIM_CLK()		RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM1, ENABLE)
+	#define STEPW_DMA_CLK()		RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE)
+	#define STEPW_DMA0			DMA1_Channel2
+	#define STEPW_DMA1			DMA1_Channel3
+	#define STEPW_DMA2			DMA1_Channel4
+	#define STEPW_DMA_IRQn		DMA1_Channel2_IRQn
+	#define STEPW_DMA_IRQHandler	DMA1_Channel2_IRQHandler
+	#define STEPW_DMA_IT_HT		DMA1_IT_HT2
+	#define STEPW_DMA_IT_TC		DMA1_IT_TC2
+	#define STEPW_DMA_IT_GL		DMA1_IT_GL2
+#endif
 
 /*
 #define M3_TIM				TIM5
@@ -246,6 +330,17 @@ void LedOff(void);
 #define LIMIT_Z_PIN				GPIO_Pin_8
 #define LIMIT_Z_STATE			0
 
+// Outputs of M3/M5 (spindle), M7/M8/M9 (mist, flood), M106/M107 (fan): the step engine
+// switches them in order with the moves. Not wired on this board, define the free pins to use them.
+//#define OUT_SPINDLE_PORT		GPIOx
+//#define OUT_SPINDLE_PIN		GPIO_Pin_x
+//#define OUT_MIST_PORT			GPIOx
+//#define OUT_MIST_PIN			GPIO_Pin_x
+//#define OUT_FLOOD_PORT		GPIOx
+//#define OUT_FLOOD_PIN			GPIO_Pin_x
+//#define OUT_FAN_PORT			GPIOx
+//#define OUT_FAN_PIN			GPIO_Pin_x
+
 #if (USE_RTC == 1)
 	#include "rtc.h"
 #endif
@@ -48,8 +48,32 @@ extern "C" {
 */
 #define USE_SDCARD		2
 #define USE_ENCODER		0
-// Motor number for encoder
-#define MX_ENCODER			2
+/*
+	USE_STEPM_DDA
+		0	Each axis is stepped by own timer
+		1	All axes are stepped in lockstep by M0_TIM (DDA)
+*/
+#define USE_STEPM_DDA	1
+// STEP pins are not timer outputs on this board
+#define USE_STEPM_OC	0
+// DMA step waveform is implemented for F10x DMA channels only
+#define USE_STEPM_DMA	0
+/*
+	USE_STEPM_ARC
+		0	G2/G3 are cut into lines (SM_ARC_TOLERANCE_MM)
+		1	G2/G3 in XY plane are one move, stepped by the midpoint circle DDA of M0_TIM
+*/
+#define USE_STEPM_ARC	1
+// Input shaper is a stage of the DMA step waveform
+#define USE_STEPW_SHAPER	0
+/*
+	USE_CNC_REAL - numbers of the G-code parser, arcs and planner
+		0	double
+		1	float, single precision FPU of Cortex-M4
+		2	fixed point Q15.16
+*/
+#define USE_CNC_REAL	1
+// Encoders of the motors (ENCN_TIM ...), see stm32f10x-board.h
 #define MX_STEP_ON			GPIO_SetBits
 #define MX_STEP_OFF			GPIO_ResetBits
 
@@ -93,6 +117,12 @@ extern "C" {
 #define M2_STEP_PORT		GPIOC
 #define M2_STEP_PIN			GPIO_Pin_13
 
+// Ramp generator: updates step frequencies STEPM_RAMP_FRQ times per second
+#define STEPM_RAMP_TIM				TIM7
+#define STEPM_RAMP_TIM_IRQn			TIM7_IRQn
+#define STEPM_RAMP_TIM_IRQHandler	TIM7_IRQHandler
+#define STEPM_RAMP_TIM_CLK			RCC_APB1Periph_TIM7
+
 #ifdef M3_STEP_PORT
 	#define STEPS_MOTORS	4
 #else
@@ -121,6 +151,17 @@ extern "C" {
 #define LIMIT_Z_PIN				GPIO_Pin_9
 #define LIMIT_Z_STATE			0
 
+// Outputs of M3/M5 (spindle), M7/M8/M9 (mist, flood), M106/M107 (fan): the step engine
+// switches them in order with the moves. Not wired on this board, define the free pins to use them.
+//#define OUT_SPINDLE_PORT		GPIOx
+//#define OUT_SPINDLE_PIN		GPIO_Pin_x
+//#define OUT_MIST_PORT			GPIOx
+//#define OUT_MIST_PIN			GPIO_Pin_x
+//#define OUT_FLOOD_PORT		GPIOx
+//#define OUT_FLOOD_PIN			GPIO_Pin_x
+//#define OUT_FAN_PORT			GPIOx
+//#define OUT_FAN_PIN			GPIO_Pin_x
+
 
 #define PIN_SPEED_LOW()			GPIO_InitStructure.GPIO_Speed = GPIO_Speed_2MHz
 #define PIN_SPEED_MID()			GPIO_InitStructure.GPIO_Speed = GPIO_Speed_25MHz
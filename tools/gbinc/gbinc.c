@@ -0,0 +1,304 @@
+/*
+ * gbinc - G-code to the pre-compiled job (.gbin, see src/application/gbin.h).
+ *
+ * The parser, the arcs and the path stage of the firmware make the blocks of the planner,
+ * they go to the file instead of the planner (USE_GBIN_WRITER in stdafx.h).
+ * The steps are made for the machine profile: sm.conf of the SD card or the defaults of gcode.h.
+ *
+ * Build (the numbers and the arcs of the board the job is for):
+ *	STM32F103:	gcc -O2 -std=gnu99 -D_WINDOWS -DUSE_CNC_REAL=2 -DUSE_STEPM_ARC=1 -Itools/gbinc -Isrc/application -o gbinc \
+ *				tools/gbinc/gbinc.c src/application/{gcode,gcode_exec,planner,cnc_real,gbin}.c -lm
+ *	STM32F429:	the same with -DUSE_CNC_REAL=1
+ *
+ * Usage: gbinc [-c sm.conf] [-s line] job.nc job.gbin
+ *	-s line - the job from the line as "start at the line" of the machine: the lines before it
+ *			  are parsed only, the tool goes over the top of the job to the point of the line
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stdafx.h"
+#include "gbin.h"
+
+extern int curGCodeMode;
+extern uint32_t commonTimeIdeal;
+extern bool isGcodeStop;
+extern CNC_REAL minX, maxX, minY, maxY, minZ, maxZ;
+
+void initGcodeProc(void);
+
+static FILE *out;
+static uint32_t blocks;
+static uint32_t feedUm;	// feed rate of the last move, 1/1000 mm/min
+
+//---------------------------------------------------------------------
+// The firmware parts which are not used: no motion on the host
+uint32_t Seconds(void) { return 0; }
+void delayMs(uint16_t msec) { (void)msec; }
+char *str_trim(char *str) { return str; }
+
+void stepm_init(void) {}
+void stepm_EmergeStop(void) {}
+void stepm_setOverride(uint16_t feed, uint16_t rapid) { (void)feed; (void)rapid; }
+void stepm_addMove(uint32_t steps[], uint32_t frq[], uint8_t dir[]) { (void)steps; (void)frq; (void)dir; }
+void stepm_addRamp(uint32_t steps[], uint8_t dir[], const STEPM_RAMP *ramp) { (void)steps; (void)dir; (void)ramp; }
+void stepm_addArc(const STEPM_ARC *arc, const STEPM_RAMP *ramp) { (void)arc; (void)ramp; }
+void stepm_addCmd(uint8_t cmd, uint32_t value) { (void)cmd; (void)value; }
+uint32_t stepm_LinesBufferIsFull(void) { return 0; }
+int32_t stepm_getRemainLines(void) { return 0; }
+int32_t stepm_getCurGlobalStepsNum(uint8_t id) { (void)id; return 0; }
+int32_t stepm_inProc(void) { return 0; }
+
+//---------------------------------------------------------------------
+static bool gbin_put(const GBIN_RECORD *rec)
+{
+	uint8_t buf[GBIN_MAX_RECORD];
+
+	if ((curGCodeMode & GFILE_MODE_MASK_EXEC) == 0)
+		return true;	// a line before the start line
+	blocks++;
+	return fwrite(buf, gbin_encode(rec, buf), 1, out) == 1;
+}
+
+static bool gbin_putFeed(CNC_REAL feed_rate)
+{
+	GBIN_RECORD rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = GBIN_FEED;
+	rec.value = real_mulDivRound(feed_rate, 1000, 1);
+	if (rec.value == feedUm)
+		return true;
+	feedUm = rec.value;
+	return gbin_put(&rec);
+}
+
+bool gbin_putLine(const int32_t steps[], CNC_REAL moveLength, CNC_REAL feed_rate, bool isRapid)
+{
+	GBIN_RECORD rec;
+
+	if (!gbin_putFeed(feed_rate))
+		return false;
+	memset(&rec, 0, sizeof(rec));
+	rec.type = GBIN_LINE;
+	rec.flag = isRapid;
+	memcpy(rec.steps, steps, sizeof(rec.steps));
+	rec.lengthUm = real_mulDivRound(moveLength, 1000, 1);
+	return gbin_put(&rec);
+}
+
+bool gbin_putArc(const STEPM_ARC *arc, CNC_REAL length, CNC_REAL feed_rate)
+{
+	GBIN_RECORD rec;
+
+	if (!gbin_putFeed(feed_rate))
+		return false;
+	memset(&rec, 0, sizeof(rec));
+	rec.type = GBIN_ARC;
+	rec.flag = arc->cw != 0;
+	rec.arc = *arc;
+	rec.lengthUm = real_mulDivRound(length, 1000, 1);
+	return gbin_put(&rec);
+}
+
+bool gbin_putCmd(uint8_t cmd, uint32_t value)
+{
+	GBIN_RECORD rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = GBIN_CMD;
+	rec.cmd = cmd;
+	rec.value = value;
+	return gbin_put(&rec);
+}
+
+bool gbin_putOverride(bool isEnabled)
+{
+	GBIN_RECORD rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = GBIN_OVERRIDE;
+	rec.flag = isEnabled;
+	return gbin_put(&rec);
+}
+
+//---------------------------------------------------------------------
+static char *conf_gets(char *str, int size, FILE *f)
+{
+	char *s = fgets(str, size, f);
+
+	if (s != NULL)
+		str[strcspn(str, "\r\n")] = 0;
+	return s;
+}
+
+// sm.conf as saveSmParam writes it, see initSmParam
+static void readConf(const char *name)
+{
+	FILE *f = fopen(name, "r");
+	char str[256], *p;
+	int i, n;
+	bool hasJerk, hasBacklash;
+
+	if (f == NULL)
+	{
+		fprintf(stderr, "can't open %s\n", name);
+		exit(1);
+	}
+	for (i = 0; i < 3; i++)
+	{
+		if (conf_gets(str, sizeof(str), f) == NULL)
+			break;
+		hasJerk = strstr(str, "jerk") != NULL;
+		hasBacklash = strstr(str, "backlash") != NULL;
+		if (conf_gets(str, sizeof(str), f) == NULL)
+			break;
+		p = str;
+		_smParam.smoothStartF_from0[i] = strtofix_M(p, &p, 0);
+		_smParam.smoothStopF_to0[i] = strtofix_M(p, &p, 0);
+		_smParam.smoothAF[i] = strtofix_M(p, &p, 0);
+		_smParam.maxFeedRate[i] = strtofix_M(p, &p, 0);
+		if (hasJerk)
+		{
+			int32_t jerk = strtofix_M(p, &p, 0);
+			if (jerk > 0)
+				_smParam.jerk[i] = jerk;
+		}
+		if (hasBacklash)
+		{
+			int32_t backlash = strtofix_M(p, &p, 0);
+			if (backlash >= 0)
+				_smParam.backlash[i] = backlash;
+		}
+	}
+	if (conf_gets(str, sizeof(str), f) != NULL && conf_gets(str, sizeof(str), f) != NULL)
+		_smParam.maxSpindleTemperature = strtofix_M(str, &p, 0);
+	if (conf_gets(str, sizeof(str), f) != NULL && strstr(str, "steps") != NULL)
+	{
+		for (i = 0; i < CRDS_SIZE; i++)
+		{
+			if (conf_gets(str, sizeof(str), f) == NULL)
+				break;
+			p = str;
+			_smParam.stepsPer360[i] = strtofix_M(p, &p, 0);
+			_smParam.umPer360[i] = strtofix_M(p, &p, 0);
+			if (i < 3)
+				_smParam.tableSize[i] = strtofix_M(p, &p, 0);
+		}
+		if (conf_gets(str, sizeof(str), f) != NULL && conf_gets(str, sizeof(str), f) != NULL)
+		{
+			p = str;
+			_smParam.arcTolerance_um = strtofix_M(p, &p, 0);
+			_smParam.arcMinRadius_um = strtofix_M(p, &p, 0);
+		}
+	}
+	fclose(f);
+	if ((n = sm_checkParam(&_smParam)) != 0)
+		fprintf(stderr, "%s: %d bad values, defaults are used\n", name, n);
+}
+
+int main(int argc, char **argv)
+{
+	GBIN_HDR hdr;
+	GBIN_RECORD rec;
+	FILE *in;
+	char str[256];
+	int lineNum = 0, startLine = 0;
+	uint8_t st;
+	long inSize, outSize;
+
+	sm_defaultParam(&_smParam);
+	while (argc > 3 && argv[1][0] == '-')
+	{
+		if (strcmp(argv[1], "-c") == 0)
+			readConf(argv[2]);
+		else if (strcmp(argv[1], "-s") == 0)
+			startLine = atoi(argv[2]);
+		else
+			break;
+		argv += 2;
+		argc -= 2;
+	}
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: gbinc [-c sm.conf] [-s line] job.nc job.gbin\n");
+		return 1;
+	}
+	sm_deriveParam(&_smParam);
+
+	in = fopen(argv[1], "r");
+	if (in == NULL)
+	{
+		fprintf(stderr, "can't open %s\n", argv[1]);
+		return 1;
+	}
+	out = fopen(argv[2], "wb");
+	if (out == NULL)
+	{
+		fprintf(stderr, "can't create %s\n", argv[2]);
+		return 1;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	fwrite(&hdr, sizeof(hdr), 1, out);	// it's written at the end
+
+	initGcodeProc();
+	// the arcs are native as on the machine, the lines before the start are checked
+	curGCodeMode = startLine > 1 ? GFILE_MODE_MASK_CHK : GFILE_MODE_MASK_EXEC;
+	while (!isGcodeStop && fgets(str, sizeof(str), in) != NULL)
+	{
+		lineNum++;
+		if (strchr(str, '\n') == NULL && !feof(in))
+		{
+			fprintf(stderr, "%s:%d: the line is too long\n", argv[1], lineNum);
+			return 1;
+		}
+		if (lineNum == startLine && startLine > 1)
+		{
+			feedUm = 0;	// the first move after the restart has its feed
+			if (!cnc_restart(GFILE_MODE_MASK_EXEC, 0))
+				return 1;
+		}
+		str[strcspn(str, "\r\n")] = 0;
+		st = gc_execute_line(str);
+		if (st != GCSTATUS_OK)
+		{
+			fprintf(stderr, "%s:%d: status %d: %s\n", argv[1], lineNum, st, str);
+			return 1;
+		}
+	}
+	if (startLine > lineNum)
+	{
+		fprintf(stderr, "%s: %d lines, no line %d\n", argv[1], lineNum, startLine);
+		return 1;
+	}
+	inSize = ftell(in);
+	fclose(in);
+	cnc_flush();
+	memset(&rec, 0, sizeof(rec));
+	rec.type = GBIN_END;
+	gbin_put(&rec);
+	outSize = ftell(out);
+
+	hdr.magic = GBIN_MAGIC;
+	hdr.version = GBIN_VERSION;
+	memcpy(hdr.stepsPer360, _smParam.stepsPer360, sizeof(hdr.stepsPer360));
+	memcpy(hdr.umPer360, _smParam.umPer360, sizeof(hdr.umPer360));
+	hdr.timeMs = commonTimeIdeal;
+	hdr.minUm[CRD_X] = real_mulDivRound(minX, 1000, 1);
+	hdr.maxUm[CRD_X] = real_mulDivRound(maxX, 1000, 1);
+	hdr.minUm[CRD_Y] = real_mulDivRound(minY, 1000, 1);
+	hdr.maxUm[CRD_Y] = real_mulDivRound(maxY, 1000, 1);
+	hdr.minUm[CRD_Z] = real_mulDivRound(minZ, 1000, 1);
+	hdr.maxUm[CRD_Z] = real_mulDivRound(maxZ, 1000, 1);
+	fseek(out, 0, SEEK_SET);
+	fwrite(&hdr, sizeof(hdr), 1, out);
+	if (ferror(out) || fclose(out) != 0)
+	{
+		fprintf(stderr, "can't write %s\n", argv[2]);
+		return 1;
+	}
+	printf("%d lines, %ld bytes -> %u blocks, %ld bytes\n", lineNum, inSize, blocks, outSize);
+	return 0;
+}
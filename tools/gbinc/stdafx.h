@@ -0,0 +1,55 @@
+#ifndef __STDAFX_H__
+#define __STDAFX_H__
+
+/*
+ * Host build of the G-code parser, the arcs and the path stage for gbinc:
+ * it takes the place of global.h and the board header.
+ */
+#define __GLOBAL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define __INLINE	inline
+
+typedef unsigned int UINT;
+
+#define USE_LCD			0
+#define USE_KEYBOARD	0
+#define USE_SDCARD		0
+#define USE_EXTRUDER	0
+#define USE_ENCODER		0
+#define USE_DEBUG_MODE	0
+#define USE_STEP_DEBUG	0
+/*
+	USE_CNC_REAL, USE_STEPM_ARC - the ones of the board the job is made for,
+	the steps are rounded by the same numbers
+*/
+#ifndef USE_CNC_REAL
+	#define USE_CNC_REAL	2
+#endif
+#ifndef USE_STEPM_ARC
+	#define USE_STEPM_ARC	0
+#endif
+/*
+	USE_GBIN_WRITER
+		1	the blocks of the planner go to the .gbin file (gbin.h), the planner is not used
+*/
+#define USE_GBIN_WRITER	1
+
+#define STEPS_MOTORS	4
+
+#define DBG(...) { }
+#define limits_chk()	0
+
+#include "screen_io.h"
+#include "keyboard.h"
+#include "gcode.h"
+#include "stepmotor.h"
+
+void delayMs(uint16_t msec);
+char *str_trim(char *str);
+uint32_t Seconds(void);
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * arc_trace_test - trace of the step waveform (stepw_fill) of the native arcs against the old
+ * engine, which made the arc of chords: the same end point and the same steps of each axis,
+ * every step of the native arc within a step of the ideal circle. The lines are checked too:
+ * the steps of each axis and the final position of the move, the Bresenham axes within
+ * a step of their ideal position.
+ *
+ * Build and run: make -C tools/hosttest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "stdafx.h"
+#include "wave_trace.h"
+
+static int fails;
+
+#define CHECK(cond, ...)	do { if (!(cond)) { fails++; printf("FAIL %s:%d: ", __func__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+static uint32_t seed = 2024;
+
+static uint32_t rnd(uint32_t n)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 8) & 0xffffff) % n;
+}
+
+//---------------------------------------------------------------------
+// Lines: the steps of each axis follow the main one
+static struct {
+	int32_t  start[STEPW_AXES_MAX];
+	uint32_t steps[STEPW_AXES_MAX], total;
+	uint8_t  main;
+	double   maxLag;
+} line;
+
+static void lineStep(const int32_t pos[], uint32_t tick)
+{
+	uint32_t done = abs(pos[line.main] - line.start[line.main]);
+
+	(void)tick;
+	for (int i = 0; i < STEPW_AXES_MAX; i++)
+	{
+		double lag = fabs(abs(pos[i] - line.start[i]) - (double)done * line.steps[i] / line.total);
+
+		if (lag > line.maxLag)
+			line.maxLag = lag;
+	}
+}
+
+static void test_lines(void)
+{
+	STEPM_RAMP ramp;
+	uint8_t dir[STEPW_AXES_MAX];
+	uint32_t moves = 3000;
+
+	trace_init(STEPW_AXES_MAX);
+	trace.onStep = lineStep;
+	for (uint32_t m = 0; m < moves; m++)
+	{
+		memcpy(line.start, trace.pos, sizeof(line.start));
+		line.total = 0;
+		for (int i = 0; i < STEPW_AXES_MAX; i++)
+		{
+			line.steps[i] = rnd(4) == 0 ? 0 : rnd(m % 10 == 0 ? 50000 : 300);
+			dir[i] = rnd(2);
+			if (line.steps[i] > line.total)
+			{
+				line.total = line.steps[i];
+				line.main = i;
+			}
+		}
+		if (line.total == 0)
+			continue;
+		trace_ramp(&ramp, 100 + rnd(60000));
+		stepw_loadMove(line.steps, dir, &ramp);
+		trace_run(100000000);
+		for (int i = 0; i < STEPW_AXES_MAX; i++)
+		{
+			int32_t d = dir[i] ? (int32_t)line.steps[i] : -(int32_t)line.steps[i];
+
+			CHECK(trace.pos[i] - line.start[i] == d, "move %u axis %d: %d steps, not %d", m, i, trace.pos[i] - line.start[i], d);
+		}
+	}
+	CHECK(line.maxLag <= 1, "an axis is %.2f steps off the line", line.maxLag);
+	CHECK(trace.dirErrors == 0, "%u DIR/STEP timing errors", trace.dirErrors);
+	printf("lines: %u moves, max lag %.2f step\n", moves, line.maxLag);
+}
+
+//---------------------------------------------------------------------
+// Arcs: the native DDA against the chords of the old engine
+static struct {
+	double   r;
+	int32_t  cx, cy;
+	uint32_t n, dev;
+	double   *devs;
+} arc;
+
+static void arcStep(const int32_t pos[], uint32_t tick)
+{
+	(void)tick;
+	if (arc.n < arc.dev)
+		arc.devs[arc.n++] = fabs(hypot(pos[0] - arc.cx, pos[1] - arc.cy) - arc.r);
+}
+
+// Arc of r steps around (cx, cy) from the angle a0 to a1 (radians, a1 < a0 - CW)
+static void runArc(uint32_t r, double a0, double a1, double *devNative, double *devChords)
+{
+	STEPM_ARC a;
+	STEPW_ARC w;
+	STEPM_RAMP ramp;
+	int32_t start[2], native[2];
+	uint32_t steps[STEPW_AXES_MAX], nativeSteps[2], chords;
+	uint8_t dir[STEPW_AXES_MAX];
+	uint32_t n;
+
+	memset(&a, 0, sizeof(a));
+	a.r = r;
+	a.cw = a1 < a0;
+	a.x = (int32_t)lround(r * cos(a0));
+	a.y = (int32_t)lround(r * sin(a0));
+	a.xEnd = (int32_t)lround(r * cos(a1));
+	a.yEnd = (int32_t)lround(r * sin(a1));
+	a.length = (uint32_t)lround(r * fabs(a1 - a0));
+	arc.r = r;
+	arc.cx = trace.pos[0] - a.x;
+	arc.cy = trace.pos[1] - a.y;
+	start[0] = trace.pos[0];
+	start[1] = trace.pos[1];
+	trace_ramp(&ramp, 1000 + rnd(40000));
+
+	// native: STEPM_ARC as stepm_addArc loads it
+	arc.n = 0;
+	memset(trace.steps, 0, sizeof(trace.steps));
+	stepw_arcStart(&w, &a);
+	if (stepw_arcNext(&w))
+	{
+		stepw_loadArc(&w, &ramp);
+		trace_run(200000000);
+	}
+	native[0] = trace.pos[0];
+	native[1] = trace.pos[1];
+	nativeSteps[0] = trace.steps[0];
+	nativeSteps[1] = trace.steps[1];
+	// the last events step to the end point, off the circle by a step or two
+	for (*devNative = 0, n = 0; n + 2 < arc.n; n++)
+		if (arc.devs[n] > *devNative)
+			*devNative = arc.devs[n];
+	CHECK(native[0] - arc.cx == a.xEnd && native[1] - arc.cy == a.yEnd, "r %u: native arc ends at %d,%d, not %d,%d",
+		r, native[0] - arc.cx, native[1] - arc.cy, a.xEnd, a.yEnd);
+
+	// the old engine: chords within 0.5 step of the circle, their points rounded
+	chords = (uint32_t)ceil(fabs(a1 - a0) / (2 * acos(1 - 0.5 / r > -1 ? 1 - 0.5 / r : -1)));
+	trace.pos[0] = start[0];
+	trace.pos[1] = start[1];
+	memset(trace.steps, 0, sizeof(trace.steps));
+	arc.n = 0;
+	for (uint32_t i = 1; i <= chords; i++)
+	{
+		double t = a0 + (a1 - a0) * i / chords;
+		int32_t x = i == chords ? a.xEnd : (int32_t)lround(r * cos(t));
+		int32_t y = i == chords ? a.yEnd : (int32_t)lround(r * sin(t));
+		int32_t dx = x + arc.cx - trace.pos[0], dy = y + arc.cy - trace.pos[1];
+
+		memset(steps, 0, sizeof(steps));
+		memset(dir, 0, sizeof(dir));
+		steps[0] = abs(dx);
+		steps[1] = abs(dy);
+		dir[0] = dx > 0;
+		dir[1] = dy > 0;
+		stepw_loadMove(steps, dir, &ramp);
+		trace_run(200000000);
+	}
+	for (*devChords = 0, n = 0; n < arc.n; n++)
+		if (arc.devs[n] > *devChords)
+			*devChords = arc.devs[n];
+	CHECK(trace.pos[0] == native[0] && trace.pos[1] == native[1], "r %u: chords end at %d,%d, the arc at %d,%d",
+		r, trace.pos[0], trace.pos[1], native[0], native[1]);
+	// the arc and the chords go through the same rows and columns of steps, the arc may have
+	// a step there and back more where it starts or ends at the top of the circle
+	for (int i = 0; i < 2; i++)
+		CHECK(abs((int32_t)nativeSteps[i] - (int32_t)trace.steps[i]) <= 2,
+			"r %u %.2f..%.2f axis %d: %u steps of the arc, %u of the chords", r, a0, a1, i, nativeSteps[i], trace.steps[i]);
+}
+
+static void test_arcs(void)
+{
+	static const uint32_t radius[] = { 2, 5, 40, 320, 3200, 20000 };
+	double devNative = 0, devChords = 0, dn, dc;
+	uint32_t arcs = 0;
+
+	arc.dev = 8 * 20000 * 4;
+	arc.devs = malloc(arc.dev * sizeof(double));
+	trace_init(2);
+	trace.onStep = arcStep;
+	for (unsigned k = 0; k < sizeof(radius) / sizeof(radius[0]); k++)
+		for (int j = 0; j < (radius[k] > 5000 ? 20 : 200); j++)
+		{
+			double a0 = rnd(3600) * M_PI / 1800, da = (1 + rnd(3590)) * M_PI / 1800;
+
+			runArc(radius[k], a0, rnd(2) ? a0 + da : a0 - da, &dn, &dc);
+			devNative = fmax(devNative, dn);
+			devChords = fmax(devChords, dc);
+			arcs++;
+		}
+	CHECK(devNative < 1, "a step of the native arc is %.3f steps off the circle", devNative);
+	CHECK(trace.dirErrors == 0, "%u DIR/STEP timing errors", trace.dirErrors);
+	printf("arcs: %u, max deviation from the circle: native %.3f step, chords %.3f step\n", arcs, devNative, devChords);
+	free(arc.devs);
+}
+
+int main(void)
+{
+	test_lines();
+	test_arcs();
+	printf("%s: arc_trace_test\n", fails ? "FAIL" : "OK");
+	return fails ? 1 : 0;
+}
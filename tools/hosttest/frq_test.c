@@ -0,0 +1,104 @@
+/*
+ * frq_test - step frequency of the DMA waveform: stepw_frqToInc and the phase accumulator
+ * of stepw_fill, achieved against requested over the full range of the frequencies,
+ * the clamp to the half of the tick frequency (STEP high and low for a tick).
+ *
+ * stepwave.c is a part of the test: stepw_frqToInc and the state of the builder are static.
+ *
+ * Build and run: make -C tools/hosttest
+ */
+
+#include "../../src/application/stepwave.c"
+
+#include <stdio.h>
+
+#include "wave_trace.h"
+
+static int fails;
+
+#define CHECK(cond, ...)	do { if (!(cond)) { fails++; printf("FAIL %s:%d: ", __func__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+// Frequency of inc, Hz
+static double incToFrq(uint32_t inc)
+{
+	return (double)inc * TRACE_TICK_FRQ / 4294967296.0;
+}
+
+// inc of every frequency (1/K_FRQ Hz) is within one LSB of the phase, tickFrq / 2^32
+static void test_frqToInc(void)
+{
+	double maxErr = 0, maxPpm = 0;
+
+	trace_init(1);
+	for (uint32_t f = 1; f <= TRACE_TICK_FRQ / 2 * K_FRQ; f += f < 100000 ? 1 : 7)
+	{
+		double err = fabs(incToFrq(stepw_frqToInc(f)) - (double)f / K_FRQ);
+
+		if (err > maxErr)
+			maxErr = err;
+		if (f >= 100 * K_FRQ && err / f * K_FRQ * 1e6 > maxPpm)
+			maxPpm = err / f * K_FRQ * 1e6;
+	}
+	CHECK(maxErr <= TRACE_TICK_FRQ / 4294967296.0, "error %.9f Hz", maxErr);
+	// above the half of the tick frequency: a step every 2 ticks
+	for (uint32_t f = TRACE_TICK_FRQ / 2 * K_FRQ; f < 4 * TRACE_TICK_FRQ * K_FRQ; f += 997)
+		CHECK(stepw_frqToInc(f) == 0x80000000u, "f %u: inc %08x", f, stepw_frqToInc(f));
+	CHECK(stepw_frqToInc(0xffffffff) == 0x80000000u, "inc %08x", stepw_frqToInc(0xffffffff));
+	printf("frqToInc: max error %.2e Hz, %.3f ppm from 100 Hz\n", maxErr, maxPpm);
+}
+
+// The accumulator: N steps of a move at a constant frequency take N / f seconds
+static uint32_t firstTick, lastTick;
+
+static void onStep(const int32_t pos[], uint32_t tick)
+{
+	if (pos[0] == 1)
+		firstTick = tick;
+	lastTick = tick;
+}
+
+static void test_accumulator(void)
+{
+	STEPM_RAMP ramp;
+	uint32_t steps[STEPW_AXES_MAX] = { 0 };
+	uint8_t dir[STEPW_AXES_MAX] = { 1 };
+	double maxPpm = 0, maxPpmLow = 0;
+	uint32_t runs = 0;
+
+	for (double fr = 1; fr < 4 * TRACE_TICK_FRQ; fr *= 1.13)
+	{
+		uint32_t f = (uint32_t)(fr * K_FRQ) + runs % K_FRQ;	// the fractions of Hz too
+		double fHz = (double)f / K_FRQ, fExp = fHz < TRACE_TICK_FRQ / 2 ? fHz : TRACE_TICK_FRQ / 2;
+		double fGot, ticks;
+
+		trace_init(1);
+		trace.onStep = onStep;
+		steps[0] = fExp < 20 ? 21 : (uint32_t)(fExp * 20);	// 20 seconds
+		memset(&ramp, 0, sizeof(ramp));
+		ramp.fEntry = ramp.fPeak = ramp.fExit = f;
+		stepw_loadMove(steps, dir, &ramp);
+		trace_run(0xffffffff);
+		CHECK(trace.pos[0] == (int32_t)steps[0], "%.1f Hz: %d steps of %u", fHz, trace.pos[0], steps[0]);
+		CHECK(trace.dirErrors == 0, "%.1f Hz: STEP high for two ticks", fHz);
+		// the steps after the first one are over (N - 1) periods of inc, within a tick:
+		// the accumulator loses nothing, the error is the one of inc only
+		ticks = lastTick - firstTick;
+		fGot = (steps[0] - 1) * (double)TRACE_TICK_FRQ / ticks;
+		CHECK(fabs(ticks - (steps[0] - 1.0) * 4294967296.0 / stepw_frqToInc(f)) <= 1, "%.1f Hz: %.0f ticks, %.4f Hz", fHz, ticks, fGot);
+		if (fExp >= 100 && fabs(fGot - fExp) / fExp * 1e6 > maxPpm)
+			maxPpm = fabs(fGot - fExp) / fExp * 1e6;
+		if (fExp < 100 && fabs(fGot - fExp) / fExp * 1e6 > maxPpmLow)
+			maxPpmLow = fabs(fGot - fExp) / fExp * 1e6;
+		runs++;
+	}
+	printf("accumulator: %u frequencies from 1 Hz to %u kHz, max error over 20 s %.3f ppm from 100 Hz, %.1f ppm below\n",
+		runs, 4 * TRACE_TICK_FRQ / 1000, maxPpm, maxPpmLow);
+}
+
+int main(void)
+{
+	test_frqToInc();
+	test_accumulator();
+	printf("%s: frq_test\n", fails ? "FAIL" : "OK");
+	return fails ? 1 : 0;
+}
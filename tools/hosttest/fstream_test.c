@@ -0,0 +1,296 @@
+/*
+ * fstream_test - the ping-pong reader of the job file (fstream.c) against a simulated SD card
+ * of the F103 board: a 20 MB G-code file in scattered clusters, the first sector of a cluster
+ * by f_lseek, the rest by DMA which ends after the latency of the card and the transfer.
+ * The job is parsed as cnc_gfile does it: the lines come whole and in order at the offsets of
+ * fstream_tell, from the start and from a line in the middle of the file, a read error stops it.
+ * The motors run the moves of a queue of 16, the waits for the card and the underruns (the motors
+ * stopped during the wait) are reported: none for a card of 12 MB/s, some for a slow one.
+ *
+ * Build and run: make -C tools/hosttest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stdafx.h"
+#include "fstream.h"
+
+static int fails;
+
+#define CHECK(cond, ...)	do { if (!(cond)) { fails++; printf("FAIL %s:%d: ", __func__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+static uint32_t seed = 2024;
+
+static uint32_t rnd(uint32_t n)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 8) & 0xffffff) % n;
+}
+
+#define FILE_SIZE		(20 * 1024 * 1024)
+#define CLUSTER_SECT	8		// 4 KB clusters: the most cluster starts
+#define DATA_SECT		1000	// the first sector of the data area
+#define MOVE_QUEUE		16
+
+typedef struct {
+	const char *name;
+	uint32_t latUs, jitterUs;	// of a read command
+	uint32_t sectUs;			// transfer of a sector
+	uint32_t moveUs;			// mean time of a move
+	uint32_t failDma;			// the DMA transfer which fails, 0 - none
+} CARD;
+
+static char *file;						// the job
+static uint32_t fileSize;
+static uint8_t *card;					// the sectors of the file on the card
+static uint32_t *clusterMap;			// cluster of the card of the cluster of the file
+static uint32_t clusters;
+static const CARD *cfg;
+static uint64_t now;					// us
+static uint64_t motorEnd;				// the end of the last move
+static uint64_t moveEnds[MOVE_QUEUE];	// of the moves in the queue
+static uint64_t dmaEnd;
+static uint32_t *dmaBuf, dmaSect, dmaCount, dmaNum;
+static bool isDma;
+static char buf[FSTREAM_SIZE] __attribute__((aligned(4)));
+
+SD_Error SD_errno;
+
+//---------------------------------------------------------------------
+// The card
+static uint32_t readTime(uint32_t sectors)
+{
+	return cfg->latUs + rnd(cfg->jitterUs) + sectors * cfg->sectUs;
+}
+
+static uint32_t fileSector(uint32_t ofs)
+{
+	uint32_t cl = ofs / (CLUSTER_SECT * 512);
+
+	return DATA_SECT + clusterMap[cl] * CLUSTER_SECT + ofs / 512 % CLUSTER_SECT;
+}
+
+static const uint8_t *cardSector(uint32_t sect)
+{
+	uint32_t rel = sect - DATA_SECT;
+
+	return card + (rel / CLUSTER_SECT * CLUSTER_SECT + rel % CLUSTER_SECT) * 512;
+}
+
+FRESULT f_lseek(FIL *fp, uint32_t ofs)
+{
+	CHECK(!isDma, "f_lseek while the DMA transfer goes");
+	if (ofs > fp->fsize)
+		ofs = fp->fsize;
+	// the next cluster of the chain is in the FAT: one more sector at the start of a cluster
+	now += readTime((ofs - 1) / (CLUSTER_SECT * 512) != (fp->fptr - 1) / (CLUSTER_SECT * 512) ? 2 : 1);
+	fp->fptr = ofs;
+	fp->dsect = fileSector(ofs);
+	memcpy(fp->buf, cardSector(fp->dsect), 512);
+	return FR_OK;
+}
+
+SD_Error SD_ReadBlock(uint32_t addr, uint32_t *readbuff, uint16_t BlockSize)
+{
+	CHECK(!isDma, "a sector read while the DMA transfer goes");
+	CHECK(BlockSize == 512, "block %u", BlockSize);
+	now += readTime(1);
+	memcpy(readbuff, cardSector(addr >> 9), 512);
+	return SD_OK;
+}
+
+SD_Error SD_StartReadMultiBlocks(uint32_t addr, uint32_t *readbuff, uint16_t BlockSize, uint32_t NumberOfBlocks)
+{
+	CHECK(!isDma, "a DMA transfer while the other one goes");
+	CHECK(((uintptr_t)readbuff & 3) == 0, "unaligned DMA buffer");
+	CHECK(NumberOfBlocks > 1 && BlockSize == 512, "%u blocks of %u", NumberOfBlocks, BlockSize);
+	isDma = true;
+	dmaBuf = readbuff;
+	dmaSect = addr >> 9;
+	dmaCount = NumberOfBlocks;
+	dmaEnd = now + readTime(NumberOfBlocks);
+	dmaNum++;
+	return SD_OK;
+}
+
+SD_Error SD_GetReadState(void)
+{
+	uint32_t i;
+
+	CHECK(isDma, "no DMA transfer");
+	now++;		// the poll
+	if (now < dmaEnd)
+		return SD_REQUEST_PENDING;
+	isDma = false;
+	if (dmaNum == cfg->failDma)
+		return SD_ERROR;
+	// the data goes at the end of the transfer: the buffer is not used before
+	for (i = 0; i < dmaCount; i++)
+	{
+		CHECK((dmaSect + i - DATA_SECT) / CLUSTER_SECT == (dmaSect - DATA_SECT) / CLUSTER_SECT, "DMA past the cluster");
+		memcpy((uint8_t *)dmaBuf + i * 512, cardSector(dmaSect + i), 512);
+	}
+	return SD_OK;
+}
+
+int32_t stepm_inProc(void)
+{
+	return now < motorEnd;
+}
+
+//---------------------------------------------------------------------
+// The job: G1 lines with comments now and then, the clusters are scattered over the card
+static void makeJob(void)
+{
+	uint32_t i, j, n = 0;
+
+	file = malloc(FILE_SIZE + 256);
+	while (n < FILE_SIZE)
+	{
+		if (rnd(50) == 0)
+			n += sprintf(file + n, "(pass %u)\n", n);
+		else
+			n += sprintf(file + n, "G1 X%d.%03u Y%d.%03u F%u\n", (int)rnd(400) - 200, rnd(1000),
+				(int)rnd(300) - 150, rnd(1000), 100 + rnd(3000));
+	}
+	fileSize = n;
+	clusters = (fileSize + CLUSTER_SECT * 512 - 1) / (CLUSTER_SECT * 512);
+	card = calloc(clusters, CLUSTER_SECT * 512);
+	clusterMap = malloc(clusters * sizeof(*clusterMap));
+	for (i = 0; i < clusters; i++)
+		clusterMap[i] = i;
+	for (i = clusters - 1; i > 0; i--)
+	{
+		uint32_t t = clusterMap[i];
+
+		j = rnd(i + 1);
+		clusterMap[i] = clusterMap[j];
+		clusterMap[j] = t;
+	}
+	for (i = 0; i < clusters; i++)
+	{
+		uint32_t len = fileSize - i * CLUSTER_SECT * 512;
+
+		memcpy(card + clusterMap[i] * CLUSTER_SECT * 512, file + i * CLUSTER_SECT * 512,
+			len < CLUSTER_SECT * 512 ? len : CLUSTER_SECT * 512);
+	}
+}
+
+// The move of the line goes to the queue, the parser waits for a free place as cnc_waitSMotorReady
+static void queueMove(uint32_t line)
+{
+	uint64_t *end = &moveEnds[line % MOVE_QUEUE];
+
+	while (*end > now)
+	{
+		now += 50;
+		fstream_poll();
+	}
+	if (motorEnd < now)
+		motorEnd = now;
+	motorEnd += cfg->moveUs / 2 + rnd(cfg->moveUs);
+	*end = motorEnd;
+}
+
+// The loop of cnc_gfile from the line at ofs, returns the offset after the last line
+static uint32_t runJob(uint32_t ofs, uint32_t *lines)
+{
+	static FATFS fs = { CLUSTER_SECT };
+	FIL fid;
+	char *p, *str = NULL, *bufEnd;
+	uint32_t len, tail = 0, pos = ofs;
+	int bad = 0;
+
+	memset(&fid, 0, sizeof(fid));
+	fid.fs = &fs;
+	fid.fsize = fileSize;
+	now = motorEnd = 0;
+	memset(moveEnds, 0, sizeof(moveEnds));
+	dmaNum = 0;
+	*lines = 0;
+	fstream_open(&fid, buf, ofs, true);
+	while ((str = fstream_next(str, tail, &len)) != NULL)
+	{
+		bufEnd = str + len;
+		for (; str < bufEnd; (*lines)++, str = p + 1)
+		{
+			p = memchr(str, '\n', bufEnd - str);
+			if (p == NULL)
+			{
+				if (!fstream_isLast() && bufEnd - str < FSTREAM_TAIL)
+					break;
+				p = bufEnd;
+			}
+			if (bad < 5 && (fstream_tell(str) != pos || memcmp(str, file + pos, p - str) != 0
+				|| (p < bufEnd && file[pos + (p - str)] != '\n')))
+			{
+				CHECK(false, "line %u at %u (fstream_tell %u): '%.20s'", *lines, pos, fstream_tell(str), str);
+				bad++;
+			}
+			pos += (uint32_t)(p - str) + 1;
+			now += 80;	// the parser
+			if (str[0] == 'G')
+				queueMove(*lines);
+			fstream_poll();
+		}
+		tail = str < bufEnd ? bufEnd - str : 0;
+	}
+	fstream_close();
+	return pos;
+}
+
+static void test_card(const CARD *c)
+{
+	uint32_t lines, pos;
+
+	cfg = c;
+	pos = runJob(0, &lines);
+	CHECK(pos == fileSize, "%s: the end at %u of %u", c->name, pos, fileSize);
+	CHECK(fstreamStat.errors == 0, "%s: %u errors", c->name, fstreamStat.errors);
+	printf("%s: %u bytes, %u lines, %u halves, %u waits, %u underruns, %.0f s\n", c->name,
+		fileSize, lines, fstreamStat.reads, fstreamStat.waits, fstreamStat.underruns, now / 1e6);
+}
+
+static void test_restart(void)
+{
+	static const CARD fast = { "restart", 250, 1000, 43, 3000, 0 };
+	uint32_t lines, ofs = fileSize / 2 + 1234, pos;
+
+	cfg = &fast;
+	while (file[ofs - 1] != '\n')	// the start of a line as in gidx, not at a sector
+		ofs++;
+	pos = runJob(ofs, &lines);
+	CHECK(pos == fileSize, "the end at %u of %u", pos, fileSize);
+	CHECK(fstreamStat.errors == 0, "%u errors", fstreamStat.errors);
+}
+
+static void test_error(void)
+{
+	static const CARD bad = { "error", 250, 1000, 43, 3000, 100 };
+	uint32_t lines, pos;
+
+	cfg = &bad;
+	pos = runJob(0, &lines);
+	CHECK(fstreamStat.errors == 1, "%u errors", fstreamStat.errors);
+	CHECK(pos < fileSize, "the job goes on after the error");
+	CHECK(!isDma, "the DMA transfer is not ended");
+}
+
+int main(void)
+{
+	// 12 MB/s, up to 1.25 ms of a command; 1 MB/s, up to 100 ms and the moves of 0.2 ms
+	static const CARD fast = { "card", 250, 1000, 43, 3000, 0 };
+	static const CARD slow = { "slow card", 20000, 80000, 500, 200, 0 };
+
+	makeJob();
+	test_card(&fast);
+	CHECK(fstreamStat.underruns == 0, "%u underruns", fstreamStat.underruns);
+	test_card(&slow);
+	CHECK(fstreamStat.underruns != 0, "no underruns of the slow card");
+	test_restart();
+	test_error();
+	printf("%s: fstream_test\n", fails ? "FAIL" : "OK");
+	return fails ? 1 : 0;
+}
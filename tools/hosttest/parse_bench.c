@@ -0,0 +1,273 @@
+/*
+ * parse_bench - lines/sec of the G-code front end of cnc_gfile on a 10 MB CAM file: the lines
+ * out of the file buffer and gc_execute_line, the new tree (the single-pass tokenizer, the lines
+ * split in place in the halves of fstream) against the old one (BASE: f_gets of every line,
+ * its copy to the shown lines, next_statement over the line twice).
+ *
+ * Only gcode.c of the tree is timed: cnc_line and the others are stubs which keep the target,
+ * so the planner is not in the time. The file is of G0/G1 lines, the old parser cut the arcs
+ * to chords itself. The file is in memory, the time of the SD card is not in it either.
+ * The new parser gives the moves shorter than SM_TOO_SHORT_SEGMENT_MM to the path stage of
+ * cnc_line, the old one dropped them: the new one makes a few more moves to the same end.
+ * The new tree is built with each numeric backend (USE_CNC_REAL), the old one is double;
+ * x86 has sqrt in hardware, the Q15.16 move length (real_isqrt64) is slower here than on
+ * the Cortex-M3 against the soft double.
+ *
+ * Build and run: make -C tools/hosttest bench (BASE=<rev> - the old tree, f00d594)
+ *	./parse_bench_0 [job.nc] && ./base_parse_bench [job.nc]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "stdafx.h"
+#ifndef BASELINE
+	#include "fstream.h"
+#endif
+
+#define JOB_SIZE		(10 * 1024 * 1024)
+#define MAX_STR_SIZE	150		// of gcode_exec.c
+
+static uint32_t moves;
+static double target[3];
+
+//---------------------------------------------------------------------
+// The executor of gcode_exec.c: the moves are counted only
+#ifdef BASELINE
+void cnc_dwell(int pause) { (void)pause; }
+
+uint8_t cnc_line(double x, double y, double z, double extruder_length, double length, double feed_rate)
+{
+	(void)extruder_length; (void)length; (void)feed_rate;
+	target[0] = x;
+	target[1] = y;
+	target[2] = z;
+	moves++;
+	return 1;
+}
+#else
+SM_PARAM _smParam;		// of the arcs only
+
+uint8_t cnc_dwell(int pause) { (void)pause; return 1; }
+uint8_t cnc_outputs(uint8_t outputs) { (void)outputs; return 1; }
+void cnc_overrideEnable(bool isEnabled) { (void)isEnabled; }
+CNC_REAL plan_arcFeedRate(CNC_REAL feed_rate, CNC_REAL radius) { (void)radius; return feed_rate; }
+
+uint8_t cnc_line(CNC_REAL x, CNC_REAL y, CNC_REAL z, CNC_REAL extruder_length, CNC_REAL length,
+	CNC_REAL feed_rate, bool isRapid)
+{
+	(void)extruder_length; (void)length; (void)feed_rate; (void)isRapid;
+	target[0] = real_toDouble(x);
+	target[1] = real_toDouble(y);
+	target[2] = real_toDouble(z);
+	moves++;
+	return 1;
+}
+#endif
+void cnc_end(void) {}
+void initGcodeProc(void) { gc_init(); }
+
+//---------------------------------------------------------------------
+static uint32_t seed = 4321;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) & 0xffff;
+}
+
+// CAM-like job: contours of 0.05-1 mm steps (modal G1 mostly), Z passes, rapids, feeds
+static char *makeJob(uint32_t *size)
+{
+	char *job = malloc(JOB_SIZE + 128);
+	double x = 50, y = 50, z = -1;
+	uint32_t n = 0;
+
+	n += sprintf(job + n, "G21 G90 G17\nG0 X50 Y50 Z2\nG1 Z-1 F400\n");
+	while (n < JOB_SIZE)
+	{
+		uint32_t k = rnd() % 100;
+		double a = rnd() * (2 * M_PI / 65536), d = 0.05 + rnd() % 950 / 1000.0;
+
+		x = fmin(fmax(x + d * cos(a), 5), 95);
+		y = fmin(fmax(y + d * sin(a), 5), 95);
+		if (k < 2)
+			n += sprintf(job + n, "G0 Z2\nG0 X%.3f Y%.3f\nG1 Z%.4f F300\nG1 F%u\n", x, y, z = -0.5 - rnd() % 2000 / 1000.0, 800 + rnd() % 5 * 100);
+		else if (k < 40)
+			n += sprintf(job + n, "G1 X%.3f Y%.3f Z%.4f\n", x, y, z = fmin(fmax(z + (rnd() % 200 - 100) / 10000.0, -3), 0));
+		else
+			n += sprintf(job + n, "X%.3f Y%.3f\n", x, y);
+	}
+	n += sprintf(job + n, "G0 Z2\nM2\n");
+	*size = n;
+	return job;
+}
+
+static char *readJob(const char *name, uint32_t *size)
+{
+	FILE *f = fopen(name, "rb");
+	char *job;
+
+	if (f == NULL)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	rewind(f);
+	job = malloc(*size + 1);
+	*size = fread(job, 1, *size, f);
+	fclose(f);
+	return job;
+}
+
+//---------------------------------------------------------------------
+static const char *file;
+static uint32_t fileSize, filePos;
+static uint32_t lines, errors;
+static char shown[MAX_STR_SIZE];	// the last of linesBuffer.gcode
+
+static void executeLine(char *str)
+{
+	if (gc_execute_line(str) != GCSTATUS_OK && errors++ < 5)
+		printf("line %u: error: %s\n", lines + 1, str);
+	lines++;
+}
+
+#ifdef BASELINE
+// f_gets: a byte at a time, the line with its '\n'
+static char *fileGets(char *buf, int len)
+{
+	int n = 0;
+
+	while (n < len - 1 && filePos < fileSize)
+	{
+		char c = file[filePos++];
+
+		buf[n++] = c;
+		if (c == '\n')
+			break;
+	}
+	buf[n] = 0;
+	return n != 0 ? buf : NULL;
+}
+
+static void trimEnd(char *str)
+{
+	int n = strlen(str);
+
+	while (n > 0 && (str[n - 1] == '\n' || str[n - 1] == '\r' || str[n - 1] == ' '))
+		str[--n] = 0;
+}
+
+// cnc_gfile of the old tree: the buffer is filled with the lines, each one with its length
+// before it, then they go to the parser and to the shown lines
+static void frontEnd(void)
+{
+	static char cncFileBuf[16000];
+	bool hasMoreLines = true;
+
+	do
+	{
+		char *p = cncFileBuf, *str;
+
+		while (true)
+		{
+			*p = 0;
+			str = p + 1;
+			if ((cncFileBuf + sizeof(cncFileBuf) - str) < (MAX_STR_SIZE + 1))
+				break;
+			if (fileGets(str, MAX_STR_SIZE) == NULL)
+			{
+				hasMoreLines = false;
+				break;
+			}
+			trimEnd(str);
+			*p = (uint8_t)strlen(str) + 1;
+			p += *p + 1;
+		}
+		for (p = cncFileBuf; *p != 0; p += *p + 1)
+		{
+			strcpy(shown, p + 1);
+			executeLine(p + 1);
+		}
+	} while (hasMoreLines);
+}
+#else
+// cnc_gfile: the halves of fstream (read by DMA, here a copy) after the rest of the last line
+// of the previous one, the lines are split in place, the shown line is a pointer
+static void frontEnd(void)
+{
+	static char cncFileBuf[FSTREAM_SIZE];
+	char *str, *p, *bufEnd = cncFileBuf + FSTREAM_TAIL, *cmd = NULL;
+	uint32_t tail = 0;
+
+	while (filePos < fileSize)
+	{
+		uint32_t len = fileSize - filePos < FSTREAM_HALF ? fileSize - filePos : FSTREAM_HALF;
+
+		str = cncFileBuf + FSTREAM_TAIL - tail;
+		memmove(str, bufEnd - tail, tail);
+		memcpy(cncFileBuf + FSTREAM_TAIL, file + filePos, len);
+		filePos += len;
+		bufEnd = cncFileBuf + FSTREAM_TAIL + len;
+		for (; str < bufEnd; str = p + 1)
+		{
+			p = memchr(str, '\n', bufEnd - str);
+			if (p == NULL)
+			{
+				if (filePos < fileSize && bufEnd - str < FSTREAM_TAIL)
+					break;
+				p = bufEnd;
+			}
+			*p = 0;
+			if (p > str && p[-1] == '\r')
+				p[-1] = 0;
+			cmd = str;
+			executeLine(str);
+		}
+		tail = str < bufEnd ? bufEnd - str : 0;
+	}
+	if (cmd != NULL)
+		strncpy(shown, cmd, sizeof(shown) - 1);	// cnc_keepShownLines
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	char *job = argc > 1 ? readJob(argv[1], &fileSize) : makeJob(&fileSize);
+	char *copy;
+	double best = 0;
+
+	if (job == NULL)
+	{
+		printf("can't open %s\n", argv[1]);
+		return 1;
+	}
+	copy = malloc(fileSize);
+	initGcodeProc();
+	for (int run = 0; run < 5; run++)
+	{
+		clock_t t;
+
+		memcpy(copy, job, fileSize);
+		file = copy;
+		filePos = 0;
+		lines = errors = moves = 0;
+		initGcodeProc();
+		t = clock();
+		frontEnd();
+		t = clock() - t;
+		if (lines / ((double)t / CLOCKS_PER_SEC) > best)
+			best = lines / ((double)t / CLOCKS_PER_SEC);
+	}
+	printf("%s: %.1f MB, %u lines, %9.0f lines/s, errors %u, moves %u, end %.3f %.3f %.3f\n",
+#ifdef BASELINE
+		"old parser, double",
+#else
+		USE_CNC_REAL == 0 ? "new parser, double" : USE_CNC_REAL == 1 ? "new parser, float " : "new parser, Q15.16",
+#endif
+		fileSize / 1048576.0, lines, best, errors, moves, target[0], target[1], target[2]);
+	return errors != 0;
+}
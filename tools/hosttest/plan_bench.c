@@ -0,0 +1,211 @@
+/*
+ * plan_bench - total time of a job with the look-ahead planner (planner.c) and with the
+ * 3-entry MVECTOR ring it replaced (smothLine of the baseline tree).
+ *
+ * The parser and the planner of the tree run on the host, the step queue is a model:
+ * a move of stepm_addMove runs with its frequency, a move of stepm_addRamp follows its
+ * velocity profile with stepw_profileTick at STEPM_RAMP_FRQ, as the ramp IRQ does.
+ * Without a file the job is the built-in one: dense CAM-like contours and a raster of short
+ * segments, where the ring slowed down toward a stop every few moves.
+ *
+ * Build and run: make -C tools/hosttest plan_bench (BASE=<rev> - the old tree, f00d594)
+ *	./plan_bench [job.nc]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "stdafx.h"
+#ifndef BASELINE
+	#include "stepwave.h"
+#endif
+
+extern int curGCodeMode;
+void initGcodeProc(void);
+
+static double jobTime;			// sec
+static uint32_t moves, slowJoints;
+static int64_t pos[STEPS_MOTORS];
+
+//---------------------------------------------------------------------
+// The firmware parts which are not used
+uint32_t Seconds(void) { return 0; }
+void delayMs(uint16_t msec) { (void)msec; }
+char *str_trim(char *str) { return str; }
+
+void stepm_init(void) {}
+void stepm_EmergeStop(void) {}
+uint32_t stepm_LinesBufferIsFull(void) { return 0; }
+int32_t stepm_getRemainLines(void) { return 0; }
+int32_t stepm_getCurGlobalStepsNum(uint8_t id) { (void)id; return 0; }
+int32_t stepm_inProc(void) { return 0; }
+
+static uint8_t mainAxis(const uint32_t steps[])
+{
+	uint8_t n = 0;
+
+	for (uint8_t i = 1; i < STEPS_MOTORS; i++)
+		if (steps[i] > steps[n])
+			n = i;
+	return n;
+}
+
+static void addPos(const uint32_t steps[], const uint8_t dir[])
+{
+	for (int i = 0; i < STEPS_MOTORS; i++)
+		pos[i] += dir[i] ? (int64_t)steps[i] : -(int64_t)steps[i];
+}
+
+// The old step engine: the frequency of the move from 1 Hz to 15 kHz
+void stepm_addMove(uint32_t steps[], uint32_t frq[], uint8_t dir[])
+{
+	uint8_t n = mainAxis(steps);
+	uint32_t f = frq[n];
+
+	if (steps[n] == 0)
+		return;
+	if (f > 15000 * K_FRQ)
+		f = 15000 * K_FRQ;
+	if (f < K_FRQ)
+		f = K_FRQ;
+	jobTime += (double)steps[n] * K_FRQ / f;
+	if (f < (uint32_t)_smParam.smoothStopF_to0[n])
+		slowJoints++;
+	moves++;
+	addPos(steps, dir);
+}
+
+#ifndef BASELINE
+void stepm_setOverride(uint16_t feed, uint16_t rapid) { (void)feed; (void)rapid; }
+void stepm_addCmd(uint8_t cmd, uint32_t value) { (void)cmd; (void)value; }
+void stepm_addArc(const STEPM_ARC *arc, const STEPM_RAMP *ramp) { (void)arc; (void)ramp; }
+
+void stepm_addRamp(uint32_t steps[], uint8_t dir[], const STEPM_RAMP *ramp)
+{
+	uint8_t n = mainAxis(steps);
+	STEPM_PROFILE prof;
+	double left = steps[n];
+
+	if (steps[n] == 0)
+		return;
+	memset(&prof, 0, sizeof(prof));
+	stepw_profileStart(&prof, ramp);
+	while (left > 0)
+	{
+		uint32_t f = stepw_profileTick(&prof, (uint32_t)ceil(left));
+		double st = (double)f / K_FRQ / STEPM_RAMP_FRQ;
+
+		if (st >= left)
+		{
+			jobTime += left * K_FRQ / f;
+			break;
+		}
+		left -= st;
+		jobTime += 1.0 / STEPM_RAMP_FRQ;
+	}
+	if (ramp->fExit < (uint32_t)_smParam.smoothStopF_to0[n < 3 ? n : 0])
+		slowJoints++;
+	moves++;
+	addPos(steps, dir);
+}
+#endif
+
+//---------------------------------------------------------------------
+// Built-in job: contours of 0.2-0.5 mm chords at F1200 and a raster of 0.3 mm segments
+// with a Z relief at F800, rapids between them
+static FILE *builtinJob(void)
+{
+	FILE *f = tmpfile();
+
+	fprintf(f, "G21 G90\nG0 Z5\n");
+	for (int pass = 0; pass < 6; pass++)
+	{
+		double r = 10 + pass * 3;
+
+		fprintf(f, "G0 X%.3f Y0\nG1 Z%.3f F300\nG1 F1200\n", r + 30, -0.5 * (pass + 1));
+		for (int i = 1; i <= 720; i++)
+		{	// rounded square: the chords of the corners and straight runs
+			double a = 2 * M_PI * i / 720, c = cos(a), s = sin(a);
+			double k = pow(pow(fabs(c), 4) + pow(fabs(s), 4), -0.25);
+			fprintf(f, "X%.3f Y%.3f\n", 30 + r * c * k, r * s * k);
+		}
+		fprintf(f, "G0 Z5\n");
+	}
+	fprintf(f, "G0 X0 Y0\nG1 Z0 F300\nG1 F800\n");
+	for (int row = 0; row < 40; row++)
+	{
+		double y = row * 0.5;
+
+		for (int i = 0; i <= 200; i++)
+		{
+			double x = row & 1 ? 60 - i * 0.3 : i * 0.3;
+			fprintf(f, "X%.3f Y%.3f Z%.3f\n", x, y, -1 + 0.6 * sin(x / 4) * cos(y / 3));
+		}
+	}
+	// the job ends at the origin: the old ring is flushed with the moves to it (cnc_line(0, ...))
+	fprintf(f, "G0 Z5\nG0 X0 Y0\nG0 Z0\nM2\n");
+	rewind(f);
+	return f;
+}
+
+static void initSmParam(void)
+{
+#ifdef BASELINE
+	_smParam.smoothStartF_from0[0] = SM_SMOOTH_START_X * K_FRQ;
+	_smParam.smoothStartF_from0[1] = SM_SMOOTH_START_Y * K_FRQ;
+	_smParam.smoothStartF_from0[2] = SM_SMOOTH_START_Z * K_FRQ;
+	_smParam.smoothStopF_to0[0] = SM_SMOOTH_STOP_X * K_FRQ;
+	_smParam.smoothStopF_to0[1] = SM_SMOOTH_STOP_Y * K_FRQ;
+	_smParam.smoothStopF_to0[2] = SM_SMOOTH_STOP_Z * K_FRQ;
+	_smParam.smoothAF[0] = SM_SMOOTH_DFEED_X * SM_X_STEPS_PER_MM * SM_SMOOTH_TFEED * K_FRQ / 1000;
+	_smParam.smoothAF[1] = SM_SMOOTH_DFEED_Y * SM_Y_STEPS_PER_MM * SM_SMOOTH_TFEED * K_FRQ / 1000;
+	_smParam.smoothAF[2] = SM_SMOOTH_DFEED_Z * SM_Z_STEPS_PER_MM * SM_SMOOTH_TFEED / 1000 * K_FRQ;
+	_smParam.maxFeedRate[0] = SM_X_MAX_STEPS_PER_SEC * K_FRQ;
+	_smParam.maxFeedRate[1] = SM_Y_MAX_STEPS_PER_SEC * K_FRQ;
+	_smParam.maxFeedRate[2] = SM_Z_MAX_STEPS_PER_SEC * K_FRQ;
+#else
+	sm_defaultParam(&_smParam);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	char line[256];
+	uint32_t n = 0;
+	FILE *f = argc > 1 ? fopen(argv[1], "r") : builtinJob();
+
+	if (f == NULL)
+	{
+		printf("can't open %s\n", argv[1]);
+		return 1;
+	}
+	initSmParam();
+	initGcodeProc();
+	curGCodeMode = GFILE_MODE_MASK_EXEC;
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		uint8_t st;
+
+		line[strcspn(line, "\r\n")] = 0;
+		n++;
+		if ((st = gc_execute_line(line)) != GCSTATUS_OK)
+			printf("line %u: error %u: %s\n", n, st, line);
+	}
+	fclose(f);
+#ifdef BASELINE
+	cnc_line(0, 0, 0, 0, 0, 0);
+	cnc_line(0, 0, 0, 0, 0, 0);
+#else
+	cnc_flush();
+#endif
+	printf("%s: lines %u, moves %u, slow joints %u, job time %.1f s, end %lld %lld %lld\n",
+#ifdef BASELINE
+		"MVECTOR ring",
+#else
+		"look-ahead  ",
+#endif
+		n, moves, slowJoints, jobTime, (long long)pos[0], (long long)pos[1], (long long)pos[2]);
+	return 0;
+}
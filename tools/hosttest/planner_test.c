@@ -0,0 +1,235 @@
+/*
+ * planner_test - the speeds and the blocks of the look-ahead planner (planner.c):
+ * after plan_setOverride the entry speeds of the queued blocks are within the new nominal
+ * speeds of both blocks of the junction and the speed changes within the mean acceleration,
+ * the oldest block keeps its entry speed; a reversal of an axis with the backlash splits
+ * the line into the takeup part of SM_BACKLASH_SMOOTH_MM and the rest, the steps of both
+ * make the steps of the line, the slack is added once to the first part.
+ *
+ * planner.c is a part of the test: the queue is static.
+ *
+ * Build and run: make -C tools/hosttest
+ */
+
+#include "../../src/application/planner.c"
+
+#include <stdio.h>
+
+static int fails;
+
+#define CHECK(cond, ...)	do { if (!(cond)) { fails++; printf("FAIL %s:%d: ", __func__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+static uint32_t seed = 2024;
+
+static uint32_t rnd(uint32_t n)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 8) & 0xffffff) % n;
+}
+
+//---------------------------------------------------------------------
+// The firmware parts which are not used: the blocks stay in the queue of the planner
+uint32_t Seconds(void) { return 0; }
+void delayMs(uint16_t msec) { (void)msec; }
+char *str_trim(char *str) { return str; }
+
+void stepm_init(void) {}
+void stepm_EmergeStop(void) {}
+uint32_t stepm_LinesBufferIsFull(void) { return 0; }
+int32_t stepm_getRemainLines(void) { return 0; }
+int32_t stepm_getCurGlobalStepsNum(uint8_t id) { (void)id; return 0; }
+int32_t stepm_inProc(void) { return 0; }
+void stepm_addMove(uint32_t steps[], uint32_t frq[], uint8_t dir[]) { (void)steps; (void)frq; (void)dir; }
+void stepm_setOverride(uint16_t feed, uint16_t rapid) { (void)feed; (void)rapid; }
+void stepm_addCmd(uint8_t cmd, uint32_t value) { (void)cmd; (void)value; }
+void stepm_addArc(const STEPM_ARC *arc, const STEPM_RAMP *ramp) { (void)arc; (void)ramp; }
+void stepm_addRamp(uint32_t steps[], uint8_t dir[], const STEPM_RAMP *ramp) { (void)steps; (void)dir; (void)ramp; }
+
+// the rounding of the fixed point
+#define SPEED_SQR_EPS	REAL_C(0.01)
+
+static uint32_t queued(void)
+{
+	return block_buffer_head >= block_buffer_tail ? block_buffer_head - block_buffer_tail
+		: block_buffer_head + PLANNER_BUF_SIZE - block_buffer_tail;
+}
+
+// v^2 change over the block with the mean acceleration of the S-curve: 2/3 of the peak one
+static CNC_REAL meanChangeSqr(const PLAN_BLOCK *block)
+{
+	return 2 * real_mul(real_mulDiv(block->acceleration, 2, 3), block->millimeters);
+}
+
+static CNC_REAL lineLength(const int32_t steps[CRDS_SIZE])
+{
+	return real_hypot3(sm_stepsToMm(CRD_X, steps[CRD_X]), sm_stepsToMm(CRD_Y, steps[CRD_Y]),
+		sm_stepsToMm(CRD_Z, steps[CRD_Z]));
+}
+
+static void randomLine(bool isRapid)
+{
+	int32_t steps[CRDS_SIZE] = { 0, 0, 0, 0 };
+	int i;
+
+	while (steps[CRD_X] == 0 && steps[CRD_Y] == 0 && steps[CRD_Z] == 0)
+	{
+		for (i = 0; i < 3; i++)
+		{
+			if (rnd(3) != 0)
+				steps[i] = sm_mmToSteps(i, real_ratio((int32_t)rnd(20000) - 10000, 1000));
+		}
+	}
+	plan_bufferLine(steps, lineLength(steps), real_fromInt(100 + rnd(3000)), isRapid);
+}
+
+// The speeds of the queue after the override: the junctions and the speed changes
+static void checkQueue(uint16_t feed, uint16_t rapid, CNC_REAL oldestEntry)
+{
+	uint8_t idx = block_buffer_tail;
+	const PLAN_BLOCK *block, *prev_block = NULL;
+
+	while (idx != block_buffer_head)
+	{
+		CNC_REAL speed;
+
+		block = &block_buffer[idx];
+		speed = real_mulDiv(block->feed_speed, block->isRapid ? rapid : feed, 100);
+		if (speed > block->max_speed)
+			speed = block->max_speed;
+		CHECK(real_abs(block->nominal_speed_sqr - real_mul(speed, speed)) <= SPEED_SQR_EPS,
+			"block %u: nominal %.3f, %.3f with the override", idx, real_toDouble(block->nominal_speed_sqr),
+			real_toDouble(real_mul(speed, speed)));
+		if (prev_block == NULL)
+			CHECK(block->entry_speed_sqr == oldestEntry, "the entry of the oldest block is changed");
+		else
+		{
+			CHECK(block->entry_speed_sqr <= block->nominal_speed_sqr, "block %u: entry %.3f above nominal %.3f",
+				idx, real_toDouble(block->entry_speed_sqr), real_toDouble(block->nominal_speed_sqr));
+			CHECK(block->entry_speed_sqr <= prev_block->nominal_speed_sqr,
+				"block %u: entry %.3f above nominal %.3f of the previous one", idx,
+				real_toDouble(block->entry_speed_sqr), real_toDouble(prev_block->nominal_speed_sqr));
+			CHECK(block->entry_speed_sqr <= prev_block->entry_speed_sqr + meanChangeSqr(prev_block) + SPEED_SQR_EPS,
+				"block %u: entry %.3f, the previous one can't accelerate to it", idx, real_toDouble(block->entry_speed_sqr));
+			if (prev_block != &block_buffer[block_buffer_tail])
+				CHECK(prev_block->entry_speed_sqr <= block->entry_speed_sqr + meanChangeSqr(prev_block) + SPEED_SQR_EPS,
+					"block %u: entry %.3f, the previous one can't decelerate to it", idx, real_toDouble(block->entry_speed_sqr));
+		}
+		prev_block = block;
+		idx = next_block_index(idx);
+	}
+	// the last block stops at its end
+	CHECK(prev_block == &block_buffer[block_buffer_tail]
+		|| prev_block->entry_speed_sqr <= meanChangeSqr(prev_block) + SPEED_SQR_EPS, "the last block can't stop");
+}
+
+static void test_override(void)
+{
+	static const uint16_t ovr[][2] = { { 30, 100 }, { 10, 10 }, { 150, 200 }, { 100, 25 }, { 200, 200 }, { 100, 100 } };
+	uint32_t i, k;
+
+	sm_defaultParam(&_smParam);
+	for (i = 0; i < 3; i++)
+		_smParam.backlash[i] = 0;
+	plan_init();
+	for (k = 0; k < 200; k++)
+	{
+		const uint16_t *o = ovr[k % (sizeof(ovr) / sizeof(ovr[0]))];
+		CNC_REAL oldestEntry;
+
+		// the step engine takes some blocks, the parser adds others
+		for (i = rnd(queued() + 1); i > 0; i--)
+			plan_discardBlock();
+		while (!plan_isFull())
+			randomLine(rnd(5) == 0);
+		oldestEntry = block_buffer[block_buffer_tail].entry_speed_sqr;
+		plan_setOverride(o[0], o[1]);
+		checkQueue(o[0], o[1], oldestEntry);
+	}
+	plan_setOverride(100, 100);
+}
+
+// The line goes to the queue, the blocks of it are checked
+static void backlashLine(int32_t x, int32_t y, int32_t z, uint8_t reversal)
+{
+	int32_t steps[CRDS_SIZE] = { x, y, z, 0 };
+	CNC_REAL mm = lineLength(steps);
+	uint8_t idx = block_buffer_head;
+	uint32_t n = queued(), total[3] = { 0, 0, 0 }, parts, i;
+	CNC_REAL partsMm = 0;
+
+	plan_bufferLine(steps, mm, real_fromInt(1200), false);
+	parts = queued() - n;
+	CHECK(parts == (reversal != 0 && mm > REAL_C(SM_BACKLASH_SMOOTH_MM) ? 2 : 1),
+		"%d %d %d: %u blocks", x, y, z, parts);
+	for (n = 0; n < parts; n++, idx = next_block_index(idx))
+	{
+		const PLAN_BLOCK *block = &block_buffer[idx];
+
+		CHECK(block->backlash == (n == 0 ? reversal : 0), "%d %d %d: backlash %x of the block %u, %x",
+			x, y, z, block->backlash, n, reversal);
+		if (parts == 2 && n == 0)
+			CHECK(block->millimeters == REAL_C(SM_BACKLASH_SMOOTH_MM), "%d %d %d: the takeup of %.3f mm", x, y, z,
+				real_toDouble(block->millimeters));
+		partsMm += block->millimeters;
+		for (i = 0; i < 3; i++)
+		{
+			uint32_t slack = (block->backlash & (1 << i)) != 0 ? _smParam.backlash[i] : 0;
+
+			CHECK(block->steps[i] >= slack, "%d %d %d: axis %u, %u steps", x, y, z, i, block->steps[i]);
+			total[i] += block->steps[i] - slack;
+			if (steps[i] != 0 && block->steps[i] != 0)
+				CHECK(block->dir[i] == (steps[i] > 0), "%d %d %d: axis %u, the direction of the block %u", x, y, z, i, n);
+		}
+	}
+	CHECK(partsMm == mm, "%d %d %d: %.3f mm of %.3f", x, y, z, real_toDouble(partsMm), real_toDouble(mm));
+	for (i = 0; i < 3; i++)
+		CHECK(total[i] == (uint32_t)labs(steps[i]), "%d %d %d: axis %u, %u steps of %d", x, y, z, i, total[i], steps[i]);
+	while (queued() > PLANNER_BUF_SIZE / 2)
+		plan_discardBlock();
+}
+
+static void test_backlash(void)
+{
+	int32_t last[3] = { 1, -1, -1 }, v[3];	// the directions after the moves below
+	uint32_t k, i;
+
+	sm_defaultParam(&_smParam);
+	_smParam.backlash[CRD_X] = 20;
+	_smParam.backlash[CRD_Y] = 35;
+	_smParam.backlash[CRD_Z] = 0;
+	plan_init();
+	backlashLine(800, 0, 0, 0);			// the first move takes no slack up
+	backlashLine(-800, 400, 0, 1);		// X reverses
+	backlashLine(-20, -10, 0, 2);		// Y reverses, shorter than the takeup
+	backlashLine(0, 0, 300, 0);			// Z has no backlash
+	backlashLine(0, 0, -300, 0);
+	backlashLine(1000, 1000, 0, 3);		// both
+	backlashLine(0, -5, 0, 2);			// Y alone, a step
+	backlashLine(0, -1000, 0, 0);		// the same way
+	// random moves, some of them shorter than the takeup
+	for (k = 0; k < 5000; k++)
+	{
+		uint8_t reversal = 0;
+
+		for (i = 0; i < 3; i++)
+		{
+			v[i] = rnd(3) == 0 ? 0 : (int32_t)rnd(k % 10 == 0 ? 20 : 4000) - (k % 10 == 0 ? 10 : 2000);
+			if (v[i] != 0)
+			{
+				if (last[i] != 0 && (last[i] > 0) != (v[i] > 0) && _smParam.backlash[i] != 0)
+					reversal |= 1 << i;
+				last[i] = v[i];
+			}
+		}
+		if (v[0] != 0 || v[1] != 0 || v[2] != 0)
+			backlashLine(v[0], v[1], v[2], reversal);
+	}
+}
+
+int main(void)
+{
+	test_override();
+	test_backlash();
+	printf("%s: planner_test\n", fails ? "FAIL" : "OK");
+	return fails ? 1 : 0;
+}
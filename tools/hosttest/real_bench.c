@@ -0,0 +1,182 @@
+/*
+ * real_bench - speed of the parser -> planner path and its error for a numeric backend
+ * (USE_CNC_REAL of cnc_real.h: 0 - double, 1 - float, 2 - Q15.16 fixed point).
+ *
+ * The built-in job of short lines and arcs (IJ and R forms) runs through gc_execute_line
+ * and the planner to the step queue stubs; the parser position after every line is kept.
+ * The double build writes the positions to a file, the other builds compare with it:
+ * the max error of the end points (mm) and the final position (steps).
+ * x86 timings show the ratio of the backends, not the speed on the Cortex-M3.
+ *
+ * Build and run: make -C tools/hosttest bench
+ *	./real_bench_0 -w ref.bin && ./real_bench_1 -r ref.bin && ./real_bench_2 -r ref.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "stdafx.h"
+
+#define JOB_LINES	200000
+
+extern int curGCodeMode;
+void initGcodeProc(void);
+
+static uint32_t moves;
+static int64_t pos[STEPS_MOTORS];
+
+//---------------------------------------------------------------------
+// The firmware parts which are not used
+uint32_t Seconds(void) { return 0; }
+void delayMs(uint16_t msec) { (void)msec; }
+char *str_trim(char *str) { return str; }
+
+void stepm_init(void) {}
+void stepm_EmergeStop(void) {}
+void stepm_setOverride(uint16_t feed, uint16_t rapid) { (void)feed; (void)rapid; }
+void stepm_addCmd(uint8_t cmd, uint32_t value) { (void)cmd; (void)value; }
+void stepm_addArc(const STEPM_ARC *arc, const STEPM_RAMP *ramp) { (void)arc; (void)ramp; }
+uint32_t stepm_LinesBufferIsFull(void) { return 0; }
+int32_t stepm_getRemainLines(void) { return 0; }
+int32_t stepm_getCurGlobalStepsNum(uint8_t id) { (void)id; return 0; }
+int32_t stepm_inProc(void) { return 0; }
+
+static void addSteps(const uint32_t steps[], const uint8_t dir[])
+{
+	for (int i = 0; i < STEPS_MOTORS; i++)
+		pos[i] += dir[i] ? (int64_t)steps[i] : -(int64_t)steps[i];
+	moves++;
+}
+
+void stepm_addMove(uint32_t steps[], uint32_t frq[], uint8_t dir[]) { (void)frq; addSteps(steps, dir); }
+void stepm_addRamp(uint32_t steps[], uint8_t dir[], const STEPM_RAMP *ramp) { (void)ramp; addSteps(steps, dir); }
+
+//---------------------------------------------------------------------
+static uint32_t seed = 12345;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) & 0xffff;
+}
+
+// CAM-like job: polylines of 0.05-1 mm steps, arcs of 1-20 mm, feed changes
+static char **makeJob(uint32_t *count)
+{
+	char **lines = malloc(JOB_LINES * sizeof(char *));
+	char buf[96];
+	double x = 50, y = 50;
+	uint32_t n = 0;
+
+	lines[n++] = strdup("G21 G90 G17");
+	lines[n++] = strdup("G0 X50 Y50 Z2");
+	lines[n++] = strdup("G1 Z-1 F400");
+	while (n < JOB_LINES - 2)
+	{
+		uint32_t k = rnd() % 10;
+
+		if (k < 7)
+		{
+			double a = rnd() * (2 * M_PI / 65536), d = 0.05 + rnd() % 950 / 1000.0;
+			x = fmin(fmax(x + d * cos(a), 5), 95);
+			y = fmin(fmax(y + d * sin(a), 5), 95);
+			snprintf(buf, sizeof(buf), "G1 X%.3f Y%.3f Z%.4f%s", x, y, -1 - rnd() % 1000 / 2000.0,
+				k == 0 ? (rnd() & 1 ? " F1200" : " F800") : "");
+		}
+		else
+		{
+			double r = 1 + rnd() % 1900 / 100.0, a0 = rnd() * (2 * M_PI / 65536), a1 = a0 + (rnd() % 2 ? 1 : -1) * (0.2 + rnd() % 250 / 100.0);
+			double cx = x - r * cos(a0), cy = y - r * sin(a0);
+			double ex = cx + r * cos(a1), ey = cy + r * sin(a1);
+
+			if (ex < 5 || ex > 95 || ey < 5 || ey > 95)
+				continue;
+			if (k == 9)
+				snprintf(buf, sizeof(buf), "%s X%.3f Y%.3f R%.3f", a1 < a0 ? "G2" : "G3", ex, ey, fabs(a1 - a0) > M_PI ? -r : r);
+			else
+				snprintf(buf, sizeof(buf), "%s X%.3f Y%.3f I%.3f J%.3f", a1 < a0 ? "G2" : "G3", ex, ey, cx - x, cy - y);
+			x = ex;
+			y = ey;
+		}
+		lines[n++] = strdup(buf);
+	}
+	lines[n++] = strdup("G0 Z2");
+	lines[n++] = strdup("M2");
+	*count = n;
+	return lines;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "double", "float", "Q15.16" };
+	const char *refName = NULL;
+	bool isWrite = false;
+	uint32_t count;
+	char **job = makeJob(&count);
+	double (*path)[3] = malloc(count * sizeof(*path));
+	double maxErr = 0, ref[3];
+	int64_t refPos[STEPS_MOTORS];
+	uint32_t errLine = 0;
+	GC_MODAL m;
+	clock_t t;
+
+	if (argc > 2 && (strcmp(argv[1], "-w") == 0 || strcmp(argv[1], "-r") == 0))
+	{
+		refName = argv[2];
+		isWrite = argv[1][1] == 'w';
+	}
+	sm_defaultParam(&_smParam);
+	initGcodeProc();
+	curGCodeMode = GFILE_MODE_MASK_EXEC;
+
+	t = clock();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint8_t st = gc_execute_line(job[i]);
+
+		if (st != GCSTATUS_OK)
+			printf("line %u: error %u: %s\n", i + 1, st, job[i]);
+		gc_getModal(&m);
+		for (int j = 0; j < 3; j++)
+			path[i][j] = real_toDouble(m.position[j]);
+	}
+	cnc_flush();
+	t = clock() - t;
+
+	printf("%-7s %u lines, %8.0f lines/s, moves %u, end %lld %lld %lld",
+		names[USE_CNC_REAL], count, count / ((double)t / CLOCKS_PER_SEC), moves,
+		(long long)pos[0], (long long)pos[1], (long long)pos[2]);
+	if (refName != NULL)
+	{
+		FILE *f = fopen(refName, isWrite ? "wb" : "rb");
+
+		if (f == NULL)
+		{
+			printf("\ncan't open %s\n", refName);
+			return 1;
+		}
+		if (isWrite)
+		{
+			fwrite(pos, sizeof(pos), 1, f);
+			fwrite(path, sizeof(*path), count, f);
+		}
+		else if (fread(refPos, sizeof(refPos), 1, f) == 1)
+		{
+			for (uint32_t i = 0; i < count && fread(ref, sizeof(ref), 1, f) == 1; i++)
+				for (int j = 0; j < 3; j++)
+					if (fabs(path[i][j] - ref[j]) > maxErr)
+					{
+						maxErr = fabs(path[i][j] - ref[j]);
+						errLine = i + 1;
+					}
+			printf(", max error %.6f mm (line %u), end %+lld %+lld %+lld steps", maxErr, errLine,
+				(long long)(pos[0] - refPos[0]), (long long)(pos[1] - refPos[1]), (long long)(pos[2] - refPos[2]));
+		}
+		fclose(f);
+	}
+	printf("\n");
+	return 0;
+}
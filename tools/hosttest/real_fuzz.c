@@ -0,0 +1,296 @@
+/*
+ * real_fuzz - the decimal parser of cnc_real.c (real_scanDecimal and the conversions) against
+ * strtod on random literals of G-code (sign, 0-15 integer digits, 0-11 fraction digits) and
+ * long ones (up to 30 digits, the leading zeros of the fraction):
+ *	the end of the number as strtod
+ *	real_decimalToDouble bit-exact in its range (mantissa < 2^53, scale 0..22), within 1 ulp out of it,
+ *	2 ulp with more than 22 digits after the point (two divisions)
+ *	real_fromDecimal of the backend (USE_CNC_REAL): double as above, float as strtof within 1 ulp,
+ *	bit-exact in its one division range, Q15.16 exactly rounded from the digits (1 LSB after the
+ *	18 digits of the mantissa or above 2^47 of it), within 1 LSB of strtod
+ *	real_decimalToFixed (1/1000) exactly rounded from the digits, the same 1 LSB
+ * Then the speed on the literals of a job against strtod and the old strtod_M (the per-digit
+ * division of the baseline, BASE). x86 divides in hardware, the Cortex-M3 makes every double
+ * operation in software: their number per literal is shown too.
+ *
+ * Build and run: make -C tools/hosttest
+ *	./real_fuzz_2 [literals]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "stdafx.h"
+#include "base_strtod_M.c"
+
+static int fails;
+
+#define CHECK(cond, ...)	do { if (!(cond) && fails++ < 20) { printf("FAIL %s:%d: ", __func__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+static uint32_t seed = 777;
+
+static uint32_t rnd(uint32_t n)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 8) & 0xffffff) % n;
+}
+
+//---------------------------------------------------------------------
+typedef struct {
+	char     str[48];
+	bool     negative;
+	__int128 m;			// all the digits
+	int      scale;		// after the point
+	int      digits;	// significant ones
+} LITERAL;
+
+static void makeLiteral(LITERAL *l, bool isJob)
+{
+	int ints, fracs, zeros = 0, n = 0;
+
+	if (isJob)
+	{	// coordinates of a job: X-12.345
+		ints = rnd(4);
+		fracs = rnd(5);
+	}
+	else if (rnd(10) != 0)
+	{
+		ints = rnd(16);
+		fracs = rnd(12);
+	}
+	else
+	{
+		ints = rnd(12);
+		zeros = rnd(2) ? rnd(12) : 0;
+		fracs = rnd(31 - ints - zeros);
+	}
+	l->negative = rnd(3) == 0;
+	if (l->negative)
+		l->str[n++] = '-';
+	else if (rnd(20) == 0)
+		l->str[n++] = '+';
+	l->m = 0;
+	l->digits = 0;
+	for (int i = 0; i < ints; i++)
+		l->str[n++] = '0' + (i == 0 && ints > 1 ? 1 + rnd(9) : rnd(10));
+	if (fracs + zeros != 0 || ints == 0 || rnd(10) == 0)
+		l->str[n++] = '.';
+	for (int i = 0; i < zeros; i++)
+		l->str[n++] = '0';
+	for (int i = 0; i < fracs; i++)
+		l->str[n++] = '0' + rnd(10);
+	l->scale = zeros + fracs;
+	l->str[n] = 0;
+	for (const char *p = l->str; *p != 0; p++)
+		if (*p >= '0' && *p <= '9')
+		{
+			l->m = l->m * 10 + (*p - '0');
+			if (l->m != 0)
+				l->digits++;
+		}
+	// the word goes on after the number
+	l->str[n] = " XYZ"[rnd(4)];
+	l->str[n + 1] = 0;
+}
+
+static __int128 pow10i(int n)
+{
+	__int128 p = 1;
+
+	while (n-- > 0)
+		p *= 10;
+	return p;
+}
+
+// round(number * mul), the sign apart, saturated to max
+static int64_t exactRound(const LITERAL *l, int64_t mul, int64_t max)
+{
+	__int128 d = pow10i(l->scale);
+	__int128 v = (l->m * mul + d / 2) / d;
+
+	if (v > max)
+		v = max;
+	return l->negative ? -(int64_t)v : (int64_t)v;
+}
+
+static int64_t ulps(double a, double b)
+{
+	int64_t x, y;
+
+	if (a == b)
+		return 0;	// +0 and -0 too
+	memcpy(&x, &a, sizeof(x));
+	memcpy(&y, &b, sizeof(y));
+	return llabs(x - y);
+}
+
+#if (USE_CNC_REAL == 1)
+static int32_t ulpsf(float a, float b)
+{
+	int32_t x, y;
+
+	if (a == b)
+		return 0;
+	memcpy(&x, &a, sizeof(x));
+	memcpy(&y, &b, sizeof(y));
+	return abs(x - y);
+}
+#endif
+
+static void test_literals(uint32_t count)
+{
+	LITERAL l;
+	REAL_DECIMAL d;
+	uint32_t exactRange = 0, oldWrong = 0, twoUlp = 0;
+#if (USE_CNC_REAL == 2)
+	uint32_t roundedQ = 0;
+#endif
+	int64_t maxUlp = 0, maxOldUlp = 0;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		char *endRef, *endOld;
+		const char *end;
+		double ref, v;
+		int64_t u, q;
+
+		makeLiteral(&l, false);
+		end = real_scanDecimal(l.str, &d);
+		ref = strtod(l.str, &endRef);
+		CHECK(end == endRef, "'%s': the end at %d, strtod %d", l.str, (int)(end - l.str), (int)(endRef - l.str));
+		if (end == l.str)
+			continue;
+		v = real_decimalToDouble(&d);
+		u = ulps(v, ref);
+		if (d.mantissa < (1ULL << 53) && d.scale >= 0 && d.scale <= 22)
+		{
+			CHECK(u == 0, "'%s': %.17g, strtod %.17g", l.str, v, ref);
+			exactRange++;
+		}
+		else
+		{
+			CHECK(u <= (d.scale > 22 ? 2 : 1), "'%s': %.17g, strtod %.17g, %lld ulp", l.str, v, ref, (long long)u);
+			if (u > 1)
+				twoUlp++;
+			if (u > maxUlp)
+				maxUlp = u;
+		}
+		u = ulps(base_strtod_M(l.str, &endOld), ref);
+		if (u != 0)
+			oldWrong++;
+		if (u > maxOldUlp)
+			maxOldUlp = u;
+
+#if (USE_CNC_REAL == 0)
+		CHECK(real_fromDecimal(&d) == v, "'%s': real_fromDecimal %.17g, %.17g", l.str, real_fromDecimal(&d), v);
+#elif (USE_CNC_REAL == 1)
+		{
+			float f = real_fromDecimal(&d), fRef = strtof(l.str, NULL);
+			int32_t uf = ulpsf(f, fRef);
+
+			if (d.mantissa < (1UL << 24) && d.scale >= 0 && d.scale <= 10)
+				CHECK(uf == 0, "'%s': %.9g, strtof %.9g", l.str, f, fRef);
+			else
+				CHECK(uf <= 1, "'%s': %.9g, strtof %.9g, %d ulp", l.str, f, fRef, uf);
+		}
+#else
+		q = exactRound(&l, 65536, REAL_MAX);
+		if (l.digits <= REAL_DECIMAL_DIGITS && d.mantissa < (1ULL << 47))
+			CHECK(real_fromDecimal(&d) == q, "'%s': Q16 %d, exact %lld", l.str, real_fromDecimal(&d), (long long)q);
+		else
+		{
+			CHECK(llabs(real_fromDecimal(&d) - q) <= 1, "'%s': Q16 %d, exact %lld", l.str, real_fromDecimal(&d), (long long)q);
+			roundedQ++;
+		}
+		// strtod is rounded before the scale: 1 LSB
+		if (fabs(ref) * 65536 < REAL_MAX)
+			CHECK(llabs(real_fromDecimal(&d) - llround(ref * 65536)) <= 1, "'%s': Q16 %d, strtod %.17g", l.str, real_fromDecimal(&d), ref);
+#endif
+		q = exactRound(&l, 1000, INT32_MAX);
+		if (l.digits <= REAL_DECIMAL_DIGITS)
+			CHECK(real_decimalToFixed(&d, 3) == q, "'%s': 1/1000 %d, exact %lld", l.str, real_decimalToFixed(&d, 3), (long long)q);
+		else
+			CHECK(llabs(real_decimalToFixed(&d, 3) - q) <= 1, "'%s': 1/1000 %d, exact %lld", l.str, real_decimalToFixed(&d, 3), (long long)q);
+	}
+	printf("literals: %u, double bit-exact in %u of them (the exact range), max %lld ulp out of it (2 ulp: %u), "
+		"old strtod_M off in %u, max %lld ulp\n", count, exactRange, (long long)maxUlp, twoUlp, oldWrong, (long long)maxOldUlp);
+#if (USE_CNC_REAL == 2)
+	printf("Q15.16: exact but %u (more than 18 digits or the mantissa above 2^47): 1 LSB\n", roundedQ);
+#endif
+}
+
+//---------------------------------------------------------------------
+#define JOB_LITERALS	1000000
+
+static double sink;
+
+static double timeParser(int kind, char **lits)
+{
+	double best = 1e9;
+
+	for (int run = 0; run < 5; run++)
+	{
+		clock_t t = clock();
+		REAL_DECIMAL d;
+
+		for (uint32_t i = 0; i < JOB_LITERALS; i++)
+		{
+			switch (kind)
+			{
+			case 0:	sink += strtod(lits[i], NULL); break;
+			case 1:	sink += base_strtod_M(lits[i], NULL); break;
+			case 2:	real_scanDecimal(lits[i], &d); sink += real_decimalToDouble(&d); break;
+			case 3:	real_scanDecimal(lits[i], &d); sink += real_fromDecimal(&d); break;
+			default: real_scanDecimal(lits[i], &d); sink += real_decimalToFixed(&d, 3); break;
+			}
+		}
+		t = clock() - t;
+		if ((double)t / CLOCKS_PER_SEC < best)
+			best = (double)t / CLOCKS_PER_SEC;
+	}
+	return best * 1e9 / JOB_LITERALS;
+}
+
+static void test_speed(void)
+{
+	static const char *names[] = { "strtod", "old strtod_M", "real_decimalToDouble",
+		USE_CNC_REAL == 0 ? "real_fromDecimal double" : USE_CNC_REAL == 1 ? "real_fromDecimal float" : "real_fromDecimal Q15.16",
+		"real_decimalToFixed" };
+	char **lits = malloc(JOB_LITERALS * sizeof(char *));
+	double ns[5];
+	LITERAL l;
+	char *text = malloc(JOB_LITERALS * sizeof(l.str)), *p = text;
+	uint64_t oldOps = 0;
+
+	// one after another as in the lines of a file
+	for (uint32_t i = 0; i < JOB_LITERALS; i++)
+	{
+		makeLiteral(&l, true);
+		lits[i] = strcpy(p, l.str);
+		p += strlen(p) + 1;
+		// the old strtod_M: an integer digit - mul, add; a fraction digit - mul, div, add
+		for (const char *s = l.str, *dot = strchr(l.str, '.'); *s != 0; s++)
+			if (*s >= '0' && *s <= '9')
+				oldOps += dot != NULL && s > dot ? 3 : 2;
+	}
+	for (int k = 0; k < 5; k++)
+		ns[k] = timeParser(k, lits);
+	for (int k = 0; k < 5; k++)
+		printf("%-24s %6.1f ns/literal, %4.2fx of strtod, %4.2fx of old strtod_M\n", names[k], ns[k], ns[0] / ns[k], ns[1] / ns[k]);
+	// the Cortex-M3 makes each one in software, the new parser: one division to double, none to Q15.16
+	printf("double operations per literal: old strtod_M %.1f, real_decimalToDouble 2, real_decimalToFixed 0%s\n",
+		(double)oldOps / JOB_LITERALS, USE_CNC_REAL == 2 ? ", real_fromDecimal 0" : "");
+	free(text);
+	free(lits);
+}
+
+int main(int argc, char **argv)
+{
+	test_literals(argc > 1 ? strtoul(argv[1], NULL, 10) : 4000000);
+	test_speed();
+	printf("%s: real_fuzz_%d\n", fails ? "FAIL" : "OK", USE_CNC_REAL);
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef SDCARD_FAKE_H_
+#define SDCARD_FAKE_H_
+
+/*
+ * FatFs and the SDIO card of the F103 board for fstream_test (USE_SDCARD == 1):
+ * the fields and the calls which fstream.c uses, the card is simulated by the test.
+ */
+typedef enum { FR_OK = 0, FR_DISK_ERR } FRESULT;
+typedef enum { SD_OK = 0, SD_REQUEST_PENDING, SD_ERROR } SD_Error;
+
+typedef struct {
+	uint8_t csize;		// sectors per cluster
+} FATFS;
+
+typedef struct {
+	FATFS *fs;
+	uint32_t fptr;
+	uint32_t fsize;
+	uint32_t dsect;		// the sector in buf
+	uint8_t buf[512];
+} FIL;
+
+extern SD_Error SD_errno;
+
+FRESULT f_lseek(FIL *fp, uint32_t ofs);
+SD_Error SD_ReadBlock(uint32_t addr, uint32_t *readbuff, uint16_t BlockSize);
+SD_Error SD_StartReadMultiBlocks(uint32_t addr, uint32_t *readbuff, uint16_t BlockSize, uint32_t NumberOfBlocks);
+SD_Error SD_GetReadState(void);
+
+#endif
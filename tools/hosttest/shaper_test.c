@@ -0,0 +1,190 @@
+/*
+ * shaper_test - the input shaper of the DMA waveform (USE_STEPW_SHAPER): the weights of
+ * stepw_shaperInit sum to 1 (65536) for ZV, ZVD and EI, the shaped waveform makes all the raw
+ * steps of an axis which goes one way and ends at the same position as the raw one, it is never
+ * faster than the raw one and its steps are late by the delays of the shaper at most.
+ * With -o file the velocity profiles of a test move (raw and shaped, steps/sec of X per ramp
+ * tick) go to the file as CSV, for a plot.
+ *
+ * stepwave.c is a part of the test: the weights are static. It is built with USE_STEPW_SHAPER=1.
+ *
+ * Build and run: make -C tools/hosttest
+ *	./shaper_test [-o profile.csv]
+ */
+
+#include "../../src/application/stepwave.c"
+
+#include <stdio.h>
+
+#include "wave_trace.h"
+
+static int fails;
+
+#define CHECK(cond, ...)	do { if (!(cond)) { fails++; printf("FAIL %s:%d: ", __func__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+static const char *names[] = { "raw", "ZV", "ZVD", "EI" };
+
+static void test_weights(void)
+{
+	static const double frq[] = { 8, 12, 16, 25, 40, 60, 100, 250 };
+	static const double damping[] = { 0, 0.02, 0.05, 0.1, 0.2, 0.4 };
+	uint32_t n = 0;
+
+	trace_init(1);
+	for (uint8_t type = STEPW_SHAPER_NONE; type <= STEPW_SHAPER_EI; type++)
+		for (unsigned i = 0; i < sizeof(frq) / sizeof(frq[0]); i++)
+			for (unsigned j = 0; j < sizeof(damping) / sizeof(damping[0]); j++)
+			{
+				uint32_t sum = 0;
+
+				stepw_shaperInit(0, type, frq[i], damping[j]);
+				for (int k = 0; k < shaperTaps.taps[0]; k++)
+				{
+					sum += shaperTaps.w[0][k];
+					CHECK(shaperTaps.d[0][k] < STEPW_SHAPER_HISTORY, "%s %.0f Hz: delay %u", names[type], frq[i], shaperTaps.d[0][k]);
+				}
+				CHECK(sum == 65536, "%s %.0f Hz damping %.2f: sum of the weights %u", names[type], frq[i], damping[j], sum);
+				CHECK(shaperTaps.taps[0] <= STEPW_SHAPER_TAPS, "%s: %u taps", names[type], shaperTaps.taps[0]);
+				n++;
+			}
+	printf("weights: %u shapers sum to 65536\n", n);
+}
+
+//---------------------------------------------------------------------
+// Test moves: X and Y accelerate to 20 kHz and brake, X goes on, Y goes back at once
+// (the shaped steps there and back cancel each other), the last move is short
+#define PROFILE_TICKS	1600	// ramp ticks, 0.8 s
+#define X_END			(6000 + 4000 + 37)
+#define Y_END			(3000 - 1500 + 11)
+#define Y_STEPS			(3000 + 1500 + 11)
+
+static uint32_t vel[PROFILE_TICKS][2];
+static uint32_t lastStep;		// ramp tick of the last step
+static int32_t last[2];
+
+static void onStep(const int32_t pos[], uint32_t tick)
+{
+	uint32_t t = tick / (TRACE_TICK_FRQ / STEPM_RAMP_FRQ);
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (pos[i] != last[i] && t < PROFILE_TICKS)
+			vel[t][i]++;
+		last[i] = pos[i];
+	}
+	lastStep = t;
+}
+
+static void loadMove(int32_t x, int32_t y, uint32_t fPeak, uint16_t tAcc)
+{
+	uint32_t steps[STEPW_AXES_MAX] = { abs(x), abs(y) };
+	uint8_t dir[STEPW_AXES_MAX] = { x > 0, y > 0 };
+	uint32_t total = steps[0] > steps[1] ? steps[0] : steps[1];
+	STEPM_RAMP ramp;
+
+	memset(&ramp, 0, sizeof(ramp));
+	ramp.fEntry = ramp.fExit = 500 * K_FRQ;
+	ramp.fPeak = fPeak * K_FRQ;
+	ramp.tAcc = tAcc;
+	// the braking takes as many steps as the acceleration
+	ramp.decelSteps = (uint32_t)((uint64_t)(ramp.fEntry + ramp.fPeak) / 2 * tAcc / STEPM_RAMP_FRQ / K_FRQ);
+	if (ramp.decelSteps > total / 2)
+		ramp.decelSteps = total / 2;
+	stepw_loadMove(steps, dir, &ramp);
+}
+
+static void fillWhile(bool isPlaying)
+{
+	static uint32_t words[TRACE_WORDS];
+	uint32_t *buf[STEPW_PORTS_MAX] = { words, NULL };
+
+	while (isPlaying ? stepw_isPlaying() : !stepw_isIdle())
+	{
+		uint16_t n = stepw_fill(buf, 0, TRACE_WORDS);
+
+		for (uint16_t i = 0; i < n; i++)
+			trace_word(words[i]);
+	}
+}
+
+// The test moves with the shaper of the type on X and Y, returns the ramp tick of the last step
+static uint32_t runProfile(uint8_t type, double frq, double damping)
+{
+	trace_init(2);
+	trace.onStep = onStep;
+	memset(vel, 0, sizeof(vel));
+	memset(last, 0, sizeof(last));
+	stepw_shaperInit(0, type, frq, damping);
+	stepw_shaperInit(1, type, frq, damping);
+	loadMove(6000, 3000, 20000, 200);
+	fillWhile(false);
+	loadMove(4000, -1500, 15000, 150);
+	fillWhile(false);
+	loadMove(37, 11, 2000, 10);	// shorter than the delays of the shaper
+	fillWhile(true);
+	return lastStep;
+}
+
+static void test_profiles(const char *csvName)
+{
+	static uint32_t profile[4][PROFILE_TICKS];
+	static const double frq[] = { 20, 35, 60 };
+	uint32_t ticks[4], maxRaw = 0;
+	FILE *csv = NULL;
+
+	ticks[0] = runProfile(STEPW_SHAPER_NONE, 0, 0);
+	CHECK(trace.pos[0] == X_END && trace.pos[1] == Y_END, "raw: the end at %d,%d", trace.pos[0], trace.pos[1]);
+	CHECK(trace.steps[0] == X_END && trace.steps[1] == Y_STEPS, "raw: %u, %u steps", trace.steps[0], trace.steps[1]);
+	CHECK(trace.dirErrors == 0, "raw: %u DIR/STEP timing errors", trace.dirErrors);
+	for (int t = 0; t < PROFILE_TICKS; t++)
+	{
+		profile[0][t] = vel[t][0];
+		if (vel[t][0] > maxRaw)
+			maxRaw = vel[t][0];
+	}
+	for (unsigned i = 0; i < sizeof(frq) / sizeof(frq[0]); i++)
+		for (uint8_t type = STEPW_SHAPER_ZV; type <= STEPW_SHAPER_EI; type++)
+		{
+			uint32_t maxShaped = 0;
+
+			ticks[type] = runProfile(type, frq[i], 0.05);
+			CHECK(trace.pos[0] == X_END && trace.pos[1] == Y_END, "%s %.0f Hz: the end at %d,%d",
+				names[type], frq[i], trace.pos[0], trace.pos[1]);
+			CHECK(trace.steps[0] == X_END && trace.steps[1] <= Y_STEPS, "%s %.0f Hz: %u, %u steps",
+				names[type], frq[i], trace.steps[0], trace.steps[1]);
+			CHECK(trace.dirErrors == 0, "%s %.0f Hz: %u DIR/STEP timing errors", names[type], frq[i], trace.dirErrors);
+			for (int t = 0; t < PROFILE_TICKS; t++)
+			{
+				if (vel[t][0] > maxShaped)
+					maxShaped = vel[t][0];
+				if (frq[i] == 35)
+					profile[type][t] = vel[t][0];
+			}
+			// a step of the rate may go to the next ramp tick
+			CHECK(maxShaped <= maxRaw + 1, "%s %.0f Hz: %u steps per ramp tick, raw %u", names[type], frq[i], maxShaped, maxRaw);
+			// the raw steps are out in the next ramp tick, late by the longest delay, the carry
+			// of the fractions may take one more
+			CHECK(ticks[type] >= ticks[0] && ticks[type] <= ticks[0] + shaperTaps.maxDelay + 2, "%s %.0f Hz: the last step at %u, raw %u",
+				names[type], frq[i], ticks[type], ticks[0]);
+		}
+	printf("profiles: ZV, ZVD, EI at 20, 35, 60 Hz: X %u steps as raw, Y %u of %u, the last step at 35 Hz %u/%u/%u/%u ms (raw/ZV/ZVD/EI)\n",
+		trace.steps[0], trace.steps[1], Y_STEPS, ticks[0] * 1000 / STEPM_RAMP_FRQ,
+		ticks[1] * 1000 / STEPM_RAMP_FRQ, ticks[2] * 1000 / STEPM_RAMP_FRQ, ticks[3] * 1000 / STEPM_RAMP_FRQ);
+
+	if (csvName == NULL || (csv = fopen(csvName, "w")) == NULL)
+		return;
+	fprintf(csv, "ms,raw,ZV,ZVD,EI\n");
+	for (int t = 0; t < PROFILE_TICKS; t++)
+		fprintf(csv, "%.1f,%u,%u,%u,%u\n", t * 1000.0 / STEPM_RAMP_FRQ, profile[0][t] * STEPM_RAMP_FRQ,
+			profile[1][t] * STEPM_RAMP_FRQ, profile[2][t] * STEPM_RAMP_FRQ, profile[3][t] * STEPM_RAMP_FRQ);
+	fclose(csv);
+	printf("profiles of X (steps/sec) at 35 Hz are in %s\n", csvName);
+}
+
+int main(int argc, char **argv)
+{
+	test_weights();
+	test_profiles(argc > 2 && strcmp(argv[1], "-o") == 0 ? argv[2] : NULL);
+	printf("%s: shaper_test\n", fails ? "FAIL" : "OK");
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * spsc_test - stress test of the moves queue index ring (src/application/stepq.h).
+ *
+ * Two threads take the places of the firmware ones: the producer (stepm_addMove) writes
+ * the slots and publishes them, the consumer (the step IRQs) checks and releases them.
+ * Every slot has the sequence number and a checksum of its payload: a slot read before it
+ * is written or written before it is released shows up as a lost, repeated or torn move.
+ * Both threads give the CPU away at random points inside the slot access, the way an IRQ
+ * preempts the producer, so the test works on one CPU too.
+ *
+ * Build and run:
+ *	gcc -O2 -std=gnu99 -Wall -Wextra -pthread -Isrc/application -o spsc_test tools/hosttest/spsc_test.c
+ *	./spsc_test [moves]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define __INLINE	inline
+#define __DMB()		__sync_synchronize()
+
+#include "stepq.h"
+
+#define PAYLOAD_WORDS	8	// LINE_DATA sized slot
+
+typedef struct
+{
+	uint32_t seq;
+	uint32_t data[PAYLOAD_WORDS];
+	uint32_t sum;
+} SLOT;
+
+static SLOT slots[STEPS_BUF_SIZE];
+static volatile uint8_t buf_get, buf_put;
+static uint32_t moves = 20000000;
+static uint32_t fullWaits, emptyWaits;
+
+// preemption at a random point, about one of 32 calls
+static void maybe_yield(uint32_t *rnd)
+{
+	*rnd ^= *rnd << 13;
+	*rnd ^= *rnd >> 17;
+	*rnd ^= *rnd << 5;
+	if ((*rnd & 31) == 0)
+		sched_yield();
+}
+
+static uint32_t slot_sum(const SLOT *s)
+{
+	uint32_t sum = s->seq * 2654435761u;
+	for (int i = 0; i < PAYLOAD_WORDS; i++)
+		sum = (sum ^ s->data[i]) * 16777619u;
+	return sum;
+}
+
+static void *producer(void *arg)
+{
+	uint32_t rnd = 0x12345678;
+
+	(void)arg;
+	for (uint32_t n = 0; n < moves; n++)
+	{
+		uint8_t put = buf_put;
+		while (steps_buf_isFull(put, buf_get))
+		{	// stepm_addMove sleeps (__WFI) here
+			fullWaits++;
+			sched_yield();
+		}
+		SLOT *s = &slots[put];
+		s->seq = n;
+		maybe_yield(&rnd);
+		for (int i = 0; i < PAYLOAD_WORDS; i++)
+			s->data[i] = n * 31u + i;
+		s->sum = slot_sum(s);
+		maybe_yield(&rnd);
+		steps_buf_publish(&buf_put);
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	uint32_t rnd = 0x9abcdef1;
+
+	(void)arg;
+	for (uint32_t n = 0; n < moves; n++)
+	{
+		while (buf_get == buf_put)
+		{
+			emptyWaits++;
+			sched_yield();
+		}
+		uint8_t get = buf_get;
+		const SLOT *s = &slots[get];
+		maybe_yield(&rnd);
+		if (s->seq != n || s->sum != slot_sum(s) || s->data[PAYLOAD_WORDS - 1] != n * 31u + PAYLOAD_WORDS - 1)
+		{
+			printf("FAIL: move %u: slot %u has seq %u\n", n, get, s->seq);
+			exit(1);
+		}
+		if (steps_buf_count(buf_put, get) == 0 || steps_buf_count(buf_put, get) >= STEPS_BUF_SIZE)
+		{
+			printf("FAIL: move %u: count %u\n", n, steps_buf_count(buf_put, get));
+			exit(1);
+		}
+		maybe_yield(&rnd);
+		steps_buf_release(&buf_get);
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t p, c;
+
+	if (argc > 1)
+		moves = strtoul(argv[1], NULL, 0);
+	pthread_create(&c, NULL, consumer, NULL);
+	pthread_create(&p, NULL, producer, NULL);
+	pthread_join(p, NULL);
+	pthread_join(c, NULL);
+	if (buf_get != buf_put)
+	{
+		printf("FAIL: queue is not empty at the end\n");
+		return 1;
+	}
+	printf("OK: %u moves, queue of %u, producer waits %u, consumer waits %u\n",
+		moves, STEPS_BUF_SIZE, fullWaits, emptyWaits);
+	return 0;
+}
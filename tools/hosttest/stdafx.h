@@ -0,0 +1,58 @@
+#ifndef __STDAFX_H__
+#define __STDAFX_H__
+
+/*
+ * Host build of the application modules for the tests and the benchmarks of tools/hosttest:
+ * it takes the place of global.h and the board header. The planner goes to the step queue
+ * stubs of the test (stepm_*), not to a file as in gbinc.
+ */
+#define __GLOBAL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define __INLINE	inline
+#define __DMB()		__sync_synchronize()
+
+typedef unsigned int UINT;
+
+#define USE_LCD			0
+#define USE_KEYBOARD	0
+#define USE_EXTRUDER	0
+#define USE_ENCODER		0
+#define USE_DEBUG_MODE	0
+#define USE_STEP_DEBUG	0
+#define USE_GBIN_WRITER	0
+/*
+	USE_CNC_REAL, USE_STEPM_ARC, USE_STEPW_SHAPER, USE_SDCARD - set by the make rule of the test
+*/
+#ifndef USE_SDCARD
+	#define USE_SDCARD	0
+#endif
+#ifndef USE_CNC_REAL
+	#define USE_CNC_REAL	2
+#endif
+#ifndef USE_STEPM_ARC
+	#define USE_STEPM_ARC	0
+#endif
+
+#define STEPS_MOTORS	4
+
+#if (USE_SDCARD == 1)
+	#include "sdcard_fake.h"
+#endif
+
+#define DBG(...) { }
+#define limits_chk()	0
+
+#include "screen_io.h"
+#include "keyboard.h"
+#include "gcode.h"
+#include "stepmotor.h"
+
+void delayMs(uint16_t msec);
+char *str_trim(char *str);
+uint32_t Seconds(void);
+
+#endif
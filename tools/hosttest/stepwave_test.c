@@ -0,0 +1,232 @@
+/*
+ * stepwave_test - unit tests of the velocity profile, the feed hold envelope and the circle DDA
+ * of stepwave.c: the braking point and the clamp of tDec of stepw_profileTick, stepw_holdTick,
+ * stepw_arcNext reaching the end point of CW, CCW and longer than half circle arcs.
+ *
+ * Build and run: make -C tools/hosttest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "stdafx.h"
+#include "stepwave.h"
+
+static int fails;
+
+#define CHECK(cond, ...)	do { if (!(cond)) { fails++; printf("FAIL %s:%d: ", __func__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+//---------------------------------------------------------------------
+// The move runs as in the ramp IRQ: one stepw_profileTick per ramp tick with the steps left
+static void profileMove(const STEPM_RAMP *ramp, uint32_t steps)
+{
+	STEPM_PROFILE prof;
+	double left = steps;
+	uint32_t ticks = 0, fDec = 0, fPrev = ramp->fEntry, f = ramp->fEntry;
+	bool isDec = false;
+
+	memset(&prof, 0, sizeof(prof));
+	stepw_profileStart(&prof, ramp);
+	while (left > 0 && ticks < 10000000)
+	{
+		uint32_t stepsLeft = (uint32_t)ceil(left);
+
+		f = stepw_profileTick(&prof, stepsLeft);
+		ticks++;
+		if (isDec)
+		{
+			CHECK(f <= fPrev, "frequency goes up while braking: %u -> %u", fPrev, f);
+			CHECK(f >= ramp->fExit, "frequency %u below fExit", f);
+		}
+		else if (prof.phase == STEPM_PROFILE_DEC)
+		{	// the braking point: the first tick with the steps left within decelSteps
+			uint32_t t = (uint32_t)((uint64_t)stepsLeft * (2 * K_FRQ * STEPM_RAMP_FRQ) / (prof.fFrom + ramp->fExit));
+
+			isDec = true;
+			fDec = prof.fFrom;
+			CHECK(stepsLeft <= ramp->decelSteps, "braking at %u steps left, decelSteps %u", stepsLeft, ramp->decelSteps);
+			CHECK(stepsLeft + (fPrev / K_FRQ / STEPM_RAMP_FRQ + 1) > ramp->decelSteps,
+				"braking late: %u steps left, decelSteps %u", stepsLeft, ramp->decelSteps);
+			CHECK(prof.tDec == (t > 0xffff ? 0xffff : (t == 0 ? 1 : t)), "tDec %u, expected %u", prof.tDec, t);
+		}
+		else
+			CHECK(f <= ramp->fPeak || f <= ramp->fEntry, "frequency %u above fPeak %u", f, ramp->fPeak);
+		fPrev = f;
+		left -= (double)f / K_FRQ / STEPM_RAMP_FRQ;
+	}
+	CHECK(isDec, "no braking");
+	// the time of the braking is taken from the steps left, the S-curve has (f + fExit) / 2
+	// average: the steps are over at the flat end of the curve, about fExit
+	CHECK(prof.phase == STEPM_PROFILE_OFF || f - ramp->fExit <= (fDec - ramp->fExit) / 100,
+		"the move ended at %u, %u ticks before fExit %u (braking from %u)", f, prof.tDec - prof.tick, ramp->fExit, fDec);
+	CHECK(left > -(double)ramp->fExit / K_FRQ / STEPM_RAMP_FRQ - 1, "fExit is reached %.1f steps late", -left);
+}
+
+static void test_profileBraking(void)
+{
+	STEPM_RAMP ramp;
+
+	// the peak is reached, braking from the run
+	memset(&ramp, 0, sizeof(ramp));
+	ramp.fEntry = 2000;
+	ramp.fPeak = 100000;
+	ramp.fExit = 5000;
+	ramp.tAcc = 400;
+	ramp.decelSteps = 1900;
+	profileMove(&ramp, 20000);
+	// short move: braking starts in the middle of the acceleration
+	ramp.decelSteps = 900;
+	profileMove(&ramp, 1500);
+	// braking from the entry at once, to a stop speed
+	memset(&ramp, 0, sizeof(ramp));
+	ramp.fEntry = ramp.fPeak = 60000;
+	ramp.fExit = 1000;
+	ramp.decelSteps = 800;
+	profileMove(&ramp, 800);
+}
+
+static void test_profileClamp(void)
+{
+	STEPM_PROFILE prof;
+	STEPM_RAMP ramp;
+
+	// very slow and long braking: the ticks don't fit 16 bits
+	memset(&ramp, 0, sizeof(ramp));
+	ramp.fEntry = ramp.fPeak = ramp.fExit = K_FRQ;
+	ramp.decelSteps = 100000;
+	memset(&prof, 0, sizeof(prof));
+	stepw_profileStart(&prof, &ramp);
+	CHECK(prof.phase == STEPM_PROFILE_RUN, "phase %u", prof.phase);
+	stepw_profileTick(&prof, 100000);
+	CHECK(prof.phase == STEPM_PROFILE_DEC && prof.tDec == 0xffff, "phase %u tDec %u", prof.phase, prof.tDec);
+
+	// no steps left at the braking point: one tick to fExit
+	ramp.fEntry = ramp.fPeak = 50000;
+	ramp.fExit = 3000;
+	ramp.decelSteps = 10;
+	memset(&prof, 0, sizeof(prof));
+	stepw_profileStart(&prof, &ramp);
+	stepw_profileTick(&prof, 0);
+	CHECK(prof.phase == STEPM_PROFILE_DEC && prof.tDec == 1, "phase %u tDec %u", prof.phase, prof.tDec);
+	CHECK(stepw_profileTick(&prof, 0) == ramp.fExit && prof.phase == STEPM_PROFILE_OFF, "phase %u f %u", prof.phase, prof.f);
+}
+
+//---------------------------------------------------------------------
+static void test_hold(void)
+{
+	STEPM_PROFILE prof;
+	STEPM_RAMP ramp;
+	STEPW_HOLD hold;
+	uint32_t f, fPrev, ticks;
+
+	memset(&ramp, 0, sizeof(ramp));
+	ramp.fEntry = ramp.fPeak = ramp.fExit = 40000;
+	ramp.fStop = 2000;
+	ramp.accel = 100;
+	memset(&prof, 0, sizeof(prof));
+	stepw_profileStart(&prof, &ramp);
+	memset(&hold, 0, sizeof(hold));
+	CHECK(stepw_holdTick(&hold, 40000) == 40000, "the envelope is off");
+
+	// braking: down to fStop in (40000 - 2000) / accel ticks, then stopped
+	stepw_holdStart(&hold, &prof, true);
+	CHECK(hold.state == STEPW_HOLD_DEC && hold.ticks == 380, "state %u ticks %u", hold.state, hold.ticks);
+	for (fPrev = 40000, ticks = 0; hold.state == STEPW_HOLD_DEC && ticks < 1000; ticks++, fPrev = f)
+	{
+		f = stepw_holdTick(&hold, 40000);
+		CHECK(f <= fPrev, "tick %u: %u -> %u", ticks, fPrev, f);
+	}
+	CHECK(hold.state == STEPW_HOLD_STOP && ticks >= 380 && ticks <= 381, "state %u after %u ticks", hold.state, ticks);
+	CHECK(stepw_holdTick(&hold, 40000) == 0 && stepw_holdTick(&hold, 40000) == 0, "the motion is not stopped");
+	stepw_holdStart(&hold, &prof, true);
+	CHECK(hold.state == STEPW_HOLD_STOP, "the second hold restarts the braking");
+
+	// resume: back to the frequency of the profile, the envelope goes off
+	stepw_holdResume(&hold, &prof, true);
+	CHECK(hold.state == STEPW_HOLD_ACC, "state %u", hold.state);
+	for (fPrev = 0, ticks = 0; hold.state == STEPW_HOLD_ACC && ticks < 1000; ticks++, fPrev = f)
+	{
+		f = stepw_holdTick(&hold, 30000);
+		CHECK(f >= fPrev && f <= 30000, "tick %u: %u -> %u", ticks, fPrev, f);
+	}
+	CHECK(hold.state == STEPW_HOLD_OFF && ticks <= 381, "state %u after %u ticks", hold.state, ticks);
+	CHECK(stepw_holdTick(&hold, 30000) == 30000, "the profile is limited after the resume");
+
+	// the profile is already slower than fStop: stopped at the next tick
+	stepw_holdStart(&hold, &prof, true);
+	stepw_holdTick(&hold, 1500);
+	CHECK(hold.state == STEPW_HOLD_STOP, "state %u", hold.state);
+	// no move in process: stopped and resumed at once
+	hold.state = STEPW_HOLD_OFF;
+	stepw_holdStart(&hold, &prof, false);
+	CHECK(hold.state == STEPW_HOLD_STOP && stepw_holdTick(&hold, 40000) == 0, "state %u", hold.state);
+	stepw_holdResume(&hold, &prof, false);
+	CHECK(hold.state == STEPW_HOLD_OFF && stepw_holdTick(&hold, 40000) == 40000, "state %u", hold.state);
+}
+
+//---------------------------------------------------------------------
+// Arc of r steps from the angle a0 to a1 (degrees, a1 < a0 - CW)
+static void runArc(uint32_t r, double a0, double a1)
+{
+	STEPM_ARC a;
+	STEPW_ARC w;
+	int32_t x, y;
+	uint32_t events = 0, offCircle = 0;
+
+	memset(&a, 0, sizeof(a));
+	a.r = r;
+	a.cw = a1 < a0;
+	a.x = x = (int32_t)lround(r * cos(a0 * M_PI / 180));
+	a.y = y = (int32_t)lround(r * sin(a0 * M_PI / 180));
+	a.xEnd = (int32_t)lround(r * cos(a1 * M_PI / 180));
+	a.yEnd = (int32_t)lround(r * sin(a1 * M_PI / 180));
+	a.length = (uint32_t)lround(r * fabs(a1 - a0) * M_PI / 180);
+	stepw_arcStart(&w, &a);
+	while (stepw_arcNext(&w) && events < 8 * r + 16)
+	{
+		events++;
+		CHECK(w.mask != 0, "event without steps");
+		if (w.mask & STEPW_ARC_X)
+			x += w.dir & STEPW_ARC_X ? 1 : -1;
+		if (w.mask & STEPW_ARC_Y)
+			y += w.dir & STEPW_ARC_Y ? 1 : -1;
+		if (w.phase == 0 && fabs(hypot(x, y) - r) > 1)
+			offCircle++;
+	}
+	CHECK(x == w.a.x && y == w.a.y, "r %u %.0f..%.0f: steps give %d,%d, the point is %d,%d", r, a0, a1, x, y, w.a.x, w.a.y);
+	CHECK(x == a.xEnd && y == a.yEnd, "r %u %.0f..%.0f: ended at %d,%d, not %d,%d", r, a0, a1, x, y, a.xEnd, a.yEnd);
+	CHECK(offCircle == 0, "r %u %.0f..%.0f: %u points more than a step off the circle", r, a0, a1, offCircle);
+	CHECK(events <= 4 * a.length / 3 + 4 && events + 4 >= a.length * 7 / 10, "r %u %.0f..%.0f: %u events for %u steps",
+		r, a0, a1, events, a.length);
+}
+
+static void test_arc(void)
+{
+	static const uint32_t radius[] = { 3, 17, 320, 3200, 64000 };
+
+	for (unsigned i = 0; i < sizeof(radius) / sizeof(radius[0]); i++)
+	{
+		uint32_t r = radius[i];
+
+		runArc(r, 0, 90);		// CCW
+		runArc(r, 90, 0);		// CW
+		runArc(r, 30, 200);		// CCW more than half
+		runArc(r, 200, 30);		// CW more than half
+		runArc(r, -45, 270);	// CCW almost the full circle
+		runArc(r, 135, -200);	// CW almost the full circle
+		runArc(r, 10, 17);		// short
+		runArc(r, 17, 10);
+	}
+}
+
+int main(void)
+{
+	test_profileBraking();
+	test_profileClamp();
+	test_hold();
+	test_arc();
+	printf("%s: stepwave_test\n", fails ? "FAIL" : "OK");
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+#ifndef WAVE_TRACE_H_
+#define WAVE_TRACE_H_
+
+/*
+ * Decoder of the step waveform of stepw_fill for the host tests: the BSRR words of one port,
+ * STEP of the axis i is pin 2i, its DIR is pin 2i + 1. Every STEP edge goes to the position
+ * of its axis with the DIR state, the callback sees the positions after each tick with steps.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "stepwave.h"
+
+#define TRACE_TICK_FRQ	100000		// STEPW_TICK_FRQ of the F103 board
+#define TRACE_WORDS		512
+
+typedef struct {
+	int32_t  pos[STEPW_AXES_MAX];
+	uint32_t steps[STEPW_AXES_MAX];
+	uint32_t ticks;
+	uint32_t dirErrors;				// DIR written at the tick of STEP or STEP high for two ticks
+	uint8_t  dir, stepHigh;
+	void     (*onStep)(const int32_t pos[], uint32_t tick);
+} TRACE;
+
+static TRACE trace;
+
+static inline void trace_init(uint8_t axes)
+{
+	STEPW_PIN step[STEPW_AXES_MAX], dir[STEPW_AXES_MAX];
+
+	for (int i = 0; i < axes; i++)
+	{
+		step[i].port = dir[i].port = 0;
+		step[i].pin = 1 << (2 * i);
+		dir[i].pin = 1 << (2 * i + 1);
+	}
+	stepw_init(step, dir, axes, TRACE_TICK_FRQ);
+	memset(&trace, 0, sizeof(trace));
+}
+
+static inline void trace_word(uint32_t w)
+{
+	bool isStep = false;
+
+	for (int i = 0; i < STEPW_AXES_MAX; i++)
+	{
+		uint32_t s = 1 << (2 * i), d = 2 * s;
+
+		if (w & (d | d << 16))
+		{
+			if (w & s)
+				trace.dirErrors++;	// DIR and STEP at the same tick
+			trace.dir = w & d ? trace.dir | (1 << i) : trace.dir & ~(1 << i);
+		}
+		if (w & s)
+		{	// BSRR: the set wins over the reset of the same pin
+			if (trace.stepHigh & (1 << i))
+				trace.dirErrors++;	// no low tick between the steps
+			trace.stepHigh |= 1 << i;
+			trace.pos[i] += trace.dir & (1 << i) ? 1 : -1;
+			trace.steps[i]++;
+			isStep = true;
+		}
+		else if (w & s << 16)
+			trace.stepHigh &= ~(1 << i);
+	}
+	if (isStep && trace.onStep != NULL)
+		trace.onStep(trace.pos, trace.ticks);
+	trace.ticks++;
+}
+
+// Fill and decode until the builder is idle, maxTicks - a limit for a broken builder
+static inline void trace_run(uint32_t maxTicks)
+{
+	static uint32_t words[TRACE_WORDS];
+	uint32_t *buf[STEPW_PORTS_MAX] = { words, NULL };
+
+	while (!stepw_isIdle() && maxTicks != 0)
+	{
+		uint16_t n = stepw_fill(buf, 0, TRACE_WORDS);
+
+		for (uint16_t i = 0; i < n; i++)
+			trace_word(words[i]);
+		maxTicks = maxTicks > n ? maxTicks - n : 0;
+	}
+}
+
+// Constant frequency profile (steps/sec)
+static inline void trace_ramp(STEPM_RAMP *ramp, uint32_t frq)
+{
+	memset(ramp, 0, sizeof(*ramp));
+	ramp->fEntry = ramp->fPeak = ramp->fExit = frq * K_FRQ;
+}
+
+#endif /* WAVE_TRACE_H_ */